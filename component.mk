@@ -1,2 +1,6 @@
 COMPONENT_ADD_INCLUDEDIRS := include
 COMPONENT_ADD_SRCDIRS := src
+CPPFLAGS += -Werror=vla
+ifdef CONFIG_NDEF_LOG_LEVEL
+CPPFLAGS += -DLOG_LOCAL_LEVEL=$(CONFIG_NDEF_LOG_LEVEL)
+endif
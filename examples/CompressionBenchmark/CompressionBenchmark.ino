@@ -0,0 +1,93 @@
+
+#include "NfcAdapter.h"
+#include "SimulatedTransport.h"
+
+// Compression ratio, CPU time and NTAG215 pages and air time of typical payloads
+const char* payloads[] = {
+    "{\"ssid\":\"warehouse-iot\",\"password\":\"correct horse battery staple\",\"mqtt\":{\"host\":\"mqtt.example.com\","
+        "\"port\":8883,\"topic\":\"sensors/dock-3/temperature\",\"qos\":1},\"sensors\":[{\"id\":1,\"type\":\"temperature\","
+        "\"interval\":60},{\"id\":2,\"type\":\"humidity\",\"interval\":60},{\"id\":3,\"type\":\"temperature\",\"interval\":300}]}",
+    "{\"asset\":\"PUMP-0042\",\"serviced\":\"2024-03-01\",\"next\":\"2024-09-01\",\"technician\":\"J. Smith\"}",
+    "time,temperature,humidity\n10:00,21.5,40\n10:05,21.6,40\n10:10,21.6,41\n10:15,21.7,41\n10:20,21.7,41\n"
+        "10:25,21.8,42\n10:30,21.8,42\n10:35,21.9,42\n10:40,21.9,43\n10:45,22.0,43\n",
+    "https://example.com/a/8f3Kq1Zx"
+};
+const char* names[] = {"Config JSON", "Asset JSON", "Sensor CSV", "Short URL"};
+const char* types[] = {"application/json", "application/json", "text/csv", "text/plain"};
+
+// a halted tag only answers again after leaving the field
+void reenter(SimulatedTransport& sim, SimulatedTag& tag) {
+    sim.removeTag(&tag);
+    sim.addTag(&tag);
+}
+
+// pages and time of writing message to an NTAG215, then reading it back
+void measure(const char* label, NdefMessage& message) {
+    SimulatedTransport sim = SimulatedTransport();
+    SimulatedTag tag = SimulatedTag(SimulatedTag::MODEL_NTAG215);
+    tag.formatNdef();
+    sim.addTag(&tag);
+    NfcAdapter nfc = NfcAdapter(&sim);
+
+    bool success = nfc.tagPresent() && nfc.write(message);
+    SimulatedTransport::Stats write = sim.getStats();
+    nfc.haltTag();
+    reenter(sim, tag);
+    sim.resetStats();
+    // larger than NFC_TAG_INLINE_NDEF_SIZE, the message is read into a buffer
+    static byte buffer[512];
+    success = success && nfc.tagPresent() && nfc.read(buffer, sizeof(buffer)).hasNdefMessage();
+    SimulatedTransport::Stats read = sim.getStats();
+
+    Serial.print("  ");
+    Serial.print(label);
+    Serial.print(success ? ": " : " FAILED: ");
+    Serial.print((message.getEncodedSize() + 3) / 4);
+    Serial.print(" pages, write ");
+    Serial.print((long)write.busyTime);
+    Serial.print(" us, read ");
+    Serial.print((long)read.busyTime);
+    Serial.println(" us");
+}
+
+void setup(void) {
+    Serial.begin(9600);
+    Serial.println("NDEF Compression Benchmark");
+
+    static byte compressed[512];
+    static byte decompressed[512];
+    for (int i = 0; i < sizeof(payloads) / sizeof(payloads[0]); i++) {
+        uint16_t length = strlen(payloads[i]);
+        Serial.println(names[i]);
+
+        unsigned long start = micros();
+        uint16_t compressedLength = NdefCompression::compress((const byte*)payloads[i], length, compressed, sizeof(compressed));
+        unsigned long compressTime = micros() - start;
+        start = micros();
+        int decompressedLength = NdefCompression::decompress(compressed, compressedLength, decompressed, sizeof(decompressed));
+        unsigned long decompressTime = micros() - start;
+
+        Serial.print("  ");
+        Serial.print(length);
+        Serial.print(" -> ");
+        Serial.print(compressedLength);
+        Serial.print(" bytes, ");
+        Serial.print(100 * compressedLength / length);
+        Serial.print("%, compress ");
+        Serial.print(compressTime);
+        Serial.print(" us, decompress ");
+        Serial.print(decompressTime);
+        Serial.println(decompressedLength == length ? " us" : " us MISMATCH");
+
+        NdefMessage message = NdefMessage();
+        message.addMimeMediaRecord(types[i], (byte*)payloads[i], length);
+        measure("plain", message);
+        // a payload that doesn't get smaller is written as it is
+        if (message.compress() > 0) {
+            measure("compressed", message);
+        }
+    }
+}
+
+void loop(void) {
+}
@@ -0,0 +1,33 @@
+
+#include <SPI.h>
+#include <MFRC522.h>
+#include "NfcAdapter.h"
+
+#define SS_PIN 8
+
+MFRC522 mfrc522(SS_PIN, UINT8_MAX); // Create MFRC522 instance
+
+NfcAdapter nfc = NfcAdapter(&mfrc522);
+NfcInventory inventory;
+
+void setup(void) {
+    Serial.begin(9600);
+    Serial.println("NDEF Inventory");
+    nfc.begin();
+}
+
+void loop(void) {
+    Serial.println("\nPlace a stack of NFC tags on the reader\n");
+    uint8_t count = nfc.inventory(inventory);
+    Serial.print(count);
+    Serial.println(" tags");
+    for (uint8_t i = 0; i < count; i++)
+    {
+        inventory.getTag(i).print();
+    }
+    if (!inventory.isComplete())
+    {
+        Serial.println("More tags in the field than the inventory holds");
+    }
+    delay(5000);
+}
@@ -0,0 +1,73 @@
+#include "NfcPipeline.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+// the linux target has no reader, a simulated NTAG215 enters the field instead
+#include "SimulatedTransport.h"
+
+SimulatedTransport sim = SimulatedTransport();
+SimulatedTag simTag = SimulatedTag(SimulatedTag::MODEL_NTAG215);
+NfcAdapter nfc = NfcAdapter(&sim);
+#else
+#include <SPI.h>
+#include <MFRC522.h>
+
+#define SS_PIN 8
+
+MFRC522 mfrc522(SS_PIN, UINT8_MAX); // Create MFRC522 instance
+NfcAdapter nfc = NfcAdapter(&mfrc522);
+#endif
+
+// runs on core 1, the reader on core 0 keeps polling meanwhile
+class PrintHandler : public NfcPipeline::Handler {
+    public:
+        void handle(NfcTag& tag, NdefMessage& message) {
+            Serial.print("Tag with ");
+            Serial.print(message.getRecordCount());
+            Serial.println(" records");
+        }
+};
+
+PrintHandler handler;
+NfcPipeline pipeline = NfcPipeline(&nfc, &handler);
+
+void setup(void) {
+    Serial.begin(9600);
+    Serial.println("NDEF Pipeline");
+#if CONFIG_IDF_TARGET_LINUX
+    simTag.formatNdef();
+    sim.addTag(&simTag);
+    NdefMessage message = NdefMessage();
+    message.addUriRecord("https://github.com/benklop/esp-idf-ndef");
+    if (nfc.tagPresent()) {
+        nfc.write(message);
+    }
+    nfc.haltTag();
+    // both sides are threads on the host
+    pipeline.start(4096, 5, pdMS_TO_TICKS(10));
+#else
+    SPI.begin();
+    mfrc522.PCD_Init();
+    pipeline.start(4096, 5, pdMS_TO_TICKS(10), 0, 1);
+#endif
+}
+
+void loop(void) {
+#if CONFIG_IDF_TARGET_LINUX
+    // The halted tag is read again after it re-entered the field. The simulator
+    // belongs to the RF task while the pipeline runs, so it is stopped meanwhile.
+    for (int i = 0; i < 10; i++) {
+        delay(100);
+        pipeline.stop();
+        sim.removeTag(&simTag);
+        sim.addTag(&simTag);
+        pipeline.start(4096, 5, pdMS_TO_TICKS(10));
+    }
+#else
+    delay(10000);
+#endif
+    NfcPipeline::Stats stats = pipeline.getStats();
+    Serial.print(stats.tags);
+    Serial.print(" tags, longest from selection to handled ");
+    Serial.print((long)(stats.maxLatency / 1000));
+    Serial.println(" ms");
+}
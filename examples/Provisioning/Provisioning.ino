@@ -0,0 +1,81 @@
+
+#include "NfcAdapter.h"
+#include "NfcProvisioner.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+// The linux target has no reader. A run of simulated tags mixing Type 2 models
+// enters the field instead, each one gets the next serial.
+#include "SimulatedTransport.h"
+
+#define RUN_LENGTH 8
+
+SimulatedTransport sim = SimulatedTransport();
+SimulatedTag::Model models[RUN_LENGTH] = {
+    SimulatedTag::MODEL_NTAG216, SimulatedTag::MODEL_ULTRALIGHT,
+    SimulatedTag::MODEL_NTAG213, SimulatedTag::MODEL_NTAG216,
+    SimulatedTag::MODEL_NTAG215, SimulatedTag::MODEL_ULTRALIGHT_C,
+    SimulatedTag::MODEL_ULTRALIGHT_EV1, SimulatedTag::MODEL_NTAG213
+};
+uint8_t next = 0;
+NfcAdapter nfc = NfcAdapter(&sim);
+#else
+#include <SPI.h>
+#include <MFRC522.h>
+
+#define SS_PIN 8
+
+MFRC522 mfrc522(SS_PIN, UINT8_MAX); // Create MFRC522 instance
+
+NfcAdapter nfc = NfcAdapter(&mfrc522);
+#endif
+NdefMessage message;
+NdefTemplate *tagTemplate;
+NfcProvisioner *provisioner;
+
+void setup(void) {
+    Serial.begin(9600);
+    Serial.println("NDEF Provisioning");
+    nfc.begin();
+
+    // placeholders are replaced by the UID and a serial number of the same length
+    message.addUriRecord("https://example.com/UUUUUUUUUUUUUU/SSSSSS");
+    tagTemplate = new NdefTemplate(message);
+    tagTemplate->addSlot("UUUUUUUUUUUUUU", NdefTemplate::SLOT_UID_HEX);
+    tagTemplate->addSlot("SSSSSS", NdefTemplate::SLOT_SERIAL);
+
+    provisioner = new NfcProvisioner(&nfc, tagTemplate);
+    provisioner->begin(1);
+    Serial.println("\nPlace tags on the reader one after the other\n");
+}
+
+void loop(void) {
+#if CONFIG_IDF_TARGET_LINUX
+    if (next == RUN_LENGTH) {
+        return;
+    }
+    SimulatedTag tag = SimulatedTag(models[next++]);
+    tag.formatNdef();
+    sim.clearField();
+    sim.addTag(&tag);
+#endif
+    NfcProvisioner::Report report;
+    if (provisioner->provision(&report)) {
+        Serial.print("Serial ");
+        Serial.print(report.serial);
+        Serial.print(report.result == NdefTlv::WRITE_COMMITTED ? " written in " : " FAILED after ");
+        Serial.print((long)(report.tagTime / 1000));
+        Serial.println(" ms");
+
+        NfcProvisioner::Stats stats = provisioner->getStats();
+        Serial.print(stats.committed);
+        Serial.print(" tags, ");
+        Serial.print(stats.failed);
+        Serial.print(" failed, ");
+        Serial.print(provisioner->getTagsPerMinute());
+        Serial.println(" tags per minute");
+    }
+#if CONFIG_IDF_TARGET_LINUX
+    sim.clearField();
+#endif
+    delay(50);
+}
@@ -0,0 +1,31 @@
+
+#include <SPI.h>
+#include <MFRC522.h>
+#include "NfcAdapter.h"
+#include "GpioIrqSource.h"
+
+#define SS_PIN 8
+#define IRQ_PIN GPIO_NUM_4
+
+MFRC522 mfrc522(SS_PIN, UINT8_MAX); // Create MFRC522 instance
+
+NfcAdapter nfc = NfcAdapter(&mfrc522);
+GpioIrqSource irq = GpioIrqSource(IRQ_PIN);
+
+void setup(void) {
+    Serial.begin(9600);
+    Serial.println("NDEF Reader, interrupt driven");
+    nfc.begin();
+    irq.begin();
+}
+
+void loop(void) {
+    Serial.println("\nScan a NFC tag\n");
+    // the task sleeps until a card answers, no polling delay
+    if (nfc.waitForTag(&irq, portMAX_DELAY))
+    {
+        NfcTag tag = nfc.read();
+        tag.print();
+        nfc.haltTag();
+    }
+}
@@ -0,0 +1,56 @@
+
+#include <SPI.h>
+#include <MFRC522.h>
+#include "NfcReaderPool.h"
+
+// One MFRC522 per antenna, all on the same SPI bus
+#define READER_COUNT 4
+const uint8_t SS_PINS[READER_COUNT] = {5, 17, 16, 4};
+
+MFRC522 *readers[READER_COUNT];
+NfcAdapter *adapters[READER_COUNT];
+
+NfcReaderPool pool = NfcReaderPool(NfcReaderPool::SCHEDULE_PRIORITY);
+
+void setup(void) {
+    Serial.begin(9600);
+    Serial.println("NDEF Reader Pool");
+    SPI.begin();
+    for (int i = 0; i < READER_COUNT; i++) {
+        readers[i] = new MFRC522(SS_PINS[i], UINT8_MAX);
+        readers[i]->PCD_Init();
+        adapters[i] = new NfcAdapter(readers[i]);
+        // the entry antenna is polled twice as often as the others
+        pool.addReader(adapters[i], i == 0 ? 2 : 1);
+    }
+    pool.start(4096, 5, pdMS_TO_TICKS(10));
+}
+
+void loop(void) {
+    NfcReaderPool::Event event;
+    if (pool.receive(&event, pdMS_TO_TICKS(1000)))
+    {
+        Serial.print("Tag on reader ");
+        Serial.println(event.reader);
+
+        // the readers aren't polled while one is in use
+        NfcAdapter *nfc = pool.acquire(event.reader, portMAX_DELAY);
+        NfcTag tag = nfc->read();
+        nfc->haltTag();
+        pool.release();
+        tag.print();
+    }
+    else
+    {
+        for (int i = 0; i < READER_COUNT; i++) {
+            NfcReaderPool::ReaderStats stats = pool.getStats(i);
+            Serial.print("Reader ");
+            Serial.print(i);
+            Serial.print(" polls ");
+            Serial.print(stats.polls);
+            Serial.print(" longest wait ");
+            Serial.print((long)(stats.maxInterval / 1000));
+            Serial.println(" ms");
+        }
+    }
+}
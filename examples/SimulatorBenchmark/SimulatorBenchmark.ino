@@ -0,0 +1,79 @@
+
+#include "NfcAdapter.h"
+#include "SimulatedTransport.h"
+
+// RF exchanges and air time of a write and a read on each tag model, without a reader
+SimulatedTag::Model models[] = {
+    SimulatedTag::MODEL_MIFARE_CLASSIC_1K,
+    SimulatedTag::MODEL_ULTRALIGHT,
+    SimulatedTag::MODEL_ULTRALIGHT_C,
+    SimulatedTag::MODEL_ULTRALIGHT_EV1,
+    SimulatedTag::MODEL_NTAG213,
+    SimulatedTag::MODEL_NTAG215,
+    SimulatedTag::MODEL_NTAG216,
+    SimulatedTag::MODEL_NTAG424_DNA,
+    SimulatedTag::MODEL_DESFIRE_EV2
+};
+const char* names[] = {"Classic 1K", "Ultralight", "Ultralight C", "Ultralight EV1", "NTAG213", "NTAG215", "NTAG216",
+    "NTAG 424 DNA", "DESFire EV2"};
+
+void printStats(const char* operation, bool success, SimulatedTransport& sim) {
+    SimulatedTransport::Stats stats = sim.getStats();
+    Serial.print("  ");
+    Serial.print(operation);
+    Serial.print(success ? ": " : " FAILED: ");
+    Serial.print(stats.exchanges);
+    Serial.print(" exchanges, ");
+    Serial.print((long)stats.busyTime);
+    Serial.println(" us");
+}
+
+// a halted tag only answers again after leaving the field
+void reenter(SimulatedTransport& sim, SimulatedTag& tag) {
+    sim.removeTag(&tag);
+    sim.addTag(&tag);
+}
+
+void setup(void) {
+    Serial.begin(9600);
+    Serial.println("NDEF Simulator Benchmark");
+
+    NdefMessage message = NdefMessage();
+    message.addUriRecord("https://github.com/benklop/esp-idf-ndef");
+
+    for (int i = 0; i < sizeof(models) / sizeof(models[0]); i++) {
+        SimulatedTransport sim = SimulatedTransport();
+        SimulatedTag tag = SimulatedTag(models[i]);
+        tag.formatNdef();
+        sim.addTag(&tag);
+        NfcAdapter nfc = NfcAdapter(&sim);
+        Serial.println(names[i]);
+
+        bool success = nfc.tagPresent() && nfc.write(message);
+        printStats("write", success, sim);
+        nfc.haltTag();
+
+        // the layout is cached, the second time the tag isn't probed again
+        reenter(sim, tag);
+        sim.resetStats();
+        success = nfc.tagPresent() && nfc.read().hasNdefMessage();
+        printStats("read", success, sim);
+        nfc.haltTag();
+
+        reenter(sim, tag);
+        sim.resetStats();
+        success = nfc.tagPresent() && nfc.write(message);
+        printStats("cached write", success, sim);
+        nfc.haltTag();
+
+        // one frame in 20 lost
+        reenter(sim, tag);
+        sim.resetStats();
+        sim.setErrorRate(0.05, 1);
+        success = nfc.tagPresent() && nfc.read().hasNdefMessage();
+        printStats("read, 5% frames lost", success, sim);
+    }
+}
+
+void loop(void) {
+}
@@ -0,0 +1,22 @@
+#ifndef GpioIrqSource_h
+#define GpioIrqSource_h
+
+#include <driver/gpio.h>
+#include <NfcIrqSource.h>
+
+// The MFRC522 IRQ pin wired to a GPIO. The pin is active low, the ISR only
+// gives the semaphore a waiting task blocks on.
+class GpioIrqSource : public NfcIrqSource
+{
+    public:
+        GpioIrqSource(gpio_num_t pin);
+        ~GpioIrqSource();
+        bool begin();
+        void end();
+    private:
+        gpio_num_t _pin;
+        bool _installed;
+        static void isrHandler(void *arg);
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef IsoDep_h
+#define IsoDep_h
+
+#include <NfcTransport.h>
+#include <NfcStatus.h>
+
+#define ISO_DEP_CMD_RATS 0xE0
+
+// PCB of each block type, bit 0 is the block number
+#define ISO_DEP_PCB_I_BLOCK 0x02
+#define ISO_DEP_PCB_CHAINING 0x10
+#define ISO_DEP_PCB_R_ACK 0xA2
+#define ISO_DEP_PCB_R_NAK 0xB2
+#define ISO_DEP_PCB_S_DESELECT 0xC2
+#define ISO_DEP_PCB_S_WTX 0xF2
+// bits telling the block type apart, CID and block number masked out
+#define ISO_DEP_PCB_I_MASK 0xE2
+#define ISO_DEP_PCB_R_MASK 0xF6
+#define ISO_DEP_PCB_S_MASK 0xF7
+
+// FSDI and FSCI 8, larger codes are reserved and read as 8
+#define ISO_DEP_MAX_FRAME 256
+// FSCI when the ATS leaves it out
+#define ISO_DEP_DEFAULT_FSCI 2
+// PCB and CRC_A around the information field
+#define ISO_DEP_FRAME_OVERHEAD 3
+
+// ISO/IEC 14443-4 half duplex block transmission over a transport. An APDU
+// longer than a frame is chained in I-blocks as large as both sides accept,
+// a lost block is asked for again with R(NAK), S(WTX) is answered.
+// CID and NAD are not used.
+class IsoDep
+{
+    public:
+        IsoDep(NfcTransport *transport);
+        // the tag was selected again or replaced, it needs RATS
+        void reset();
+        // RATS, the ATS gives the frame size the tag accepts
+        NfcTransport::Status activate();
+        bool isActive();
+        // send a command APDU and receive the response APDU. responseLength holds
+        // the size of response and is set to the length received.
+        NfcTransport::Status transceive(const byte *command, uint16_t commandLength, byte *response, uint16_t *responseLength);
+        // S(DESELECT), the tag goes to HALT
+        NfcTransport::Status deselect();
+        // the tag answers R(NAK) with its last block, without side effects
+        bool isPresent();
+        // largest frame sent, the smaller of FSC and what the reader takes
+        uint16_t getSendFrameSize();
+        // largest frame received, FSD
+        uint16_t getReceiveFrameSize();
+        // tries of one block before the exchange fails
+        void setRetryPolicy(const NfcRetryPolicy& policy);
+        // FSD or FSC in bytes for an FSDI or FSCI
+        static uint16_t getFrameSize(byte code);
+    private:
+        NfcTransport *_transport;
+        bool _active;
+        uint16_t _fsc;
+        uint16_t _fsd;
+        byte _blockNumber;
+        uint8_t _attempts;
+        NfcTransport::Status exchange(const byte *frame, uint16_t frameSize, byte *response, uint16_t *responseSize);
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef Mfrc522Transport_h
+#define Mfrc522Transport_h
+
+#include <MFRC522.h>
+#include <NfcTransport.h>
+
+// NfcTransport over an MFRC522 reader
+class Mfrc522Transport : public NfcTransport
+{
+    public:
+        Mfrc522Transport(MFRC522 *shield);
+        bool isNewCardPresent();
+        Status wakeupA();
+        bool readCardSerial();
+        Status select(Uid *tagUid);
+        Status haltA();
+        Status authenticate(bool keyB, byte block, const byte *key);
+        void stopCrypto1();
+        Status mifareRead(byte block, byte *buffer, byte *bufferSize);
+        Status mifareWrite(byte block, const byte *data);
+        Status ultralightWrite(byte page, const byte *data);
+        Status transceive(const byte *command, byte commandSize, byte *response, byte *responseSize);
+        void armCardDetect();
+        void enableCardDetectIrq(bool enable);
+        void dumpVersion();
+        MFRC522* getShield();
+    private:
+        MFRC522 *_shield;
+        void copyUid();
+};
+
+#endif
@@ -1,33 +1,119 @@
 #ifndef MifareClassic_h
 #define MifareClassic_h
 
-// Comment out next line to remove Mifare Classic and save memory
-#define NDEF_SUPPORT_MIFARE_CLASSIC
+#include <NdefConfig.h>
 
 #ifdef NDEF_SUPPORT_MIFARE_CLASSIC
 
 #define BLOCK_SIZE 16
-#define LONG_TLV_SIZE 4
-#define SHORT_TLV_SIZE 2
+#define MIFARE_KEY_SIZE 6
 
-#include <MFRC522.h>
-#include <MFRC522Debug.h>
+// NDEF data area of a Mifare Classic 1K, sectors 1-15 without their trailers
+#define CLASSIC_1K_DATA_BLOCKS 45
+// every block of a Mifare Classic 1K, trailers and the manufacturer block included
+#define CLASSIC_1K_BLOCKS 64
+
+#include <NfcTransport.h>
 #include <NfcTag.h>
+#include <NdefTlv.h>
+#include <NfcStatus.h>
+#include <TagInfo.h>
+#include <TagImage.h>
+
+class MifareClassic;
+
+// Data area blocks for the TLV engine, the last block read is kept
+class MifareClassicTlvStorage : public TlvStorage
+{
+    public:
+        MifareClassicTlvStorage(MifareClassic *tag);
+        bool read(uint16_t offset, byte *data, uint16_t length);
+        bool write(uint16_t offset, byte *data);
+        uint8_t getUnitSize();
+        // drop the cached block
+        void invalidate();
+    private:
+        MifareClassic *_tag;
+        byte _block[BLOCK_SIZE];
+        int _blockIndex;
+};
 
 class MifareClassic
 {
     public:
-        MifareClassic(MFRC522 *nfcShield);
+        // info caches what was learned about the tag across selections, it may be NULL
+        MifareClassic(NfcTransport *transport, TagInfo *info = NULL);
         ~MifareClassic();
-        NfcTag read();
+        // forget everything learned about the selected tag, info may be NULL
+        void reset(TagInfo *info);
+        // the same after a failed write, keeping the status of the write
+        void invalidate(TagInfo *info);
+        // a message larger than NFC_TAG_INLINE_NDEF_SIZE goes to buffer, which has to outlive the tag
+        NfcTag read(byte *buffer = NULL, uint16_t bufferSize = 0);
+        // where each record is, from the record headers alone
+        bool indexRecords(NdefRecordIndex& index);
+        // the payload of one entry of index into data, reading only its blocks
+        bool readPayload(const NdefRecordIndex& index, uint8_t entry, byte *data, uint16_t dataSize);
         bool write(NdefMessage& ndefMessage);
+        // write with an empty NDEF TLV staged first and verify what was written
+        NdefTlv::WriteResult writeTransaction(NdefMessage& ndefMessage);
+        // write a message already encoded, as a plain write or a transaction
+        NdefTlv::WriteResult writeEncoded(const byte *message, uint16_t length, bool transactional);
+        // The same in a workspace from the caller, e.g. static or in PSRAM, instead of
+        // NDEF_WORKSPACE_SIZE bytes of stack. See requiredWorkspace() for its size,
+        // the message given to writeEncoded() may be in the workspace itself.
+        bool write(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize);
+        NdefTlv::WriteResult writeTransaction(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize);
+        NdefTlv::WriteResult writeEncoded(const byte *message, uint16_t length, bool transactional, byte *workspace, uint16_t workspaceSize);
+        // what writing a message of messageLength bytes would do, from info alone
+        static void planWrite(const TagInfo& info, uint16_t messageLength, bool transactional, WritePlan& plan);
+        // workspace for the largest message the tag holds, 0 if info doesn't tell
+        static uint16_t requiredWorkspace(const TagInfo& info);
         bool formatNDEF();
         bool formatMifare();
+        // Send every block to sink from *nextBlock on, *nextBlock is left at the first
+        // block not sent, so a dump cut short goes on from there on the next call.
+        // Key A of each trailer is the key that opened the sector. Key B is all
+        // zeros where the access bits hide it, e.g. on NFC Forum formatted sectors.
+        bool dumpImage(TagImageSink& sink, uint16_t *nextBlock);
+        // Write an image from source from *nextBlock on, resumable the same way.
+        // A trailer whose access bits hide key B is written with keyB, the image
+        // can't hold it. Without keyB the restore stops there with ERROR_IMAGE.
+        bool restoreImage(TagImageSource& source, uint16_t *nextBlock, const byte *keyB = NULL);
+        // index of a block in the data area to its block number, trailers are skipped
+        static int getDataBlock(int index);
+        // read a block of the data area, authenticating its sector with the NDEF key if needed
+        bool readBlock(int block, byte *data);
+        bool writeBlock(int block, byte *data);
+        // the selected tag still answers, with its UID
+        bool isPresent();
+        // halt the tag and select it again, dropping authentication
+        bool reselect();
+        // what went wrong in the last read, write or format, and where
+        NfcStatus getStatus();
+        void setRetryPolicy(const NfcRetryPolicy& policy);
     private:
-        MFRC522* _nfcShield;
-        int getBufferSize(int messageLength);
-        int getNdefStartIndex(byte *data);
-        bool decodeTlv(byte *data, int *messageLength, int *messageStartIndex);
+        NfcTransport* _nfcShield;
+        byte _key[MIFARE_KEY_SIZE];
+        int _authenticatedSector;
+        TagInfo *_info;
+        // the last block read and the TLV map stay valid while the tag stays selected
+        MifareClassicTlvStorage _storage;
+        TlvMap _map;
+        bool _mapped;
+        NfcStatus _status;
+        NfcRetryPolicy _retryPolicy;
+        bool authenticate(int block);
+        bool authenticateImage(int block, const byte *imageKey);
+        bool readBlockOnce(int block, byte *data);
+        bool writeBlockOnce(int block, byte *data);
+        bool recover(NfcRetry& retry);
+        bool formatAuthenticate(bool keyB, int block, const byte *key);
+        bool formatWrite(int block, const byte *data);
+        bool mapDataArea();
+        bool loadCachedMap();
+        NdefTlv::WriteResult writeMessage(NdefMessage& m, bool transactional, byte *workspace, uint16_t workspaceSize);
+        void setFormatted(bool formatted);
 };
 
 #endif
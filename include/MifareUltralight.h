@@ -1,31 +1,154 @@
 #ifndef MifareUltralight_h
 #define MifareUltralight_h
 
-#include <MFRC522.h>
+#include <NdefConfig.h>
+
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+
+#include <NfcTransport.h>
 #include <NfcTag.h>
+#include <NdefTlv.h>
+#include <NfcStatus.h>
+#include <TagCredentials.h>
+#include <TagInfo.h>
+#include <TagImage.h>
 
 #define ULTRALIGHT_PAGE_SIZE 4
 #define ULTRALIGHT_READ_SIZE 16
 
+#define ULTRALIGHT_CC_PAGE 3
 #define ULTRALIGHT_DATA_START_PAGE 4
 #define ULTRALIGHT_MESSAGE_LENGTH_INDEX 1
 #define ULTRALIGHT_DATA_START_INDEX 2
-#define ULTRALIGHT_MAX_PAGE 63
+
+// NTAG21x and Ultralight EV1 commands
+#define NTAG_CMD_GET_VERSION 0x60
+#define NTAG_CMD_FAST_READ 0x3A
+#define NTAG_VERSION_SIZE 8
+#define NTAG_CMD_PWD_AUTH 0x1B
+
+// Ultralight C 3DES mutual authentication
+#define ULTRALIGHT_C_CMD_AUTHENTICATE 0x1A
+#define ULTRALIGHT_C_RANDOM_SIZE 8
+
+// The MFRC522 FIFO holds 64 bytes, 15 pages + CRC is the largest FAST_READ response that fits
+#define NTAG_FAST_READ_MAX_PAGES 15
+
+class MifareUltralight;
+
+// Data area pages for the TLV engine, the last READ or FAST_READ chunk is kept
+class UltralightTlvStorage : public TlvStorage
+{
+    public:
+        UltralightTlvStorage(MifareUltralight *tag);
+        bool read(uint16_t offset, byte *data, uint16_t length);
+        bool write(uint16_t offset, byte *data);
+        uint8_t getUnitSize();
+        // drop the cached chunk
+        void invalidate();
+        // cache pages read by other commands, so they aren't read again
+        void load(uint16_t offset, const byte *data, uint16_t length);
+    private:
+        MifareUltralight *_tag;
+        byte _chunk[NTAG_FAST_READ_MAX_PAGES * ULTRALIGHT_PAGE_SIZE];
+        uint16_t _chunkOffset;
+        uint16_t _chunkLength;
+};
 
 class MifareUltralight
 {
     public:
-        MifareUltralight(MFRC522 *nfcShield);
+        enum Product {
+            PRODUCT_UNKNOWN,
+            PRODUCT_ULTRALIGHT,
+            PRODUCT_ULTRALIGHT_C,
+            PRODUCT_ULTRALIGHT_EV1_MF0UL11,
+            PRODUCT_ULTRALIGHT_EV1_MF0UL21,
+            PRODUCT_NTAG210,
+            PRODUCT_NTAG212,
+            PRODUCT_NTAG213,
+            PRODUCT_NTAG215,
+            PRODUCT_NTAG216
+        };
+        // info caches what was learned about the tag across selections, it may be NULL
+        MifareUltralight(NfcTransport *transport, TagCredentials *credentials = NULL, TagInfo *info = NULL);
         ~MifareUltralight();
-        NfcTag read();
+        // forget everything learned about the selected tag, info may be NULL
+        void reset(TagInfo *info);
+        // the same after a failed write, keeping the status of the write
+        void invalidate(TagInfo *info);
+        // a message larger than NFC_TAG_INLINE_NDEF_SIZE goes to buffer, which has to outlive the tag
+        NfcTag read(byte *buffer = NULL, uint16_t bufferSize = 0);
+        // where each record is, from the record headers alone
+        bool indexRecords(NdefRecordIndex& index);
+        // the payload of one entry of index into data, reading only its pages
+        bool readPayload(const NdefRecordIndex& index, uint8_t entry, byte *data, uint16_t dataSize);
         bool write(NdefMessage& ndefMessage);
+        // write with an empty NDEF TLV staged first and verify what was written
+        NdefTlv::WriteResult writeTransaction(NdefMessage& ndefMessage);
+        // write a message already encoded, as a plain write or a transaction
+        NdefTlv::WriteResult writeEncoded(const byte *message, uint16_t length, bool transactional);
+        // The same in a workspace from the caller, e.g. static or in PSRAM, instead of
+        // NDEF_WORKSPACE_SIZE bytes of stack. See requiredWorkspace() for its size,
+        // the message given to writeEncoded() may be in the workspace itself.
+        bool write(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize);
+        NdefTlv::WriteResult writeTransaction(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize);
+        NdefTlv::WriteResult writeEncoded(const byte *message, uint16_t length, bool transactional, byte *workspace, uint16_t workspaceSize);
         bool clean();
+        // Send every readable page to sink from *nextPage on, configuration pages
+        // included. *nextPage is left at the first page not sent, so a dump cut
+        // short goes on from there on the next call.
+        bool dumpImage(TagImageSink& sink, uint16_t *nextPage);
+        // write the CC and user pages of an image from source, resumable the same way
+        bool restoreImage(TagImageSource& source, uint16_t *nextPage);
+        // what writing a message of messageLength bytes would do, from info alone
+        static void planWrite(const TagInfo& info, uint16_t messageLength, bool transactional, WritePlan& plan);
+        // workspace for the largest message the tag holds, 0 if info doesn't tell
+        static uint16_t requiredWorkspace(const TagInfo& info);
+        Product getProduct();
+        // user memory in bytes, starting at ULTRALIGHT_DATA_START_PAGE
+        uint16_t getCapacity();
+        bool supportsFastRead();
+        // read pageCount pages into buffer, which must hold pageCount * ULTRALIGHT_PAGE_SIZE bytes
+        bool readPages(uint16_t page, uint16_t pageCount, byte *buffer);
+        bool writePage(uint16_t page, byte *data);
+        // authenticate with the credential known for this UID, once per selection
+        bool authenticate();
+        // the selected tag still answers, with its UID
+        bool isPresent();
+        // what went wrong in the last read, write or clean, and where
+        NfcStatus getStatus();
+        void setRetryPolicy(const NfcRetryPolicy& policy);
     private:
-        MFRC522 *nfc;
+        NfcTransport *nfc;
+        TagCredentials *_credentials;
+        TagInfo *_info;
+        // pages read and the TLV map stay valid while the tag stays selected
+        UltralightTlvStorage _storage;
+        TlvMap _map;
+        bool _mapped;
+        Product _product;
+        uint16_t _userPages;
+        bool _fastRead;
+        bool _identified;
+        NfcStatus _status;
+        NfcRetryPolicy _retryPolicy;
+        void identify();
+        uint16_t getImagePages();
+        NdefTlv::WriteResult writeMessage(NdefMessage& m, bool transactional, byte *workspace, uint16_t workspaceSize);
+        bool getVersion(byte *version);
+        bool reselect();
+        bool passwordAuth(TagCredentials::Entry *entry);
+        bool ultralightCAuth(TagCredentials::Entry *entry);
+        bool readChunk(uint16_t page, uint16_t pageCount, byte *buffer);
+        bool fastRead(uint16_t startPage, uint16_t endPage, byte *buffer);
+        bool recover(NfcRetry& retry);
         bool isUnformatted();
         uint16_t readTagSize();
-        void findNdefMessage(uint16_t *messageLength, uint16_t *ndefStartIndex);
-        uint16_t calculateBufferSize(uint16_t messageLength, uint16_t ndefStartIndex);
+        bool mapDataArea();
+        bool loadCachedMap();
+        void rememberKey(TagCredentials::Entry *entry);
 };
 
 #endif
+#endif
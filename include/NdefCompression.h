@@ -0,0 +1,48 @@
+#ifndef NdefCompression_h
+#define NdefCompression_h
+
+#include <NdefConfig.h>
+
+#ifdef NDEF_SUPPORT_COMPRESSION
+
+#include <inttypes.h>
+#include <NdefRecord.h>
+
+// NFC Forum external type of a compressed record, domain:type as the RTD asks.
+// Its payload is the original TNF, type length, type and payload length, then
+// the payload compressed.
+#define NDEF_COMPRESSED_TYPE "github.com:esp-idf-ndef.lzss"
+
+// LZSS with a fixed window: a flag byte ahead of every 8 tokens, a literal is
+// one byte, a match two bytes with a 10 bit distance and a 6 bit length
+#define NDEF_COMPRESSION_WINDOW 1024
+#define NDEF_COMPRESSION_MIN_MATCH 3
+#define NDEF_COMPRESSION_MAX_MATCH 66
+
+// Compression of record payloads, so JSON and other text takes fewer pages.
+// Nothing is allocated by the codec, decompression only needs the output
+// buffer as its window.
+class NdefCompression
+{
+    public:
+        // bytes written to output, 0 if they wouldn't fit in outputSize
+        static uint16_t compress(const byte *data, uint16_t length, byte *output, uint16_t outputSize);
+        // bytes written to output, -1 if data is corrupt or doesn't fit in outputSize
+        static int decompress(const byte *data, uint16_t length, byte *output, uint16_t outputSize);
+
+        // Replace record with its compressed form. A record that doesn't get
+        // smaller, its compression header included, is left as it is.
+        static bool compressRecord(NdefRecord& record);
+        static bool isCompressed(NdefRecord& record);
+        // payload length of the original record, 0 if record isn't compressed
+        static uint16_t getOriginalLength(NdefRecord& record);
+        // The original payload of a compressed record's payload, e.g. one fetched
+        // with readPayload(). Bytes written to output, -1 if corrupt or too large.
+        static int decompressPayload(const byte *payload, uint16_t length, byte *output, uint16_t outputSize);
+        // Turn record back into the original. The payload is decompressed into
+        // buffer, which must hold getOriginalLength() bytes, before the record takes a copy.
+        static bool decompressRecord(NdefRecord& record, byte *buffer, uint16_t bufferSize);
+};
+
+#endif
+#endif
@@ -0,0 +1,73 @@
+#ifndef NdefConfig_h
+#define NdefConfig_h
+
+// Build options, set in menuconfig under "NDEF" (see Kconfig). Without an
+// sdkconfig, e.g. on a host build, every driver and codec is compiled in and
+// each option can be given with -D instead.
+
+#ifdef __has_include
+#if __has_include(<sdkconfig.h>)
+#include <sdkconfig.h>
+#endif
+#endif
+
+#ifdef CONFIG_NDEF_KCONFIG
+
+#ifdef CONFIG_NDEF_SUPPORT_MIFARE_CLASSIC
+#define NDEF_SUPPORT_MIFARE_CLASSIC
+#endif
+#ifdef CONFIG_NDEF_SUPPORT_ULTRALIGHT
+#define NDEF_SUPPORT_ULTRALIGHT
+#endif
+#ifdef CONFIG_NDEF_SUPPORT_ULTRALIGHT_C
+#define NDEF_SUPPORT_ULTRALIGHT_C
+#endif
+#ifdef CONFIG_NDEF_SUPPORT_TYPE_4
+#define NDEF_SUPPORT_TYPE_4
+#endif
+#ifdef CONFIG_NDEF_SUPPORT_COMPRESSION
+#define NDEF_SUPPORT_COMPRESSION
+#endif
+#define NDEF_MAX_RECORDS CONFIG_NDEF_MAX_RECORDS
+#define NDEF_WORKSPACE_SIZE CONFIG_NDEF_WORKSPACE_SIZE
+#define NFC_TAG_INLINE_NDEF_SIZE CONFIG_NDEF_TAG_INLINE_SIZE
+#ifdef CONFIG_NDEF_ALLOC_INTERNAL
+#define NDEF_ALLOC_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#elif defined(CONFIG_NDEF_ALLOC_SPIRAM)
+#define NDEF_ALLOC_CAPS (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#endif
+
+#elif !defined(NDEF_NO_DEFAULT_FEATURES)
+
+#define NDEF_SUPPORT_MIFARE_CLASSIC
+#define NDEF_SUPPORT_ULTRALIGHT
+#define NDEF_SUPPORT_ULTRALIGHT_C
+#define NDEF_SUPPORT_TYPE_4
+#define NDEF_SUPPORT_COMPRESSION
+
+#endif
+
+// records in an NdefMessage
+#ifndef NDEF_MAX_RECORDS
+#define NDEF_MAX_RECORDS 4
+#endif
+
+// Bytes on the stack of a write without a workspace from the caller, the
+// largest message it takes is 5 bytes less. A Classic 1K or an NTAG216 fits.
+#ifndef NDEF_WORKSPACE_SIZE
+#define NDEF_WORKSPACE_SIZE 1024
+#endif
+
+// Record payloads, types and ids, and the buffers of the codec. From a heap
+// given by capabilities, so they can be kept out of internal RAM next to
+// a BLE or WiFi stack, or kept in it when PSRAM is too slow.
+#ifdef NDEF_ALLOC_CAPS
+#include <esp_heap_caps.h>
+#define NDEF_MALLOC(size) heap_caps_malloc(size, NDEF_ALLOC_CAPS)
+#else
+#include <stdlib.h>
+#define NDEF_MALLOC(size) malloc(size)
+#endif
+#define NDEF_FREE(ptr) free(ptr)
+
+#endif
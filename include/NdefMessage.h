@@ -2,14 +2,18 @@
 #define NdefMessage_h
 
 #include <NdefRecord.h>
+#include <NdefCompression.h>
 
-#define MAX_NDEF_RECORDS 4
+#define MAX_NDEF_RECORDS NDEF_MAX_RECORDS
 
 class NdefMessage
 {
     public:
         NdefMessage(void);
         NdefMessage(const byte *data, const uint16_t numBytes);
+        // decoded with compressed records turned back into the originals, each
+        // payload decompressed into buffer first, see decompress()
+        NdefMessage(const byte *data, const uint16_t numBytes, byte *buffer, uint16_t bufferSize);
         NdefMessage(const NdefMessage& rhs);
         ~NdefMessage();
         NdefMessage& operator=(const NdefMessage& rhs);
@@ -25,6 +29,14 @@ class NdefMessage
         void addUriRecord(const char *uri);
         void addExternalRecord(const char *type, const byte *payload, const uint16_t payloadLength);
         void addEmptyRecord();
+#ifdef NDEF_SUPPORT_COMPRESSION
+        // compress the payload of each record that gets smaller, see NdefCompression.
+        // Returns the number of records compressed.
+        uint8_t compress();
+        // turn compressed records back into the originals, decompressing each payload
+        // into buffer first. false if a payload doesn't fit or is corrupt.
+        bool decompress(byte *buffer, uint16_t bufferSize);
+#endif
 
         uint8_t getRecordCount();
         NdefRecord getRecord(uint8_t index);
@@ -2,6 +2,7 @@
 #define NdefRecord_h
 
 #include <cstring>
+#include <NdefConfig.h>
 
 typedef uint8_t byte;
 
@@ -0,0 +1,100 @@
+#ifndef NdefRecordIndex_h
+#define NdefRecordIndex_h
+
+#include <inttypes.h>
+#include <cstring>
+#include <NdefRecord.h>
+#include <NfcTag.h>
+
+// type bytes kept for each record, enough for "T", "U" and most MIME and external types
+#define NDEF_INDEX_TYPE_SIZE 32
+// flags and TNF, type length, a long payload length and the id length
+#define NDEF_INDEX_HEADER_SIZE 7
+
+// Where each record of the NDEF message on a tag is, from the record headers
+// alone. The payloads aren't read, readPayload() of a driver fetches the pages
+// or blocks of one of them later. Units are Type 2 pages or Mifare Classic
+// blocks, as the tag addresses them.
+struct NdefRecordIndex
+{
+    struct Entry
+    {
+        // position of the record in the message
+        uint8_t record;
+        NdefRecord::TNF tnf;
+        // the record header as indexed, compared with the tag before a payload is read
+        byte header[NDEF_INDEX_HEADER_SIZE];
+        uint8_t headerLength;
+        // the payload goes on in the next record
+        bool chunked;
+        uint8_t typeLength;
+        // the first NDEF_INDEX_TYPE_SIZE bytes of the type
+        byte type[NDEF_INDEX_TYPE_SIZE];
+        uint8_t idLength;
+        // record and payload in the message, offsets from its first byte
+        uint16_t offset;
+        uint16_t length;
+        uint16_t payloadOffset;
+        uint16_t payloadLength;
+        // pages or blocks holding the payload
+        uint16_t firstUnit;
+        uint16_t lastUnit;
+    };
+    // the tag indexed and the NDEF TLV value in its data area, to catch another
+    // tag or a message changed since
+    byte uid[TAG_MAX_UID_SIZE];
+    uint8_t uidLength;
+    uint16_t valueOffset;
+    uint16_t messageLength;
+    // records in the message. With more than NDEF_MAX_RECORDS the last entry is
+    // the last record, those before it are the first ones.
+    uint8_t recordCount;
+    uint8_t entryCount;
+    Entry entries[NDEF_MAX_RECORDS];
+
+    void reset()
+    {
+        uidLength = 0;
+        valueOffset = 0;
+        messageLength = 0;
+        recordCount = 0;
+        entryCount = 0;
+    }
+
+    // The entry of the first record of tnf and type, -1 if none. A type ending in
+    // a 0 byte matches too, addMimeMediaRecord() writes one.
+    int find(NdefRecord::TNF tnf, const char *recordType) const
+    {
+        size_t length = strlen(recordType);
+        for (uint8_t i = 0; i < entryCount; i++)
+        {
+            const Entry& entry = entries[i];
+            bool terminated = entry.typeLength == length + 1 && length < NDEF_INDEX_TYPE_SIZE && entry.type[length] == 0;
+            if (entry.tnf == tnf && (entry.typeLength == length || terminated) && length <= NDEF_INDEX_TYPE_SIZE &&
+                memcmp(entry.type, recordType, length) == 0)
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // the entry of the last record, -1 if the message has none
+    int last() const
+    {
+        return entryCount > 0 ? entryCount - 1 : -1;
+    }
+
+    void setUid(const byte *tagUid, uint8_t tagUidLength)
+    {
+        uidLength = tagUidLength < TAG_MAX_UID_SIZE ? tagUidLength : TAG_MAX_UID_SIZE;
+        memcpy(uid, tagUid, uidLength);
+    }
+
+    bool isOf(const byte *tagUid, uint8_t tagUidLength) const
+    {
+        return uidLength == tagUidLength && memcmp(uid, tagUid, uidLength) == 0;
+    }
+};
+
+#endif
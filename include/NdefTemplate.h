@@ -0,0 +1,46 @@
+#ifndef NdefTemplate_h
+#define NdefTemplate_h
+
+#include <NdefMessage.h>
+
+#define NDEF_TEMPLATE_MAX_SLOTS 4
+
+// An NDEF message encoded once and patched for each tag. A slot is a placeholder
+// in the message, like the UUUUUUUUUUUUUU of a URI, overwritten with text of the
+// same length so no record or TLV length changes.
+class NdefTemplate
+{
+    public:
+        enum SlotType
+        {
+            // UID in upper case hex, right aligned and padded with '0'
+            SLOT_UID_HEX,
+            // serial number in decimal, right aligned and padded with '0'
+            SLOT_SERIAL
+        };
+        NdefTemplate(NdefMessage& message);
+        ~NdefTemplate();
+        // slot at the first free occurrence of placeholder in the encoded message
+        bool addSlot(const char *placeholder, SlotType type);
+        uint8_t getSlotCount();
+        uint16_t getEncodedSize();
+        // the message for a tag, data must hold getEncodedSize() bytes.
+        // false if a value doesn't fit its slot.
+        bool patch(const byte *uid, uint8_t uidLength, uint32_t serial, byte *data);
+    private:
+        struct Slot
+        {
+            uint16_t offset;
+            uint8_t length;
+            SlotType type;
+        };
+        byte *_encoded;
+        uint16_t _encodedSize;
+        Slot _slots[NDEF_TEMPLATE_MAX_SLOTS];
+        uint8_t _slotCount;
+        NdefTemplate(const NdefTemplate& rhs);
+        NdefTemplate& operator=(const NdefTemplate& rhs);
+        bool isFree(uint16_t offset, uint8_t length);
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef NdefTlv_h
+#define NdefTlv_h
+
+#include <inttypes.h>
+#include <NdefRecord.h>
+#include <WritePlan.h>
+#include <NdefRecordIndex.h>
+
+#define TLV_NULL 0x00
+#define TLV_LOCK_CONTROL 0x01
+#define TLV_MEMORY_CONTROL 0x02
+#define TLV_NDEF 0x03
+#define TLV_PROPRIETARY 0xFD
+#define TLV_TERMINATOR 0xFE
+
+#define LONG_TLV_SIZE 4
+#define SHORT_TLV_SIZE 2
+
+// Lock and Memory Control TLVs a data area can declare
+#define TLV_MAX_AREAS 4
+
+// largest page or block a TlvStorage writes, a Mifare Classic block
+#define TLV_MAX_UNIT_SIZE 16
+
+// A driver's view of the tag data area for the TLV engine.
+// Offsets are relative to the start of the data area, writes are one page or block.
+class TlvStorage
+{
+    public:
+        virtual ~TlvStorage() {}
+        virtual bool read(uint16_t offset, byte *data, uint16_t length) = 0;
+        virtual bool write(uint16_t offset, byte *data) = 0;
+        virtual uint8_t getUnitSize() = 0;
+        // drop cached data, so the next read comes from the tag
+        virtual void invalidate() = 0;
+};
+
+// Reserved and dynamic lock areas inside a data area, and where the NDEF TLV is.
+// TLV bytes are stored skipping these areas, see NFC Forum Type 2 Tag spec 2.3.
+class TlvMap
+{
+    public:
+        struct Area
+        {
+            uint16_t offset;
+            uint16_t length;
+            bool lock;
+        };
+        TlvMap();
+        // baseAddress is the tag memory address of data area offset 0
+        void reset(uint16_t baseAddress, uint16_t dataAreaSize);
+        bool addArea(uint16_t address, uint16_t length, bool lock);
+        bool isReserved(uint16_t offset);
+        // first offset >= offset that is not reserved
+        uint16_t nextUsable(uint16_t offset);
+        // offset just past count usable bytes starting at offset
+        uint16_t advance(uint16_t offset, uint16_t count);
+        // usable bytes between offset and the end of the data area
+        uint16_t usableBytes(uint16_t offset);
+        // usable bytes from offset up to the next reserved area
+        uint16_t getRunLength(uint16_t offset);
+        // a valueOffset equal to tlvOffset records where a new NDEF TLV goes
+        void setNdefTlv(uint16_t tlvOffset, uint16_t valueOffset, uint16_t length);
+        bool hasNdefTlv();
+        uint16_t getNdefTlvOffset();
+        uint16_t getNdefValueOffset();
+        uint16_t getNdefLength();
+        // largest NDEF message that fits in a TLV at the NDEF TLV offset
+        uint16_t getNdefCapacity();
+        uint16_t getDataAreaSize();
+        uint8_t getAreaCount();
+        Area getArea(uint8_t index);
+    private:
+        uint16_t _baseAddress;
+        uint16_t _dataAreaSize;
+        Area _areas[TLV_MAX_AREAS];
+        uint8_t _areaCount;
+        uint16_t _ndefTlvOffset;
+        uint16_t _ndefValueOffset;
+        uint16_t _ndefLength;
+};
+
+class NdefTlv
+{
+    public:
+        enum WriteResult
+        {
+            // the new message is on the tag, verified
+            WRITE_COMMITTED,
+            // the tag still holds the old message
+            WRITE_ROLLED_BACK,
+            // the tag holds an empty NDEF TLV or its state is unknown, it must be written again
+            WRITE_TORN
+        };
+        // Walk the TLV blocks from the start of the data area up to the NDEF TLV,
+        // recording Lock and Memory Control areas in map. Without an NDEF TLV the
+        // map points at the first free offset, where a new one should be written.
+        static bool parse(TlvStorage& storage, TlvMap& map);
+        // copy the NDEF TLV value, skipping reserved areas
+        static bool readValue(TlvStorage& storage, TlvMap& map, byte *data);
+        // length bytes of the NDEF TLV value from messageOffset on
+        static bool readValue(TlvStorage& storage, TlvMap& map, uint16_t messageOffset, byte *data, uint16_t length);
+        // Walk the record headers of the NDEF TLV value, skipping types past
+        // NDEF_INDEX_TYPE_SIZE, ids and payloads. Units are data area offsets divided
+        // by the unit size, the driver turns them into pages or blocks.
+        static bool indexRecords(TlvStorage& storage, TlvMap& map, NdefRecordIndex& index);
+        // the header of the record at entry.offset is still the one indexed
+        static bool matchesHeader(TlvStorage& storage, TlvMap& map, const NdefRecordIndex::Entry& entry);
+        // Write the usable bytes between start and end from data, or zeros if data is NULL.
+        // Reserved bytes and bytes before start keep their content, units that are
+        // entirely reserved are skipped.
+        static bool writeData(TlvStorage& storage, TlvMap& map, uint16_t start, uint16_t end, const byte *data);
+        // Write the length bytes of a TLV at start so a tear can't leave a half written
+        // message: the units holding the header first get an empty NDEF TLV, then the
+        // rest is written, then the header. What was written is read back to verify it.
+        static WriteResult writeTransaction(TlvStorage& storage, TlvMap& map, uint16_t start, const byte *data, uint16_t length, uint8_t headerSize);
+        // compare the usable bytes between start and end on the tag with data
+        static bool verifyData(TlvStorage& storage, TlvMap& map, uint16_t start, uint16_t end, const byte *data);
+        static uint8_t getHeaderSize(uint16_t messageLength);
+        // NDEF TLV header, message and terminator if there is room for it
+        static uint16_t getTlvSize(uint16_t messageLength, uint16_t usableBytes);
+        static uint8_t encodeHeader(uint16_t messageLength, byte *data);
+        // Workspace a driver writes a message from: the message encoded behind room
+        // for a long TLV header, framed in place with the header and terminator.
+        static uint16_t getWorkspaceSize(uint16_t messageLength);
+        // The units writeData() and writeTransaction() would write, as data area
+        // offsets, and the units they read. Nothing is sent to the tag.
+        static void planData(TlvMap& map, uint8_t unitSize, uint16_t start, uint16_t end, WritePlan& plan);
+        static void planTransaction(TlvMap& map, uint8_t unitSize, uint16_t start, uint16_t length, uint8_t headerSize, WritePlan& plan);
+    private:
+        // a unit holds bytes from start on that are written, and bytes that are kept
+        static bool isTouched(TlvMap& map, uint16_t unitOffset, uint8_t unitSize, uint16_t start, bool *keep);
+};
+
+#endif
@@ -1,32 +1,84 @@
 #ifndef NfcAdapter_h
 #define NfcAdapter_h
 
-#include <MFRC522.h>
+#include <NfcTransport.h>
+#include <NfcStatus.h>
 #include <NfcTag.h>
+#include <TagCredentials.h>
+#include <TagInfo.h>
+#include <TagSession.h>
+#include <NfcIrqSource.h>
+#include <NfcInventory.h>
 
-// Drivers
-#include <MifareClassic.h>
-#include <MifareUltralight.h>
+// how often a card detect REQA is sent while waiting for a tag
+#define NFC_IRQ_REARM_TICKS pdMS_TO_TICKS(100)
+
+class MFRC522;
 
 class NfcAdapter {
     public:
         NfcAdapter(MFRC522 *interface);
+        // any reader or a simulator, the transport is not owned by the adapter
+        NfcAdapter(NfcTransport *transport);
 
         ~NfcAdapter(void);
         void begin();
         bool tagPresent(); // tagAvailable
-        NfcTag read();
+        // the tag selected by tagPresent() is still in the field, in about one exchange
+        bool tagStillPresent();
+        // block until a card enters the field and is selected, or timeout ticks pass.
+        // A REQA goes out every rearm ticks while the field is empty.
+        bool waitForTag(NfcIrqSource *irq, TickType_t timeout, TickType_t rearm = NFC_IRQ_REARM_TICKS);
+        // session on the selected tag, selecting a new one if needed. NULL if there is no tag.
+        // The adapter owns the session, it ends when another tag is selected or halted.
+        TagSession* open();
+        // select, read and halt every tag in the field, returns the number found
+        // Messages larger than NFC_TAG_INLINE_NDEF_SIZE go one after the other into
+        // buffer, a tag whose message doesn't fit has ERROR_TOO_LARGE in the inventory.
+        uint8_t inventory(NfcInventory& inventory, bool readMessages = true, byte *buffer = NULL, uint16_t bufferSize = 0);
+        // a message larger than NFC_TAG_INLINE_NDEF_SIZE goes to buffer, which has to outlive the tag
+        NfcTag read(byte *buffer = NULL, uint16_t bufferSize = 0);
+        // read the record headers only, then one payload, see TagSession
+        bool indexRecords(NdefRecordIndex& index);
+        bool readPayload(const NdefRecordIndex& index, uint8_t entry, byte *data, uint16_t dataSize);
         bool write(NdefMessage& ndefMessage);
+        // write that survives the tag leaving the field: the tag keeps the old message
+        // or an empty one, never a partial one, and what was written is verified
+        NdefTlv::WriteResult writeTransaction(NdefMessage& ndefMessage);
+        // the same with a workspace from the caller instead of the stack, see TagSession
+        bool write(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize);
+        NdefTlv::WriteResult writeTransaction(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize);
+        // workspace for the largest message a tag seen before holds, 0 if unknown
+        uint16_t requiredWorkspace(const byte *uid, uint8_t uidLength);
+        // what writing message to a tag seen before would do, from the tag cache alone,
+        // so a message that doesn't fit is caught before the tag is presented again
+        bool planWrite(NdefMessage& message, const byte *uid, uint8_t uidLength, WritePlan& plan, bool transactional = false);
         // erase tag by writing an empty NDEF record
         bool erase();
         // format a tag as NDEF
         bool format();
         // reset tag back to factory state
         bool clean();
+        // raw page or block image of the tag, see TagSession
+        bool dumpImage(TagImageSink& sink, uint16_t *next);
+        bool restoreImage(TagImageSource& source, uint16_t *next, const byte *keyB = NULL);
         void haltTag();
+        // passwords and keys for protected tags
+        TagCredentials& getCredentials();
+        // what was learned about recently seen tags, so they aren't probed again
+        TagInfoCache& getTagInfoCache();
+        // why the last read, write, format or clean failed, and on which block or page
+        NfcStatus getStatus();
+        // how often a block or page is tried, with what backoff and reselections
+        void setRetryPolicy(const NfcRetryPolicy& policy);
     private:
-        MFRC522* shield;
-        NfcTag::TagType guessTagType();
+        NfcTransport* shield;
+        NfcTransport* _ownedTransport;
+        TagCredentials _credentials;
+        TagInfoCache _tagCache;
+        TagSession _session;
+        TagSession& session();
+        bool selectTag();
 };
 
 #endif
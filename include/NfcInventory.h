@@ -0,0 +1,31 @@
+#ifndef NfcInventory_h
+#define NfcInventory_h
+
+#include <NfcTag.h>
+#include <NfcStatus.h>
+
+#define NFC_INVENTORY_MAX_TAGS 8
+
+// The tags found in the field by one NfcAdapter::inventory() sweep
+class NfcInventory
+{
+    public:
+        NfcInventory();
+        uint8_t getTagCount();
+        NfcTag& getTag(uint8_t index);
+        // how reading the tag went, ERROR_TOO_LARGE when its message fit neither
+        // inline nor in what was left of the buffer given to inventory()
+        NfcStatus getStatus(uint8_t index);
+        // false if the sweep stopped with tags left in the field, because the inventory was full
+        bool isComplete();
+        void clear();
+        bool add(const NfcTag& tag, const NfcStatus& status = NfcStatus());
+        bool contains(const byte *uid, uint8_t uidLength);
+    private:
+        NfcTag _tags[NFC_INVENTORY_MAX_TAGS];
+        NfcStatus _statuses[NFC_INVENTORY_MAX_TAGS];
+        uint8_t _tagCount;
+        bool _complete;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef NfcIrqSource_h
+#define NfcIrqSource_h
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+// The reader's IRQ line. A task blocks in wait() until the reader raises it,
+// subclasses only decide where the interrupt comes from.
+class NfcIrqSource
+{
+    public:
+        NfcIrqSource();
+        virtual ~NfcIrqSource();
+        virtual bool begin() = 0;
+        virtual void end() {}
+        // called each time the reader is armed to detect a card
+        virtual void arm() {}
+        // true if the IRQ was raised within timeout
+        bool wait(TickType_t timeout);
+        // drop an IRQ raised before the reader was armed
+        void clear();
+    protected:
+        void signal();
+        // from an interrupt handler, true if a higher priority task was woken
+        bool signalFromIsr();
+    private:
+        SemaphoreHandle_t _event;
+};
+
+// IRQ source for host tests and simulators. The IRQ is raised by trigger(),
+// or on arm() while a card is in the simulated field.
+class SimulatedIrqSource : public NfcIrqSource
+{
+    public:
+        SimulatedIrqSource();
+        bool begin();
+        void arm();
+        void trigger();
+        void setCardPresent(bool present);
+        uint32_t getArmCount();
+    private:
+        volatile bool _cardPresent;
+        volatile uint32_t _armCount;
+};
+
+#endif
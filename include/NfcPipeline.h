@@ -0,0 +1,89 @@
+#ifndef NfcPipeline_h
+#define NfcPipeline_h
+
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <NfcAdapter.h>
+
+// tags read and waiting to be handled, a power of two
+#define NFC_PIPELINE_SLOTS 4
+// message bytes a slot holds past NFC_TAG_INLINE_NDEF_SIZE, an NTAG216 or a Classic 1K fits
+#define NFC_PIPELINE_MESSAGE_SIZE 1024
+
+// Reads tags on one task and decodes and handles them on another, so the reader
+// is polled again while the last tag is being handled. The RF task detects a tag,
+// reads its message bytes into a slot and halts it. The slot goes to the handling
+// task through a lock-free single producer, single consumer ring, and the handling
+// task decodes the message and calls the handler. On an ESP32 the RF task can be
+// pinned to core 0 and the handling task to core 1. On the linux target both are
+// threads, with SimulatedTransport as the reader.
+class NfcPipeline
+{
+    public:
+        // called on the handling task, tag and message are valid until it returns
+        class Handler
+        {
+            public:
+                virtual ~Handler() {}
+                virtual void handle(NfcTag& tag, NdefMessage& message) = 0;
+        };
+        // times in microseconds
+        struct Stats
+        {
+            uint32_t tags;
+            uint32_t handled;
+            // polls skipped because every slot was waiting to be handled
+            uint32_t stalls;
+            uint8_t maxDepth;
+            // on the RF task, and decoding and handling on the other
+            int64_t readTime;
+            int64_t handleTime;
+            // longest from a tag being selected until its handler returned
+            int64_t maxLatency;
+        };
+        // the pipeline has the adapter to itself while it runs
+        NfcPipeline(NfcAdapter *adapter, Handler *handler);
+        ~NfcPipeline();
+        // RF side: read and halt a tag in the field and queue it. false if there
+        // is no tag or no free slot, a tag left in the field is read once one frees up.
+        bool poll();
+        // handling side: decode and handle every queued tag, returns how many
+        uint8_t dispatch();
+        // run both sides on their own tasks until stop(). The RF task waits pollDelay
+        // ticks after each poll, a core is 0, 1 or tskNO_AFFINITY.
+        bool start(uint32_t stackSize, UBaseType_t priority, TickType_t pollDelay,
+            BaseType_t rfCore = tskNO_AFFINITY, BaseType_t handlerCore = tskNO_AFFINITY);
+        // tags already read are handled before it returns
+        void stop();
+        bool isRunning();
+        // each counter is written by one task, taken while running they may be a tag apart
+        Stats getStats();
+        void resetStats();
+    private:
+        struct Slot
+        {
+            NfcTag tag;
+            byte buffer[NFC_PIPELINE_MESSAGE_SIZE];
+            int64_t selected;
+        };
+        NfcAdapter *_adapter;
+        Handler *_handler;
+        Slot _slots[NFC_PIPELINE_SLOTS];
+        // written by the RF side only, and by the handling side only
+        std::atomic<uint8_t> _head;
+        std::atomic<uint8_t> _tail;
+        // given by the RF side when a slot was queued
+        SemaphoreHandle_t _ready;
+        // set by start() and cleared by each task as it ends, stop() waits on them
+        std::atomic<TaskHandle_t> _rfTask;
+        std::atomic<TaskHandle_t> _handlerTask;
+        std::atomic<bool> _running;
+        TickType_t _pollDelay;
+        Stats _stats;
+        static void rfTask(void *arg);
+        static void handlerTask(void *arg);
+};
+
+#endif
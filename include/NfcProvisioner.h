@@ -0,0 +1,69 @@
+#ifndef NfcProvisioner_h
+#define NfcProvisioner_h
+
+#include <NfcAdapter.h>
+#include <NdefTemplate.h>
+
+// Writes a template to a run of tags: detect, patch, write, verify and halt.
+// The message is encoded once, and the TLV layout of the first tag written is
+// used for the next ones of the same product and CC, so a tag costs GET_VERSION
+// and a CC read to identify it, one read to check its layout, the writes and the
+// verify reads. A tag of another product is probed like an unknown tag.
+class NfcProvisioner
+{
+    public:
+        struct Report
+        {
+            byte uid[TAG_MAX_UID_SIZE];
+            uint8_t uidLength;
+            uint32_t serial;
+            NdefTlv::WriteResult result;
+            // why the tag wasn't committed. ERROR_WORKSPACE or ERROR_TOO_LARGE when
+            // the message was never sent, the result is WRITE_ROLLED_BACK then too.
+            NfcStatus::Error error;
+            // microseconds to write and verify, and from detection to halt
+            int64_t writeTime;
+            int64_t tagTime;
+        };
+        struct Stats
+        {
+            uint32_t tags;
+            uint32_t committed;
+            uint32_t failed;
+            // microseconds since begin() and spent on tags
+            int64_t elapsed;
+            int64_t busyTime;
+            int64_t maxTagTime;
+        };
+        NfcProvisioner(NfcAdapter *adapter, NdefTemplate *message);
+        // start a run, the next committed tag gets serial
+        void begin(uint32_t serial = 0);
+        // provision the tag in the field. false if there is no tag, or it is the
+        // tag just provisioned put back on the reader.
+        bool provision(Report *report);
+        // Patch and frame the message in workspace, e.g. static or in PSRAM, instead of
+        // NDEF_WORKSPACE_SIZE bytes of stack. It holds TagSession::requiredWorkspace()
+        // of the template's message.
+        void setWorkspace(byte *workspace, uint16_t workspaceSize);
+        uint32_t getSerial();
+        Stats getStats();
+        // committed tags per minute since begin()
+        float getTagsPerMinute();
+    private:
+        NfcAdapter *_adapter;
+        NdefTemplate *_template;
+        uint32_t _serial;
+        int64_t _startTime;
+        Stats _stats;
+        // layout of the first tag committed, used for the following tags
+        TagInfo _profile;
+        bool _hasProfile;
+        byte _lastUid[TAG_MAX_UID_SIZE];
+        uint8_t _lastUidLength;
+        byte *_workspace;
+        uint16_t _workspaceSize;
+        NdefTlv::WriteResult write(TagSession *session, Report *report);
+        NdefTlv::WriteResult write(TagSession *session, Report *report, byte *workspace, uint16_t workspaceSize);
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef NfcReaderPool_h
+#define NfcReaderPool_h
+
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <NfcAdapter.h>
+
+#define NFC_READER_POOL_MAX_READERS 8
+#define NFC_READER_POOL_QUEUE_LENGTH 16
+
+// Several readers sharing one SPI bus. Readers are polled one at a time, so the
+// bus is never used by two of them at once, and tag events from every antenna
+// arrive on a single queue.
+class NfcReaderPool
+{
+    public:
+        enum Schedule { SCHEDULE_ROUND_ROBIN, SCHEDULE_PRIORITY };
+        struct Event
+        {
+            uint8_t reader;
+            byte uid[TAG_MAX_UID_SIZE];
+            uint8_t uidLength;
+            NfcTag::TagType tagType;
+            int64_t time; // esp_timer_get_time() when the tag was selected
+        };
+        // times in microseconds
+        struct ReaderStats
+        {
+            uint32_t polls;
+            uint32_t tags;
+            // events lost to a full queue
+            uint32_t dropped;
+            int64_t lastPoll;
+            // longest time between two polls of the reader, the fairness of the schedule
+            int64_t maxInterval;
+            // time spent polling the reader, the latency it adds to the others
+            int64_t totalPollTime;
+            int64_t maxPollTime;
+        };
+        NfcReaderPool(Schedule schedule = SCHEDULE_ROUND_ROBIN, uint8_t queueLength = NFC_READER_POOL_QUEUE_LENGTH);
+        ~NfcReaderPool();
+        // index of the reader, -1 if the pool is full. With SCHEDULE_PRIORITY a reader
+        // with priority 3 is polled three times as often as one with priority 1.
+        int addReader(NfcAdapter *adapter, uint8_t priority = 1);
+        uint8_t getReaderCount();
+        NfcAdapter* getReader(uint8_t reader);
+        // Poll the next reader in the schedule, true if it selected a tag. A tag is
+        // reported once, it stays selected and is checked with tagStillPresent()
+        // until it leaves or the tag is halted through acquire().
+        bool poll();
+        // poll from a FreeRTOS task until stop(), waiting pollDelay ticks after each round
+        bool start(uint32_t stackSize, UBaseType_t priority, TickType_t pollDelay);
+        void stop();
+        bool isRunning();
+        bool receive(Event *event, TickType_t wait);
+        // exclusive use of a reader to read or write the tag of an event,
+        // the readers aren't polled until release()
+        NfcAdapter* acquire(uint8_t reader, TickType_t wait);
+        void release();
+        ReaderStats getStats(uint8_t reader);
+        void resetStats();
+    private:
+        struct Reader
+        {
+            NfcAdapter *adapter;
+            uint8_t priority;
+            int32_t credit;
+            // the tag of the last event is still selected, it isn't reported again
+            bool reported;
+            ReaderStats stats;
+        };
+        Reader _readers[NFC_READER_POOL_MAX_READERS];
+        uint8_t _readerCount;
+        uint8_t _next;
+        Schedule _schedule;
+        QueueHandle_t _events;
+        SemaphoreHandle_t _bus;
+        // the polling task and stop() change these from two tasks
+        std::atomic<TaskHandle_t> _task;
+        std::atomic<bool> _running;
+        TickType_t _pollDelay;
+        uint8_t nextReader();
+        static void pollTask(void *arg);
+};
+
+#endif
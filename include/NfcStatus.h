@@ -0,0 +1,136 @@
+#ifndef NfcStatus_h
+#define NfcStatus_h
+
+#include <NfcTransport.h>
+
+// default NfcRetryPolicy
+#define NFC_RETRY_ATTEMPTS 3
+#define NFC_RETRY_BACKOFF_US 500
+#define NFC_RETRY_MAX_BACKOFF_US 8000
+#define NFC_RETRY_RESELECTS 1
+
+// Outcome of the last driver operation: what went wrong, on which block or
+// page, and what it takes to try again.
+class NfcStatus
+{
+    public:
+        enum Error
+        {
+            ERROR_NONE,
+            // no answer, marginal coupling or the tag left
+            ERROR_TIMEOUT,
+            // an answer with a bad CRC, parity or collision
+            ERROR_FRAME,
+            // the tag refused the command and went back to IDLE
+            ERROR_NAK,
+            // the reader failed or a buffer was too small
+            ERROR_READER,
+            // key or password rejected
+            ERROR_AUTHENTICATION,
+            // the tag didn't answer WUPA and select any more
+            ERROR_TAG_LOST,
+            ERROR_NOT_FORMATTED,
+            // the TLVs could not be decoded
+            ERROR_BAD_TLV,
+            ERROR_TOO_LARGE,
+            // what was read back differs from what was written
+            ERROR_VERIFY,
+            // no driver for the tag type
+            ERROR_UNSUPPORTED,
+            // a Type 4 tag answered with an error status word
+            ERROR_APDU,
+            // an image sink or source failed, or the image can't go on the tag
+            ERROR_IMAGE,
+            // the workspace given can't hold the message with its TLV header
+            ERROR_WORKSPACE,
+            // the message on the tag isn't the one a record index was made of
+            ERROR_STALE_INDEX
+        };
+        enum Operation
+        {
+            OPERATION_NONE,
+            OPERATION_SELECT,
+            OPERATION_AUTHENTICATE,
+            OPERATION_READ,
+            OPERATION_WRITE
+        };
+        enum Recovery
+        {
+            // retrying can't help
+            RECOVERY_NONE,
+            // the tag is still selected, send the command again
+            RECOVERY_RETRY,
+            // the tag is IDLE, select and authenticate it before sending the command again
+            RECOVERY_RESELECT
+        };
+
+        NfcStatus();
+        NfcStatus(Error error, Operation operation = OPERATION_NONE, int16_t address = -1,
+            NfcTransport::Status transportStatus = NfcTransport::STATUS_OK);
+        // a failure, keeping the count of retries so far
+        void set(Error error, Operation operation = OPERATION_NONE, int16_t address = -1,
+            NfcTransport::Status transportStatus = NfcTransport::STATUS_OK);
+        // a failure reported by the transport
+        void setTransport(NfcTransport::Status transportStatus, Operation operation, int16_t address);
+        // the operation went through after retries
+        void clearError();
+        void retried();
+        bool ok();
+        Error getError();
+        Operation getOperation();
+        // block or page the operation failed on, -1 if none
+        int16_t getAddress();
+        NfcTransport::Status getTransportStatus();
+        // retries during the operation, also when it went through in the end
+        uint8_t getRetries();
+        Recovery getRecovery();
+        static Error fromTransport(NfcTransport::Status status);
+        static const char* getErrorName(Error error);
+    private:
+        Error _error;
+        Operation _operation;
+        int16_t _address;
+        NfcTransport::Status _transportStatus;
+        uint8_t _retries;
+};
+
+// How hard the drivers try to read or write one block or page
+struct NfcRetryPolicy
+{
+    // tries of a block or page, 1 disables retries
+    uint8_t attempts;
+    // wait before the first retry, doubling up to maxBackoff, in microseconds
+    uint32_t backoff;
+    uint32_t maxBackoff;
+    // reselections of the tag allowed for a block or page
+    uint8_t reselects;
+    NfcRetryPolicy(uint8_t attempts = NFC_RETRY_ATTEMPTS, uint32_t backoff = NFC_RETRY_BACKOFF_US,
+        uint32_t maxBackoff = NFC_RETRY_MAX_BACKOFF_US, uint8_t reselects = NFC_RETRY_RESELECTS);
+};
+
+// Retries of one block or page. A timeout or a bad frame is retried as is
+// first, a NAK or a second failure needs the tag selected again.
+class NfcRetry
+{
+    public:
+        enum Action
+        {
+            ACTION_GIVE_UP,
+            ACTION_RETRY,
+            ACTION_RESELECT
+        };
+        // a Crypto1 session doesn't survive an error, with sessionLost every retry reselects
+        NfcRetry(const NfcRetryPolicy& policy, NfcTransport *transport, bool sessionLost = false);
+        // after a failure in status, wait the backoff and tell how to try again
+        Action next(NfcStatus& status);
+    private:
+        const NfcRetryPolicy& _policy;
+        NfcTransport *_transport;
+        uint8_t _attempts;
+        uint8_t _reselects;
+        uint32_t _backoff;
+        bool _sessionLost;
+        Action _last;
+};
+
+#endif
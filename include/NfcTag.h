@@ -5,34 +5,66 @@
 #include <inttypes.h>
 #include <NdefMessage.h>
 
+#define TAG_MAX_UID_SIZE 10
+// encoded NDEF message kept in the tag itself, larger ones need a buffer from the caller
+#ifndef NFC_TAG_INLINE_NDEF_SIZE
+#define NFC_TAG_INLINE_NDEF_SIZE 256
+#endif
+
+// A value type without heap memory: the UID and the encoded message are copied
+// in, the message is decoded when asked for. Copies are plain copies, so a tag
+// can go through a FreeRTOS queue. A message in a caller's buffer stays there,
+// the buffer has to outlive the tag and its copies.
 class NfcTag
 {
     public:
         enum TagType { TYPE_MIFARE_CLASSIC = 0, TYPE_1, TYPE_2, TYPE_3, TYPE_4, TYPE_UNKNOWN = 99 };
-        NfcTag(byte *uid, uint8_t uidLength, TagType tagType);
-        NfcTag(byte *uid, uint8_t uidLength, TagType tagType, bool isFormatted);
-        NfcTag(byte *uid, uint8_t uidLength, TagType tagType, NdefMessage& ndefMessage);
-        NfcTag(byte *uid, uint8_t uidLength, TagType tagType, const byte *ndefData, const uint16_t ndefDataLength);
-        ~NfcTag(void);
-        NfcTag& operator=(const NfcTag &rhs);
+        // an empty slot, TYPE_UNKNOWN without UID
+        NfcTag();
+        NfcTag(const byte *uid, uint8_t uidLength, TagType tagType);
+        NfcTag(const byte *uid, uint8_t uidLength, TagType tagType, bool isFormatted);
+        // A message larger than NFC_TAG_INLINE_NDEF_SIZE goes in buffer. When it
+        // doesn't fit there either it is left out and isNdefDropped() is true.
+        NfcTag(const byte *uid, uint8_t uidLength, TagType tagType, NdefMessage& ndefMessage,
+            byte *buffer = NULL, uint16_t bufferSize = 0);
+        NfcTag(const byte *uid, uint8_t uidLength, TagType tagType, const byte *ndefData, const uint16_t ndefDataLength,
+            byte *buffer = NULL, uint16_t bufferSize = 0);
+        // room for an encoded message of length bytes, inline or else in buffer,
+        // NULL if neither is large enough. The tag then holds that message, or
+        // is left with isNdefDropped() and the length.
+        byte* allocateNdef(uint16_t length, byte *buffer = NULL, uint16_t bufferSize = 0);
         uint8_t getUidLength();
         void getUid(byte *uid, uint8_t *uidLength);
         TagType getTagType();
         bool hasNdefMessage();
+        // a message was given but had no room, getNdefLength() is its size
+        bool isNdefDropped();
+        // decoded from the bytes held, the records are allocated by NdefMessage
         NdefMessage getNdefMessage();
+        // the same, with compressed records decompressed through buffer
+        NdefMessage getNdefMessage(byte *buffer, uint16_t bufferSize);
+        // the encoded message, NULL without one
+        const byte* getNdefData();
+        uint16_t getNdefLength();
         bool isFormatted();
         void print();
     private:
-        byte *_uid;
+        byte _uid[TAG_MAX_UID_SIZE];
         uint8_t _uidLength;
         TagType _tagType; // Mifare Classic, NFC Forum Type {1,2,3,4}, Unknown
-        NdefMessage *_ndefMessage;
+        byte _ndefInline[NFC_TAG_INLINE_NDEF_SIZE];
+        // the caller's buffer, NULL when the message is inline
+        byte *_ndefBuffer;
+        uint16_t _ndefLength;
+        bool _hasNdefMessage;
+        bool _ndefDropped;
         /**
          * if tag is not formatted it is most probably in HALTED state as soon as we realize that
          * because authentication failed => We need to call PICC_WakeupA
          */
         bool _isFormatted; 
         // TODO capacity
+        void setUid(const byte *uid, uint8_t uidLength);
 };
 
-#endif
\ No newline at end of file
+#endif
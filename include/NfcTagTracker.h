@@ -0,0 +1,81 @@
+#ifndef NfcTagTracker_h
+#define NfcTagTracker_h
+
+#include <NfcAdapter.h>
+
+// UIDs remembered, present or recently gone
+#define NFC_TRACKER_MAX_TAGS 8
+// microseconds a tag may go unseen before it has left
+#define NFC_TRACKER_EXIT_US 500000
+
+// Enter and exit events per UID on top of an NfcAdapter, so a tag resting on the
+// antenna is read once instead of on every poll. The tag read stays selected and
+// each poll checks it is still there with one exchange. A tag unseen for the exit
+// time has left. A UID back within the exit time, after a bad frame or a wobble on
+// the antenna, isn't a new tag. One tag at a time is followed, others in the field
+// are found once it has left.
+class NfcTagTracker
+{
+    public:
+        enum EventType { EVENT_ENTER, EVENT_EXIT };
+        struct Event
+        {
+            EventType type;
+            byte uid[TAG_MAX_UID_SIZE];
+            uint8_t uidLength;
+            // esp_timer_get_time() when the tag was selected, or found gone
+            int64_t time;
+            // the tag read when it entered, without its message if messages aren't read
+            NfcTag tag;
+            // the message came from the cache, the tag wasn't read
+            bool cached;
+        };
+        struct Stats
+        {
+            uint32_t enters;
+            uint32_t exits;
+            // polls that found a tag already present
+            uint32_t suppressed;
+            uint32_t cacheHits;
+        };
+        NfcTagTracker(NfcAdapter *adapter, int64_t exitTime = NFC_TRACKER_EXIT_US, bool readMessages = true);
+        // look for tags coming and going, true with an event. A tag entering is read and
+        // left selected, it can be written through the adapter until the next poll.
+        bool poll(Event *event);
+        // Known UIDs get the message read when they last entered, without RF traffic.
+        // Only messages of up to NFC_TAG_INLINE_NDEF_SIZE bytes are kept.
+        void setCacheMessages(bool cacheMessages);
+        // the tag is read again when it next enters, e.g. after it was written
+        void forget(const byte *uid, uint8_t uidLength);
+        void clear();
+        bool isPresent(const byte *uid, uint8_t uidLength);
+        Stats getStats();
+        void resetStats();
+    private:
+        struct Entry
+        {
+            byte uid[TAG_MAX_UID_SIZE];
+            uint8_t uidLength;
+            bool present;
+            int64_t lastSeen;
+            // the tag as read on entering, with its message if it was cached
+            NfcTag tag;
+            bool hasMessage;
+        };
+        NfcAdapter *_adapter;
+        int64_t _exitTime;
+        bool _readMessages;
+        bool _cacheMessages;
+        Entry _entries[NFC_TRACKER_MAX_TAGS];
+        uint8_t _entryCount;
+        // the entry of the selected tag, -1 if none is
+        int _current;
+        Stats _stats;
+        int find(const byte *uid, uint8_t uidLength);
+        int allocate();
+        void enter(TagSession *session, int index, Event *event, int64_t now);
+        // the exit of a tag other than the selected one unseen for the exit time
+        bool expire(Event *event, int64_t now);
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef NfcTransport_h
+#define NfcTransport_h
+
+#include <NfcTag.h>
+
+// the MFRC522 FIFO, the largest frame sent or received in one go
+#define NFC_TRANSPORT_MAX_FRAME 64
+
+// The commands the drivers send to a tag, through a reader or a simulator.
+// Status and PICC type values follow the MFRC522 library.
+class NfcTransport
+{
+    public:
+        enum Status
+        {
+            STATUS_OK,
+            STATUS_ERROR,
+            STATUS_COLLISION,
+            STATUS_TIMEOUT,
+            STATUS_NO_ROOM,
+            STATUS_INTERNAL_ERROR,
+            STATUS_INVALID,
+            STATUS_CRC_WRONG,
+            STATUS_MIFARE_NACK = 0xff
+        };
+        enum PiccType
+        {
+            PICC_TYPE_UNKNOWN,
+            PICC_TYPE_ISO_14443_4,
+            PICC_TYPE_ISO_18092,
+            PICC_TYPE_MIFARE_MINI,
+            PICC_TYPE_MIFARE_1K,
+            PICC_TYPE_MIFARE_4K,
+            PICC_TYPE_MIFARE_UL,
+            PICC_TYPE_MIFARE_PLUS,
+            PICC_TYPE_MIFARE_DESFIRE,
+            PICC_TYPE_TNP3XXX,
+            PICC_TYPE_NOT_COMPLETE = 0xff
+        };
+        struct Uid
+        {
+            byte size;
+            byte uidByte[TAG_MAX_UID_SIZE];
+            byte sak;
+        };
+
+        virtual ~NfcTransport() {}
+        virtual void begin() {}
+        // REQA, true if a tag in IDLE state answered
+        virtual bool isNewCardPresent() = 0;
+        // WUPA, tags in IDLE and HALT state answer
+        virtual Status wakeupA() = 0;
+        // anticollision and select of one tag, its UID is left in uid
+        virtual bool readCardSerial() = 0;
+        // select the tag with a known UID, after WUPA
+        virtual Status select(Uid *tagUid) = 0;
+        virtual Status haltA() = 0;
+        // Mifare Classic authentication of the sector holding block, key is 6 bytes
+        virtual Status authenticate(bool keyB, byte block, const byte *key) = 0;
+        virtual void stopCrypto1() = 0;
+        // READ, 16 bytes and their CRC, buffer holds 18 bytes
+        virtual Status mifareRead(byte block, byte *buffer, byte *bufferSize) = 0;
+        // Mifare Classic WRITE of a 16 byte block
+        virtual Status mifareWrite(byte block, const byte *data) = 0;
+        // Type 2 WRITE of a 4 byte page
+        virtual Status ultralightWrite(byte page, const byte *data) = 0;
+        // any other command. CRC_A is appended to command, the response is checked
+        // and its CRC left at the end, responseSize counts it.
+        virtual Status transceive(const byte *command, byte commandSize, byte *response, byte *responseSize) = 0;
+        // leave a REQA pending, so the reader raises its IRQ when a tag answers
+        virtual void armCardDetect() = 0;
+        // route the receive interrupt to the IRQ pin, or restore the default
+        virtual void enableCardDetectIrq(bool enable) = 0;
+        // log the reader firmware version
+        virtual void dumpVersion() {}
+        // wait between retries, a simulator only counts the time
+        virtual void delay(uint32_t micros);
+        // largest frame transceive() sends or receives, CRC included
+        virtual uint16_t getMaxFrameSize() { return NFC_TRANSPORT_MAX_FRAME; }
+
+        static PiccType getType(byte sak);
+        static const char* getStatusName(Status status);
+
+        // UID of the selected tag
+        Uid uid;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef SimulatedTag_h
+#define SimulatedTag_h
+
+#include <NfcTransport.h>
+#include <IsoDep.h>
+#include <WritePlan.h>
+
+// CLA, INS, P1, P2, Lc, 255 bytes and Le
+#define SIMULATED_APDU_SIZE 261
+// bytes of a Type 4 NDEF file programmed in one EEPROM cycle
+#define SIMULATED_TYPE_4_WRITE_SIZE NFC_TYPE_4_WRITE_SIZE
+
+// Memory and command model of a tag for SimulatedTransport. Type 2 tags model
+// pages, static lock bits, OTP CC bits, GET_VERSION, FAST_READ, PWD_AUTH and
+// Ultralight C 3DES authentication. Mifare Classic tags model sectors, keys and
+// access bits. Type 4 tags model RATS, ISO-DEP chaining and the NFC Forum NDEF
+// application with its CC and NDEF files. Dynamic lock bits, value blocks and
+// the native DESFire and NTAG 424 commands are not modelled.
+class SimulatedTag
+{
+    public:
+        enum Model
+        {
+            MODEL_MIFARE_CLASSIC_1K,
+            MODEL_MIFARE_CLASSIC_4K,
+            MODEL_ULTRALIGHT,
+            MODEL_ULTRALIGHT_C,
+            MODEL_ULTRALIGHT_EV1,
+            MODEL_NTAG213,
+            MODEL_NTAG215,
+            MODEL_NTAG216,
+            // FSC 128, a 256 byte NDEF file, shipped NDEF formatted
+            MODEL_NTAG424_DNA,
+            // FSC 64, MLe 59 and MLc 52, shipped without an NDEF application,
+            // formatNdef() creates one with a 4 KB NDEF file
+            MODEL_DESFIRE_EV2
+        };
+        enum State
+        {
+            STATE_IDLE,
+            STATE_READY,
+            STATE_ACTIVE,
+            STATE_HALT
+        };
+        // a tag as shipped. Without a UID each tag gets its own.
+        SimulatedTag(Model model, const byte *uid = NULL, uint8_t uidLength = 0);
+        ~SimulatedTag();
+        Model getModel();
+        bool isClassic();
+        bool isType4();
+        const byte* getUid();
+        uint8_t getUidLength();
+        byte getSak();
+        // raw memory from page or block 0, trailers and configuration pages included.
+        // Type 4 tags hold the CC file, padded to 16 bytes, then the NDEF file.
+        byte* getMemory();
+        uint16_t getMemorySize();
+        // NDEF formatted with an empty message. 4K tags get the 1K layout.
+        void formatNdef();
+        // NTAG and Ultralight EV1 password, protecting writes from page auth0, and reads too if protectReads
+        void setPassword(const byte *password, const byte *pack, byte auth0, bool protectReads);
+        // Ultralight C key, protecting writes from page auth0, and reads too if protectReads
+        void setUltralightCKey(const byte *key, byte auth0, bool protectReads);
+
+        // used by SimulatedTransport, a NAK or a lost frame puts the tag back to IDLE
+        State getState();
+        void setState(State state);
+        NfcTransport::Status read(byte block, byte *data);
+        NfcTransport::Status write(byte block, const byte *data, byte length);
+        NfcTransport::Status authenticate(bool keyB, byte block, const byte *key);
+        NfcTransport::Status command(const byte *command, byte commandSize, byte *response, byte *responseSize);
+        // EEPROM cycles of the NDEF file since the last call
+        uint16_t takeWriteCycles();
+    private:
+        Model _model;
+        byte _uid[7];
+        uint8_t _uidLength;
+        byte *_memory;
+        uint16_t _memorySize;
+        State _state;
+        // Mifare Classic sector authenticated and with which key, -1 for none
+        int _authSector;
+        bool _authKeyB;
+        // Type 2 authentication
+        bool _authenticated;
+        byte _key[16];
+        byte _rndB[8];
+        bool _authStarted;
+        uint32_t _random;
+        // Type 4: ISO-DEP state, the APDU being received and the answer being sent
+        bool _ndefApplication;
+        bool _protocol;
+        uint16_t _fsd;
+        byte _blockNumber;
+        byte _lastBlock[ISO_DEP_MAX_FRAME];
+        uint16_t _lastBlockSize;
+        byte _apdu[SIMULATED_APDU_SIZE];
+        uint16_t _apduLength;
+        byte _answer[SIMULATED_APDU_SIZE];
+        uint16_t _answerLength;
+        uint16_t _answerSent;
+        bool _applicationSelected;
+        uint16_t _file;
+        uint16_t _writeCycles;
+        SimulatedTag(const SimulatedTag& rhs);
+        SimulatedTag& operator=(const SimulatedTag& rhs);
+        uint16_t getPages();
+        uint16_t getConfigPage();
+        byte getAuth0();
+        bool readProtected();
+        bool pageLocked(uint16_t page);
+        bool pageHidden(uint16_t page);
+        NfcTransport::Status nak();
+        int getSector(byte block);
+        int getTrailer(int sector);
+        byte getAccess(byte block);
+        bool accessBitsValid(const byte *trailer);
+        bool canRead(byte block);
+        bool canWrite(byte block);
+        NfcTransport::Status isoDepBlock(const byte *block, byte blockSize, byte *response, byte *responseSize);
+        uint16_t nextAnswerBlock(byte *block);
+        void processApdu();
+        uint16_t getFileSize(uint16_t file);
+        byte* getFile(uint16_t file);
+        void ultralightCAuth(const byte *command, byte commandSize, byte *response, byte *responseSize, NfcTransport::Status *status);
+};
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef SimulatedTransport_h
+#define SimulatedTransport_h
+
+#include <NfcTransport.h>
+#include <NfcIrqSource.h>
+#include <SimulatedTag.h>
+
+#define SIMULATED_FIELD_MAX_TAGS 8
+
+// A reader with SimulatedTags in its field, to run the drivers on the host.
+// Every frame is counted and costs time on a virtual clock, so RF exchanges
+// and latency of a read or write can be measured offline. Frames can be lost
+// at random and a tag can be pulled away after a number of exchanges.
+class SimulatedTransport : public NfcTransport
+{
+    public:
+        // per frame cost in microseconds
+        struct Latency
+        {
+            // SPI setup, frame delay and reader processing
+            uint32_t command;
+            // each byte sent or received, 106 kbit/s plus SPI
+            uint32_t byte;
+            // EEPROM programming of a page or block, or of 32 bytes of a Type 4 file
+            uint32_t write;
+            // Mifare Classic three pass authentication
+            uint32_t authenticate;
+        };
+        struct Stats
+        {
+            uint32_t exchanges;
+            uint32_t reads;
+            uint32_t writes;
+            uint32_t authentications;
+            uint32_t selections;
+            // frames lost, NAKs and timeouts
+            uint32_t errors;
+            // virtual time spent on the air, in microseconds
+            uint64_t busyTime;
+            // virtual time waited between retries, in microseconds
+            uint64_t waitTime;
+        };
+
+        SimulatedTransport();
+        // tags are not owned and must outlive the field
+        bool addTag(SimulatedTag *tag);
+        void removeTag(SimulatedTag *tag);
+        void clearField();
+        uint8_t getTagCount();
+        // the tag selected by the last anticollision or select, NULL if none
+        SimulatedTag* getSelectedTag();
+
+        void setLatency(const Latency& latency);
+        Latency getLatency();
+        // rate of frames lost, 0 to 1, from a PRNG seeded with seed. Half of them
+        // never reach the tag, the other half are executed but the answer is garbled.
+        void setErrorRate(float rate, uint32_t seed);
+        // the selected tag leaves the field before the exchange-th next frame, 0 to cancel
+        void removeTagAfter(uint32_t exchanges);
+        // raised by armCardDetect() while a tag in the field is IDLE
+        void setIrqSource(SimulatedIrqSource *irq);
+        // largest frame, CRC included, NFC_TRANSPORT_MAX_FRAME like the MFRC522 FIFO by default
+        void setMaxFrameSize(uint16_t size);
+        Stats getStats();
+        void resetStats();
+
+        bool isNewCardPresent();
+        Status wakeupA();
+        bool readCardSerial();
+        Status select(Uid *tagUid);
+        Status haltA();
+        Status authenticate(bool keyB, byte block, const byte *key);
+        void stopCrypto1();
+        Status mifareRead(byte block, byte *buffer, byte *bufferSize);
+        Status mifareWrite(byte block, const byte *data);
+        Status ultralightWrite(byte page, const byte *data);
+        Status transceive(const byte *command, byte commandSize, byte *response, byte *responseSize);
+        void armCardDetect();
+        void enableCardDetectIrq(bool enable);
+        // adds to waitTime instead of waiting
+        void delay(uint32_t micros);
+        uint16_t getMaxFrameSize();
+    private:
+        enum Frame
+        {
+            FRAME_OK,
+            FRAME_LOST,
+            FRAME_GARBLED
+        };
+        SimulatedTag *_tags[SIMULATED_FIELD_MAX_TAGS];
+        uint8_t _tagCount;
+        SimulatedTag *_selected;
+        bool _crypto;
+        Latency _latency;
+        Stats _stats;
+        uint32_t _errorThreshold;
+        uint32_t _random;
+        uint32_t _removeAfter;
+        SimulatedIrqSource *_irq;
+        uint16_t _maxFrameSize;
+        Frame send();
+        void charge(uint16_t sent, uint16_t received, uint32_t extra);
+        Frame exchange(uint16_t sent, uint16_t received, uint32_t extra);
+        Status fail(Status status);
+        SimulatedTag* getActiveTag();
+};
+
+#endif
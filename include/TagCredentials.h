@@ -0,0 +1,59 @@
+#ifndef TagCredentials_h
+#define TagCredentials_h
+
+#include <inttypes.h>
+#include <NfcTag.h>
+
+#define TAG_CREDENTIALS_MAX_ENTRIES 8
+// tags the default credential was tried on, kept apart so they don't evict the entries above
+#define TAG_CREDENTIALS_MAX_DEFAULT_ENTRIES 8
+
+#define NTAG_PASSWORD_SIZE 4
+#define NTAG_PACK_SIZE 2
+#define ULTRALIGHT_C_KEY_SIZE 16
+
+// Passwords and keys for protected Type 2 tags, keyed by UID.
+// Entries remember whether their credential was rejected, so a bad
+// password is never sent twice, and which selection they authenticated,
+// so a tag is authenticated once per selection.
+class TagCredentials
+{
+    public:
+        enum Kind { KIND_NONE, KIND_NTAG_PASSWORD, KIND_ULTRALIGHT_C_KEY };
+        struct Entry
+        {
+            byte uid[TAG_MAX_UID_SIZE];
+            uint8_t uidLength; // 0 for the default credential
+            Kind kind;
+            byte key[ULTRALIGHT_C_KEY_SIZE]; // NTAG password in the first 4 bytes
+            byte pack[NTAG_PACK_SIZE];
+            bool checkPack;
+            bool failed;
+            uint32_t authenticatedSelection;
+            uint32_t lastUsed;
+        };
+        TagCredentials();
+        // uid NULL sets the credential tried on tags without their own
+        bool setPassword(const byte *uid, uint8_t uidLength, const byte *password, const byte *pack);
+        bool setUltralightCKey(const byte *uid, uint8_t uidLength, const byte *key);
+        void remove(const byte *uid, uint8_t uidLength);
+        // Entry for uid. Without one of its own, a copy of the default credential is
+        // made on first use, in a table of its own where tags the default was
+        // rejected by are the last to go.
+        Entry* find(const byte *uid, uint8_t uidLength);
+        // a new tag selection drops the authentication state of every entry
+        void beginSelection();
+        bool isAuthenticated(Entry *entry);
+        void setAuthenticated(Entry *entry);
+        void setFailed(Entry *entry);
+    private:
+        Entry _entries[TAG_CREDENTIALS_MAX_ENTRIES];
+        Entry _defaultEntries[TAG_CREDENTIALS_MAX_DEFAULT_ENTRIES];
+        Entry _default;
+        uint32_t _selection;
+        uint32_t _clock;
+        static Entry* lookup(Entry *entries, uint8_t count, const byte *uid, uint8_t uidLength);
+        Entry* allocate(Entry *entries, uint8_t count, const byte *uid, uint8_t uidLength);
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef TagImage_h
+#define TagImage_h
+
+#include <inttypes.h>
+#include <NdefRecord.h>
+
+// Where a raw tag image goes, one page or block at a time in address order,
+// e.g. a file, a buffer or a socket. false stops the dump at that unit.
+class TagImageSink
+{
+    public:
+        virtual ~TagImageSink() {}
+        virtual bool write(uint16_t unit, const byte *data, uint8_t length) = 0;
+};
+
+// Where a raw tag image is restored from, any unit may be asked for again
+class TagImageSource
+{
+    public:
+        virtual ~TagImageSource() {}
+        virtual bool read(uint16_t unit, byte *data, uint8_t length) = 0;
+};
+
+// A whole image in memory, a Classic 1K is 1024 bytes and an NTAG216 924
+class TagImageBuffer : public TagImageSink, public TagImageSource
+{
+    public:
+        TagImageBuffer(byte *buffer, uint16_t size, uint8_t unitSize);
+        bool write(uint16_t unit, const byte *data, uint8_t length);
+        bool read(uint16_t unit, byte *data, uint8_t length);
+        // bytes up to the end of the last unit written
+        uint16_t getLength();
+    private:
+        byte *_buffer;
+        uint16_t _size;
+        uint8_t _unitSize;
+        uint16_t _length;
+};
+
+#endif
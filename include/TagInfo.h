@@ -0,0 +1,58 @@
+#ifndef TagInfo_h
+#define TagInfo_h
+
+#include <NfcTag.h>
+#include <NdefTlv.h>
+#include <TagCredentials.h>
+
+#define TAG_INFO_CACHE_SIZE 8
+#define TYPE_2_CC_SIZE 4
+// CCLEN, mapping version, MLe, MLc and the NDEF File Control TLV
+#define TYPE_4_CC_SIZE 15
+
+// What the drivers learned about a tag. Product, capacity and the TLV layout
+// don't need to be probed again when the same UID is presented again.
+struct TagInfo
+{
+    byte uid[TAG_MAX_UID_SIZE];
+    uint8_t uidLength;
+    NfcTag::TagType tagType;
+    // product, data area size and fast read support are known
+    bool identified;
+    uint8_t product; // MifareUltralight::Product for Type 2 tags
+    uint16_t dataAreaSize;
+    bool fastRead;
+    // capability container, page 3 of Type 2 tags or the CC file of Type 4 tags
+    bool ccKnown;
+    byte cc[TYPE_4_CC_SIZE];
+    bool formatted;
+    // map holds the reserved areas and the NDEF TLV position
+    bool mapped;
+    TlvMap map;
+    // credential that last authenticated the tag
+    TagCredentials::Kind keyKind;
+    byte key[ULTRALIGHT_C_KEY_SIZE];
+    uint32_t lastUsed;
+};
+
+// Bounded LRU cache of TagInfo keyed by UID
+class TagInfoCache
+{
+    public:
+        TagInfoCache();
+        TagInfo* find(const byte *uid, uint8_t uidLength);
+        // entry for uid, the least recently used entry is recycled when the cache is full
+        TagInfo* get(const byte *uid, uint8_t uidLength);
+        void invalidate(const byte *uid, uint8_t uidLength);
+        void clear();
+        static void reset(TagInfo *info);
+        // copy what a product and its layout tell, not the UID or credentials
+        static void copyLayout(TagInfo *info, const TagInfo *from);
+        // both were identified as the same product with the same CC
+        static bool sameProduct(const TagInfo *info, const TagInfo *from);
+    private:
+        TagInfo _entries[TAG_INFO_CACHE_SIZE];
+        uint32_t _clock;
+};
+
+#endif
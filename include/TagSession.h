@@ -0,0 +1,110 @@
+#ifndef TagSession_h
+#define TagSession_h
+
+#include <NfcTransport.h>
+#include <NfcStatus.h>
+#include <NfcTag.h>
+#include <TagCredentials.h>
+#include <TagInfo.h>
+#include <TagImage.h>
+#include <NdefRecordIndex.h>
+
+// Drivers
+#include <MifareClassic.h>
+#include <MifareUltralight.h>
+#include <Type4Tag.h>
+
+// The selected tag and its driver. Authentication, the pages or blocks read
+// and the TLV map are kept between operations until the session is closed or
+// another tag is selected, so a read followed by a write doesn't detect,
+// authenticate or map the tag again.
+class TagSession
+{
+    public:
+        TagSession(NfcTransport *shield, TagCredentials *credentials, TagInfoCache *cache);
+        // start a session on the tag selected in the shield
+        void begin();
+        // forget the tag without talking to it, after it was deselected
+        void end();
+        // halt the tag and end the session
+        void close();
+        // the session was begun and the shield still has its tag selected
+        bool isOpen();
+        // the selected tag is still in the field, with the cheapest command that proves it
+        bool isPresent();
+        // a message larger than NFC_TAG_INLINE_NDEF_SIZE goes to buffer, which has to outlive the tag
+        NfcTag read(byte *buffer = NULL, uint16_t bufferSize = 0);
+        // Where each record of the message is, from the record headers alone, so one
+        // payload can be read later without the pages or blocks of the others.
+        // Mifare Classic and Type 2 tags, a Type 4 tag is read whole.
+        bool indexRecords(NdefRecordIndex& index);
+        // the payload of one entry of index into data, while the tag holds the same message
+        bool readPayload(const NdefRecordIndex& index, uint8_t entry, byte *data, uint16_t dataSize);
+        bool write(NdefMessage& ndefMessage);
+        // write so a tag pulled away mid write keeps its old message or an empty one,
+        // and read back what was written
+        NdefTlv::WriteResult writeTransaction(NdefMessage& ndefMessage);
+        // write a message already encoded, e.g. patched from an NdefTemplate
+        NdefTlv::WriteResult writeEncoded(const byte *message, uint16_t length, bool transactional);
+        // The writes above encode and frame the message in NDEF_WORKSPACE_SIZE bytes
+        // of stack. These take a workspace from the caller instead, e.g. static or in
+        // PSRAM, so a write uses the same stack whatever the message size. The message
+        // given to writeEncoded() may be in the workspace itself.
+        bool write(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize);
+        NdefTlv::WriteResult writeTransaction(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize);
+        NdefTlv::WriteResult writeEncoded(const byte *message, uint16_t length, bool transactional, byte *workspace, uint16_t workspaceSize);
+        // workspace for writing message to any tag
+        static uint16_t requiredWorkspace(NdefMessage& message);
+        // workspace for the largest message the tag info describes holds, 0 if unknown
+        static uint16_t requiredWorkspace(const TagInfo& info);
+        // what writing message to the tag info describes would do, without RF traffic.
+        // Returns plan.fits.
+        static bool planWrite(NdefMessage& message, const TagInfo& info, WritePlan& plan, bool transactional = false);
+        // erase tag by writing an empty NDEF record
+        bool erase();
+        // format a tag as NDEF
+        bool format();
+        // reset tag back to factory state
+        bool clean();
+        // Raw image of a Type 2 tag, one unit per page, or of a Mifare Classic 1K, one
+        // per block. *next is the unit to go on from, 0 to start, and is left at the
+        // first unit not done, so the same call finishes a transfer cut short.
+        bool dumpImage(TagImageSink& sink, uint16_t *next);
+        // keyB is the Mifare Classic key B of sectors where the image can't hold it
+        bool restoreImage(TagImageSource& source, uint16_t *next, const byte *keyB = NULL);
+        const byte* getUid();
+        uint8_t getUidLength();
+        NfcTag::TagType getTagType();
+        // what is cached about the tag, NULL without a cache
+        TagInfo* getInfo();
+        // data area in bytes, 0 if unknown
+        uint16_t getCapacity();
+        // what went wrong in the last operation, and on which block or page
+        NfcStatus getStatus();
+        // retries of a block or page, for the drivers of every tag type
+        void setRetryPolicy(const NfcRetryPolicy& policy);
+    private:
+        NfcTransport *_shield;
+        TagCredentials *_credentials;
+        TagInfoCache *_cache;
+        TagInfo *_info;
+        byte _uid[TAG_MAX_UID_SIZE];
+        uint8_t _uidLength;
+        NfcTag::TagType _type;
+        bool _open;
+        // failures outside a driver, no driver for the tag
+        NfcStatus _status;
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+        MifareClassic _classic;
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+        MifareUltralight _ultralight;
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+        Type4Tag _type4;
+#endif
+        NfcTag::TagType guessTagType();
+        void invalidate();
+};
+
+#endif
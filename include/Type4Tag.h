@@ -0,0 +1,102 @@
+#ifndef Type4Tag_h
+#define Type4Tag_h
+
+#include <NdefConfig.h>
+
+#ifdef NDEF_SUPPORT_TYPE_4
+
+#include <NfcTransport.h>
+#include <NfcTag.h>
+#include <NdefTlv.h>
+#include <NfcStatus.h>
+#include <IsoDep.h>
+#include <TagInfo.h>
+
+// NFC Forum Type 4 Tag 2.0 commands
+#define TYPE_4_CLA 0x00
+#define TYPE_4_INS_SELECT 0xA4
+#define TYPE_4_INS_READ_BINARY 0xB0
+#define TYPE_4_INS_UPDATE_BINARY 0xD6
+#define TYPE_4_SW_OK 0x9000
+#define TYPE_4_SW_SIZE 2
+
+#define TYPE_4_NDEF_AID_SIZE 7
+#define TYPE_4_CC_FILE 0xE103
+// NLEN in front of the message in the NDEF file
+#define TYPE_4_NLEN_SIZE 2
+// a short APDU carries up to 255 bytes and asks for up to 256
+#define TYPE_4_MAX_LC 255
+#define TYPE_4_MAX_LE 256
+
+// Tags with the NFC Forum Type 4 NDEF application, e.g. DESFire EV1-EV3 and
+// NTAG 424 DNA formatted for NDEF. ReadBinary and UpdateBinary are as large as
+// the CC allows and ISO-DEP chains them in frames as large as tag and reader
+// take, so a message of a few KB moves in few exchanges. The tag's own
+// commands, keys and file management are not used.
+class Type4Tag
+{
+    public:
+        // info caches what was learned about the tag across selections, it may be NULL
+        Type4Tag(NfcTransport *transport, TagInfo *info = NULL);
+        // forget the tag after another selection, it needs RATS again. info may be NULL.
+        void reset(TagInfo *info);
+        // forget the CC and the NDEF file, the tag stays activated
+        void invalidate(TagInfo *info);
+        // a message larger than NFC_TAG_INLINE_NDEF_SIZE goes to buffer, which has to outlive the tag
+        NfcTag read(byte *buffer = NULL, uint16_t bufferSize = 0);
+        bool write(NdefMessage& ndefMessage);
+        // NLEN is cleared before the message is written and set after, then read back
+        NdefTlv::WriteResult writeTransaction(NdefMessage& ndefMessage);
+        // write a message already encoded, as a plain write or a transaction
+        NdefTlv::WriteResult writeEncoded(const byte *message, uint16_t length, bool transactional);
+        // The message encoded in a workspace from the caller, e.g. static or in PSRAM,
+        // instead of NDEF_WORKSPACE_SIZE bytes of stack. See requiredWorkspace().
+        bool write(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize);
+        NdefTlv::WriteResult writeTransaction(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize);
+        // an empty NDEF file, NLEN 0
+        bool clean();
+        // largest message, the NDEF file without NLEN, 0 if unknown
+        uint16_t getCapacity();
+        // what writing a message of messageLength bytes would do, from the CC info holds
+        static void planWrite(const TagInfo& info, uint16_t messageLength, bool transactional, WritePlan& plan);
+        // workspace for the largest message the NDEF file holds, 0 if info doesn't tell
+        static uint16_t requiredWorkspace(const TagInfo& info);
+        // the selected tag still answers
+        bool isPresent();
+        // S(DESELECT), the tag goes to HALT
+        void deselect();
+        // what went wrong in the last read, write or clean, and where
+        NfcStatus getStatus();
+        void setRetryPolicy(const NfcRetryPolicy& policy);
+    private:
+        NfcTransport *_transport;
+        TagInfo *_info;
+        IsoDep _isoDep;
+        NfcStatus _status;
+        NfcRetryPolicy _retryPolicy;
+        // the NDEF file is selected, and what the CC tells about it
+        bool _selected;
+        uint16_t _maxRead;
+        uint16_t _maxWrite;
+        uint16_t _fileId;
+        uint16_t _fileSize;
+        bool _writable;
+        NdefTlv::WriteResult writeMessage(NdefMessage& m, bool transactional, byte *workspace, uint16_t workspaceSize);
+        bool open();
+        bool selectNdefFile();
+        bool readCapabilities();
+        // MLe, MLc and the NDEF file from a CC, false if it has no readable NDEF file
+        static bool parseCapabilities(const byte *cc, uint16_t *maxRead, uint16_t *maxWrite,
+            uint16_t *fileId, uint16_t *fileSize, bool *writable);
+        bool command(const byte *apdu, uint16_t length, byte *response, uint16_t *responseLength,
+            NfcStatus::Operation operation, int16_t offset);
+        bool sendApdu(const byte *apdu, uint16_t length, byte *response, uint16_t *responseLength,
+            NfcStatus::Operation operation, int16_t offset);
+        bool select(byte p1, byte p2, const byte *data, byte length);
+        bool readBinary(uint16_t offset, byte *data, uint16_t length);
+        bool updateBinary(uint16_t offset, const byte *data, uint16_t length);
+        bool recover(NfcRetry& retry);
+};
+
+#endif
+#endif
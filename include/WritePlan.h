@@ -0,0 +1,75 @@
+#ifndef WritePlan_h
+#define WritePlan_h
+
+#include <inttypes.h>
+
+// pages of an NTAG216 or blocks of a Classic 1K, with room for a transaction
+#define WRITE_PLAN_MAX_UNITS 256
+
+// Time in microseconds of an MFRC522 on a 10 MHz SPI bus, measured against
+// NTAG213 and Classic 1K. SimulatedTransport charges the same by default.
+#define NFC_TIME_COMMAND_US 400
+#define NFC_TIME_BYTE_US 95
+#define NFC_TIME_WRITE_US 4100
+#define NFC_TIME_AUTHENTICATE_US 2000
+// bytes a Type 4 tag programs in one EEPROM write cycle
+#define NFC_TYPE_4_WRITE_SIZE 32
+
+// What writing a message would do to a tag, worked out from its TagInfo
+// without RF traffic. The units are pages for Type 2 tags, blocks for Mifare
+// Classic and NDEF file offsets of each UpdateBinary for Type 4 tags, in the
+// order they are written.
+struct WritePlan
+{
+    // the tag type and its capacity are known, nothing else is set otherwise
+    bool known;
+    // the TLVs weren't read yet, an NDEF formatted tag without other TLVs is assumed
+    bool assumedLayout;
+    uint16_t messageLength;
+    // what goes on the tag, the message with its TLV header and terminator or NLEN
+    uint16_t writeLength;
+    // largest message the tag holds
+    uint16_t capacity;
+    bool fits;
+    // writes counts every unit written, units lists the first WRITE_PLAN_MAX_UNITS
+    uint16_t units[WRITE_PLAN_MAX_UNITS];
+    uint16_t unitCount;
+    uint16_t writes;
+    // units read to keep their other bytes, to validate the layout or to verify,
+    // ReadBinary commands for Type 4 tags
+    uint16_t reads;
+    uint8_t authentications;
+    uint32_t estimatedTime;
+
+    void reset()
+    {
+        known = false;
+        assumedLayout = false;
+        messageLength = 0;
+        writeLength = 0;
+        capacity = 0;
+        fits = false;
+        unitCount = 0;
+        writes = 0;
+        reads = 0;
+        authentications = 0;
+        estimatedTime = 0;
+    }
+
+    void addUnit(uint16_t unit)
+    {
+        if (unitCount < WRITE_PLAN_MAX_UNITS)
+        {
+            units[unitCount++] = unit;
+        }
+        writes++;
+    }
+
+    // one exchange, its frames with CRC and what the tag needs on top
+    static uint32_t exchangeTime(uint16_t sent, uint16_t received, uint32_t extra)
+    {
+        return NFC_TIME_COMMAND_US + (sent + received) * NFC_TIME_BYTE_US + extra;
+    }
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include <sdkconfig.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include <esp_log.h>
+#include <esp_attr.h>
+#include "GpioIrqSource.h"
+
+static const char* LOG_TAG = "GPIO IRQ";
+
+GpioIrqSource::GpioIrqSource(gpio_num_t pin)
+{
+    _pin = pin;
+    _installed = false;
+}
+
+GpioIrqSource::~GpioIrqSource()
+{
+    end();
+}
+
+bool GpioIrqSource::begin()
+{
+    gpio_config_t config = {};
+    config.pin_bit_mask = 1ULL << _pin;
+    config.mode = GPIO_MODE_INPUT;
+    config.pull_up_en = GPIO_PULLUP_ENABLE;
+    config.pull_down_en = GPIO_PULLDOWN_DISABLE;
+    config.intr_type = GPIO_INTR_NEGEDGE;
+    esp_err_t err = gpio_config(&config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(LOG_TAG, "Could not configure GPIO %d: %s", _pin, esp_err_to_name(err));
+        return false;
+    }
+
+    // the service may already be installed by the application
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE)
+    {
+        ESP_LOGE(LOG_TAG, "Could not install GPIO ISR service: %s", esp_err_to_name(err));
+        return false;
+    }
+
+    err = gpio_isr_handler_add(_pin, isrHandler, this);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(LOG_TAG, "Could not add ISR for GPIO %d: %s", _pin, esp_err_to_name(err));
+        return false;
+    }
+    _installed = true;
+    return true;
+}
+
+void GpioIrqSource::end()
+{
+    if (_installed)
+    {
+        gpio_isr_handler_remove(_pin);
+        _installed = false;
+    }
+}
+
+void IRAM_ATTR GpioIrqSource::isrHandler(void *arg)
+{
+    GpioIrqSource *source = (GpioIrqSource*)arg;
+    if (source->signalFromIsr())
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+#endif
@@ -0,0 +1,244 @@
+#include <esp_log.h>
+#include "IsoDep.h"
+
+static const char* LOG_TAG = "ISO-DEP";
+
+// FSD and FSC in bytes for codes 0-8
+static const uint16_t FRAME_SIZES[9] = { 16, 24, 32, 40, 48, 64, 96, 128, 256 };
+
+IsoDep::IsoDep(NfcTransport *transport)
+{
+    _transport = transport;
+    _attempts = NFC_RETRY_ATTEMPTS;
+    reset();
+}
+
+void IsoDep::reset()
+{
+    _active = false;
+    _fsc = getFrameSize(ISO_DEP_DEFAULT_FSCI);
+    _fsd = getFrameSize(ISO_DEP_DEFAULT_FSCI);
+    _blockNumber = 0;
+}
+
+uint16_t IsoDep::getFrameSize(byte code)
+{
+    return FRAME_SIZES[code < 8 ? code : 8];
+}
+
+NfcTransport::Status IsoDep::activate()
+{
+    reset();
+
+    // the largest FSD the reader takes in one go, frame sizes in transceive() are a byte
+    uint16_t limit = _transport->getMaxFrameSize();
+    if (limit > 255)
+    {
+        limit = 255;
+    }
+    byte fsdi = 0;
+    while (fsdi < 8 && getFrameSize(fsdi + 1) <= limit)
+    {
+        fsdi++;
+    }
+
+    byte rats[2] = { ISO_DEP_CMD_RATS, (byte)(fsdi << 4) };
+    byte ats[255];
+    byte atsSize = getFrameSize(fsdi) < sizeof(ats) ? getFrameSize(fsdi) : sizeof(ats);
+    NfcTransport::Status status = _transport->transceive(rats, sizeof(rats), ats, &atsSize);
+    // TL counts itself, the ATS is followed by its CRC
+    if (status != NfcTransport::STATUS_OK || atsSize < 3 || ats[0] == 0 || ats[0] + 2 > atsSize)
+    {
+        ESP_LOGD(LOG_TAG, "No ATS - Status: %d", status);
+        return status == NfcTransport::STATUS_OK ? NfcTransport::STATUS_ERROR : status;
+    }
+
+    _fsd = getFrameSize(fsdi);
+    // T0 follows TL, FSCI is its low nibble
+    _fsc = getFrameSize(ats[0] > 1 ? ats[1] & 0x0F : ISO_DEP_DEFAULT_FSCI);
+    _active = true;
+    ESP_LOGD(LOG_TAG, "ATS, FSC %d, FSD %d", _fsc, _fsd);
+    ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, ats, ats[0], ESP_LOG_DEBUG);
+    return NfcTransport::STATUS_OK;
+}
+
+bool IsoDep::isActive()
+{
+    return _active;
+}
+
+NfcTransport::Status IsoDep::transceive(const byte *command, uint16_t commandLength, byte *response, uint16_t *responseLength)
+{
+    if (!_active)
+    {
+        return NfcTransport::STATUS_INVALID;
+    }
+
+    byte frame[ISO_DEP_MAX_FRAME];
+    byte answer[ISO_DEP_MAX_FRAME];
+    uint16_t answerSize;
+    uint16_t chunkSize = getSendFrameSize() - ISO_DEP_FRAME_OVERHEAD;
+    uint16_t sent = 0;
+    NfcTransport::Status status;
+
+    // the command in I-blocks, the tag acknowledges each chained one with R(ACK)
+    do
+    {
+        uint16_t chunk = commandLength - sent < chunkSize ? commandLength - sent : chunkSize;
+        bool chaining = sent + chunk < commandLength;
+        frame[0] = ISO_DEP_PCB_I_BLOCK | _blockNumber | (chaining ? ISO_DEP_PCB_CHAINING : 0);
+        memcpy(&frame[1], &command[sent], chunk);
+        answerSize = _fsd;
+        status = exchange(frame, chunk + 1, answer, &answerSize);
+        if (status != NfcTransport::STATUS_OK)
+        {
+            return status;
+        }
+        sent += chunk;
+        if (chaining)
+        {
+            if ((answer[0] & ISO_DEP_PCB_R_MASK) != ISO_DEP_PCB_R_ACK)
+            {
+                ESP_LOGD(LOG_TAG, "Chained block not acknowledged, PCB %02X", answer[0]);
+                return NfcTransport::STATUS_ERROR;
+            }
+            _blockNumber ^= 1;
+        }
+    } while (sent < commandLength);
+
+    // the response in I-blocks, each chained one acknowledged with R(ACK)
+    uint16_t received = 0;
+    while (true)
+    {
+        if ((answer[0] & ISO_DEP_PCB_I_MASK) != ISO_DEP_PCB_I_BLOCK)
+        {
+            ESP_LOGD(LOG_TAG, "Expected an I-block, PCB %02X", answer[0]);
+            return NfcTransport::STATUS_ERROR;
+        }
+        _blockNumber ^= 1;
+        if (received + answerSize - 1 > *responseLength)
+        {
+            return NfcTransport::STATUS_NO_ROOM;
+        }
+        memcpy(&response[received], &answer[1], answerSize - 1);
+        received += answerSize - 1;
+        if ((answer[0] & ISO_DEP_PCB_CHAINING) == 0)
+        {
+            break;
+        }
+
+        byte ack = ISO_DEP_PCB_R_ACK | _blockNumber;
+        answerSize = _fsd;
+        status = exchange(&ack, 1, answer, &answerSize);
+        if (status != NfcTransport::STATUS_OK)
+        {
+            return status;
+        }
+    }
+    *responseLength = received;
+    return NfcTransport::STATUS_OK;
+}
+
+// One block sent and one received, without its CRC. A block lost either way is
+// recovered as ISO/IEC 14443-4 asks: R(NAK) makes the tag send its last block
+// again, or R(ACK) with the other block number if our block never reached it,
+// and then ours is sent again. S(WTX) is confirmed until the answer comes.
+NfcTransport::Status IsoDep::exchange(const byte *frame, uint16_t frameSize, byte *response, uint16_t *responseSize)
+{
+    byte nak = ISO_DEP_PCB_R_NAK | _blockNumber;
+    byte wtx[2] = { ISO_DEP_PCB_S_WTX, 0 };
+    const byte *sent = frame;
+    uint16_t sentSize = frameSize;
+    uint8_t attempts = 1;
+    while (true)
+    {
+        byte received = *responseSize > 255 ? 255 : *responseSize;
+        NfcTransport::Status status = _transport->transceive(sent, sentSize, response, &received);
+        if (status == NfcTransport::STATUS_OK && received >= 3)
+        {
+            received -= 2;
+            if ((response[0] & ISO_DEP_PCB_S_MASK) == ISO_DEP_PCB_S_WTX && received >= 2)
+            {
+                // the tag needs more time, the same WTXM grants it
+                wtx[1] = response[1] & 0x3F;
+                sent = wtx;
+                sentSize = sizeof(wtx);
+                continue;
+            }
+            if ((response[0] & ISO_DEP_PCB_R_MASK) != ISO_DEP_PCB_R_ACK || (response[0] & 0x01) == _blockNumber)
+            {
+                *responseSize = received;
+                return NfcTransport::STATUS_OK;
+            }
+            ESP_LOGD(LOG_TAG, "Block %d not received by the tag, sending it again", _blockNumber);
+            sent = frame;
+            sentSize = frameSize;
+            status = NfcTransport::STATUS_ERROR;
+        }
+        else
+        {
+            ESP_LOGD(LOG_TAG, "Block %d lost - Status: %d", _blockNumber, status);
+            sent = &nak;
+            sentSize = 1;
+        }
+
+        if (attempts++ >= _attempts)
+        {
+            return status == NfcTransport::STATUS_OK ? NfcTransport::STATUS_ERROR : status;
+        }
+    }
+}
+
+NfcTransport::Status IsoDep::deselect()
+{
+    if (!_active)
+    {
+        return NfcTransport::STATUS_OK;
+    }
+    byte command = ISO_DEP_PCB_S_DESELECT;
+    byte answer[3];
+    byte answerSize = sizeof(answer);
+    NfcTransport::Status status = _transport->transceive(&command, 1, answer, &answerSize);
+    _active = false;
+    return status;
+}
+
+// R(NAK) with the next block number is answered R(ACK), the last block isn't
+// sent again and the chaining state is left as it was
+bool IsoDep::isPresent()
+{
+    if (!_active)
+    {
+        return false;
+    }
+    byte nak = ISO_DEP_PCB_R_NAK | _blockNumber;
+    byte answer[ISO_DEP_MAX_FRAME];
+    byte answerSize = _fsd > 255 ? 255 : _fsd;
+    NfcTransport::Status status = _transport->transceive(&nak, 1, answer, &answerSize);
+    if (status != NfcTransport::STATUS_OK || answerSize < 3)
+    {
+        ESP_LOGD(LOG_TAG, "Tag gone - Status: %d", status);
+        return false;
+    }
+    return true;
+}
+
+uint16_t IsoDep::getSendFrameSize()
+{
+    uint16_t limit = _transport->getMaxFrameSize();
+    if (limit > 255)
+    {
+        limit = 255;
+    }
+    return _fsc < limit ? _fsc : limit;
+}
+
+uint16_t IsoDep::getReceiveFrameSize()
+{
+    return _fsd;
+}
+
+void IsoDep::setRetryPolicy(const NfcRetryPolicy& policy)
+{
+    _attempts = policy.attempts > 0 ? policy.attempts : 1;
+}
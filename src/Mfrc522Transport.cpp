@@ -0,0 +1,140 @@
+#include <sdkconfig.h>
+#if !CONFIG_IDF_TARGET_LINUX
+#include "Mfrc522Transport.h"
+
+Mfrc522Transport::Mfrc522Transport(MFRC522 *shield)
+{
+    _shield = shield;
+    memset(&uid, 0, sizeof(uid));
+}
+
+bool Mfrc522Transport::isNewCardPresent()
+{
+    return _shield->PICC_IsNewCardPresent();
+}
+
+NfcTransport::Status Mfrc522Transport::wakeupA()
+{
+    byte atqa[2];
+    byte atqaSize = sizeof(atqa);
+    return (Status)_shield->PICC_WakeupA(atqa, &atqaSize);
+}
+
+bool Mfrc522Transport::readCardSerial()
+{
+    bool selected = _shield->PICC_ReadCardSerial();
+    copyUid();
+    return selected;
+}
+
+NfcTransport::Status Mfrc522Transport::select(Uid *tagUid)
+{
+    MFRC522::Uid selectUid;
+    selectUid.size = tagUid->size;
+    memcpy(selectUid.uidByte, tagUid->uidByte, tagUid->size);
+    selectUid.sak = tagUid->sak;
+    Status status = (Status)_shield->PICC_Select(&selectUid, tagUid->size * 8);
+    tagUid->sak = selectUid.sak;
+    _shield->uid = selectUid;
+    copyUid();
+    return status;
+}
+
+NfcTransport::Status Mfrc522Transport::haltA()
+{
+    return (Status)_shield->PICC_HaltA();
+}
+
+NfcTransport::Status Mfrc522Transport::authenticate(bool keyB, byte block, const byte *key)
+{
+    MFRC522::MIFARE_Key mifareKey;
+    memcpy(mifareKey.keyByte, key, MFRC522::MF_KEY_SIZE);
+    byte command = keyB ? MFRC522::PICC_CMD_MF_AUTH_KEY_B : MFRC522::PICC_CMD_MF_AUTH_KEY_A;
+    return (Status)_shield->PCD_Authenticate(command, block, &mifareKey, &(_shield->uid));
+}
+
+void Mfrc522Transport::stopCrypto1()
+{
+    _shield->PCD_StopCrypto1();
+}
+
+NfcTransport::Status Mfrc522Transport::mifareRead(byte block, byte *buffer, byte *bufferSize)
+{
+    return (Status)_shield->MIFARE_Read(block, buffer, bufferSize);
+}
+
+NfcTransport::Status Mfrc522Transport::mifareWrite(byte block, const byte *data)
+{
+    byte buffer[16];
+    memcpy(buffer, data, sizeof(buffer));
+    return (Status)_shield->MIFARE_Write(block, buffer, sizeof(buffer));
+}
+
+NfcTransport::Status Mfrc522Transport::ultralightWrite(byte page, const byte *data)
+{
+    byte buffer[4];
+    memcpy(buffer, data, sizeof(buffer));
+    return (Status)_shield->MIFARE_Ultralight_Write(page, buffer, sizeof(buffer));
+}
+
+NfcTransport::Status Mfrc522Transport::transceive(const byte *command, byte commandSize, byte *response, byte *responseSize)
+{
+    // ISO-DEP blocks fill the FIFO
+    byte frame[NFC_TRANSPORT_MAX_FRAME];
+    if (commandSize + 2 > (int)sizeof(frame))
+    {
+        return STATUS_NO_ROOM;
+    }
+    memcpy(frame, command, commandSize);
+    MFRC522::StatusCode status = _shield->PCD_CalculateCRC(frame, commandSize, &frame[commandSize]);
+    if (status != MFRC522::STATUS_OK)
+    {
+        return (Status)status;
+    }
+    return (Status)_shield->PCD_TransceiveData(frame, commandSize + 2, response, responseSize, NULL, 0, true);
+}
+
+// Instead of a full REQA and anticollision, the reader is left waiting for the
+// answer to a bare REQA
+void Mfrc522Transport::armCardDetect()
+{
+    _shield->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    _shield->PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+    _shield->PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80);
+    _shield->PCD_WriteRegister(MFRC522::FIFODataReg, MFRC522::PICC_CMD_REQA);
+    _shield->PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+    // StartSend, REQA is a short frame of 7 bits
+    _shield->PCD_WriteRegister(MFRC522::BitFramingReg, 0x87);
+}
+
+void Mfrc522Transport::enableCardDetectIrq(bool enable)
+{
+    if (enable)
+    {
+        // IRQ pin active low, raised by RxIRq only
+        _shield->PCD_WriteRegister(MFRC522::ComIEnReg, 0xA0);
+    }
+    else
+    {
+        _shield->PCD_WriteRegister(MFRC522::ComIEnReg, 0x80);
+        _shield->PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+    }
+}
+
+void Mfrc522Transport::dumpVersion()
+{
+    _shield->PCD_DumpVersionToSerial();
+}
+
+MFRC522* Mfrc522Transport::getShield()
+{
+    return _shield;
+}
+
+void Mfrc522Transport::copyUid()
+{
+    uid.size = _shield->uid.size <= TAG_MAX_UID_SIZE ? _shield->uid.size : TAG_MAX_UID_SIZE;
+    memcpy(uid.uidByte, _shield->uid.uidByte, uid.size);
+    uid.sak = _shield->uid.sak;
+}
+#endif
@@ -4,178 +4,460 @@
 
 static const char* LOG_TAG = "Mifare Classic";
 
-MifareClassic::MifareClassic(MFRC522 *nfcShield)
+// NFC Forum public key A for NDEF sectors, for the MAD sector, and the transport key
+static const byte NDEF_KEY[MIFARE_KEY_SIZE] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7};
+static const byte MAD_KEY[MIFARE_KEY_SIZE] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5};
+static const byte DEFAULT_KEY[MIFARE_KEY_SIZE] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+MifareClassic::MifareClassic(NfcTransport *transport, TagInfo *info) : _storage(this)
 {
-  _nfcShield = nfcShield;
+  _nfcShield = transport;
+  memcpy(_key, NDEF_KEY, MIFARE_KEY_SIZE);
+  reset(info);
 }
 
 MifareClassic::~MifareClassic()
 {
 }
 
-NfcTag MifareClassic::read()
+void MifareClassic::reset(TagInfo *info)
+{
+    invalidate(info);
+    _status = NfcStatus();
+}
+
+void MifareClassic::invalidate(TagInfo *info)
+{
+    _info = info;
+    _authenticatedSector = -1;
+    _mapped = false;
+    _storage.invalidate();
+}
+
+NfcTag MifareClassic::read(byte *buffer, uint16_t bufferSize)
 {
-    MFRC522::MIFARE_Key key = {{0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7}};
-    int messageStartIndex = 0;
-    int messageLength = 0;
-    byte dataSize = BLOCK_SIZE + 2;
-    byte data[dataSize];
+    _status = NfcStatus();
+    // sector 1 only authenticates with the NDEF key when the tag is NDEF formatted
+    if (!authenticate(4))
+    {
+        ESP_LOGI(LOG_TAG, "Tag is not NDEF formatted.");
+        _status.set(NfcStatus::ERROR_NOT_FORMATTED, NfcStatus::OPERATION_AUTHENTICATE, 4, _status.getTransportStatus());
+        setFormatted(false);
+        return NfcTag(_nfcShield->uid.uidByte, _nfcShield->uid.size, NfcTag::TYPE_MIFARE_CLASSIC, false);
+    }
 
-    // read first block to get message length
-    if (_nfcShield->PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, 4, &key, &(_nfcShield->uid)) == MFRC522::STATUS_OK)
+    if (!mapDataArea() || !_map.hasNdefTlv())
     {
-        if(_nfcShield->MIFARE_Read(4, data, &dataSize) != MFRC522::STATUS_OK)
+        ESP_LOGE(LOG_TAG, "Error. Could not decode TLV");
+        if (_status.ok())
         {
-            ESP_LOGE(LOG_TAG, "Error. Failed read block 4");
-            return NfcTag(_nfcShield->uid.uidByte, _nfcShield->uid.size, NfcTag::TYPE_MIFARE_CLASSIC);
+            _status.set(NfcStatus::ERROR_BAD_TLV, NfcStatus::OPERATION_READ);
         }
+        return NfcTag(_nfcShield->uid.uidByte, _nfcShield->uid.size, NfcTag::TYPE_UNKNOWN); // TODO should the error message go in NfcTag?
+    }
 
-        if (!decodeTlv(data, &messageLength, &messageStartIndex))
+    int messageLength = _map.getNdefLength();
+    ESP_LOGD(LOG_TAG, "Message Length %d", messageLength);
+
+    // the message is read straight into the tag, or the caller's buffer when it's larger
+    NfcTag tag(_nfcShield->uid.uidByte, _nfcShield->uid.size, NfcTag::TYPE_MIFARE_CLASSIC);
+    byte *data = tag.allocateNdef(messageLength, buffer, bufferSize);
+    if (data == NULL)
+    {
+        ESP_LOGE(LOG_TAG, "Error. Message of %d bytes needs a buffer", messageLength);
+        _status.set(NfcStatus::ERROR_TOO_LARGE, NfcStatus::OPERATION_READ);
+        return tag;
+    }
+    if (messageLength > 0 && !NdefTlv::readValue(_storage, _map, data))
+    {
+        if (_status.ok())
         {
-            ESP_LOGE(LOG_TAG, "Error. Could not decode TLV");
-            return NfcTag(_nfcShield->uid.uidByte, _nfcShield->uid.size, NfcTag::TYPE_UNKNOWN); // TODO should the error message go in NfcTag?
+            _status.set(NfcStatus::ERROR_BAD_TLV, NfcStatus::OPERATION_READ);
         }
+        // TODO Nicer error handling
+        return NfcTag(_nfcShield->uid.uidByte, _nfcShield->uid.size, NfcTag::TYPE_MIFARE_CLASSIC);
     }
-    else
+
+    return tag;
+}
+
+bool MifareClassic::indexRecords(NdefRecordIndex& index)
+{
+    _status = NfcStatus();
+    index.reset();
+    if (!authenticate(4))
     {
         ESP_LOGI(LOG_TAG, "Tag is not NDEF formatted.");
-        return NfcTag(_nfcShield->uid.uidByte, _nfcShield->uid.size, NfcTag::TYPE_MIFARE_CLASSIC, false);
+        _status.set(NfcStatus::ERROR_NOT_FORMATTED, NfcStatus::OPERATION_AUTHENTICATE, 4, _status.getTransportStatus());
+        setFormatted(false);
+        return false;
     }
 
-    int currentBlock = 4;
-    // this should be nested in the message length loop
-    int index = 0;
-    // Add 2 to allow MFRC522 to add CRC
-    int bufferSize = getBufferSize(messageLength) + 2;
-    uint8_t buffer[bufferSize];
+    if (!mapDataArea() || !_map.hasNdefTlv() || !NdefTlv::indexRecords(_storage, _map, index))
+    {
+        ESP_LOGE(LOG_TAG, "Error. Could not index the records");
+        if (_status.ok())
+        {
+            _status.set(NfcStatus::ERROR_BAD_TLV, NfcStatus::OPERATION_READ);
+        }
+        return false;
+    }
 
-    ESP_LOGD(LOG_TAG, "Message Length %d", messageLength);
-    ESP_LOGD(LOG_TAG, "Buffer Size %d", bufferSize);
+    for (uint8_t i = 0; i < index.entryCount; i++)
+    {
+        index.entries[i].firstUnit = getDataBlock(index.entries[i].firstUnit);
+        index.entries[i].lastUnit = getDataBlock(index.entries[i].lastUnit);
+    }
+    index.setUid(_nfcShield->uid.uidByte, _nfcShield->uid.size);
+    return true;
+}
 
-    while (index < bufferSize-2)
+// Only the blocks of the payload are read, and only their sectors authenticated.
+// A new selection maps the data area again, from the first data block.
+bool MifareClassic::readPayload(const NdefRecordIndex& index, uint8_t entry, byte *data, uint16_t dataSize)
+{
+    _status = NfcStatus();
+    if (entry >= index.entryCount)
+    {
+        ESP_LOGE(LOG_TAG, "Error. The index has no entry %d", entry);
+        _status.set(NfcStatus::ERROR_STALE_INDEX, NfcStatus::OPERATION_READ);
+        return false;
+    }
+    if (!index.isOf(_nfcShield->uid.uidByte, _nfcShield->uid.size))
+    {
+        ESP_LOGI(LOG_TAG, "The index is of another tag");
+        _status.set(NfcStatus::ERROR_STALE_INDEX, NfcStatus::OPERATION_READ);
+        return false;
+    }
+    const NdefRecordIndex::Entry& record = index.entries[entry];
+    if (record.payloadLength > dataSize)
     {
+        ESP_LOGE(LOG_TAG, "Error. Payload of %d bytes needs a larger buffer", record.payloadLength);
+        _status.set(NfcStatus::ERROR_TOO_LARGE, NfcStatus::OPERATION_READ);
+        return false;
+    }
 
-        // authenticate on every sector
-        if (((currentBlock < 128) && (currentBlock % 4 == 0)) || ((currentBlock >= 128) && (currentBlock % 16 == 0)))
+    if (!_mapped && (!mapDataArea() || !_map.hasNdefTlv()))
+    {
+        if (_status.ok())
         {
+            _status.set(NfcStatus::ERROR_BAD_TLV, NfcStatus::OPERATION_READ);
+        }
+        return false;
+    }
+    if (_map.getNdefValueOffset() != index.valueOffset || _map.getNdefLength() != index.messageLength)
+    {
+        ESP_LOGI(LOG_TAG, "The message changed since it was indexed");
+        _status.set(NfcStatus::ERROR_STALE_INDEX, NfcStatus::OPERATION_READ);
+        return false;
+    }
 
-            if (_nfcShield->PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, currentBlock, &key, &(_nfcShield->uid)) != MFRC522::STATUS_OK)
-            {
-                ESP_LOGE(LOG_TAG, "Error. Block Authentication failed for %d", currentBlock);
-                // TODO Nicer error handling
-                return NfcTag(_nfcShield->uid.uidByte, _nfcShield->uid.size, NfcTag::TYPE_MIFARE_CLASSIC);
-            }
+    if (!NdefTlv::readValue(_storage, _map, record.payloadOffset, data, record.payloadLength))
+    {
+        if (_status.ok())
+        {
+            _status.set(NfcStatus::ERROR_BAD_TLV, NfcStatus::OPERATION_READ);
+        }
+        return false;
+    }
+    // after the payload, the header is mostly in the block just read or the one before
+    if (!NdefTlv::matchesHeader(_storage, _map, record))
+    {
+        if (_status.ok())
+        {
+            ESP_LOGI(LOG_TAG, "The record changed since it was indexed");
+            _status.set(NfcStatus::ERROR_STALE_INDEX, NfcStatus::OPERATION_READ);
         }
+        return false;
+    }
+    return true;
+}
+
+int MifareClassic::getDataBlock(int index)
+{
+    // 3 data blocks per sector, sector 0 holds the MAD
+    return (index / 3 + 1) * 4 + index % 3;
+}
+
+bool MifareClassic::authenticate(int block)
+{
+    int sector = block < 128 ? block / 4 : 32 + (block - 128) / 16;
+    if (sector == _authenticatedSector)
+    {
+        return true;
+    }
 
-        // read the data
-        byte readBufferSize = 18;
-        if(_nfcShield->MIFARE_Read(currentBlock, &buffer[index], &readBufferSize) == MFRC522::STATUS_OK)
+    NfcTransport::Status status = _nfcShield->authenticate(false, block, _key);
+    if (status != NfcTransport::STATUS_OK)
+    {
+        ESP_LOGE(LOG_TAG, "Error. Block authentication failed for block %d: %s", block, NfcTransport::getStatusName(status));
+        _status.set(NfcStatus::ERROR_AUTHENTICATION, NfcStatus::OPERATION_AUTHENTICATE, block, status);
+        _authenticatedSector = -1;
+        return false;
+    }
+    _authenticatedSector = sector;
+    return true;
+}
+
+// A block of the authenticated sector is read in one exchange. Otherwise the
+// tag can't be read, it is halted, woken and selected by UID instead, and a
+// removed tag is known when WUPA gets no answer.
+bool MifareClassic::isPresent()
+{
+    if (_authenticatedSector > 0 && _authenticatedSector < 32)
+    {
+        byte buffer[BLOCK_SIZE + 2];
+        byte bufferSize = sizeof(buffer);
+        NfcTransport::Status status = _nfcShield->mifareRead(_authenticatedSector * 4, buffer, &bufferSize);
+        if (status != NfcTransport::STATUS_OK)
         {
-            ESP_LOGD(LOG_TAG, "Block %d:", currentBlock);
-            ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, &buffer[index], BLOCK_SIZE, ESP_LOG_DEBUG);
+            ESP_LOGD(LOG_TAG, "Tag gone - Status: %d", status);
+            _authenticatedSector = -1;
+            return false;
         }
-        else
+        return true;
+    }
+    return reselect();
+}
+
+bool MifareClassic::reselect()
+{
+    _nfcShield->haltA();
+    _nfcShield->stopCrypto1();
+    _authenticatedSector = -1;
+
+    NfcTransport::Status status = _nfcShield->wakeupA();
+    if (status != NfcTransport::STATUS_OK)
+    {
+        ESP_LOGD(LOG_TAG, "Tag gone - Status: %d", status);
+        return false;
+    }
+
+    // selecting with all UID bits only answers if it is the same tag
+    status = _nfcShield->select(&(_nfcShield->uid));
+    if (status != NfcTransport::STATUS_OK)
+    {
+        ESP_LOGD(LOG_TAG, "Could not reselect tag - Status: %d", status);
+        return false;
+    }
+    return true;
+}
+
+bool MifareClassic::readBlock(int block, byte *data)
+{
+    NfcRetry retry(_retryPolicy, _nfcShield, true);
+    while (!readBlockOnce(block, data))
+    {
+        if (!recover(retry))
         {
-            ESP_LOGE(LOG_TAG, "Read failed %d", currentBlock);
-            // TODO Nicer error handling
-            return NfcTag(_nfcShield->uid.uidByte, _nfcShield->uid.size, NfcTag::TYPE_MIFARE_CLASSIC);
+            return false;
         }
+    }
+    if (!_status.ok())
+    {
+        _status.clearError();
+    }
+
+    ESP_LOGD(LOG_TAG, "Block %d:", block);
+    ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, data, BLOCK_SIZE, ESP_LOG_DEBUG);
+    return true;
+}
+
+bool MifareClassic::readBlockOnce(int block, byte *data)
+{
+    if (!authenticate(block))
+    {
+        return false;
+    }
 
-        index += BLOCK_SIZE;
-        currentBlock++;
+    // Add 2 for the CRC the reader leaves after the data
+    byte buffer[BLOCK_SIZE + 2];
+    byte bufferSize = sizeof(buffer);
+    NfcTransport::Status status = _nfcShield->mifareRead(block, buffer, &bufferSize);
+    if (status != NfcTransport::STATUS_OK)
+    {
+        ESP_LOGD(LOG_TAG, "Read failed %d", block);
+        _status.setTransport(status, NfcStatus::OPERATION_READ, block);
+        return false;
+    }
+    memcpy(data, buffer, BLOCK_SIZE);
+    return true;
+}
 
-        // skip the trailer block
-        if (((currentBlock < 128) && ((currentBlock+1) % 4 == 0)) || ((currentBlock >= 128) && ((currentBlock+1) % 16 == 0)))
+bool MifareClassic::writeBlock(int block, byte *data)
+{
+    NfcRetry retry(_retryPolicy, _nfcShield, true);
+    while (!writeBlockOnce(block, data))
+    {
+        if (!recover(retry))
         {
-            ESP_LOGD(LOG_TAG, "Skipping block %d", currentBlock);
-            currentBlock++;
+            return false;
         }
     }
+    if (!_status.ok())
+    {
+        _status.clearError();
+    }
 
-    return NfcTag(_nfcShield->uid.uidByte, _nfcShield->uid.size, NfcTag::TYPE_MIFARE_CLASSIC, &buffer[messageStartIndex], messageLength);
+    ESP_LOGD(LOG_TAG, "Wrote block %d:", block);
+    ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, data, BLOCK_SIZE, ESP_LOG_DEBUG);
+    return true;
 }
 
-int MifareClassic::getBufferSize(int messageLength)
+bool MifareClassic::writeBlockOnce(int block, byte *data)
 {
+    if (!authenticate(block))
+    {
+        return false;
+    }
 
-    int bufferSize = messageLength;
+    NfcTransport::Status status = _nfcShield->mifareWrite(block, data);
+    if (status != NfcTransport::STATUS_OK)
+    {
+        ESP_LOGD(LOG_TAG, "Write failed %d", block);
+        _status.setTransport(status, NfcStatus::OPERATION_WRITE, block);
+        return false;
+    }
+    return true;
+}
 
-    // TLV header is 2 or 4 bytes, TLV terminator is 1 byte.
-    if (messageLength < 0xFF)
+// Any error ends the Crypto1 session, so a block is only tried again after
+// the tag is selected and its sector authenticated again.
+bool MifareClassic::recover(NfcRetry& retry)
+{
+    if (retry.next(_status) == NfcRetry::ACTION_GIVE_UP)
     {
-        bufferSize += SHORT_TLV_SIZE + 1;
+        ESP_LOGE(LOG_TAG, "Error. Block %d: %s after %d retries", _status.getAddress(),
+            NfcStatus::getErrorName(_status.getError()), _status.getRetries());
+        return false;
     }
-    else
+    if (!reselect())
     {
-        bufferSize += LONG_TLV_SIZE + 1;
+        _status.set(NfcStatus::ERROR_TAG_LOST, NfcStatus::OPERATION_SELECT, _status.getAddress());
+        return false;
     }
+    return true;
+}
+
+NfcStatus MifareClassic::getStatus()
+{
+    return _status;
+}
+
+void MifareClassic::setRetryPolicy(const NfcRetryPolicy& policy)
+{
+    _retryPolicy = policy;
+}
 
-    // bufferSize needs to be a multiple of BLOCK_SIZE
-    if (bufferSize % BLOCK_SIZE != 0)
+bool MifareClassic::mapDataArea()
+{
+    _mapped = false;
+    _map.reset(0, CLASSIC_1K_DATA_BLOCKS * BLOCK_SIZE);
+    if (!NdefTlv::parse(_storage, _map))
     {
-        bufferSize = ((bufferSize / BLOCK_SIZE) + 1) * BLOCK_SIZE;
+        return false;
     }
 
-    return bufferSize;
+    _mapped = true;
+    setFormatted(true);
+    if (_info != NULL)
+    {
+        _info->map = _map;
+        _info->mapped = true;
+    }
+    return true;
 }
 
-// skip null tlvs (0x0) before the real message
-// technically unlimited null tlvs, but we assume
-// T & L of TLV in the first block we read
-int MifareClassic::getNdefStartIndex(byte *data)
+// A cached map is used when the block holding the NDEF TLV still has its type
+// and length there, or the terminator a new TLV replaces, so a tag rewritten
+// elsewhere or given another tag's layout is mapped again. On a tag with the
+// NDEF TLV first that is the one block read the walk takes, the cache only
+// saves reads when other TLVs come before it.
+bool MifareClassic::loadCachedMap()
 {
+    if (_info == NULL || !_info->mapped)
+    {
+        return false;
+    }
 
-    for (int i = 0; i < BLOCK_SIZE; i++)
+    TlvMap& map = _info->map;
+    uint16_t tlvOffset = map.getNdefTlvOffset();
+    // the Classic data area has no reserved areas, the header is contiguous
+    uint8_t headerSize = map.hasNdefTlv() ? map.getNdefValueOffset() - tlvOffset : 1;
+    byte header[LONG_TLV_SIZE];
+    bool valid = true;
+    if (tlvOffset < map.getDataAreaSize())
     {
-        if (data[i] == 0x0)
+        if (headerSize > sizeof(header) || tlvOffset + headerSize > map.getDataAreaSize() ||
+            !_storage.read(tlvOffset, header, headerSize))
         {
-            // do nothing, skip
+            ESP_LOGD(LOG_TAG, "Could not validate cached map");
+            _info->mapped = false;
+            return false;
         }
-        else if (data[i] == 0x3)
+
+        if (!map.hasNdefTlv())
         {
-            return i;
+            valid = header[0] == TLV_TERMINATOR;
+        }
+        else if (headerSize == SHORT_TLV_SIZE)
+        {
+            valid = header[0] == TLV_NDEF && header[1] == map.getNdefLength();
         }
         else
         {
-            ESP_LOGI(LOG_TAG, "Unknown TLV %x", data[i]);
-            return -2;
+            valid = header[0] == TLV_NDEF && header[1] == 0xFF && ((header[2] << 8) | header[3]) == map.getNdefLength();
         }
     }
+    if (!valid)
+    {
+        ESP_LOGD(LOG_TAG, "Cached map is stale");
+        _info->mapped = false;
+        return false;
+    }
 
-    return -1;
+    _map = map;
+    _mapped = true;
+    return true;
 }
 
-// Decode the NDEF data length from the Mifare TLV
-// Leading null TLVs (0x0) are skipped
-// Assuming T & L of TLV will be in the first block
-// messageLength and messageStartIndex written to the parameters
-// success or failure status is returned
-//
-// { 0x3, LENGTH }
-// { 0x3, 0xFF, LENGTH, LENGTH }
-bool MifareClassic::decodeTlv(byte *data, int *messageLength, int *messageStartIndex)
+void MifareClassic::setFormatted(bool formatted)
 {
-    int i = getNdefStartIndex(data);
+    if (_info == NULL)
+    {
+        return;
+    }
 
-    if (i < 0 || data[i] != 0x3)
+    _info->tagType = NfcTag::TYPE_MIFARE_CLASSIC;
+    _info->identified = true;
+    _info->dataAreaSize = CLASSIC_1K_DATA_BLOCKS * BLOCK_SIZE;
+    _info->formatted = formatted;
+    if (!formatted)
     {
-        ESP_LOGE(LOG_TAG, "Error. Can't decode message length.");
-        return false;
+        _info->mapped = false;
     }
-    else
+}
+
+// formatting talks to the reader directly, failures are recorded but not retried
+bool MifareClassic::formatAuthenticate(bool keyB, int block, const byte *key)
+{
+    NfcTransport::Status status = _nfcShield->authenticate(keyB, block, key);
+    if (status != NfcTransport::STATUS_OK)
     {
-        if (data[i+1] == 0xFF)
-        {
-            *messageLength = ((0xFF & data[i+2]) << 8) | (0xFF & data[i+3]);
-            *messageStartIndex = i + LONG_TLV_SIZE;
-        }
-        else
-        {
-            *messageLength = data[i+1];
-            *messageStartIndex = i + SHORT_TLV_SIZE;
-        }
+        _status.set(NfcStatus::ERROR_AUTHENTICATION, NfcStatus::OPERATION_AUTHENTICATE, block, status);
+        return false;
     }
+    return true;
+}
 
+bool MifareClassic::formatWrite(int block, const byte *data)
+{
+    NfcTransport::Status status = _nfcShield->mifareWrite(block, data);
+    if (status != NfcTransport::STATUS_OK)
+    {
+        _status.setTransport(status, NfcStatus::OPERATION_WRITE, block);
+        return false;
+    }
     return true;
 }
 
@@ -183,7 +465,14 @@ bool MifareClassic::decodeTlv(byte *data, int *messageLength, int *messageStartI
 // We are formatting in read/write mode with a NDEF TLV 03 03 and an empty NDEF record D0 00 00 FE - AN1304 6.3.2
 bool MifareClassic::formatNDEF()
 {
-    MFRC522::MIFARE_Key keya = {{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}};
+    _status = NfcStatus();
+    // sectors are authenticated with the transport key below
+    _authenticatedSector = -1;
+    // the data area is rewritten, it is mapped again on the next read or write
+    setFormatted(false);
+    _mapped = false;
+    _storage.invalidate();
+    byte keya[MIFARE_KEY_SIZE] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
     byte emptyNdefMesg[16] = {0x03, 0x03, 0xD0, 0x00, 0x00, 0xFE, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
     byte blockbuffer0[16] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
     byte blockbuffer1[16] = {0x14, 0x01, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
@@ -192,31 +481,31 @@ bool MifareClassic::formatNDEF()
     byte blockbuffer4[16] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7, 0x7F, 0x07, 0x88, 0x40, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
     // TODO use UID from method parameters?
-    if (_nfcShield->PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, 1, &keya, &(_nfcShield->uid)) != MFRC522::STATUS_OK)
+    if (!formatAuthenticate(false, 1, keya))
     {
         ESP_LOGE(LOG_TAG, "Unable to authenticate block 1 to enable card formatting!");
         return false;
     }
 
-    if (_nfcShield->MIFARE_Write(1, blockbuffer1, 16) != MFRC522::STATUS_OK)
+    if (!formatWrite(1, blockbuffer1))
     {
         ESP_LOGE(LOG_TAG, "Unable to format the card for NDEF: Block 1 failed");
         return false;
     }
 
-    if (_nfcShield->MIFARE_Write(2, blockbuffer2, 16) != MFRC522::STATUS_OK)
+    if (!formatWrite(2, blockbuffer2))
     {
         ESP_LOGE(LOG_TAG, "Unable to format the card for NDEF: Block 2 failed");
         return false;
     }
     // Write new key A and permissions
-    if (_nfcShield->MIFARE_Write(3, blockbuffer3, 16) != MFRC522::STATUS_OK)
+    if (!formatWrite(3, blockbuffer3))
     {
         ESP_LOGE(LOG_TAG, "Unable to format the card for NDEF: Block 3 failed");
         return false;
     }
     for (int i=4; i<64; i+=4) {
-        if (_nfcShield->PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, i, &keya, &(_nfcShield->uid)) != MFRC522::STATUS_OK)
+        if (!formatAuthenticate(false, i, keya))
         {
             ESP_LOGE(LOG_TAG, "Unable to authenticate block %d", i);
             return false;
@@ -224,7 +513,7 @@ bool MifareClassic::formatNDEF()
 
         if (i == 4)  // special handling for block 4
         {
-            if (_nfcShield->MIFARE_Write(i, emptyNdefMesg, 16) != MFRC522::STATUS_OK)
+            if (!formatWrite(i, emptyNdefMesg))
             {
                 ESP_LOGE(LOG_TAG, "Unable to write block %d", i);
                 return false;
@@ -232,23 +521,23 @@ bool MifareClassic::formatNDEF()
         }
         else
         {
-            if (_nfcShield->MIFARE_Write(i, blockbuffer0, 16) != MFRC522::STATUS_OK)
+            if (!formatWrite(i, blockbuffer0))
             {
                 ESP_LOGE(LOG_TAG, "Unable to write block %d", i);
                 return false;
             }
         }
-        if (_nfcShield->MIFARE_Write(i+1, blockbuffer0, 16) != MFRC522::STATUS_OK)
+        if (!formatWrite(i+1, blockbuffer0))
         {
             ESP_LOGE(LOG_TAG, "Unable to write block %d", i+1);
             return false;
         }
-        if (_nfcShield->MIFARE_Write(i+2, blockbuffer0, 16) != MFRC522::STATUS_OK)
+        if (!formatWrite(i+2, blockbuffer0))
         {
             ESP_LOGE(LOG_TAG, "Unable to write block %d", i+2);
             return false;
         }
-        if (_nfcShield->MIFARE_Write(i+3, blockbuffer4, 16) != MFRC522::STATUS_OK)
+        if (!formatWrite(i+3, blockbuffer4))
         {
             ESP_LOGE(LOG_TAG, "Unable to write block %d", i+3);
             return false;
@@ -269,9 +558,14 @@ bool MifareClassic::formatNDEF()
 
 bool MifareClassic::formatMifare()
 {
+    _status = NfcStatus();
+    _authenticatedSector = -1;
+    setFormatted(false);
+    _mapped = false;
+    _storage.invalidate();
 
     // The default Mifare Classic key
-    MFRC522::MIFARE_Key KEY_DEFAULT_KEYAB = {{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}};
+    byte KEY_DEFAULT_KEYAB[MIFARE_KEY_SIZE] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
     byte emptyBlock[16] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
     byte authBlock[16] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x07, 0x80, 0x69, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
@@ -282,7 +576,7 @@ bool MifareClassic::formatMifare()
     for (idx = 0; idx < numOfSector; idx++)
     {
         // Step 1: Authenticate the current sector using key B 0xFF 0xFF 0xFF 0xFF 0xFF 0xFF
-        if (_nfcShield->PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_B, BLOCK_NUMBER_OF_SECTOR_TRAILER(idx), &KEY_DEFAULT_KEYAB, &(_nfcShield->uid)) != MFRC522::STATUS_OK)
+        if (!formatAuthenticate(true, BLOCK_NUMBER_OF_SECTOR_TRAILER(idx), KEY_DEFAULT_KEYAB))
         {
             ESP_LOGE(LOG_TAG, "Authentication failed for sector %d", idx);
             return false;
@@ -291,7 +585,7 @@ bool MifareClassic::formatMifare()
         // Step 2: Write to the other blocks
         if (idx == 0)
         {
-            if (_nfcShield->MIFARE_Write((BLOCK_NUMBER_OF_SECTOR_TRAILER(idx)) - 2, emptyBlock, 16) != MFRC522::STATUS_OK)
+            if (!formatWrite((BLOCK_NUMBER_OF_SECTOR_TRAILER(idx)) - 2, emptyBlock))
             {
                 ESP_LOGE(LOG_TAG, "Unable to write to sector %d", idx);
             }
@@ -299,23 +593,23 @@ bool MifareClassic::formatMifare()
         else
         {
             // this block has not to be overwritten for block 0. It contains Tag id and other unique data.
-            if (_nfcShield->MIFARE_Write((BLOCK_NUMBER_OF_SECTOR_TRAILER(idx)) - 3, emptyBlock, 16) != MFRC522::STATUS_OK)
+            if (!formatWrite((BLOCK_NUMBER_OF_SECTOR_TRAILER(idx)) - 3, emptyBlock))
             {
                 ESP_LOGE(LOG_TAG, "Unable to write to sector %d", idx);
             }
-            if (_nfcShield->MIFARE_Write((BLOCK_NUMBER_OF_SECTOR_TRAILER(idx)) - 2, emptyBlock, 16) != MFRC522::STATUS_OK)
+            if (!formatWrite((BLOCK_NUMBER_OF_SECTOR_TRAILER(idx)) - 2, emptyBlock))
             {
                 ESP_LOGE(LOG_TAG, "Unable to write to sector %d", idx);
             }
         }
 
-        if (_nfcShield->MIFARE_Write((BLOCK_NUMBER_OF_SECTOR_TRAILER(idx)) - 1, emptyBlock, 16) != MFRC522::STATUS_OK)
+        if (!formatWrite((BLOCK_NUMBER_OF_SECTOR_TRAILER(idx)) - 1, emptyBlock))
         {
             ESP_LOGE(LOG_TAG, "Unable to write to sector %d", idx);
         }
 
         // Write the trailer block
-        if (_nfcShield->MIFARE_Write((BLOCK_NUMBER_OF_SECTOR_TRAILER(idx)), authBlock, 16) != MFRC522::STATUS_OK)
+        if (!formatWrite((BLOCK_NUMBER_OF_SECTOR_TRAILER(idx)), authBlock))
         {
             ESP_LOGE(LOG_TAG, "Unable to write trailer byte of sector %d", idx);
         }
@@ -325,73 +619,429 @@ bool MifareClassic::formatMifare()
 
 bool MifareClassic::write(NdefMessage& m)
 {
+    byte workspace[NDEF_WORKSPACE_SIZE];
+    return writeMessage(m, false, workspace, sizeof(workspace)) == NdefTlv::WRITE_COMMITTED;
+}
+
+bool MifareClassic::write(NdefMessage& m, byte *workspace, uint16_t workspaceSize)
+{
+    return writeMessage(m, false, workspace, workspaceSize) == NdefTlv::WRITE_COMMITTED;
+}
+
+NdefTlv::WriteResult MifareClassic::writeTransaction(NdefMessage& m)
+{
+    byte workspace[NDEF_WORKSPACE_SIZE];
+    return writeMessage(m, true, workspace, sizeof(workspace));
+}
+
+NdefTlv::WriteResult MifareClassic::writeTransaction(NdefMessage& m, byte *workspace, uint16_t workspaceSize)
+{
+    return writeMessage(m, true, workspace, workspaceSize);
+}
+
+// the message is encoded behind room for the TLV header and framed in place
+NdefTlv::WriteResult MifareClassic::writeMessage(NdefMessage& m, bool transactional, byte *workspace, uint16_t workspaceSize)
+{
+    uint16_t length = m.getEncodedSize();
+    if (NdefTlv::getWorkspaceSize(length) > workspaceSize)
+    {
+        ESP_LOGE(LOG_TAG, "Workspace of %d bytes can't hold a message of %d", workspaceSize, length);
+        _status = NfcStatus();
+        _status.set(NfcStatus::ERROR_WORKSPACE, NfcStatus::OPERATION_WRITE);
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+    m.encode(&workspace[LONG_TLV_SIZE]);
+    return writeEncoded(&workspace[LONG_TLV_SIZE], length, transactional, workspace, workspaceSize);
+}
+
+NdefTlv::WriteResult MifareClassic::writeEncoded(const byte *message, uint16_t messageLength, bool transactional)
+{
+    byte workspace[NDEF_WORKSPACE_SIZE];
+    return writeEncoded(message, messageLength, transactional, workspace, sizeof(workspace));
+}
+
+NdefTlv::WriteResult MifareClassic::writeEncoded(const byte *message, uint16_t messageLength, bool transactional,
+    byte *workspace, uint16_t workspaceSize)
+{
+    _status = NfcStatus();
+    // the map is current if this driver already read or wrote the tag
+    if (!_mapped && !loadCachedMap() && !mapDataArea())
+    {
+        ESP_LOGE(LOG_TAG, "Error. Could not decode TLV");
+        if (_status.ok())
+        {
+            _status.set(NfcStatus::ERROR_BAD_TLV, NfcStatus::OPERATION_READ);
+        }
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
 
-    uint8_t encoded[m.getEncodedSize()];
-    m.encode(encoded);
+    uint16_t tagCapacity = _map.getNdefCapacity();
+    if (messageLength > tagCapacity)
+    {
+        ESP_LOGE(LOG_TAG, "Encoded message length %d exceeds tag capacity %d", messageLength, tagCapacity);
+        _status.set(NfcStatus::ERROR_TOO_LARGE, NfcStatus::OPERATION_WRITE);
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
 
-    uint8_t buffer[getBufferSize(sizeof(encoded))];
-    memset(buffer, 0, sizeof(buffer));
+    uint16_t start = _map.getNdefTlvOffset();
+    uint16_t tlvSize = NdefTlv::getTlvSize(messageLength, _map.usableBytes(start));
+    if (tlvSize > workspaceSize)
+    {
+        ESP_LOGE(LOG_TAG, "Workspace of %d bytes can't hold a TLV of %d", workspaceSize, tlvSize);
+        _status.set(NfcStatus::ERROR_WORKSPACE, NfcStatus::OPERATION_WRITE);
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+    // the message may be in the workspace already, memmove() shifts it behind the header
+    byte *encoded = workspace;
+    uint8_t headerSize = NdefTlv::getHeaderSize(messageLength);
+    memmove(encoded + headerSize, message, messageLength);
+    NdefTlv::encodeHeader(messageLength, encoded);
+    if (tlvSize > headerSize + messageLength)
+    {
+        encoded[tlvSize - 1] = TLV_TERMINATOR;
+    }
 
-    ESP_LOGD(LOG_TAG, "sizeof(encoded) %d", sizeof(encoded));
-    ESP_LOGD(LOG_TAG, "sizeof(buffer) %d", sizeof(buffer));
+    ESP_LOGD(LOG_TAG, "messageLength %d", messageLength);
+    ESP_LOGD(LOG_TAG, "tlvSize %d", tlvSize);
 
-    if (sizeof(encoded) < 0xFF)
+    NdefTlv::WriteResult result;
+    if (transactional)
     {
-        buffer[0] = 0x3;
-        buffer[1] = sizeof(encoded);
-        memcpy(&buffer[2], encoded, sizeof(encoded));
-        buffer[2+sizeof(encoded)] = 0xFE; // terminator
+        result = NdefTlv::writeTransaction(_storage, _map, start, encoded, tlvSize, headerSize);
     }
     else
     {
-        buffer[0] = 0x3;
-        buffer[1] = 0xFF;
-        buffer[2] = ((sizeof(encoded) >> 8) & 0xFF);
-        buffer[3] = (sizeof(encoded) & 0xFF);
-        memcpy(&buffer[4], encoded, sizeof(encoded));
-        buffer[4+sizeof(encoded)] = 0xFE; // terminator
+        bool written = NdefTlv::writeData(_storage, _map, start, _map.advance(start, tlvSize), encoded);
+        result = written ? NdefTlv::WRITE_COMMITTED : NdefTlv::WRITE_TORN;
+    }
+    if (result != NdefTlv::WRITE_COMMITTED && _status.ok())
+    {
+        _status.set(NfcStatus::ERROR_VERIFY, NfcStatus::OPERATION_WRITE);
+    }
+    // a torn write leaves the TLVs in an unknown state, a rolled back one left them as they were
+    _mapped = result != NdefTlv::WRITE_TORN;
+    if (result == NdefTlv::WRITE_COMMITTED)
+    {
+        _map.setNdefTlv(start, _map.nextUsable(_map.advance(start, headerSize)), messageLength);
+    }
+    if (_info != NULL)
+    {
+        _info->mapped = _mapped;
+        _info->map = _map;
+    }
+    return result;
+}
+
+// The blocks writeEncoded() writes to a tag with the layout info holds, and
+// a sector authentication each time the blocks move to another sector. A tag
+// not mapped yet is assumed to hold only an NDEF TLV, as formatNDEF() leaves it.
+void MifareClassic::planWrite(const TagInfo& info, uint16_t messageLength, bool transactional, WritePlan& plan)
+{
+    plan.reset();
+    plan.messageLength = messageLength;
+    if (info.tagType != NfcTag::TYPE_MIFARE_CLASSIC || !info.identified)
+    {
+        return;
+    }
+    plan.known = true;
+    if (!info.formatted)
+    {
+        // the NDEF key didn't open sector 1, nothing can be written
+        return;
     }
 
-    // Write to tag
-    unsigned int index = 0;
-    byte currentBlock = 4;
-    MFRC522::MIFARE_Key key = {{0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7}};
+    TlvMap map = info.map;
+    if (!info.mapped)
+    {
+        map.reset(0, CLASSIC_1K_DATA_BLOCKS * BLOCK_SIZE);
+        map.setNdefTlv(0, 0, 0);
+        plan.assumedLayout = true;
+    }
+    plan.capacity = map.getNdefCapacity();
+    plan.fits = messageLength <= plan.capacity;
+    if (!plan.fits)
+    {
+        return;
+    }
 
-    while (index < sizeof(buffer))
+    uint16_t start = map.getNdefTlvOffset();
+    uint16_t tlvSize = NdefTlv::getTlvSize(messageLength, map.usableBytes(start));
+    uint16_t end = map.advance(start, tlvSize);
+    plan.writeLength = tlvSize;
+    if (transactional)
+    {
+        NdefTlv::planTransaction(map, BLOCK_SIZE, start, tlvSize, NdefTlv::getHeaderSize(messageLength), plan);
+    }
+    else
     {
+        NdefTlv::planData(map, BLOCK_SIZE, start, end, plan);
+    }
 
-        if (((currentBlock < 128) && (currentBlock % 4 == 0)) || ((currentBlock >= 128) && (currentBlock % 16 == 0)))
+    // the sector of the NDEF TLV is opened first, to map the tag or validate the map
+    int sector = getDataBlock(start / BLOCK_SIZE) / 4;
+    plan.authentications = 1;
+    if (plan.assumedLayout)
+    {
+        plan.reads++;
+    }
+    for (uint16_t i = 0; i < plan.unitCount; i++)
+    {
+        plan.units[i] = getDataBlock(plan.units[i] / BLOCK_SIZE);
+        if (plan.units[i] / 4 != sector)
         {
-            MFRC522::StatusCode status =_nfcShield->PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, currentBlock, &key, &(_nfcShield->uid));
-            if (status != MFRC522::STATUS_OK)
+            sector = plan.units[i] / 4;
+            plan.authentications++;
+        }
+    }
+    if (transactional)
+    {
+        // verified from the first block on
+        for (uint16_t index = start / BLOCK_SIZE; index * BLOCK_SIZE < end; index++)
+        {
+            if (getDataBlock(index) / 4 != sector)
             {
-                ESP_LOGE(LOG_TAG, "Error. Block authentication failed for block %d: %s", currentBlock, MFRC522Debug::GetStatusCodeName(status));
-                return false;
+                sector = getDataBlock(index) / 4;
+                plan.authentications++;
             }
         }
+    }
+    plan.estimatedTime = plan.authentications * WritePlan::exchangeTime(12, 5, NFC_TIME_AUTHENTICATE_US) +
+        plan.reads * WritePlan::exchangeTime(4, BLOCK_SIZE + 2, 0) +
+        plan.writes * (WritePlan::exchangeTime(4, 1, 0) + WritePlan::exchangeTime(BLOCK_SIZE + 2, 1, NFC_TIME_WRITE_US));
+}
 
-        if (_nfcShield->MIFARE_Write(currentBlock, &buffer[index], BLOCK_SIZE) != MFRC522::STATUS_OK)
+uint16_t MifareClassic::requiredWorkspace(const TagInfo& info)
+{
+    if (info.tagType != NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        return 0;
+    }
+    // before its TLVs were read a 1K can hold a message as large as its data area
+    TlvMap map = info.map;
+    uint16_t capacity = info.mapped ? map.getNdefCapacity() : CLASSIC_1K_DATA_BLOCKS * BLOCK_SIZE;
+    return NdefTlv::getWorkspaceSize(capacity);
+}
+
+// Authenticate the sector of block with the first key it takes: the MAD key
+// for sector 0 and the one that opened the last sector otherwise, the image's,
+// then the NFC Forum and transport keys. A rejected key drops the tag to IDLE,
+// it is selected again for the next.
+bool MifareClassic::authenticateImage(int block, const byte *imageKey)
+{
+    byte last[MIFARE_KEY_SIZE];
+    memcpy(last, _key, MIFARE_KEY_SIZE);
+    const byte *keys[6] = { block < 4 ? MAD_KEY : last, imageKey, last, NDEF_KEY, MAD_KEY, DEFAULT_KEY };
+    for (uint8_t i = 0; i < 6; i++)
+    {
+        bool tried = keys[i] == NULL;
+        for (uint8_t j = 0; j < i && !tried; j++)
+        {
+            tried = keys[j] != NULL && memcmp(keys[i], keys[j], MIFARE_KEY_SIZE) == 0;
+        }
+        if (tried)
+        {
+            continue;
+        }
+
+        memcpy(_key, keys[i], MIFARE_KEY_SIZE);
+        _authenticatedSector = -1;
+        if (authenticate(block))
+        {
+            _status.clearError();
+            return true;
+        }
+        if (!reselect())
         {
-            ESP_LOGE(LOG_TAG, "Write failed %d", currentBlock);
+            _status.set(NfcStatus::ERROR_TAG_LOST, NfcStatus::OPERATION_SELECT, block);
             return false;
         }
+    }
+    return false;
+}
 
-        
-        ESP_LOGD(LOG_TAG, "Wrote block %d:", currentBlock);
-        ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, &buffer[index], BLOCK_SIZE, ESP_LOG_DEBUG);
+// access bits are stored with their inverse, a trailer without that can't be opened again
+static bool accessBitsValid(const byte *trailer)
+{
+    return (trailer[7] >> 4) == (~trailer[6] & 0x0F) &&
+        (trailer[8] & 0x0F) == ((~trailer[6] >> 4) & 0x0F) &&
+        (trailer[8] >> 4) == (~trailer[7] & 0x0F);
+}
 
-        index += BLOCK_SIZE;
-        currentBlock++;
+// Key B reads back unless the trailer's access bits C1 C2 C3 are 000, 010 or 001
+static bool keyBHidden(const byte *trailer)
+{
+    bool c1 = trailer[7] & 0x80;
+    bool c2 = trailer[8] & 0x08;
+    bool c3 = trailer[8] & 0x80;
+    return c1 || (c2 && c3);
+}
 
-        if (((currentBlock < 128) && ((currentBlock+1) % 4 == 0)) || ((currentBlock >= 128) && ((currentBlock+1) % 16 == 0)))
+// Blocks are read one by one as a sector is authenticated, trailers too.
+// Key A never reads back, the key that opened the sector takes its place.
+// Key B reads as zeros where the access bits hide it.
+bool MifareClassic::dumpImage(TagImageSink& sink, uint16_t *nextBlock)
+{
+    _status = NfcStatus();
+    byte data[BLOCK_SIZE];
+    bool success = true;
+    while (*nextBlock < CLASSIC_1K_BLOCKS)
+    {
+        int block = *nextBlock;
+        if ((block / 4 != _authenticatedSector && !authenticateImage(block, NULL)) || !readBlock(block, data))
+        {
+            success = false;
+            break;
+        }
+        if (block % 4 == 3)
+        {
+            memcpy(data, _key, MIFARE_KEY_SIZE);
+        }
+        if (!sink.write(block, data, BLOCK_SIZE))
         {
-            // can't write to trailer block
-            ESP_LOGD(LOG_TAG, "Skipping block %d", currentBlock);
-            currentBlock++;
+            ESP_LOGE(LOG_TAG, "Error. Image sink refused block %d", block);
+            _status.set(NfcStatus::ERROR_IMAGE, NfcStatus::OPERATION_READ, block);
+            success = false;
+            break;
         }
+        (*nextBlock)++;
+    }
+
+    // the NDEF sectors are opened with the NDEF key again
+    memcpy(_key, NDEF_KEY, MIFARE_KEY_SIZE);
+    _authenticatedSector = -1;
+    return success;
+}
 
+// Each sector is opened with the transport key of a blank tag, or after a
+// field loss with the key of the image's trailer if that was written already.
+// The trailer is the last block of its sector, so the new keys only apply to
+// what comes after. Block 0 holds the UID and is not written. Every block is
+// written without reading it first, a resumed restore writes one block twice.
+// The zeros a dump has for a hidden key B are not written as the key, that
+// would lock the caller out of whatever key B grants.
+bool MifareClassic::restoreImage(TagImageSource& source, uint16_t *nextBlock, const byte *keyB)
+{
+    _status = NfcStatus();
+    _mapped = false;
+    _storage.invalidate();
+    if (_info != NULL)
+    {
+        _info->mapped = false;
+    }
+    if (*nextBlock == 0)
+    {
+        *nextBlock = 1;
     }
 
+    byte data[BLOCK_SIZE];
+    byte trailer[BLOCK_SIZE];
+    bool success = true;
+    while (*nextBlock < CLASSIC_1K_BLOCKS)
+    {
+        int block = *nextBlock;
+        if (block / 4 != _authenticatedSector)
+        {
+            if (!source.read(block | 3, trailer, BLOCK_SIZE) || !accessBitsValid(trailer))
+            {
+                ESP_LOGE(LOG_TAG, "Error. No valid trailer for block %d in the image", block);
+                _status.set(NfcStatus::ERROR_IMAGE, NfcStatus::OPERATION_WRITE, block | 3);
+                success = false;
+                break;
+            }
+            if (keyBHidden(trailer) && keyB == NULL)
+            {
+                ESP_LOGE(LOG_TAG, "Error. Key B of sector %d isn't in the image, restore it with a key B", block / 4);
+                _status.set(NfcStatus::ERROR_IMAGE, NfcStatus::OPERATION_WRITE, block | 3);
+                success = false;
+                break;
+            }
+            if (!authenticateImage(block, trailer))
+            {
+                success = false;
+                break;
+            }
+        }
+        if (!source.read(block, data, BLOCK_SIZE))
+        {
+            ESP_LOGE(LOG_TAG, "Error. Image source has no block %d", block);
+            _status.set(NfcStatus::ERROR_IMAGE, NfcStatus::OPERATION_WRITE, block);
+            success = false;
+            break;
+        }
+        if (block % 4 == 3 && keyBHidden(data))
+        {
+            memcpy(&data[10], keyB, MIFARE_KEY_SIZE);
+        }
+        if (!writeBlock(block, data))
+        {
+            success = false;
+            break;
+        }
+        (*nextBlock)++;
+    }
+
+    memcpy(_key, NDEF_KEY, MIFARE_KEY_SIZE);
+    _authenticatedSector = -1;
+    return success;
+}
+
+MifareClassicTlvStorage::MifareClassicTlvStorage(MifareClassic *tag)
+{
+    _tag = tag;
+    invalidate();
+}
+
+void MifareClassicTlvStorage::invalidate()
+{
+    _blockIndex = -1;
+}
+
+bool MifareClassicTlvStorage::read(uint16_t offset, byte *data, uint16_t length)
+{
+    while (length > 0)
+    {
+        int index = offset / BLOCK_SIZE;
+        if (index != _blockIndex)
+        {
+            _blockIndex = -1;
+            if (index >= CLASSIC_1K_DATA_BLOCKS || !_tag->readBlock(MifareClassic::getDataBlock(index), _block))
+            {
+                return false;
+            }
+            _blockIndex = index;
+        }
+
+        uint16_t count = BLOCK_SIZE - offset % BLOCK_SIZE;
+        if (count > length)
+        {
+            count = length;
+        }
+        memcpy(data, &_block[offset % BLOCK_SIZE], count);
+        offset += count;
+        data += count;
+        length -= count;
+    }
     return true;
 }
+
+bool MifareClassicTlvStorage::write(uint16_t offset, byte *data)
+{
+    int index = offset / BLOCK_SIZE;
+    if (!_tag->writeBlock(MifareClassic::getDataBlock(index), data))
+    {
+        _blockIndex = -1;
+        return false;
+    }
+
+    if (index == _blockIndex)
+    {
+        memcpy(_block, data, BLOCK_SIZE);
+    }
+    return true;
+}
+
+uint8_t MifareClassicTlvStorage::getUnitSize()
+{
+    return BLOCK_SIZE;
+}
 #endif
@@ -1,5 +1,13 @@
 #include <esp_log.h>
+#include <esp_random.h>
+#include <mbedtls/des.h>
 #include "MifareUltralight.h"
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+
+// Kconfig turns DES on with Ultralight C support, a build without it has to as well
+#if defined(NDEF_SUPPORT_ULTRALIGHT_C) && !defined(MBEDTLS_DES_C)
+#error "Ultralight C authentication needs MBEDTLS_DES_C, or leave NDEF_SUPPORT_ULTRALIGHT_C out"
+#endif
 
 /**
  *
@@ -20,82 +28,633 @@
  * 4-39 are read/write unless blocked by the lock bytes in page 2. Page 40 Lock
  * bytes Page 41 16 bit one way counter Pages 42-43 Authentication configuration
  * 		Pages 44-47 Authentication key
+ *
+ * NTAG210/212/213/215/216 and MIFARE Ultralight EV1 (MF0UL11/MF0UL21):
+ * 		Answer GET_VERSION with product type and storage size, and support
+ * FAST_READ to read a page range in one command. User memory starts at page 4
+ * and is 48/128/144/504/888 bytes for NTAG210/212/213/215/216 and 48/128
+ * bytes for MF0UL11/MF0UL21.
  */
 
 static const char* LOG_TAG = "Mifare Ultralight";
 
-MifareUltralight::MifareUltralight(MFRC522 *nfcShield)
+MifareUltralight::MifareUltralight(NfcTransport *transport, TagCredentials *credentials, TagInfo *info) : _storage(this)
 {
-    nfc = nfcShield;
+    nfc = transport;
+    _credentials = credentials;
+    reset(info);
 }
 
 MifareUltralight::~MifareUltralight()
 {
 }
 
-NfcTag MifareUltralight::read()
+void MifareUltralight::reset(TagInfo *info)
+{
+    invalidate(info);
+    _status = NfcStatus();
+}
+
+void MifareUltralight::invalidate(TagInfo *info)
+{
+    _info = info;
+    _product = PRODUCT_UNKNOWN;
+    _userPages = 0;
+    _fastRead = false;
+    _identified = false;
+    _mapped = false;
+    _storage.invalidate();
+}
+
+NfcTag MifareUltralight::read(byte *buffer, uint16_t bufferSize)
 {
+    _status = NfcStatus();
+    identify();
+    authenticate();
+
     if (isUnformatted())
     {
         ESP_LOGI(LOG_TAG, "WARNING: Tag is not formatted.");
+        _status.set(NfcStatus::ERROR_NOT_FORMATTED, NfcStatus::OPERATION_READ, ULTRALIGHT_DATA_START_PAGE);
+        if (_info != NULL)
+        {
+            _info->formatted = false;
+            _info->mapped = false;
+        }
         return NfcTag(nfc->uid.uidByte, nfc->uid.size, NfcTag::TYPE_2);
     }
 
-    uint16_t messageLength = 0;
-    uint16_t ndefStartIndex = 0;
-    findNdefMessage(&messageLength, &ndefStartIndex);
-
-    uint16_t bufferSize = calculateBufferSize(messageLength, ndefStartIndex);
+    if (!mapDataArea())
+    {
+        return NfcTag(nfc->uid.uidByte, nfc->uid.size, NfcTag::TYPE_2);
+    }
 
+    uint16_t messageLength = _map.getNdefLength();
     if (messageLength == 0) { // data is 0x44 0x03 0x00 0xFE
         NdefMessage message = NdefMessage();
         message.addEmptyRecord();
         return NfcTag(nfc->uid.uidByte, nfc->uid.size, NfcTag::TYPE_2, message);
     }
 
-    uint8_t index = 0;
-    byte buffer[bufferSize];
-    for (uint8_t page = ULTRALIGHT_DATA_START_PAGE; page < ULTRALIGHT_MAX_PAGE; page++)
+    // the message is read straight into the tag, or the caller's buffer when it's larger
+    NfcTag tag(nfc->uid.uidByte, nfc->uid.size, NfcTag::TYPE_2);
+    byte *data = tag.allocateNdef(messageLength, buffer, bufferSize);
+    if (data == NULL)
     {
-        // read the data
-        byte dataSize = ULTRALIGHT_READ_SIZE + 2;
-        MFRC522::StatusCode status = nfc->MIFARE_Read(page, &buffer[index], &dataSize);
-        if (status == MFRC522::STATUS_OK)
+        ESP_LOGE(LOG_TAG, "Error. Message of %d bytes needs a buffer", messageLength);
+        _status.set(NfcStatus::ERROR_TOO_LARGE, NfcStatus::OPERATION_READ);
+        return tag;
+    }
+    if (!NdefTlv::readValue(_storage, _map, data))
+    {
+        if (_status.ok())
         {
-            ESP_LOGD(LOG_TAG, "Page %d:", page);
-            ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, &buffer[index], ULTRALIGHT_PAGE_SIZE, ESP_LOG_DEBUG);
+            _status.set(NfcStatus::ERROR_BAD_TLV, NfcStatus::OPERATION_READ);
+        }
+        return NfcTag(nfc->uid.uidByte, nfc->uid.size, NfcTag::TYPE_2);
+    }
+
+    return tag;
+
+}
+
+bool MifareUltralight::indexRecords(NdefRecordIndex& index)
+{
+    _status = NfcStatus();
+    index.reset();
+    identify();
+    authenticate();
+
+    if (isUnformatted())
+    {
+        ESP_LOGI(LOG_TAG, "WARNING: Tag is not formatted.");
+        _status.set(NfcStatus::ERROR_NOT_FORMATTED, NfcStatus::OPERATION_READ, ULTRALIGHT_DATA_START_PAGE);
+        if (_info != NULL)
+        {
+            _info->formatted = false;
+            _info->mapped = false;
+        }
+        return false;
+    }
+
+    if (!mapDataArea() || !NdefTlv::indexRecords(_storage, _map, index))
+    {
+        if (_status.ok())
+        {
+            _status.set(NfcStatus::ERROR_BAD_TLV, NfcStatus::OPERATION_READ);
+        }
+        return false;
+    }
+
+    for (uint8_t i = 0; i < index.entryCount; i++)
+    {
+        index.entries[i].firstUnit += ULTRALIGHT_DATA_START_PAGE;
+        index.entries[i].lastUnit += ULTRALIGHT_DATA_START_PAGE;
+    }
+    index.setUid(nfc->uid.uidByte, nfc->uid.size);
+    return true;
+}
+
+// Only the pages from the payload on are read, in as few READ or FAST_READ
+// commands as they take. A new selection maps the data area again first.
+bool MifareUltralight::readPayload(const NdefRecordIndex& index, uint8_t entry, byte *data, uint16_t dataSize)
+{
+    _status = NfcStatus();
+    if (entry >= index.entryCount)
+    {
+        ESP_LOGE(LOG_TAG, "Error. The index has no entry %d", entry);
+        _status.set(NfcStatus::ERROR_STALE_INDEX, NfcStatus::OPERATION_READ);
+        return false;
+    }
+    if (!index.isOf(nfc->uid.uidByte, nfc->uid.size))
+    {
+        ESP_LOGI(LOG_TAG, "The index is of another tag");
+        _status.set(NfcStatus::ERROR_STALE_INDEX, NfcStatus::OPERATION_READ);
+        return false;
+    }
+    const NdefRecordIndex::Entry& record = index.entries[entry];
+    if (record.payloadLength > dataSize)
+    {
+        ESP_LOGE(LOG_TAG, "Error. Payload of %d bytes needs a larger buffer", record.payloadLength);
+        _status.set(NfcStatus::ERROR_TOO_LARGE, NfcStatus::OPERATION_READ);
+        return false;
+    }
+
+    if (!_mapped)
+    {
+        identify();
+        authenticate();
+        if (!mapDataArea())
+        {
+            return false;
+        }
+    }
+    if (_map.getNdefValueOffset() != index.valueOffset || _map.getNdefLength() != index.messageLength)
+    {
+        ESP_LOGI(LOG_TAG, "The message changed since it was indexed");
+        _status.set(NfcStatus::ERROR_STALE_INDEX, NfcStatus::OPERATION_READ);
+        return false;
+    }
+
+    // the pages read for the header usually hold the payload as well
+    if (!NdefTlv::matchesHeader(_storage, _map, record))
+    {
+        if (_status.ok())
+        {
+            ESP_LOGI(LOG_TAG, "The record changed since it was indexed");
+            _status.set(NfcStatus::ERROR_STALE_INDEX, NfcStatus::OPERATION_READ);
+        }
+        return false;
+    }
+
+    if (!NdefTlv::readValue(_storage, _map, record.payloadOffset, data, record.payloadLength))
+    {
+        if (_status.ok())
+        {
+            _status.set(NfcStatus::ERROR_BAD_TLV, NfcStatus::OPERATION_READ);
+        }
+        return false;
+    }
+    return true;
+}
+
+MifareUltralight::Product MifareUltralight::getProduct()
+{
+    identify();
+    return _product;
+}
+
+uint16_t MifareUltralight::getCapacity()
+{
+    identify();
+    return _userPages * ULTRALIGHT_PAGE_SIZE;
+}
+
+bool MifareUltralight::supportsFastRead()
+{
+    identify();
+    return _fastRead;
+}
+
+// NTAG21x and Ultralight EV1 report product and memory size with GET_VERSION.
+// Ultralight and Ultralight C don't support it, they are sized from the CC.
+// The CC of a tag with a cache entry is read either way.
+// Neither changes for a UID, so a cached result is used without asking the tag.
+void MifareUltralight::identify()
+{
+    if (_identified)
+    {
+        return;
+    }
+    _identified = true;
+
+    if (_info != NULL && _info->identified)
+    {
+        _product = (Product)_info->product;
+        _userPages = _info->dataAreaSize / ULTRALIGHT_PAGE_SIZE;
+        _fastRead = _info->fastRead;
+        ESP_LOGD(LOG_TAG, "Cached product %d, %d user pages, fast read %d", _product, _userPages, _fastRead);
+        return;
+    }
+
+    byte version[NTAG_VERSION_SIZE];
+    if (getVersion(version))
+    {
+        ESP_LOGD(LOG_TAG, "Version:");
+        ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, version, NTAG_VERSION_SIZE, ESP_LOG_DEBUG);
+
+        // byte 2 is the product type, byte 6 the storage size
+        bool ntag = version[2] == 0x04;
+        switch (version[6])
+        {
+            case 0x0B:
+                _product = ntag ? PRODUCT_NTAG210 : PRODUCT_ULTRALIGHT_EV1_MF0UL11;
+                _userPages = 12;
+                break;
+            case 0x0E:
+                _product = ntag ? PRODUCT_NTAG212 : PRODUCT_ULTRALIGHT_EV1_MF0UL21;
+                _userPages = 32;
+                break;
+            case 0x0F:
+                _product = PRODUCT_NTAG213;
+                _userPages = 36;
+                break;
+            case 0x11:
+                _product = PRODUCT_NTAG215;
+                _userPages = 126;
+                break;
+            case 0x13:
+                _product = PRODUCT_NTAG216;
+                _userPages = 222;
+                break;
+            default:
+                ESP_LOGI(LOG_TAG, "Unknown storage size 0x%x", version[6]);
+                break;
+        }
+        _fastRead = (_product != PRODUCT_UNKNOWN);
+        // the CC goes into the cache too, so a tag of another model or formatted
+        // another way doesn't pass for this one. Pages 4-6 come with it but aren't
+        // kept, before authentication read protection returns them as zeros.
+        // A NAK, from read protection starting at page 3, leaves the tag IDLE.
+        if (_fastRead && _info != NULL && readTagSize() == 0)
+        {
+            reselect();
+        }
+    }
+    else
+    {
+        // the tag goes back to IDLE after rejecting the command
+        reselect();
+    }
+
+    if (_product == PRODUCT_UNKNOWN)
+    {
+        uint16_t tagCapacity = readTagSize();
+        _userPages = tagCapacity / ULTRALIGHT_PAGE_SIZE;
+        if (tagCapacity == 48)
+        {
+            _product = PRODUCT_ULTRALIGHT;
+        }
+        else if (tagCapacity == 144)
+        {
+            _product = PRODUCT_ULTRALIGHT_C;
+        }
+    }
+
+    ESP_LOGD(LOG_TAG, "Product %d, %d user pages, fast read %d", _product, _userPages, _fastRead);
+
+    if (_info != NULL && _userPages > 0)
+    {
+        _info->tagType = NfcTag::TYPE_2;
+        _info->identified = true;
+        _info->product = _product;
+        _info->dataAreaSize = _userPages * ULTRALIGHT_PAGE_SIZE;
+        _info->fastRead = _fastRead;
+    }
+}
+
+bool MifareUltralight::getVersion(byte *version)
+{
+    byte command[1] = { NTAG_CMD_GET_VERSION };
+    byte response[NTAG_VERSION_SIZE + 2];
+    byte responseSize = sizeof(response);
+    NfcTransport::Status status = nfc->transceive(command, sizeof(command), response, &responseSize);
+    if (status != NfcTransport::STATUS_OK || responseSize < NTAG_VERSION_SIZE)
+    {
+        ESP_LOGD(LOG_TAG, "GET_VERSION not supported - Status: %d", status);
+        return false;
+    }
+
+    memcpy(version, response, NTAG_VERSION_SIZE);
+    return true;
+}
+
+// One READ of pages 0-3 confirms the tag is still selected. Pages 0 and 1 hold
+// a 7 byte UID, so it is also known to be the same tag.
+bool MifareUltralight::isPresent()
+{
+    byte dataSize = ULTRALIGHT_READ_SIZE + 2;
+    byte data[ULTRALIGHT_READ_SIZE + 2];
+    NfcTransport::Status status = nfc->mifareRead(0, data, &dataSize);
+    if (status != NfcTransport::STATUS_OK)
+    {
+        ESP_LOGD(LOG_TAG, "Tag gone - Status: %d", status);
+        return false;
+    }
+
+    if (nfc->uid.size == 7)
+    {
+        // page 0 is UID0-2 and BCC0, page 1 UID3-6
+        return memcmp(data, nfc->uid.uidByte, 3) == 0 && memcmp(&data[4], &nfc->uid.uidByte[3], 4) == 0;
+    }
+    return true;
+}
+
+bool MifareUltralight::reselect()
+{
+    nfc->wakeupA();
+    NfcTransport::Status status = nfc->select(&(nfc->uid));
+    if (_credentials != NULL)
+    {
+        // a new selection starts unauthenticated
+        _credentials->beginSelection();
+    }
+    if (status != NfcTransport::STATUS_OK)
+    {
+        ESP_LOGE(LOG_TAG, "Error. Could not reselect tag - Status: %d", status);
+        return false;
+    }
+    return true;
+}
+
+// Without a credential for the tag, or after it was rejected, the tag is
+// used unauthenticated and only the unprotected pages can be accessed.
+bool MifareUltralight::authenticate()
+{
+    if (_credentials == NULL)
+    {
+        return false;
+    }
+
+    TagCredentials::Entry *entry = _credentials->find(nfc->uid.uidByte, nfc->uid.size);
+    if (entry == NULL && _info != NULL && _info->keyKind != TagCredentials::KIND_NONE)
+    {
+        // the credential was evicted, the key that last worked on this tag is still known
+        if (_info->keyKind == TagCredentials::KIND_NTAG_PASSWORD)
+        {
+            _credentials->setPassword(nfc->uid.uidByte, nfc->uid.size, _info->key, NULL);
         }
         else
         {
-            ESP_LOGE(LOG_TAG, "Page %d: Read Failed - Status: %d", page, status);
-            return NfcTag(nfc->uid.uidByte, nfc->uid.size, NfcTag::TYPE_2);
+            _credentials->setUltralightCKey(nfc->uid.uidByte, nfc->uid.size, _info->key);
         }
+        entry = _credentials->find(nfc->uid.uidByte, nfc->uid.size);
+    }
+    if (entry == NULL || entry->failed)
+    {
+        return false;
+    }
+    if (_credentials->isAuthenticated(entry))
+    {
+        return true;
+    }
+
+    identify();
+    bool authenticated = false;
+    if (entry->kind == TagCredentials::KIND_NTAG_PASSWORD && _product >= PRODUCT_ULTRALIGHT_EV1_MF0UL11)
+    {
+        authenticated = passwordAuth(entry);
+    }
+    else if (entry->kind == TagCredentials::KIND_ULTRALIGHT_C_KEY && _product == PRODUCT_ULTRALIGHT_C)
+    {
+        authenticated = ultralightCAuth(entry);
+    }
+    else
+    {
+        ESP_LOGD(LOG_TAG, "Credential kind %d does not apply to product %d", entry->kind, _product);
+        return false;
+    }
+
+    if (authenticated)
+    {
+        _credentials->setAuthenticated(entry);
+        rememberKey(entry);
+    }
+    else
+    {
+        _credentials->setFailed(entry);
+        rememberKey(NULL);
+        // a rejected authentication sends the tag back to IDLE
+        reselect();
+    }
+    return authenticated;
+}
+
+void MifareUltralight::rememberKey(TagCredentials::Entry *entry)
+{
+    if (_info == NULL)
+    {
+        return;
+    }
+
+    if (entry == NULL)
+    {
+        _info->keyKind = TagCredentials::KIND_NONE;
+        memset(_info->key, 0, sizeof(_info->key));
+    }
+    else
+    {
+        _info->keyKind = entry->kind;
+        memcpy(_info->key, entry->key, sizeof(_info->key));
+    }
+}
+
+bool MifareUltralight::passwordAuth(TagCredentials::Entry *entry)
+{
+    byte command[1 + NTAG_PASSWORD_SIZE] = { NTAG_CMD_PWD_AUTH };
+    memcpy(&command[1], entry->key, NTAG_PASSWORD_SIZE);
+    byte response[NTAG_PACK_SIZE + 2];
+    byte responseSize = sizeof(response);
+    NfcTransport::Status status = nfc->transceive(command, sizeof(command), response, &responseSize);
+    if (status != NfcTransport::STATUS_OK || responseSize < NTAG_PACK_SIZE)
+    {
+        ESP_LOGE(LOG_TAG, "Error. PWD_AUTH failed - Status: %d", status);
+        return false;
+    }
+
+    if (entry->checkPack && memcmp(response, entry->pack, NTAG_PACK_SIZE) != 0)
+    {
+        ESP_LOGE(LOG_TAG, "Error. PWD_AUTH returned an unexpected PACK");
+        return false;
+    }
+
+    ESP_LOGD(LOG_TAG, "Authenticated with password");
+    return true;
+}
+
+#ifdef NDEF_SUPPORT_ULTRALIGHT_C
+// 2 key 3DES in CBC mode, iv is updated to the last ciphertext block
+static void ultralightCCrypt(const byte *key, int mode, byte *iv, const byte *input, byte *output, size_t length)
+{
+    mbedtls_des3_context context;
+    mbedtls_des3_init(&context);
+    if (mode == MBEDTLS_DES_ENCRYPT)
+    {
+        mbedtls_des3_set2key_enc(&context, key);
+    }
+    else
+    {
+        mbedtls_des3_set2key_dec(&context, key);
+    }
+    mbedtls_des3_crypt_cbc(&context, mode, length, iv, input, output);
+    mbedtls_des3_free(&context);
+}
+#endif
+
+// See MF0ICU2 datasheet 7.5.5 - the tag sends ek(RndB), the reader answers
+// ek(RndA || RndB') and the tag proves the key with ek(RndA')
+bool MifareUltralight::ultralightCAuth(TagCredentials::Entry *entry)
+{
+#ifdef NDEF_SUPPORT_ULTRALIGHT_C
+    byte command[1 + 2 * ULTRALIGHT_C_RANDOM_SIZE] = { ULTRALIGHT_C_CMD_AUTHENTICATE, 0x00 };
+    byte response[1 + ULTRALIGHT_C_RANDOM_SIZE + 2];
+    byte responseSize = sizeof(response);
+    NfcTransport::Status status = nfc->transceive(command, 2, response, &responseSize);
+    if (status != NfcTransport::STATUS_OK || responseSize < 1 + ULTRALIGHT_C_RANDOM_SIZE || response[0] != 0xAF)
+    {
+        ESP_LOGE(LOG_TAG, "Error. AUTHENTICATE failed - Status: %d", status);
+        return false;
+    }
 
-        if (index >= (messageLength + ndefStartIndex))
+    byte iv[ULTRALIGHT_C_RANDOM_SIZE] = { 0 };
+    byte rndB[ULTRALIGHT_C_RANDOM_SIZE];
+    ultralightCCrypt(entry->key, MBEDTLS_DES_DECRYPT, iv, &response[1], rndB, ULTRALIGHT_C_RANDOM_SIZE);
+
+    // RndA || RndB rotated left by one byte
+    byte rndA[ULTRALIGHT_C_RANDOM_SIZE];
+    esp_fill_random(rndA, sizeof(rndA));
+    byte plain[2 * ULTRALIGHT_C_RANDOM_SIZE];
+    memcpy(plain, rndA, ULTRALIGHT_C_RANDOM_SIZE);
+    memcpy(&plain[ULTRALIGHT_C_RANDOM_SIZE], &rndB[1], ULTRALIGHT_C_RANDOM_SIZE - 1);
+    plain[2 * ULTRALIGHT_C_RANDOM_SIZE - 1] = rndB[0];
+
+    command[0] = 0xAF;
+    ultralightCCrypt(entry->key, MBEDTLS_DES_ENCRYPT, iv, plain, &command[1], sizeof(plain));
+    responseSize = sizeof(response);
+    status = nfc->transceive(command, sizeof(command), response, &responseSize);
+    if (status != NfcTransport::STATUS_OK || responseSize < 1 + ULTRALIGHT_C_RANDOM_SIZE || response[0] != 0x00)
+    {
+        ESP_LOGE(LOG_TAG, "Error. AUTHENTICATE rejected the key - Status: %d", status);
+        return false;
+    }
+
+    byte rndA2[ULTRALIGHT_C_RANDOM_SIZE];
+    ultralightCCrypt(entry->key, MBEDTLS_DES_DECRYPT, iv, &response[1], rndA2, ULTRALIGHT_C_RANDOM_SIZE);
+    if (memcmp(rndA2, &rndA[1], ULTRALIGHT_C_RANDOM_SIZE - 1) != 0 || rndA2[ULTRALIGHT_C_RANDOM_SIZE - 1] != rndA[0])
+    {
+        ESP_LOGE(LOG_TAG, "Error. Tag could not prove the key");
+        return false;
+    }
+
+    ESP_LOGD(LOG_TAG, "Authenticated with 3DES key");
+    return true;
+#else
+    (void)entry;
+    ESP_LOGE(LOG_TAG, "Ultralight C authentication is turned off, see CONFIG_NDEF_SUPPORT_ULTRALIGHT_C");
+    return false;
+#endif
+}
+
+bool MifareUltralight::readPages(uint16_t page, uint16_t pageCount, byte *buffer)
+{
+    while (pageCount > 0)
+    {
+        // a failed chunk is read again on its own, not the pages before it
+        uint16_t chunk = _fastRead ? NTAG_FAST_READ_MAX_PAGES : ULTRALIGHT_READ_SIZE / ULTRALIGHT_PAGE_SIZE;
+        if (chunk > pageCount)
+        {
+            chunk = pageCount;
+        }
+        NfcRetry retry(_retryPolicy, nfc);
+        while (!readChunk(page, chunk, buffer))
         {
-            break;
+            if (!recover(retry))
+            {
+                return false;
+            }
         }
+        if (!_status.ok())
+        {
+            _status.clearError();
+        }
+
+        ESP_LOGD(LOG_TAG, "Pages %d-%d:", page, page + chunk - 1);
+        ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, buffer, chunk * ULTRALIGHT_PAGE_SIZE, ESP_LOG_DEBUG);
+
+        page += chunk;
+        pageCount -= chunk;
+        buffer += chunk * ULTRALIGHT_PAGE_SIZE;
+    }
+    return true;
+}
+
+bool MifareUltralight::readChunk(uint16_t page, uint16_t pageCount, byte *buffer)
+{
+    if (_fastRead)
+    {
+        return fastRead(page, page + pageCount - 1, buffer);
+    }
 
-        index += ULTRALIGHT_PAGE_SIZE;
+    // READ always returns 4 pages
+    byte data[ULTRALIGHT_READ_SIZE + 2];
+    byte dataSize = sizeof(data);
+    NfcTransport::Status status = nfc->mifareRead(page, data, &dataSize);
+    if (status != NfcTransport::STATUS_OK)
+    {
+        ESP_LOGD(LOG_TAG, "Page %d: Read Failed - Status: %d", page, status);
+        _status.setTransport(status, NfcStatus::OPERATION_READ, page);
+        return false;
     }
+    memcpy(buffer, data, pageCount * ULTRALIGHT_PAGE_SIZE);
+    return true;
+}
 
-    return NfcTag(nfc->uid.uidByte, nfc->uid.size, NfcTag::TYPE_2, &buffer[ndefStartIndex], messageLength);
+bool MifareUltralight::fastRead(uint16_t startPage, uint16_t endPage, byte *buffer)
+{
+    byte command[3] = { NTAG_CMD_FAST_READ, (byte)startPage, (byte)endPage };
+    uint16_t dataSize = (endPage - startPage + 1) * ULTRALIGHT_PAGE_SIZE;
+    byte response[NTAG_FAST_READ_MAX_PAGES * ULTRALIGHT_PAGE_SIZE + 2];
+    byte responseSize = dataSize + 2;
+    NfcTransport::Status status = nfc->transceive(command, sizeof(command), response, &responseSize);
+    if (status != NfcTransport::STATUS_OK || responseSize < dataSize)
+    {
+        ESP_LOGD(LOG_TAG, "Pages %d-%d: Fast Read Failed - Status: %d", startPage, endPage, status);
+        if (status == NfcTransport::STATUS_OK)
+        {
+            // a short answer is a bad frame
+            _status.set(NfcStatus::ERROR_FRAME, NfcStatus::OPERATION_READ, startPage, status);
+        }
+        else
+        {
+            _status.setTransport(status, NfcStatus::OPERATION_READ, startPage);
+        }
+        return false;
+    }
 
+    memcpy(buffer, response, dataSize);
+    return true;
 }
 
 bool MifareUltralight::isUnformatted()
 {
-    uint8_t page = 4;
-    byte dataSize = ULTRALIGHT_READ_SIZE+2;
-    byte data[dataSize];
-    MFRC522::StatusCode status = nfc->MIFARE_Read(page, data, &dataSize);
-    if (status == MFRC522::STATUS_OK && dataSize >= 4)
+    byte data[ULTRALIGHT_PAGE_SIZE];
+    if (_storage.read(0, data, ULTRALIGHT_PAGE_SIZE))
     {
         return (data[0] == 0xFF && data[1] == 0xFF && data[2] == 0xFF && data[3] == 0xFF);
     }
     else
     {
-        ESP_LOGE(LOG_TAG, "Error. Failed read page %d", page);
+        ESP_LOGE(LOG_TAG, "Error. Failed read page %d", ULTRALIGHT_DATA_START_PAGE);
         return false;
     }
 }
@@ -105,129 +664,350 @@ uint16_t MifareUltralight::readTagSize()
 {
     uint16_t tagCapacity = 0;
     byte dataSize = ULTRALIGHT_READ_SIZE+2;
-    byte data[ULTRALIGHT_PAGE_SIZE];
-    MFRC522::StatusCode status = nfc->MIFARE_Read(3, data, &dataSize);
-    if (status == MFRC522::STATUS_OK && dataSize >= 2)
+    byte data[ULTRALIGHT_READ_SIZE+2];
+    NfcTransport::Status status = nfc->mifareRead(3, data, &dataSize);
+    if (status == NfcTransport::STATUS_OK && dataSize >= 2)
     {
         // See AN1303 - different rules for Mifare Family byte2 = (additional data + 48)/8
         tagCapacity = data[2] * 8;
         ESP_LOGD(LOG_TAG, "Tag capacity %d bytes", tagCapacity);
-
-        // TODO future versions should get lock information
+        if (_info != NULL)
+        {
+            memcpy(_info->cc, data, TYPE_2_CC_SIZE);
+            _info->ccKnown = true;
+        }
     }
 
     return tagCapacity;
 }
 
-// read enough of the message to find the ndef message length
-void MifareUltralight::findNdefMessage(uint16_t *messageLength, uint16_t *ndefStartIndex)
+// After a timeout or a bad frame the command is sent again. After a NAK, or
+// when that fails too, the tag is IDLE and selected and authenticated again.
+bool MifareUltralight::recover(NfcRetry& retry)
 {
-    byte dataSize = ULTRALIGHT_READ_SIZE + 2;
-    byte data[dataSize]; // 3 pages, but 4 + CRC are returned
-
-    if(nfc->MIFARE_Read(4, data, &dataSize) == MFRC522::STATUS_OK)
+    NfcRetry::Action action = retry.next(_status);
+    if (action == NfcRetry::ACTION_GIVE_UP)
     {
-        ESP_LOGD(LOG_TAG, "Pages 4-7");
-        ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, data, 18, ESP_LOG_DEBUG);
-        ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, data+ULTRALIGHT_PAGE_SIZE, 18, ESP_LOG_DEBUG);
-        ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, data+2*ULTRALIGHT_PAGE_SIZE, 18, ESP_LOG_DEBUG);
-        ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, data+3*ULTRALIGHT_PAGE_SIZE, 18, ESP_LOG_DEBUG);
-
-        if (data[0] == 0x03)
+        ESP_LOGE(LOG_TAG, "Error. Page %d: %s after %d retries", _status.getAddress(),
+            NfcStatus::getErrorName(_status.getError()), _status.getRetries());
+        return false;
+    }
+    if (action == NfcRetry::ACTION_RESELECT)
+    {
+        if (!reselect())
         {
-            *messageLength = data[1];
-            *ndefStartIndex = 2;
+            _status.set(NfcStatus::ERROR_TAG_LOST, NfcStatus::OPERATION_SELECT, _status.getAddress());
+            return false;
         }
-        else if (data[5] == 0x3) // page 5 byte 1
+        authenticate();
+    }
+    return true;
+}
+
+NfcStatus MifareUltralight::getStatus()
+{
+    return _status;
+}
+
+void MifareUltralight::setRetryPolicy(const NfcRetryPolicy& policy)
+{
+    _retryPolicy = policy;
+}
+
+// Lock and Memory Control TLVs give the reserved areas inside the data area,
+// the NDEF TLV comes after them
+bool MifareUltralight::mapDataArea()
+{
+    _mapped = false;
+    _map.reset(ULTRALIGHT_DATA_START_PAGE * ULTRALIGHT_PAGE_SIZE, getCapacity());
+    if (!NdefTlv::parse(_storage, _map))
+    {
+        ESP_LOGE(LOG_TAG, "Error. Could not decode TLV");
+        if (_status.ok())
         {
-            // TODO should really read the lock control TLV to ensure byte[5] is correct
-            *messageLength = data[6];
-            *ndefStartIndex = 7;
+            _status.set(NfcStatus::ERROR_BAD_TLV, NfcStatus::OPERATION_READ);
         }
+        return false;
     }
 
-    ESP_LOGD(LOG_TAG, "messageLength %d", *messageLength);
-    ESP_LOGD(LOG_TAG, "ndefStartIndex %d", *ndefStartIndex);
+    ESP_LOGD(LOG_TAG, "messageLength %d", _map.getNdefLength());
+    ESP_LOGD(LOG_TAG, "ndefStartIndex %d", _map.getNdefValueOffset());
+    _mapped = true;
+    if (_info != NULL)
+    {
+        _info->map = _map;
+        _info->mapped = true;
+        _info->formatted = true;
+    }
+    return true;
 }
 
-// buffer is larger than the message, need to handle some data before and after
-// message and need to ensure we read full pages
-uint16_t MifareUltralight::calculateBufferSize(uint16_t messageLength, uint16_t ndefStartIndex)
+// A cached map is used for a write when one READ of pages 3-6 shows the CC
+// unchanged and the NDEF TLV still where it was. That replaces the CC read
+// and the TLV walk, and catches a tag that was reformatted elsewhere.
+bool MifareUltralight::loadCachedMap()
 {
-    // TLV terminator 0xFE is 1 byte
-    uint16_t bufferSize = messageLength + ndefStartIndex + 1;
+    if (_info == NULL || !_info->mapped)
+    {
+        return false;
+    }
+
+    byte dataSize = ULTRALIGHT_READ_SIZE + 2;
+    byte data[ULTRALIGHT_READ_SIZE + 2];
+    NfcTransport::Status status = nfc->mifareRead(3, data, &dataSize);
+    if (status != NfcTransport::STATUS_OK)
+    {
+        ESP_LOGD(LOG_TAG, "Could not validate cached map - Status: %d", status);
+        _info->mapped = false;
+        return false;
+    }
 
-    if (bufferSize % ULTRALIGHT_READ_SIZE != 0)
+    byte *dataArea = &data[ULTRALIGHT_PAGE_SIZE];
+    uint16_t tlvOffset = _info->map.getNdefTlvOffset();
+    bool ccChanged = _info->ccKnown && memcmp(data, _info->cc, TYPE_2_CC_SIZE) != 0;
+    bool valid = !ccChanged && !(dataArea[0] == 0xFF && dataArea[1] == 0xFF && dataArea[2] == 0xFF && dataArea[3] == 0xFF);
+    if (_info->map.hasNdefTlv() && tlvOffset < ULTRALIGHT_READ_SIZE - ULTRALIGHT_PAGE_SIZE)
+    {
+        valid = valid && dataArea[tlvOffset] == TLV_NDEF;
+    }
+    if (!valid)
     {
-        // buffer must be an increment of page size
-        bufferSize = ((bufferSize / ULTRALIGHT_READ_SIZE) + 1) * ULTRALIGHT_READ_SIZE;
+        ESP_LOGD(LOG_TAG, "Cached map is stale");
+        _info->mapped = false;
+        if (ccChanged)
+        {
+            // another CC is another product, identify the tag again next time
+            _info->identified = false;
+        }
+        return false;
     }
 
-    //MFRC522 also return CRC
-    bufferSize += 2;
-    ESP_LOGD(LOG_TAG, "Buffer size is %d", bufferSize);
-    return bufferSize;
+    memcpy(_info->cc, data, TYPE_2_CC_SIZE);
+    _info->ccKnown = true;
+    _map = _info->map;
+    _mapped = true;
+    // pages 4-6 came with the CC, a write reading them back doesn't ask the tag again
+    _storage.load(0, dataArea, ULTRALIGHT_READ_SIZE - ULTRALIGHT_PAGE_SIZE);
+    return true;
 }
 
 bool MifareUltralight::write(NdefMessage& m)
 {
-    if (isUnformatted())
+    byte workspace[NDEF_WORKSPACE_SIZE];
+    return writeMessage(m, false, workspace, sizeof(workspace)) == NdefTlv::WRITE_COMMITTED;
+}
+
+bool MifareUltralight::write(NdefMessage& m, byte *workspace, uint16_t workspaceSize)
+{
+    return writeMessage(m, false, workspace, workspaceSize) == NdefTlv::WRITE_COMMITTED;
+}
+
+NdefTlv::WriteResult MifareUltralight::writeTransaction(NdefMessage& m)
+{
+    byte workspace[NDEF_WORKSPACE_SIZE];
+    return writeMessage(m, true, workspace, sizeof(workspace));
+}
+
+NdefTlv::WriteResult MifareUltralight::writeTransaction(NdefMessage& m, byte *workspace, uint16_t workspaceSize)
+{
+    return writeMessage(m, true, workspace, workspaceSize);
+}
+
+// the message is encoded behind room for the TLV header and framed in place
+NdefTlv::WriteResult MifareUltralight::writeMessage(NdefMessage& m, bool transactional, byte *workspace, uint16_t workspaceSize)
+{
+    uint16_t length = m.getEncodedSize();
+    if (NdefTlv::getWorkspaceSize(length) > workspaceSize)
     {
-        ESP_LOGI(LOG_TAG, "WARNING: Tag is not formatted.");
-        return false;
+        ESP_LOGE(LOG_TAG, "Workspace of %d bytes can't hold a message of %d", workspaceSize, length);
+        _status = NfcStatus();
+        _status.set(NfcStatus::ERROR_WORKSPACE, NfcStatus::OPERATION_WRITE);
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+    m.encode(&workspace[LONG_TLV_SIZE]);
+    return writeEncoded(&workspace[LONG_TLV_SIZE], length, transactional, workspace, workspaceSize);
+}
+
+NdefTlv::WriteResult MifareUltralight::writeEncoded(const byte *message, uint16_t messageLength, bool transactional)
+{
+    byte workspace[NDEF_WORKSPACE_SIZE];
+    return writeEncoded(message, messageLength, transactional, workspace, sizeof(workspace));
+}
+
+NdefTlv::WriteResult MifareUltralight::writeEncoded(const byte *message, uint16_t messageLength, bool transactional,
+    byte *workspace, uint16_t workspaceSize)
+{
+    _status = NfcStatus();
+    identify();
+    authenticate();
+
+    // the map is current if this driver already read or wrote the tag
+    if (!_mapped && !loadCachedMap())
+    {
+        if (isUnformatted())
+        {
+            ESP_LOGI(LOG_TAG, "WARNING: Tag is not formatted.");
+            _status.set(NfcStatus::ERROR_NOT_FORMATTED, NfcStatus::OPERATION_READ, ULTRALIGHT_DATA_START_PAGE);
+            return NdefTlv::WRITE_ROLLED_BACK;
+        }
+
+        if (!mapDataArea())
+        {
+            return NdefTlv::WRITE_ROLLED_BACK;
+        }
+    }
+
+    uint16_t tagCapacity = _map.getNdefCapacity();
+    if (messageLength > tagCapacity)
+    {
+        ESP_LOGD(LOG_TAG, "Encoded Message length exceeded tag Capacity %d", tagCapacity);
+        _status.set(NfcStatus::ERROR_TOO_LARGE, NfcStatus::OPERATION_WRITE);
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+
+    uint16_t start = _map.getNdefTlvOffset();
+    uint16_t tlvSize = NdefTlv::getTlvSize(messageLength, _map.usableBytes(start));
+    if (tlvSize > workspaceSize)
+    {
+        ESP_LOGE(LOG_TAG, "Workspace of %d bytes can't hold a TLV of %d", workspaceSize, tlvSize);
+        _status.set(NfcStatus::ERROR_WORKSPACE, NfcStatus::OPERATION_WRITE);
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+    // the message may be in the workspace already, memmove() shifts it behind the header
+    byte *encoded = workspace;
+    uint8_t headerSize = NdefTlv::getHeaderSize(messageLength);
+    memmove(encoded + headerSize, message, messageLength);
+    NdefTlv::encodeHeader(messageLength, encoded);
+    if (tlvSize > headerSize + messageLength)
+    {
+        encoded[tlvSize - 1] = TLV_TERMINATOR;
     }
-    uint16_t tagCapacity = readTagSize(); // meta info for tag
 
-    uint16_t messageLength  = m.getEncodedSize();
-    uint16_t ndefStartIndex = messageLength < 0xFF ? 2 : 4;
-    uint16_t bufferSize = calculateBufferSize(messageLength, ndefStartIndex);
+    ESP_LOGD(LOG_TAG, "messageLength %d", messageLength);
+    ESP_LOGD(LOG_TAG, "Tag Capacity %d", tagCapacity);
+    ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, encoded, tlvSize, ESP_LOG_DEBUG);
 
-    if(bufferSize>tagCapacity) {
-      ESP_LOGD(LOG_TAG, "Encoded Message length exceeded tag Capacity %d", tagCapacity);
-    	return false;
+    NdefTlv::WriteResult result;
+    if (transactional)
+    {
+        result = NdefTlv::writeTransaction(_storage, _map, start, encoded, tlvSize, headerSize);
+    }
+    else
+    {
+        bool written = NdefTlv::writeData(_storage, _map, start, _map.advance(start, tlvSize), encoded);
+        result = written ? NdefTlv::WRITE_COMMITTED : NdefTlv::WRITE_TORN;
+    }
+    if (result != NdefTlv::WRITE_COMMITTED && _status.ok())
+    {
+        _status.set(NfcStatus::ERROR_VERIFY, NfcStatus::OPERATION_WRITE);
+    }
+    // a torn write leaves the TLVs in an unknown state, a rolled back one left them as they were
+    _mapped = result != NdefTlv::WRITE_TORN;
+    if (result == NdefTlv::WRITE_COMMITTED)
+    {
+        _map.setNdefTlv(start, _map.nextUsable(_map.advance(start, headerSize)), messageLength);
+    }
+    if (_info != NULL)
+    {
+        _info->mapped = _mapped;
+        _info->map = _map;
     }
+    return result;
+}
 
-    uint8_t encoded[bufferSize];
-    uint8_t *  src = encoded;
-    unsigned int position = 0;
-    uint8_t page = ULTRALIGHT_DATA_START_PAGE;
+// The pages writeEncoded() writes to a tag with the layout info holds. A tag
+// not mapped yet is assumed to hold only an NDEF TLV, as it is shipped.
+void MifareUltralight::planWrite(const TagInfo& info, uint16_t messageLength, bool transactional, WritePlan& plan)
+{
+    plan.reset();
+    plan.messageLength = messageLength;
+    if (info.tagType != NfcTag::TYPE_2 || !info.identified)
+    {
+        return;
+    }
 
-    // Set message size. With ultralight should always be less than 0xFF but who knows?
+    TlvMap map = info.map;
+    if (!info.mapped)
+    {
+        map.reset(ULTRALIGHT_DATA_START_PAGE * ULTRALIGHT_PAGE_SIZE, info.dataAreaSize);
+        map.setNdefTlv(0, 0, 0);
+        plan.assumedLayout = true;
+    }
+    plan.known = true;
+    plan.capacity = map.getNdefCapacity();
+    plan.fits = messageLength <= plan.capacity;
+    if (!plan.fits)
+    {
+        return;
+    }
 
-    encoded[0] = 0x3;
-    if (messageLength < 0xFF)
+    uint16_t start = map.getNdefTlvOffset();
+    uint16_t tlvSize = NdefTlv::getTlvSize(messageLength, map.usableBytes(start));
+    plan.writeLength = tlvSize;
+    if (transactional)
     {
-        encoded[1] = messageLength;
+        NdefTlv::planTransaction(map, ULTRALIGHT_PAGE_SIZE, start, tlvSize, NdefTlv::getHeaderSize(messageLength), plan);
     }
     else
     {
-        encoded[1] = 0xFF;
-        encoded[2] = ((messageLength >> 8) & 0xFF);
-        encoded[3] = (messageLength & 0xFF);
+        NdefTlv::planData(map, ULTRALIGHT_PAGE_SIZE, start, map.advance(start, tlvSize), plan);
+    }
+    for (uint16_t i = 0; i < plan.unitCount; i++)
+    {
+        plan.units[i] = ULTRALIGHT_DATA_START_PAGE + plan.units[i] / ULTRALIGHT_PAGE_SIZE;
+    }
+
+    // READ returns 4 pages, FAST_READ up to NTAG_FAST_READ_MAX_PAGES
+    uint32_t readTime = WritePlan::exchangeTime(4, ULTRALIGHT_READ_SIZE + 2, 0);
+    uint16_t readPages = ULTRALIGHT_READ_SIZE / ULTRALIGHT_PAGE_SIZE;
+    uint32_t chunkTime = readTime;
+    if (info.fastRead)
+    {
+        readPages = NTAG_FAST_READ_MAX_PAGES;
+        chunkTime = WritePlan::exchangeTime(5, readPages * ULTRALIGHT_PAGE_SIZE + 2, 0);
     }
+    // a cached map is validated with one READ, otherwise the CC and the TLVs are read
+    uint16_t layoutReads = plan.assumedLayout ? 2 : 1;
+    plan.estimatedTime = (plan.reads + readPages - 1) / readPages * chunkTime + layoutReads * readTime +
+        plan.writes * WritePlan::exchangeTime(8, 1, NFC_TIME_WRITE_US);
+    plan.reads += layoutReads * ULTRALIGHT_READ_SIZE / ULTRALIGHT_PAGE_SIZE;
+    plan.authentications = info.keyKind != TagCredentials::KIND_NONE ? 1 : 0;
+    plan.estimatedTime += plan.authentications * WritePlan::exchangeTime(7, 4, NFC_TIME_AUTHENTICATE_US);
+}
 
-    m.encode(encoded+ndefStartIndex);
-    // this is always at least 1 byte copy because of terminator.
-    memset(encoded+ndefStartIndex+messageLength,0,bufferSize-ndefStartIndex-messageLength);
-    encoded[ndefStartIndex+messageLength] = 0xFE; // terminator
+uint16_t MifareUltralight::requiredWorkspace(const TagInfo& info)
+{
+    if (info.tagType != NfcTag::TYPE_2 || !info.identified)
+    {
+        return 0;
+    }
+    TlvMap map = info.map;
+    uint16_t capacity = info.mapped ? map.getNdefCapacity() : info.dataAreaSize;
+    return NdefTlv::getWorkspaceSize(capacity);
+}
 
-    ESP_LOGD(LOG_TAG, "messageLength %d", messageLength);
-    ESP_LOGD(LOG_TAG, "Tag Capacity %d", tagCapacity);
-    ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, encoded, bufferSize, ESP_LOG_DEBUG);
-
-    while (position < bufferSize){ //bufferSize is always times pagesize so no "last chunk" check
-        // Although we have to provide 16 bytes to MIFARE_Write only 4 of them are written onto the tag
-        byte writeBuffer[16] = {0};
-        memcpy (writeBuffer, src, 4);
-        // write page
-        if (nfc->MIFARE_Write(page, writeBuffer, 16) != MFRC522::STATUS_OK)
+// WRITE (0xA2) programs one page in a single frame, unlike COMPATIBILITY_WRITE
+// which needs a second 16 byte frame of which only 4 bytes land on the tag
+bool MifareUltralight::writePage(uint16_t page, byte *data)
+{
+    // writing the same data again is harmless, whether the first write landed or not
+    NfcRetry retry(_retryPolicy, nfc);
+    NfcTransport::Status status;
+    while ((status = nfc->ultralightWrite(page, data)) != NfcTransport::STATUS_OK)
+    {
+        ESP_LOGD(LOG_TAG, "Page %d: Write Failed - Status: %d", page, status);
+        _status.setTransport(status, NfcStatus::OPERATION_WRITE, page);
+        if (!recover(retry))
+        {
             return false;
-        ESP_LOGD(LOG_TAG, "Wrote page %d", page);
-    	  ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, src, ULTRALIGHT_PAGE_SIZE, ESP_LOG_DEBUG);
-        page++;
-        src+=ULTRALIGHT_PAGE_SIZE;
-        position+=ULTRALIGHT_PAGE_SIZE;
+        }
     }
+    if (!_status.ok())
+    {
+        _status.clearError();
+    }
+    ESP_LOGD(LOG_TAG, "Wrote page %d", page);
+    ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, data, ULTRALIGHT_PAGE_SIZE, ESP_LOG_DEBUG);
     return true;
 }
 
@@ -235,22 +1015,227 @@ bool MifareUltralight::write(NdefMessage& m)
 // zero out tag data like the NXP Tag Write Android application
 bool MifareUltralight::clean()
 {
-    uint16_t tagCapacity = readTagSize();
-
-    uint8_t pages = (tagCapacity / ULTRALIGHT_PAGE_SIZE) + ULTRALIGHT_DATA_START_PAGE;
+    _status = NfcStatus();
+    identify();
+    authenticate();
 
     // factory tags have 0xFF, but OTP-CC blocks have already been set so we use 0x00
-    byte data[16] = { 0 };
+    // reserved and lock areas declared by the current TLVs are left alone
+    if (isUnformatted() || !mapDataArea())
+    {
+        _map.reset(ULTRALIGHT_DATA_START_PAGE * ULTRALIGHT_PAGE_SIZE, getCapacity());
+    }
+    _mapped = false;
+
+    if (_info != NULL)
+    {
+        _info->mapped = false;
+    }
+    return NdefTlv::writeData(_storage, _map, 0, _map.getDataAreaSize(), NULL);
+}
+
+// Pages a READ or FAST_READ returns, the Ultralight C keys and what follows
+// the configuration pages of NTAG21x and Ultralight EV1 can't be read
+uint16_t MifareUltralight::getImagePages()
+{
+    switch (_product)
+    {
+        case PRODUCT_ULTRALIGHT: return 16;
+        case PRODUCT_ULTRALIGHT_C: return 44;
+        case PRODUCT_ULTRALIGHT_EV1_MF0UL11:
+        case PRODUCT_NTAG210: return 20;
+        case PRODUCT_ULTRALIGHT_EV1_MF0UL21:
+        case PRODUCT_NTAG212: return 41;
+        case PRODUCT_NTAG213: return 45;
+        case PRODUCT_NTAG215: return 135;
+        case PRODUCT_NTAG216: return 231;
+        default: return ULTRALIGHT_DATA_START_PAGE + _userPages;
+    }
+}
+
+// Pages are read as many at a time as a command returns, a password or
+// Ultralight C key known for the tag is used first so protected pages read.
+bool MifareUltralight::dumpImage(TagImageSink& sink, uint16_t *nextPage)
+{
+    _status = NfcStatus();
+    identify();
+    authenticate();
+
+    uint16_t pages = getImagePages();
+    byte data[NTAG_FAST_READ_MAX_PAGES * ULTRALIGHT_PAGE_SIZE];
+    while (*nextPage < pages)
+    {
+        uint16_t chunk = _fastRead ? NTAG_FAST_READ_MAX_PAGES : ULTRALIGHT_READ_SIZE / ULTRALIGHT_PAGE_SIZE;
+        if (chunk > pages - *nextPage)
+        {
+            chunk = pages - *nextPage;
+        }
+        if (!readPages(*nextPage, chunk, data))
+        {
+            return false;
+        }
+        for (uint16_t i = 0; i < chunk; i++)
+        {
+            if (!sink.write(*nextPage, &data[i * ULTRALIGHT_PAGE_SIZE], ULTRALIGHT_PAGE_SIZE))
+            {
+                ESP_LOGE(LOG_TAG, "Error. Image sink refused page %d", *nextPage);
+                _status.set(NfcStatus::ERROR_IMAGE, NfcStatus::OPERATION_READ, *nextPage);
+                return false;
+            }
+            (*nextPage)++;
+        }
+    }
+    return true;
+}
+
+// Only the CC and the user pages are written. The UID is fixed, lock bits and
+// the OTP CC bits only ever get set, and the configuration pages would apply
+// the source tag's password and protection, so those pages are left as they
+// are. A page already holding the image's bytes isn't written, each chunk is
+// read first, so a restore resumed after a field loss writes little twice.
+bool MifareUltralight::restoreImage(TagImageSource& source, uint16_t *nextPage)
+{
+    _status = NfcStatus();
+    identify();
+    authenticate();
+    _mapped = false;
+    _storage.invalidate();
+    if (_info != NULL)
+    {
+        _info->mapped = false;
+        _info->ccKnown = false;
+    }
+    if (*nextPage < ULTRALIGHT_CC_PAGE)
+    {
+        *nextPage = ULTRALIGHT_CC_PAGE;
+    }
+
+    byte data[ULTRALIGHT_PAGE_SIZE];
+    if (_product == PRODUCT_UNKNOWN)
+    {
+        // a blank Ultralight has no CC to be sized from, the image's CC is what it gets
+        if (!source.read(ULTRALIGHT_CC_PAGE, data, ULTRALIGHT_PAGE_SIZE))
+        {
+            _status.set(NfcStatus::ERROR_IMAGE, NfcStatus::OPERATION_WRITE, ULTRALIGHT_CC_PAGE);
+            return false;
+        }
+        _userPages = data[2] * 8 / ULTRALIGHT_PAGE_SIZE;
+        // identified again from the restored CC
+        _identified = false;
+    }
 
-    for (int i = ULTRALIGHT_DATA_START_PAGE; i < pages; i++)
+    uint16_t pages = ULTRALIGHT_DATA_START_PAGE + _userPages;
+    byte current[NTAG_FAST_READ_MAX_PAGES * ULTRALIGHT_PAGE_SIZE];
+    while (*nextPage < pages)
     {
-        
-        ESP_LOGD(LOG_TAG, "Wrote page %d", i);
-        ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, data, ULTRALIGHT_PAGE_SIZE, ESP_LOG_DEBUG);
-        if (nfc->MIFARE_Write(i, data, 16) != MFRC522::STATUS_OK)
+        uint16_t chunk = _fastRead ? NTAG_FAST_READ_MAX_PAGES : ULTRALIGHT_READ_SIZE / ULTRALIGHT_PAGE_SIZE;
+        if (chunk > pages - *nextPage)
+        {
+            chunk = pages - *nextPage;
+        }
+        if (!readPages(*nextPage, chunk, current))
         {
             return false;
         }
+        for (uint16_t i = 0; i < chunk; i++)
+        {
+            if (!source.read(*nextPage, data, ULTRALIGHT_PAGE_SIZE))
+            {
+                ESP_LOGE(LOG_TAG, "Error. Image source has no page %d", *nextPage);
+                _status.set(NfcStatus::ERROR_IMAGE, NfcStatus::OPERATION_WRITE, *nextPage);
+                return false;
+            }
+            if (memcmp(data, &current[i * ULTRALIGHT_PAGE_SIZE], ULTRALIGHT_PAGE_SIZE) != 0 && !writePage(*nextPage, data))
+            {
+                return false;
+            }
+            (*nextPage)++;
+        }
+    }
+    return true;
+}
+
+UltralightTlvStorage::UltralightTlvStorage(MifareUltralight *tag)
+{
+    _tag = tag;
+    invalidate();
+}
+
+void UltralightTlvStorage::invalidate()
+{
+    _chunkOffset = 0;
+    _chunkLength = 0;
+}
+
+bool UltralightTlvStorage::read(uint16_t offset, byte *data, uint16_t length)
+{
+    while (length > 0)
+    {
+        if (offset < _chunkOffset || offset >= _chunkOffset + _chunkLength)
+        {
+            // fetch the chunk holding offset, as many pages as one command returns
+            uint16_t page = offset / ULTRALIGHT_PAGE_SIZE;
+            uint16_t pageCount = _tag->supportsFastRead() ? NTAG_FAST_READ_MAX_PAGES : ULTRALIGHT_READ_SIZE / ULTRALIGHT_PAGE_SIZE;
+            uint16_t userPages = _tag->getCapacity() / ULTRALIGHT_PAGE_SIZE;
+            if (page >= userPages)
+            {
+                return false;
+            }
+            if (page + pageCount > userPages)
+            {
+                pageCount = userPages - page;
+            }
+            _chunkLength = 0;
+            if (!_tag->readPages(ULTRALIGHT_DATA_START_PAGE + page, pageCount, _chunk))
+            {
+                return false;
+            }
+            _chunkOffset = page * ULTRALIGHT_PAGE_SIZE;
+            _chunkLength = pageCount * ULTRALIGHT_PAGE_SIZE;
+        }
+
+        uint16_t count = _chunkOffset + _chunkLength - offset;
+        if (count > length)
+        {
+            count = length;
+        }
+        memcpy(data, &_chunk[offset - _chunkOffset], count);
+        offset += count;
+        data += count;
+        length -= count;
+    }
+    return true;
+}
+
+bool UltralightTlvStorage::write(uint16_t offset, byte *data)
+{
+    if (!_tag->writePage(ULTRALIGHT_DATA_START_PAGE + offset / ULTRALIGHT_PAGE_SIZE, data))
+    {
+        _chunkLength = 0;
+        return false;
+    }
+
+    // keep the cached chunk in step with the tag
+    if (offset >= _chunkOffset && offset < _chunkOffset + _chunkLength)
+    {
+        memcpy(&_chunk[offset - _chunkOffset], data, ULTRALIGHT_PAGE_SIZE);
     }
     return true;
 }
+
+void UltralightTlvStorage::load(uint16_t offset, const byte *data, uint16_t length)
+{
+    if (length > sizeof(_chunk))
+    {
+        length = sizeof(_chunk);
+    }
+    memcpy(_chunk, data, length);
+    _chunkOffset = offset;
+    _chunkLength = length;
+}
+
+uint8_t UltralightTlvStorage::getUnitSize()
+{
+    return ULTRALIGHT_PAGE_SIZE;
+}
+#endif
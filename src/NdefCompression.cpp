@@ -0,0 +1,235 @@
+#include <cstdlib>
+#include <esp_log.h>
+#include "NdefCompression.h"
+#ifdef NDEF_SUPPORT_COMPRESSION
+
+static const char* LOG_TAG = "NDef Compression";
+
+// Each position takes the longest match within the window, found by
+// comparing against every earlier position. Payloads are a few hundred bytes,
+// so that is fast enough and needs no hash table.
+uint16_t NdefCompression::compress(const byte *data, uint16_t length, byte *output, uint16_t outputSize)
+{
+    uint16_t position = 0;
+    uint16_t written = 0;
+    uint16_t flags = 0;
+    uint8_t token = 8;
+    while (position < length)
+    {
+        if (token == 8)
+        {
+            if (written >= outputSize)
+            {
+                return 0;
+            }
+            flags = written++;
+            output[flags] = 0;
+            token = 0;
+        }
+
+        uint16_t maxLength = length - position;
+        if (maxLength > NDEF_COMPRESSION_MAX_MATCH)
+        {
+            maxLength = NDEF_COMPRESSION_MAX_MATCH;
+        }
+        uint16_t bestLength = 0;
+        uint16_t bestDistance = 0;
+        uint16_t start = position > NDEF_COMPRESSION_WINDOW ? position - NDEF_COMPRESSION_WINDOW : 0;
+        for (uint16_t candidate = start; candidate < position && bestLength < maxLength; candidate++)
+        {
+            uint16_t matchLength = 0;
+            while (matchLength < maxLength && data[candidate + matchLength] == data[position + matchLength])
+            {
+                matchLength++;
+            }
+            if (matchLength > bestLength)
+            {
+                bestLength = matchLength;
+                bestDistance = position - candidate;
+            }
+        }
+
+        if (bestLength >= NDEF_COMPRESSION_MIN_MATCH)
+        {
+            if (written + 2 > outputSize)
+            {
+                return 0;
+            }
+            uint16_t distance = bestDistance - 1;
+            output[written++] = distance >> 2;
+            output[written++] = ((distance & 0x03) << 6) | (bestLength - NDEF_COMPRESSION_MIN_MATCH);
+            output[flags] |= 1 << token;
+            position += bestLength;
+        }
+        else
+        {
+            if (written >= outputSize)
+            {
+                return 0;
+            }
+            output[written++] = data[position++];
+        }
+        token++;
+    }
+    return written;
+}
+
+int NdefCompression::decompress(const byte *data, uint16_t length, byte *output, uint16_t outputSize)
+{
+    uint16_t index = 0;
+    int written = 0;
+    byte flags = 0;
+    uint8_t token = 8;
+    while (index < length)
+    {
+        if (token == 8)
+        {
+            flags = data[index++];
+            token = 0;
+            continue;
+        }
+
+        if (flags & (1 << token))
+        {
+            if (index + 2 > length)
+            {
+                return -1;
+            }
+            int distance = ((data[index] << 2) | (data[index + 1] >> 6)) + 1;
+            int matchLength = (data[index + 1] & 0x3F) + NDEF_COMPRESSION_MIN_MATCH;
+            index += 2;
+            if (distance > written || written + matchLength > outputSize)
+            {
+                return -1;
+            }
+            // a match may overlap what it copies, so byte by byte
+            for (int i = 0; i < matchLength; i++)
+            {
+                output[written] = output[written - distance];
+                written++;
+            }
+        }
+        else
+        {
+            if (written >= outputSize)
+            {
+                return -1;
+            }
+            output[written++] = data[index++];
+        }
+        token++;
+    }
+    return written;
+}
+
+bool NdefCompression::compressRecord(NdefRecord& record)
+{
+    unsigned int typeLength = record.getTypeLength();
+    unsigned int payloadLength = record.getPayloadLength();
+    if (isCompressed(record) || record.getTnf() == NdefRecord::TNF_EMPTY || typeLength > 0xFF ||
+        payloadLength == 0 || payloadLength > 0xFFFF)
+    {
+        return false;
+    }
+
+    // TNF, type length, type and payload length, then the compressed payload
+    unsigned int headerLength = 2 + typeLength + 2;
+    byte *payload = (byte*)NDEF_MALLOC(headerLength + payloadLength);
+    if (payload == NULL)
+    {
+        ESP_LOGE(LOG_TAG, "Could not allocate %d bytes", headerLength + payloadLength);
+        return false;
+    }
+    payload[0] = record.getTnf();
+    payload[1] = typeLength;
+    if (typeLength > 0)
+    {
+        memcpy(&payload[2], record.getType(), typeLength);
+    }
+    payload[2 + typeLength] = payloadLength >> 8;
+    payload[3 + typeLength] = payloadLength & 0xFF;
+    uint16_t length = compress(record.getPayload(), payloadLength, &payload[headerLength], payloadLength);
+
+    NdefRecord compressed = record;
+    compressed.setTnf(NdefRecord::TNF_EXTERNAL_TYPE);
+    compressed.setType((const byte*)NDEF_COMPRESSED_TYPE, strlen(NDEF_COMPRESSED_TYPE));
+    compressed.setPayload(payload, headerLength + length);
+    NDEF_FREE(payload);
+
+    if (length == 0 || compressed.getEncodedSize() >= record.getEncodedSize())
+    {
+        ESP_LOGD(LOG_TAG, "Payload of %d bytes doesn't get smaller", payloadLength);
+        return false;
+    }
+    ESP_LOGD(LOG_TAG, "Payload of %d bytes compressed to %d", payloadLength, length);
+    record = compressed;
+    return true;
+}
+
+bool NdefCompression::isCompressed(NdefRecord& record)
+{
+    unsigned int typeLength = strlen(NDEF_COMPRESSED_TYPE);
+    return record.getTnf() == NdefRecord::TNF_EXTERNAL_TYPE && record.getTypeLength() == typeLength &&
+        memcmp(record.getType(), NDEF_COMPRESSED_TYPE, typeLength) == 0;
+}
+
+uint16_t NdefCompression::getOriginalLength(NdefRecord& record)
+{
+    if (!isCompressed(record) || record.getPayloadLength() < 2)
+    {
+        return 0;
+    }
+    const byte *payload = record.getPayload();
+    unsigned int typeLength = payload[1];
+    if (record.getPayloadLength() < 4 + typeLength)
+    {
+        return 0;
+    }
+    return (payload[2 + typeLength] << 8) | payload[3 + typeLength];
+}
+
+int NdefCompression::decompressPayload(const byte *payload, uint16_t length, byte *output, uint16_t outputSize)
+{
+    if (length < 2 || length < 4 + payload[1])
+    {
+        ESP_LOGE(LOG_TAG, "Error. Compressed payload of %d bytes has no header", length);
+        return -1;
+    }
+    unsigned int typeLength = payload[1];
+    unsigned int headerLength = 2 + typeLength + 2;
+    uint16_t originalLength = (payload[2 + typeLength] << 8) | payload[3 + typeLength];
+    if (originalLength > outputSize)
+    {
+        ESP_LOGE(LOG_TAG, "Error. Payload of %d bytes doesn't fit in %d", originalLength, outputSize);
+        return -1;
+    }
+    if (decompress(&payload[headerLength], length - headerLength, output, originalLength) != originalLength)
+    {
+        ESP_LOGE(LOG_TAG, "Error. Compressed payload is corrupt");
+        return -1;
+    }
+    return originalLength;
+}
+
+bool NdefCompression::decompressRecord(NdefRecord& record, byte *buffer, uint16_t bufferSize)
+{
+    uint16_t originalLength = getOriginalLength(record);
+    if (originalLength == 0)
+    {
+        return false;
+    }
+    if (decompressPayload(record.getPayload(), record.getPayloadLength(), buffer, bufferSize) < 0)
+    {
+        return false;
+    }
+
+    const byte *payload = record.getPayload();
+    unsigned int typeLength = payload[1];
+    NdefRecord original = record;
+    original.setTnf((NdefRecord::TNF)(payload[0] & 0x07));
+    original.setType(&payload[2], typeLength);
+    original.setPayload(buffer, originalLength);
+    record = original;
+    return true;
+}
+#endif
@@ -15,7 +15,7 @@ NdefMessage::NdefMessage(const byte * data, const uint16_t numBytes)
 
     _recordCount = 0;
 
-    int index = 0;
+    uint32_t index = 0;
 
     while (index < numBytes)
     {
@@ -30,8 +30,13 @@ NdefMessage::NdefMessage(const byte * data, const uint16_t numBytes)
         bool il = tnf_byte & 0x8;
         NdefRecord::TNF tnf = static_cast<NdefRecord::TNF>(tnf_byte & 0x7);
 
-        NdefRecord *record = new NdefRecord();
-        record->setTnf(tnf);
+        // tnf, type length, payload length and id length
+        uint32_t headerLength = 2 + (sr ? 1 : 4) + (il ? 1 : 0);
+        if (index + headerLength > numBytes)
+        {
+            ESP_LOGE(LOG_TAG, "Error. Record header at %d runs past the end of the message", index);
+            break;
+        }
 
         index++;
         int typeLength = data[index];
@@ -44,11 +49,12 @@ NdefMessage::NdefMessage(const byte * data, const uint16_t numBytes)
         }
         else
         {
+            // 4 byte payload length follows the type length
             payloadLength =
-                  (static_cast<uint32_t>(data[index])   << 24)
-                | (static_cast<uint32_t>(data[index+1]) << 16)
-                | (static_cast<uint32_t>(data[index+2]) << 8)
-                |  static_cast<uint32_t>(data[index+3]);
+                  (static_cast<uint32_t>(data[index+1]) << 24)
+                | (static_cast<uint32_t>(data[index+2]) << 16)
+                | (static_cast<uint32_t>(data[index+3]) << 8)
+                |  static_cast<uint32_t>(data[index+4]);
             index += 4;
         }
 
@@ -60,6 +66,21 @@ NdefMessage::NdefMessage(const byte * data, const uint16_t numBytes)
         }
 
         index++;
+        if (index + typeLength + idLength + payloadLength > numBytes)
+        {
+            ESP_LOGE(LOG_TAG, "Error. Record of %d bytes runs past the end of the message", (int)payloadLength);
+            break;
+        }
+
+        if (_recordCount >= MAX_NDEF_RECORDS)
+        {
+            ESP_LOGW(LOG_TAG, "WARNING: Too many records. Increase MAX_NDEF_RECORDS.");
+            break;
+        }
+
+        NdefRecord *record = new NdefRecord();
+        record->setTnf(tnf);
+
         record->setType(&data[index], typeLength);
         index += typeLength;
 
@@ -80,6 +101,20 @@ NdefMessage::NdefMessage(const byte * data, const uint16_t numBytes)
 
 }
 
+NdefMessage::NdefMessage(const byte *data, const uint16_t numBytes, byte *buffer, uint16_t bufferSize)
+    : NdefMessage(data, numBytes)
+{
+#ifdef NDEF_SUPPORT_COMPRESSION
+    if (!decompress(buffer, bufferSize))
+    {
+        ESP_LOGW(LOG_TAG, "Compressed records left as they are");
+    }
+#else
+    (void)buffer;
+    (void)bufferSize;
+#endif
+}
+
 NdefMessage::NdefMessage(const NdefMessage& rhs)
 {
     _recordCount = 0;
@@ -226,6 +261,34 @@ void NdefMessage::addUriRecord(const char *uri)
     addRecord(r);
 }
 
+#ifdef NDEF_SUPPORT_COMPRESSION
+uint8_t NdefMessage::compress()
+{
+    uint8_t compressed = 0;
+    for (unsigned int i = 0; i < _recordCount; i++)
+    {
+        if (NdefCompression::compressRecord(*_records[i]))
+        {
+            compressed++;
+        }
+    }
+    return compressed;
+}
+
+bool NdefMessage::decompress(byte *buffer, uint16_t bufferSize)
+{
+    bool success = true;
+    for (unsigned int i = 0; i < _recordCount; i++)
+    {
+        if (NdefCompression::isCompressed(*_records[i]) && !NdefCompression::decompressRecord(*_records[i], buffer, bufferSize))
+        {
+            success = false;
+        }
+    }
+    return success;
+}
+#endif
+
 // Type shoulde be something like my.com:xx
 void NdefMessage::addExternalRecord(const char *type, const byte *payload, const uint16_t payloadLength)
 {
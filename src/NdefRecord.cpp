@@ -28,19 +28,19 @@ NdefRecord::NdefRecord(const NdefRecord& rhs)
 
     if (_typeLength)
     {
-        _type = (byte*)malloc(_typeLength);
+        _type = (byte*)NDEF_MALLOC(_typeLength);
         memcpy(_type, rhs._type, _typeLength);
     }
 
     if (_payloadLength)
     {
-        _payload = (byte*)malloc(_payloadLength);
+        _payload = (byte*)NDEF_MALLOC(_payloadLength);
         memcpy(_payload, rhs._payload, _payloadLength);
     }
 
     if (_idLength)
     {
-        _id = (byte*)malloc(_idLength);
+        _id = (byte*)NDEF_MALLOC(_idLength);
         memcpy(_id, rhs._id, _idLength);
     }
 
@@ -48,9 +48,9 @@ NdefRecord::NdefRecord(const NdefRecord& rhs)
 
 NdefRecord::~NdefRecord()
 {
-    free(_type);
-    free(_payload);
-    free(_id);
+    NDEF_FREE(_type);
+    NDEF_FREE(_payload);
+    NDEF_FREE(_id);
 }
 
 NdefRecord& NdefRecord::operator=(const NdefRecord& rhs)
@@ -60,9 +60,9 @@ NdefRecord& NdefRecord::operator=(const NdefRecord& rhs)
     if (this != &rhs)
     {
         // free existing
-        free(_type);
-        free(_payload);
-        free(_id);
+        NDEF_FREE(_type);
+        NDEF_FREE(_payload);
+        NDEF_FREE(_id);
 
         _tnf = rhs._tnf;
         _typeLength = rhs._typeLength;
@@ -71,7 +71,7 @@ NdefRecord& NdefRecord::operator=(const NdefRecord& rhs)
 
         if (_typeLength)
         {
-            _type = (byte*)malloc(_typeLength);
+            _type = (byte*)NDEF_MALLOC(_typeLength);
             if(_type)
                 memcpy(_type, rhs._type, _typeLength);
             else
@@ -84,7 +84,7 @@ NdefRecord& NdefRecord::operator=(const NdefRecord& rhs)
 
         if (_payloadLength)
         {
-            _payload = (byte*)malloc(_payloadLength);
+            _payload = (byte*)NDEF_MALLOC(_payloadLength);
             if(_payload)
                 memcpy(_payload, rhs._payload, _payloadLength);
             else
@@ -97,7 +97,7 @@ NdefRecord& NdefRecord::operator=(const NdefRecord& rhs)
 
         if (_idLength)
         {
-            _id = (byte*)malloc(_idLength);
+            _id = (byte*)NDEF_MALLOC(_idLength);
             if(_id)
                 memcpy(_id, rhs._id, _idLength);
             else
@@ -165,8 +165,11 @@ void NdefRecord::encode(byte *data, bool firstRecord, bool lastRecord)
     }
 
     //Serial.println(2);
-    memcpy(data_ptr, _type, _typeLength);
-    data_ptr += _typeLength;
+    if (_typeLength)
+    {
+        memcpy(data_ptr, _type, _typeLength);
+        data_ptr += _typeLength;
+    }
 
     if (_idLength)
     {
@@ -174,8 +177,11 @@ void NdefRecord::encode(byte *data, bool firstRecord, bool lastRecord)
         data_ptr += _idLength;
     }
     
-    memcpy(data_ptr, _payload, _payloadLength);
-    data_ptr += _payloadLength;
+    if (_payloadLength)
+    {
+        memcpy(data_ptr, _payload, _payloadLength);
+        data_ptr += _payloadLength;
+    }
 }
 
 byte NdefRecord::_getTnfByte(bool firstRecord, bool lastRecord)
@@ -238,9 +244,9 @@ const byte* NdefRecord::getType()
 
 void NdefRecord::setType(const byte *type, const unsigned int numBytes)
 {
-    free(_type);
+    NDEF_FREE(_type);
 
-    _type = (uint8_t*)malloc(numBytes);
+    _type = (uint8_t*)NDEF_MALLOC(numBytes);
     memcpy(_type, type, numBytes);
     _typeLength = numBytes;
 }
@@ -252,18 +258,18 @@ const byte* NdefRecord::getPayload()
 
 void NdefRecord::setPayload(const byte *payload, const int numBytes)
 {
-    free(_payload);
+    NDEF_FREE(_payload);
 
-    _payload = (byte*)malloc(numBytes);
+    _payload = (byte*)NDEF_MALLOC(numBytes);
     memcpy(_payload, payload, numBytes);
     _payloadLength = numBytes;
 }
 
 void NdefRecord::setPayload(const byte *header, const int headerLength, const byte *payload, const int payloadLength)
 {
-    free(_payload);
+    NDEF_FREE(_payload);
 
-    _payload = (byte*)malloc(headerLength+payloadLength);
+    _payload = (byte*)NDEF_MALLOC(headerLength+payloadLength);
     memcpy(_payload, header, headerLength);
     memcpy(_payload+headerLength, payload, payloadLength);
     _payloadLength = headerLength+payloadLength;
@@ -276,9 +282,9 @@ const byte* NdefRecord::getId()
 
 void NdefRecord::setId(const byte *id, const unsigned int numBytes)
 {
-    free(_id);
+    NDEF_FREE(_id);
 
-    _id = (byte*)malloc(numBytes);
+    _id = (byte*)NDEF_MALLOC(numBytes);
     memcpy(_id, id, numBytes);
     _idLength = numBytes;
 }
@@ -0,0 +1,118 @@
+#include <cstdlib>
+#include <esp_log.h>
+#include "NdefTemplate.h"
+
+static const char* LOG_TAG = "NDef Template";
+
+NdefTemplate::NdefTemplate(NdefMessage& message)
+{
+    _encodedSize = message.getEncodedSize();
+    _encoded = (byte*)NDEF_MALLOC(_encodedSize);
+    if (_encoded == NULL)
+    {
+        ESP_LOGE(LOG_TAG, "Could not allocate %d bytes", _encodedSize);
+        _encodedSize = 0;
+    }
+    else
+    {
+        message.encode(_encoded);
+    }
+    _slotCount = 0;
+}
+
+NdefTemplate::~NdefTemplate()
+{
+    NDEF_FREE(_encoded);
+}
+
+bool NdefTemplate::addSlot(const char *placeholder, SlotType type)
+{
+    size_t length = strlen(placeholder);
+    if (_slotCount >= NDEF_TEMPLATE_MAX_SLOTS || length == 0 || length > UINT8_MAX || length > _encodedSize)
+    {
+        ESP_LOGE(LOG_TAG, "Error. Can not add slot %s", placeholder);
+        return false;
+    }
+
+    for (uint16_t offset = 0; offset + length <= _encodedSize; offset++)
+    {
+        if (memcmp(&_encoded[offset], placeholder, length) == 0 && isFree(offset, length))
+        {
+            Slot *slot = &_slots[_slotCount++];
+            slot->offset = offset;
+            slot->length = length;
+            slot->type = type;
+            return true;
+        }
+    }
+
+    ESP_LOGE(LOG_TAG, "Error. Placeholder %s not in message", placeholder);
+    return false;
+}
+
+// a placeholder used twice gives a slot for each occurrence
+bool NdefTemplate::isFree(uint16_t offset, uint8_t length)
+{
+    for (uint8_t i = 0; i < _slotCount; i++)
+    {
+        if (offset < _slots[i].offset + _slots[i].length && _slots[i].offset < offset + length)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint8_t NdefTemplate::getSlotCount()
+{
+    return _slotCount;
+}
+
+uint16_t NdefTemplate::getEncodedSize()
+{
+    return _encodedSize;
+}
+
+bool NdefTemplate::patch(const byte *uid, uint8_t uidLength, uint32_t serial, byte *data)
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    memcpy(data, _encoded, _encodedSize);
+    for (uint8_t i = 0; i < _slotCount; i++)
+    {
+        byte *field = &data[_slots[i].offset];
+        uint8_t length = _slots[i].length;
+        memset(field, '0', length);
+
+        if (_slots[i].type == SLOT_UID_HEX)
+        {
+            if (uidLength * 2 > length)
+            {
+                ESP_LOGE(LOG_TAG, "Error. %d byte UID doesn't fit %d characters", uidLength, length);
+                return false;
+            }
+            byte *digit = field + length - uidLength * 2;
+            for (uint8_t j = 0; j < uidLength; j++)
+            {
+                *digit++ = hex[uid[j] >> 4];
+                *digit++ = hex[uid[j] & 0x0F];
+            }
+        }
+        else
+        {
+            uint32_t value = serial;
+            int position = length - 1;
+            do
+            {
+                if (position < 0)
+                {
+                    ESP_LOGE(LOG_TAG, "Error. Serial %u doesn't fit %d characters", (unsigned int)serial, length);
+                    return false;
+                }
+                field[position--] = '0' + value % 10;
+                value /= 10;
+            } while (value > 0);
+        }
+    }
+    return true;
+}
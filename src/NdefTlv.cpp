@@ -0,0 +1,646 @@
+#include <esp_log.h>
+#include "NdefTlv.h"
+
+static const char* LOG_TAG = "NDef TLV";
+
+TlvMap::TlvMap()
+{
+    reset(0, 0);
+}
+
+void TlvMap::reset(uint16_t baseAddress, uint16_t dataAreaSize)
+{
+    _baseAddress = baseAddress;
+    _dataAreaSize = dataAreaSize;
+    _areaCount = 0;
+    _ndefTlvOffset = 0;
+    _ndefValueOffset = 0;
+    _ndefLength = 0;
+}
+
+bool TlvMap::addArea(uint16_t address, uint16_t length, bool lock)
+{
+    // areas outside the data area don't change the TLV layout
+    if (address < _baseAddress || address >= _baseAddress + _dataAreaSize)
+    {
+        ESP_LOGD(LOG_TAG, "Area 0x%x (%d bytes) is outside the data area", address, length);
+        return true;
+    }
+
+    if (_areaCount >= TLV_MAX_AREAS)
+    {
+        ESP_LOGW(LOG_TAG, "WARNING: Too many reserved areas. Increase TLV_MAX_AREAS.");
+        return false;
+    }
+
+    uint16_t offset = address - _baseAddress;
+    if (length > _dataAreaSize - offset)
+    {
+        length = _dataAreaSize - offset;
+    }
+
+    _areas[_areaCount].offset = offset;
+    _areas[_areaCount].length = length;
+    _areas[_areaCount].lock = lock;
+    _areaCount++;
+
+    ESP_LOGD(LOG_TAG, "%s area at offset %d, %d bytes", lock ? "Lock" : "Reserved", offset, length);
+    return true;
+}
+
+bool TlvMap::isReserved(uint16_t offset)
+{
+    for (uint8_t i = 0; i < _areaCount; i++)
+    {
+        if (offset >= _areas[i].offset && offset < _areas[i].offset + _areas[i].length)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint16_t TlvMap::nextUsable(uint16_t offset)
+{
+    bool moved = true;
+    while (moved)
+    {
+        moved = false;
+        for (uint8_t i = 0; i < _areaCount; i++)
+        {
+            if (offset >= _areas[i].offset && offset < _areas[i].offset + _areas[i].length)
+            {
+                offset = _areas[i].offset + _areas[i].length;
+                moved = true;
+            }
+        }
+    }
+    return offset;
+}
+
+uint16_t TlvMap::getRunLength(uint16_t offset)
+{
+    if (offset >= _dataAreaSize || isReserved(offset))
+    {
+        return 0;
+    }
+
+    uint16_t end = _dataAreaSize;
+    for (uint8_t i = 0; i < _areaCount; i++)
+    {
+        if (_areas[i].offset > offset && _areas[i].offset < end)
+        {
+            end = _areas[i].offset;
+        }
+    }
+    return end - offset;
+}
+
+uint16_t TlvMap::advance(uint16_t offset, uint16_t count)
+{
+    while (count > 0)
+    {
+        offset = nextUsable(offset);
+        uint16_t run = getRunLength(offset);
+        if (run == 0)
+        {
+            break;
+        }
+        if (run > count)
+        {
+            run = count;
+        }
+        offset += run;
+        count -= run;
+    }
+    return offset;
+}
+
+uint16_t TlvMap::usableBytes(uint16_t offset)
+{
+    uint16_t usable = 0;
+    offset = nextUsable(offset);
+    while (offset < _dataAreaSize)
+    {
+        uint16_t run = getRunLength(offset);
+        usable += run;
+        offset = nextUsable(offset + run);
+    }
+    return usable;
+}
+
+void TlvMap::setNdefTlv(uint16_t tlvOffset, uint16_t valueOffset, uint16_t length)
+{
+    _ndefTlvOffset = tlvOffset;
+    _ndefValueOffset = valueOffset;
+    _ndefLength = length;
+}
+
+bool TlvMap::hasNdefTlv()
+{
+    return _ndefValueOffset > _ndefTlvOffset;
+}
+
+uint16_t TlvMap::getNdefTlvOffset()
+{
+    return _ndefTlvOffset;
+}
+
+uint16_t TlvMap::getNdefValueOffset()
+{
+    return _ndefValueOffset;
+}
+
+uint16_t TlvMap::getNdefLength()
+{
+    return _ndefLength;
+}
+
+uint16_t TlvMap::getNdefCapacity()
+{
+    uint16_t usable = usableBytes(_ndefTlvOffset);
+
+    if (usable <= SHORT_TLV_SIZE)
+    {
+        return 0;
+    }
+    else if (usable - SHORT_TLV_SIZE < 0xFF)
+    {
+        return usable - SHORT_TLV_SIZE;
+    }
+    else if (usable - LONG_TLV_SIZE >= 0xFF)
+    {
+        return usable - LONG_TLV_SIZE;
+    }
+    // too big for a short TLV, too small to fill a long one
+    return 0xFE;
+}
+
+uint16_t TlvMap::getDataAreaSize()
+{
+    return _dataAreaSize;
+}
+
+uint8_t TlvMap::getAreaCount()
+{
+    return _areaCount;
+}
+
+TlvMap::Area TlvMap::getArea(uint8_t index)
+{
+    return _areas[index];
+}
+
+// read count usable bytes starting at *offset, *offset is moved past them
+static bool readUsable(TlvStorage& storage, TlvMap& map, uint16_t *offset, byte *data, uint16_t count)
+{
+    while (count > 0)
+    {
+        *offset = map.nextUsable(*offset);
+        uint16_t run = map.getRunLength(*offset);
+        if (run == 0)
+        {
+            ESP_LOGE(LOG_TAG, "Error. TLV runs past the end of the data area");
+            return false;
+        }
+        if (run > count)
+        {
+            run = count;
+        }
+        if (!storage.read(*offset, data, run))
+        {
+            return false;
+        }
+        *offset += run;
+        data += run;
+        count -= run;
+    }
+    return true;
+}
+
+bool NdefTlv::parse(TlvStorage& storage, TlvMap& map)
+{
+    uint16_t offset = map.nextUsable(0);
+
+    while (offset < map.getDataAreaSize())
+    {
+        uint16_t tlvOffset = offset;
+        byte type;
+        if (!readUsable(storage, map, &offset, &type, 1))
+        {
+            return false;
+        }
+
+        if (type == TLV_NULL)
+        {
+            continue;
+        }
+        else if (type == TLV_TERMINATOR)
+        {
+            offset = tlvOffset;
+            break;
+        }
+
+        // { T, LENGTH } or { T, 0xFF, LENGTH, LENGTH }
+        byte length[2];
+        if (!readUsable(storage, map, &offset, length, 1))
+        {
+            return false;
+        }
+        uint16_t valueLength = length[0];
+        if (length[0] == 0xFF)
+        {
+            if (!readUsable(storage, map, &offset, length, 2))
+            {
+                return false;
+            }
+            valueLength = (length[0] << 8) | length[1];
+        }
+        uint16_t valueOffset = map.nextUsable(offset);
+
+        ESP_LOGD(LOG_TAG, "TLV 0x%x at offset %d, %d bytes", type, tlvOffset, valueLength);
+
+        if (valueLength > map.usableBytes(valueOffset))
+        {
+            ESP_LOGE(LOG_TAG, "Error. TLV 0x%x length %d exceeds the data area", type, valueLength);
+            return false;
+        }
+
+        if (type == TLV_NDEF)
+        {
+            map.setNdefTlv(tlvOffset, valueOffset, valueLength);
+            return true;
+        }
+        else if (type == TLV_LOCK_CONTROL || type == TLV_MEMORY_CONTROL)
+        {
+            // { PageAddr | ByteOffset, Size, BytesLockedPerLockBit | BytesPerPage }
+            byte value[3];
+            if (valueLength < sizeof(value) || !readUsable(storage, map, &offset, value, sizeof(value)))
+            {
+                ESP_LOGE(LOG_TAG, "Error. Invalid control TLV 0x%x", type);
+                return false;
+            }
+            uint16_t address = (value[0] >> 4) * (1 << (value[2] & 0x0F)) + (value[0] & 0x0F);
+            uint16_t size = value[1] == 0 ? 256 : value[1];
+            if (type == TLV_LOCK_CONTROL)
+            {
+                // size is in lock bits
+                map.addArea(address, (size + 7) / 8, true);
+            }
+            else
+            {
+                map.addArea(address, size, false);
+            }
+            offset = map.advance(offset, valueLength - sizeof(value));
+        }
+        else
+        {
+            // proprietary TLV, skip it
+            offset = map.advance(valueOffset, valueLength);
+        }
+        offset = map.nextUsable(offset);
+    }
+
+    // no NDEF TLV, a new one goes where the walk stopped
+    map.setNdefTlv(offset, offset, 0);
+    return true;
+}
+
+bool NdefTlv::readValue(TlvStorage& storage, TlvMap& map, byte *data)
+{
+    uint16_t offset = map.getNdefValueOffset();
+    return readUsable(storage, map, &offset, data, map.getNdefLength());
+}
+
+bool NdefTlv::readValue(TlvStorage& storage, TlvMap& map, uint16_t messageOffset, byte *data, uint16_t length)
+{
+    if (messageOffset > map.getNdefLength() || length > map.getNdefLength() - messageOffset)
+    {
+        ESP_LOGE(LOG_TAG, "Error. %d bytes at %d are past the end of the message", length, messageOffset);
+        return false;
+    }
+    uint16_t offset = map.advance(map.getNdefValueOffset(), messageOffset);
+    return readUsable(storage, map, &offset, data, length);
+}
+
+bool NdefTlv::indexRecords(TlvStorage& storage, TlvMap& map, NdefRecordIndex& index)
+{
+    index.reset();
+    index.valueOffset = map.getNdefValueOffset();
+    index.messageLength = map.getNdefLength();
+
+    uint8_t unitSize = storage.getUnitSize();
+    uint16_t offset = map.getNdefValueOffset();
+    uint16_t position = 0;
+    bool last = false;
+    while (position < index.messageLength && !last)
+    {
+        // { flags | TNF, type length, payload length (1 or 4), [id length] }
+        byte header[NDEF_INDEX_HEADER_SIZE];
+        if (index.messageLength - position < 3 || !readUsable(storage, map, &offset, header, 2))
+        {
+            ESP_LOGE(LOG_TAG, "Error. Record header at %d runs past the end of the message", position);
+            return false;
+        }
+        bool shortRecord = header[0] & 0x10;
+        bool hasId = header[0] & 0x08;
+        uint8_t headerLength = 2 + (shortRecord ? 1 : 4) + (hasId ? 1 : 0);
+        if (index.messageLength - position < headerLength ||
+            !readUsable(storage, map, &offset, &header[2], headerLength - 2))
+        {
+            ESP_LOGE(LOG_TAG, "Error. Record header at %d runs past the end of the message", position);
+            return false;
+        }
+
+        uint32_t payloadLength = header[2];
+        if (!shortRecord)
+        {
+            payloadLength = (static_cast<uint32_t>(header[2]) << 24) | (static_cast<uint32_t>(header[3]) << 16) |
+                (static_cast<uint32_t>(header[4]) << 8) | header[5];
+        }
+        uint8_t typeLength = header[1];
+        uint8_t idLength = hasId ? header[headerLength - 1] : 0;
+        uint32_t length = headerLength + typeLength + idLength + payloadLength;
+        if (length > static_cast<uint32_t>(index.messageLength - position))
+        {
+            ESP_LOGE(LOG_TAG, "Error. Record of %d bytes at %d runs past the end of the message", (int)length, position);
+            return false;
+        }
+        last = header[0] & 0x40;
+
+        // a full index keeps its last entry for the last record
+        uint8_t slot = index.entryCount < NDEF_MAX_RECORDS ? index.entryCount++ : NDEF_MAX_RECORDS - 1;
+        NdefRecordIndex::Entry& entry = index.entries[slot];
+        entry.record = index.recordCount++;
+        entry.tnf = static_cast<NdefRecord::TNF>(header[0] & 0x07);
+        memcpy(entry.header, header, headerLength);
+        entry.headerLength = headerLength;
+        entry.chunked = header[0] & 0x20;
+        entry.typeLength = typeLength;
+        entry.idLength = idLength;
+        entry.offset = position;
+        entry.length = length;
+        entry.payloadOffset = position + headerLength + typeLength + idLength;
+        entry.payloadLength = payloadLength;
+
+        uint8_t kept = typeLength < NDEF_INDEX_TYPE_SIZE ? typeLength : NDEF_INDEX_TYPE_SIZE;
+        if (!readUsable(storage, map, &offset, entry.type, kept))
+        {
+            return false;
+        }
+        offset = map.nextUsable(map.advance(offset, typeLength - kept + idLength));
+        entry.firstUnit = offset / unitSize;
+        entry.lastUnit = payloadLength > 0 ? map.nextUsable(map.advance(offset, payloadLength - 1)) / unitSize : entry.firstUnit;
+        offset = map.advance(offset, payloadLength);
+        position += length;
+
+        ESP_LOGD(LOG_TAG, "Record %d at %d, %d bytes of payload in units %d-%d", entry.record, entry.offset,
+            entry.payloadLength, entry.firstUnit, entry.lastUnit);
+    }
+    return true;
+}
+
+// A message rewritten with the same length at the same place passes the check
+// of the NDEF TLV, the record header read back catches most of those.
+bool NdefTlv::matchesHeader(TlvStorage& storage, TlvMap& map, const NdefRecordIndex::Entry& entry)
+{
+    byte header[NDEF_INDEX_HEADER_SIZE];
+    return entry.headerLength <= sizeof(header) &&
+        readValue(storage, map, entry.offset, header, entry.headerLength) &&
+        memcmp(header, entry.header, entry.headerLength) == 0;
+}
+
+uint8_t NdefTlv::getHeaderSize(uint16_t messageLength)
+{
+    return messageLength < 0xFF ? SHORT_TLV_SIZE : LONG_TLV_SIZE;
+}
+
+uint16_t NdefTlv::getTlvSize(uint16_t messageLength, uint16_t usableBytes)
+{
+    uint16_t size = getHeaderSize(messageLength) + messageLength;
+    if (size < usableBytes)
+    {
+        size++; // terminator
+    }
+    return size;
+}
+
+uint16_t NdefTlv::getWorkspaceSize(uint16_t messageLength)
+{
+    return LONG_TLV_SIZE + messageLength + 1;
+}
+
+uint8_t NdefTlv::encodeHeader(uint16_t messageLength, byte *data)
+{
+    data[0] = TLV_NDEF;
+    if (messageLength < 0xFF)
+    {
+        data[1] = messageLength;
+        return SHORT_TLV_SIZE;
+    }
+    data[1] = 0xFF;
+    data[2] = ((messageLength >> 8) & 0xFF);
+    data[3] = (messageLength & 0xFF);
+    return LONG_TLV_SIZE;
+}
+
+bool NdefTlv::writeData(TlvStorage& storage, TlvMap& map, uint16_t start, uint16_t end, const byte *data)
+{
+    uint8_t unitSize = storage.getUnitSize();
+    byte unit[TLV_MAX_UNIT_SIZE];
+
+    for (uint16_t unitOffset = start - (start % unitSize); unitOffset < end; unitOffset += unitSize)
+    {
+        bool keep;
+        if (!isTouched(map, unitOffset, unitSize, start, &keep))
+        {
+            ESP_LOGD(LOG_TAG, "Skipping reserved unit at offset %d", unitOffset);
+            continue;
+        }
+
+        memset(unit, 0, unitSize);
+        if (keep && !storage.read(unitOffset, unit, unitSize))
+        {
+            return false;
+        }
+
+        for (uint8_t i = 0; i < unitSize; i++)
+        {
+            uint16_t offset = unitOffset + i;
+            if (offset < start || map.isReserved(offset))
+            {
+                continue;
+            }
+            unit[i] = (data != NULL && offset < end) ? *data++ : 0x00;
+        }
+
+        if (!storage.write(unitOffset, unit))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NdefTlv::isTouched(TlvMap& map, uint16_t unitOffset, uint8_t unitSize, uint16_t start, bool *keep)
+{
+    bool touched = false;
+    *keep = false;
+    for (uint8_t i = 0; i < unitSize; i++)
+    {
+        uint16_t offset = unitOffset + i;
+        *keep |= (offset < start || map.isReserved(offset));
+        touched |= (offset >= start && !map.isReserved(offset));
+    }
+    return touched;
+}
+
+NdefTlv::WriteResult NdefTlv::writeTransaction(TlvStorage& storage, TlvMap& map, uint16_t start, const byte *data, uint16_t length, uint8_t headerSize)
+{
+    uint8_t unitSize = storage.getUnitSize();
+    uint16_t end = map.advance(start, length);
+    uint16_t unitStart = start - (start % unitSize);
+    // end of the last unit holding a header byte
+    uint16_t split = ((map.advance(start, headerSize) - 1) / unitSize + 1) * unitSize;
+    if (split > end)
+    {
+        split = end;
+    }
+    uint16_t headerLength = split - unitStart;
+    if (unitSize > TLV_MAX_UNIT_SIZE || headerLength > 2 * TLV_MAX_UNIT_SIZE)
+    {
+        ESP_LOGE(LOG_TAG, "Error. Unit size %d not supported", unitSize);
+        return WRITE_ROLLED_BACK;
+    }
+
+    // the header units as they are, to tell a rolled back write from a torn one
+    byte old[2 * TLV_MAX_UNIT_SIZE];
+    if (!storage.read(unitStart, old, headerLength))
+    {
+        return WRITE_ROLLED_BACK;
+    }
+
+    bool written;
+    if (split == end)
+    {
+        // the whole TLV is in the header units, each unit is written at once
+        written = writeData(storage, map, start, end, data);
+    }
+    else
+    {
+        // an empty NDEF TLV, followed by the new data the header units hold
+        byte staged[2 * TLV_MAX_UNIT_SIZE];
+        uint16_t stagedLength = map.usableBytes(start) - map.usableBytes(split);
+        memcpy(staged, data, stagedLength);
+        byte empty[3] = { TLV_NDEF, 0x00, TLV_TERMINATOR };
+        memcpy(staged, empty, stagedLength < sizeof(empty) ? stagedLength : sizeof(empty));
+
+        written = writeData(storage, map, start, split, staged);
+        if (written)
+        {
+            ESP_LOGD(LOG_TAG, "Header units staged, writing offsets %d-%d", split, end);
+            if (!writeData(storage, map, split, end, data + stagedLength) ||
+                !writeData(storage, map, start, split, data))
+            {
+                ESP_LOGE(LOG_TAG, "Error. Write torn, the tag holds an empty NDEF TLV");
+                return WRITE_TORN;
+            }
+        }
+    }
+
+    storage.invalidate();
+    if (!written)
+    {
+        // the header units were being written, read them back to see if they changed
+        byte current[2 * TLV_MAX_UNIT_SIZE];
+        if (storage.read(unitStart, current, headerLength) && memcmp(current, old, headerLength) == 0)
+        {
+            ESP_LOGE(LOG_TAG, "Error. Write failed, the old message is intact");
+            return WRITE_ROLLED_BACK;
+        }
+        ESP_LOGE(LOG_TAG, "Error. Write failed, the tag state is unknown");
+        return WRITE_TORN;
+    }
+
+    if (!verifyData(storage, map, start, end, data))
+    {
+        ESP_LOGE(LOG_TAG, "Error. Verify failed");
+        return WRITE_TORN;
+    }
+    return WRITE_COMMITTED;
+}
+
+bool NdefTlv::verifyData(TlvStorage& storage, TlvMap& map, uint16_t start, uint16_t end, const byte *data)
+{
+    byte buffer[TLV_MAX_UNIT_SIZE];
+    uint16_t offset = start;
+    while (offset < end)
+    {
+        offset = map.nextUsable(offset);
+        uint16_t run = map.getRunLength(offset);
+        if (run > end - offset)
+        {
+            run = end - offset;
+        }
+        if (run > sizeof(buffer))
+        {
+            run = sizeof(buffer);
+        }
+        if (run == 0)
+        {
+            break;
+        }
+        // reads are served from the chunk the storage fetched, one command per chunk
+        if (!storage.read(offset, buffer, run) || memcmp(buffer, data, run) != 0)
+        {
+            ESP_LOGD(LOG_TAG, "Offset %d differs", offset);
+            return false;
+        }
+        offset += run;
+        data += run;
+    }
+    return true;
+}
+
+void NdefTlv::planData(TlvMap& map, uint8_t unitSize, uint16_t start, uint16_t end, WritePlan& plan)
+{
+    for (uint16_t unitOffset = start - (start % unitSize); unitOffset < end; unitOffset += unitSize)
+    {
+        bool keep;
+        if (!isTouched(map, unitOffset, unitSize, start, &keep))
+        {
+            continue;
+        }
+        if (keep)
+        {
+            plan.reads++;
+        }
+        plan.addUnit(unitOffset);
+    }
+}
+
+// the same steps as writeTransaction() when nothing fails
+void NdefTlv::planTransaction(TlvMap& map, uint8_t unitSize, uint16_t start, uint16_t length, uint8_t headerSize, WritePlan& plan)
+{
+    uint16_t end = map.advance(start, length);
+    uint16_t unitStart = start - (start % unitSize);
+    uint16_t split = ((map.advance(start, headerSize) - 1) / unitSize + 1) * unitSize;
+    if (split > end)
+    {
+        split = end;
+    }
+
+    // the header units as they are, then the units verified
+    plan.reads += (split - unitStart + unitSize - 1) / unitSize;
+    if (split == end)
+    {
+        planData(map, unitSize, start, end, plan);
+    }
+    else
+    {
+        planData(map, unitSize, start, split, plan);
+        planData(map, unitSize, split, end, plan);
+        planData(map, unitSize, start, split, plan);
+    }
+    plan.reads += (end - unitStart + unitSize - 1) / unitSize;
+}
@@ -1,177 +1,296 @@
+#include <sdkconfig.h>
 #include <esp_log.h>
+#include <freertos/task.h>
 #include "NfcAdapter.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "Mfrc522Transport.h"
+#endif
 
 static const char* LOG_TAG = "NFC Adapter";
 
-NfcAdapter::NfcAdapter(MFRC522 *interface)
+#if !CONFIG_IDF_TARGET_LINUX
+NfcAdapter::NfcAdapter(MFRC522 *interface) :
+    shield(new Mfrc522Transport(interface)),
+    _ownedTransport(shield),
+    _session(shield, &_credentials, &_tagCache)
+{
+}
+#endif
+
+NfcAdapter::NfcAdapter(NfcTransport *transport) :
+    shield(transport),
+    _ownedTransport(NULL),
+    _session(shield, &_credentials, &_tagCache)
 {
-    shield = interface;
 }
 
 NfcAdapter::~NfcAdapter(void)
 {
+    delete _ownedTransport;
 }
 
 void NfcAdapter::begin()
 {
-  shield->PCD_DumpVersionToSerial();
+  shield->dumpVersion();
 }
 
 bool NfcAdapter::tagPresent()
 {
     // If tag has already been authenticated nothing else will work until we stop crypto (shouldn't hurt)
-    shield->PCD_StopCrypto1();
+    shield->stopCrypto1();
+
+    _session.end();
 
-    if(!(shield->PICC_IsNewCardPresent() && shield->PICC_ReadCardSerial()))
+    if(!shield->isNewCardPresent())
     {
         return false;
     }
-
-    MFRC522::PICC_Type piccType = shield->PICC_GetType(shield->uid.sak);
-    return ((piccType == MFRC522::PICC_TYPE_MIFARE_1K) || (piccType == MFRC522::PICC_TYPE_MIFARE_UL));
+    return selectTag();
 }
 
-bool NfcAdapter::erase()
+// Instead of a full REQA and anticollision on every poll, the reader is left
+// waiting for the answer to a bare REQA with only RxIRq routed to the IRQ pin,
+// and the task sleeps until a card answers. A REQA is only answered once, so
+// it is sent again every rearm ticks for cards entering the field later.
+bool NfcAdapter::waitForTag(NfcIrqSource *irq, TickType_t timeout, TickType_t rearm)
 {
-    NdefMessage message = NdefMessage();
-    message.addEmptyRecord();
-    return write(message);
-}
+    TickType_t start = xTaskGetTickCount();
+    bool detected = false;
 
-bool NfcAdapter::format()
-{
-#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
-    if(shield->PICC_GetType(shield->uid.sak) == MFRC522::PICC_TYPE_MIFARE_1K)
-    {
-        MifareClassic mifareClassic = MifareClassic(shield);
-        return mifareClassic.formatNDEF();
-    }
-    else
-#endif
-    if(shield->PICC_GetType(shield->uid.sak) == MFRC522::PICC_TYPE_MIFARE_UL)
+    shield->enableCardDetectIrq(true);
+    while (!detected)
     {
-        ESP_LOGD(LOG_TAG, "No need for formating a UL");
-        return true;
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (timeout != portMAX_DELAY && elapsed >= timeout)
+        {
+            break;
+        }
+        TickType_t wait = rearm;
+        if (timeout != portMAX_DELAY && timeout - elapsed < wait)
+        {
+            wait = timeout - elapsed;
+        }
+
+        irq->clear();
+        shield->armCardDetect();
+        irq->arm();
+        if (irq->wait(wait))
+        {
+            ESP_LOGD(LOG_TAG, "Card answered REQA");
+            shield->stopCrypto1();
+            _session.end();
+            // the card is READY, anticollision can start straight away
+            detected = selectTag() || tagPresent();
+        }
     }
-    else
+
+    shield->enableCardDetectIrq(false);
+    return detected;
+}
+
+bool NfcAdapter::selectTag()
+{
+    if (!shield->readCardSerial())
     {
-        ESP_LOGD(LOG_TAG, "Unsupported Tag.");
         return false;
     }
+    _credentials.beginSelection();
+    _session.begin();
+
+    // a tag some driver reads, Mifare Classic 1K, Type 2 or Type 4
+    return _session.getTagType() != NfcTag::TYPE_UNKNOWN;
 }
 
-bool NfcAdapter::clean()
+// WUPA brings back tags halted by an earlier sweep. Each pass selects one tag
+// through anticollision, reads it and halts it, the tags that lost go back to
+// IDLE and answer the REQA of the next pass, until none is left.
+uint8_t NfcAdapter::inventory(NfcInventory& inventory, bool readMessages, byte *buffer, uint16_t bufferSize)
 {
-    NfcTag::TagType type = guessTagType();
+    inventory.clear();
+    shield->stopCrypto1();
+    _session.end();
 
-#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
-    if (type == NfcTag::TYPE_MIFARE_CLASSIC)
-    {
-        ESP_LOGD(LOG_TAG, "Cleaning Mifare Classic");
-        MifareClassic mifareClassic = MifareClassic(shield);
-        return mifareClassic.formatMifare();
-    }
-    else
-#endif
-    if (type == NfcTag::TYPE_2)
+    NfcTransport::Status status = shield->wakeupA();
+    bool found = (status == NfcTransport::STATUS_OK || status == NfcTransport::STATUS_COLLISION);
+    while (found)
     {
-        ESP_LOGD(LOG_TAG, "Cleaning Mifare Ultralight");
-        MifareUltralight ultralight = MifareUltralight(shield);
-        return ultralight.clean();
+        if (!shield->readCardSerial())
+        {
+            ESP_LOGD(LOG_TAG, "Anticollision failed");
+            break;
+        }
+        _credentials.beginSelection();
+        _session.begin();
+        if (inventory.contains(_session.getUid(), _session.getUidLength()))
+        {
+            // the tag didn't halt, don't read it forever
+            ESP_LOGW(LOG_TAG, "Tag selected twice, stopping inventory");
+            break;
+        }
+
+        bool added;
+        if (readMessages)
+        {
+            NfcTag tag = _session.read(buffer, bufferSize);
+            added = inventory.add(tag, _session.getStatus());
+            if (tag.hasNdefMessage() && tag.getNdefLength() > NFC_TAG_INLINE_NDEF_SIZE)
+            {
+                // the next large message goes after this one
+                buffer += tag.getNdefLength();
+                bufferSize -= tag.getNdefLength();
+            }
+        }
+        else
+        {
+            byte uid[TAG_MAX_UID_SIZE];
+            memcpy(uid, _session.getUid(), _session.getUidLength());
+            added = inventory.add(NfcTag(uid, _session.getUidLength(), _session.getTagType()));
+        }
+        haltTag();
+        if (!added)
+        {
+            break;
+        }
+
+        found = shield->isNewCardPresent();
     }
-    else
+
+    ESP_LOGD(LOG_TAG, "Inventory found %d tags", inventory.getTagCount());
+    return inventory.getTagCount();
+}
+
+bool NfcAdapter::planWrite(NdefMessage& message, const byte *uid, uint8_t uidLength, WritePlan& plan, bool transactional)
+{
+    TagInfo *info = _tagCache.find(uid, uidLength);
+    if (info == NULL)
     {
-        ESP_LOGI(LOG_TAG, "No driver for card type %d", type);
+        plan.reset();
+        plan.messageLength = message.getEncodedSize();
         return false;
     }
+    return TagSession::planWrite(message, *info, plan, transactional);
+}
 
+bool NfcAdapter::erase()
+{
+    return session().erase();
 }
 
-NfcTag NfcAdapter::read()
+bool NfcAdapter::format()
 {
-    uint8_t type = guessTagType();
+    return session().format();
+}
 
-#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
-    if (type == NfcTag::TYPE_MIFARE_CLASSIC)
-    {
-        ESP_LOGD(LOG_TAG, "Reading Mifare Classic");
-        MifareClassic mifareClassic = MifareClassic(shield);
-        return mifareClassic.read();
-    }
-    else
-#endif
-    if (type == NfcTag::TYPE_2)
-    {
-        ESP_LOGD(LOG_TAG, "Reading Mifare Ultralight");
-        MifareUltralight ultralight = MifareUltralight(shield);
-        return ultralight.read();
-    }
-    else if (type == NfcTag::TYPE_UNKNOWN)
-    {
-        ESP_LOGI(LOG_TAG, "Can not determine tag type");
-        return NfcTag(shield->uid.uidByte, shield->uid.size, NfcTag::TYPE_UNKNOWN);
-    }
-    else
-    {
-        ESP_LOGI(LOG_TAG, "No driver for card type %d", type);
-        // TODO should set type here
-        return NfcTag(shield->uid.uidByte, shield->uid.size, NfcTag::TYPE_UNKNOWN);
-    }
+bool NfcAdapter::clean()
+{
+    return session().clean();
+}
+
+bool NfcAdapter::dumpImage(TagImageSink& sink, uint16_t *next)
+{
+    return session().dumpImage(sink, next);
+}
 
+bool NfcAdapter::restoreImage(TagImageSource& source, uint16_t *next, const byte *keyB)
+{
+    return session().restoreImage(source, next, keyB);
+}
+
+NfcTag NfcAdapter::read(byte *buffer, uint16_t bufferSize)
+{
+    return session().read(buffer, bufferSize);
+}
+
+bool NfcAdapter::indexRecords(NdefRecordIndex& index)
+{
+    return session().indexRecords(index);
+}
+
+bool NfcAdapter::readPayload(const NdefRecordIndex& index, uint8_t entry, byte *data, uint16_t dataSize)
+{
+    return session().readPayload(index, entry, data, dataSize);
 }
 
 bool NfcAdapter::write(NdefMessage& ndefMessage)
 {
-    uint8_t type = guessTagType();
+    return session().write(ndefMessage);
+}
 
-#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
-    if (type == NfcTag::TYPE_MIFARE_CLASSIC)
-    {
-        ESP_LOGD(LOG_TAG, "Writing Mifare Classic");
-        MifareClassic mifareClassic = MifareClassic(shield);
-        return mifareClassic.write(ndefMessage);
-    }
-    else
-#endif
-    if (type == NfcTag::TYPE_2)
-    {
-        ESP_LOGD(LOG_TAG, "Writing Mifare Ultralight");
-        MifareUltralight mifareUltralight = MifareUltralight(shield);
-        return mifareUltralight.write(ndefMessage);
-    }
-    else if (type == NfcTag::TYPE_UNKNOWN)
-    {
-        ESP_LOGI(LOG_TAG, "Can not determine tag type");
-        return false;
-    }
-    else
+NdefTlv::WriteResult NfcAdapter::writeTransaction(NdefMessage& ndefMessage)
+{
+    return session().writeTransaction(ndefMessage);
+}
+
+bool NfcAdapter::write(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize)
+{
+    return session().write(ndefMessage, workspace, workspaceSize);
+}
+
+NdefTlv::WriteResult NfcAdapter::writeTransaction(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize)
+{
+    return session().writeTransaction(ndefMessage, workspace, workspaceSize);
+}
+
+uint16_t NfcAdapter::requiredWorkspace(const byte *uid, uint8_t uidLength)
+{
+    TagInfo *info = _tagCache.find(uid, uidLength);
+    return info == NULL ? 0 : TagSession::requiredWorkspace(*info);
+}
+
+bool NfcAdapter::tagStillPresent()
+{
+    return _session.isPresent();
+}
+
+TagSession* NfcAdapter::open()
+{
+    if (_session.isOpen() || tagPresent())
     {
-        ESP_LOGD(LOG_TAG, "No driver for card type %d", type);
-        return false;
+        return &_session;
     }
+    return NULL;
 }
 
 // Current tag will not be "visible" until removed from the RFID field
 void NfcAdapter::haltTag() {
-    shield->PICC_HaltA();
-    shield->PCD_StopCrypto1();
+    if (_session.isOpen())
+    {
+        // a Type 4 tag is deselected, it ignores HLTA
+        _session.close();
+        return;
+    }
+    shield->haltA();
+    shield->stopCrypto1();
+    _credentials.beginSelection();
+    _session.end();
 }
 
-NfcTag::TagType NfcAdapter::guessTagType()
+TagCredentials& NfcAdapter::getCredentials()
 {
+    return _credentials;
+}
 
-    MFRC522::PICC_Type piccType = shield->PICC_GetType(shield->uid.sak);
+TagInfoCache& NfcAdapter::getTagInfoCache()
+{
+    return _tagCache;
+}
 
-    if (piccType == MFRC522::PICC_TYPE_MIFARE_1K)
-    {
-        return NfcTag::TYPE_MIFARE_CLASSIC;
-    } 
-    else if (piccType == MFRC522::PICC_TYPE_MIFARE_UL)
-    {
-        return NfcTag::TYPE_2;
-    }
-    else
+NfcStatus NfcAdapter::getStatus()
+{
+    return _session.getStatus();
+}
+
+void NfcAdapter::setRetryPolicy(const NfcRetryPolicy& policy)
+{
+    _session.setRetryPolicy(policy);
+}
+
+// the session for the selected tag, begun here if the tag was selected outside tagPresent()
+TagSession& NfcAdapter::session()
+{
+    if (!_session.isOpen())
     {
-        return NfcTag::TYPE_UNKNOWN;
+        _session.begin();
     }
+    return _session;
 }
@@ -0,0 +1,65 @@
+#include "NfcInventory.h"
+
+NfcInventory::NfcInventory()
+{
+    _tagCount = 0;
+    _complete = true;
+}
+
+uint8_t NfcInventory::getTagCount()
+{
+    return _tagCount;
+}
+
+NfcTag& NfcInventory::getTag(uint8_t index)
+{
+    return _tags[index < _tagCount ? index : NFC_INVENTORY_MAX_TAGS - 1];
+}
+
+NfcStatus NfcInventory::getStatus(uint8_t index)
+{
+    return _statuses[index < _tagCount ? index : NFC_INVENTORY_MAX_TAGS - 1];
+}
+
+bool NfcInventory::isComplete()
+{
+    return _complete;
+}
+
+void NfcInventory::clear()
+{
+    for (uint8_t i = 0; i < _tagCount && i < NFC_INVENTORY_MAX_TAGS; i++)
+    {
+        _tags[i] = NfcTag();
+        _statuses[i] = NfcStatus();
+    }
+    _tagCount = 0;
+    _complete = true;
+}
+
+bool NfcInventory::add(const NfcTag& tag, const NfcStatus& status)
+{
+    if (_tagCount >= NFC_INVENTORY_MAX_TAGS)
+    {
+        _complete = false;
+        return false;
+    }
+    _statuses[_tagCount] = status;
+    _tags[_tagCount++] = tag;
+    return true;
+}
+
+bool NfcInventory::contains(const byte *uid, uint8_t uidLength)
+{
+    for (uint8_t i = 0; i < _tagCount; i++)
+    {
+        byte tagUid[TAG_MAX_UID_SIZE];
+        uint8_t tagUidLength = sizeof(tagUid);
+        _tags[i].getUid(tagUid, &tagUidLength);
+        if (tagUidLength == uidLength && memcmp(tagUid, uid, uidLength) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
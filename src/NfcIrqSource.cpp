@@ -0,0 +1,83 @@
+#include <esp_log.h>
+#include "NfcIrqSource.h"
+
+static const char* LOG_TAG = "NFC IRQ";
+
+NfcIrqSource::NfcIrqSource()
+{
+    _event = xSemaphoreCreateBinary();
+    if (_event == NULL)
+    {
+        ESP_LOGE(LOG_TAG, "Could not create IRQ semaphore");
+    }
+}
+
+NfcIrqSource::~NfcIrqSource()
+{
+    if (_event != NULL)
+    {
+        vSemaphoreDelete(_event);
+    }
+}
+
+bool NfcIrqSource::wait(TickType_t timeout)
+{
+    return _event != NULL && xSemaphoreTake(_event, timeout) == pdTRUE;
+}
+
+void NfcIrqSource::clear()
+{
+    wait(0);
+}
+
+void NfcIrqSource::signal()
+{
+    xSemaphoreGive(_event);
+}
+
+bool NfcIrqSource::signalFromIsr()
+{
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR(_event, &woken);
+    return woken == pdTRUE;
+}
+
+SimulatedIrqSource::SimulatedIrqSource()
+{
+    _cardPresent = false;
+    _armCount = 0;
+}
+
+bool SimulatedIrqSource::begin()
+{
+    return true;
+}
+
+void SimulatedIrqSource::arm()
+{
+    _armCount++;
+    if (_cardPresent)
+    {
+        signal();
+    }
+}
+
+void SimulatedIrqSource::trigger()
+{
+    signal();
+}
+
+void SimulatedIrqSource::setCardPresent(bool present)
+{
+    _cardPresent = present;
+    if (present)
+    {
+        // a card entering an armed field answers the pending REQA
+        signal();
+    }
+}
+
+uint32_t SimulatedIrqSource::getArmCount()
+{
+    return _armCount;
+}
@@ -0,0 +1,175 @@
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "NfcPipeline.h"
+
+static const char* LOG_TAG = "NFC Pipeline";
+
+NfcPipeline::NfcPipeline(NfcAdapter *adapter, Handler *handler)
+    : _head(0), _tail(0), _rfTask(NULL), _handlerTask(NULL), _running(false)
+{
+    _adapter = adapter;
+    _handler = handler;
+    _ready = xSemaphoreCreateBinary();
+    _pollDelay = 0;
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+NfcPipeline::~NfcPipeline()
+{
+    stop();
+    vSemaphoreDelete(_ready);
+}
+
+// The slot is filled before _head moves past it with release order, the
+// handling side loads _head with acquire order, so it sees the whole slot.
+bool NfcPipeline::poll()
+{
+    uint8_t head = _head.load(std::memory_order_relaxed);
+    uint8_t depth = head - _tail.load(std::memory_order_acquire);
+    if (depth >= NFC_PIPELINE_SLOTS)
+    {
+        _stats.stalls++;
+        return false;
+    }
+    if (!_adapter->tagPresent())
+    {
+        return false;
+    }
+
+    Slot *slot = &_slots[head % NFC_PIPELINE_SLOTS];
+    slot->selected = esp_timer_get_time();
+    slot->tag = _adapter->read(slot->buffer, sizeof(slot->buffer));
+    // a halted tag isn't selected again until it leaves the field
+    _adapter->haltTag();
+    _stats.readTime += esp_timer_get_time() - slot->selected;
+    _stats.tags++;
+    if (depth + 1 > _stats.maxDepth)
+    {
+        _stats.maxDepth = depth + 1;
+    }
+
+    _head.store(head + 1, std::memory_order_release);
+    xSemaphoreGive(_ready);
+    return true;
+}
+
+// The slot is released only after the handler returned, so the tag and the
+// buffer its message is in stay as they are while it runs.
+uint8_t NfcPipeline::dispatch()
+{
+    uint8_t handled = 0;
+    uint8_t tail = _tail.load(std::memory_order_relaxed);
+    while (tail != _head.load(std::memory_order_acquire))
+    {
+        Slot *slot = &_slots[tail % NFC_PIPELINE_SLOTS];
+        int64_t start = esp_timer_get_time();
+        NdefMessage message = slot->tag.hasNdefMessage() ? slot->tag.getNdefMessage() : NdefMessage();
+        if (_handler != NULL)
+        {
+            _handler->handle(slot->tag, message);
+        }
+        int64_t end = esp_timer_get_time();
+        _stats.handleTime += end - start;
+        _stats.handled++;
+        if (end - slot->selected > _stats.maxLatency)
+        {
+            _stats.maxLatency = end - slot->selected;
+        }
+
+        tail++;
+        _tail.store(tail, std::memory_order_release);
+        handled++;
+    }
+    return handled;
+}
+
+bool NfcPipeline::start(uint32_t stackSize, UBaseType_t priority, TickType_t pollDelay, BaseType_t rfCore, BaseType_t handlerCore)
+{
+    if (_rfTask != NULL || _handlerTask != NULL)
+    {
+        return false;
+    }
+
+    // a task clears its handle as it ends, so the handle is stored before the
+    // task is created and replaced by the real one only if it is still set
+    TaskHandle_t task = NULL;
+    TaskHandle_t pending = (TaskHandle_t)this;
+    _pollDelay = pollDelay;
+    _running = true;
+    _handlerTask = pending;
+    if (xTaskCreatePinnedToCore(handlerTask, "nfc_handler", stackSize, this, priority, &task, handlerCore) != pdPASS)
+    {
+        ESP_LOGE(LOG_TAG, "Could not create handling task");
+        _running = false;
+        _handlerTask = NULL;
+        return false;
+    }
+    _handlerTask.compare_exchange_strong(pending, task);
+
+    pending = (TaskHandle_t)this;
+    _rfTask = pending;
+    if (xTaskCreatePinnedToCore(rfTask, "nfc_rf", stackSize, this, priority, &task, rfCore) != pdPASS)
+    {
+        ESP_LOGE(LOG_TAG, "Could not create RF task");
+        _rfTask = NULL;
+        stop();
+        return false;
+    }
+    _rfTask.compare_exchange_strong(pending, task);
+    return true;
+}
+
+void NfcPipeline::stop()
+{
+    _running = false;
+    while (_rfTask != NULL)
+    {
+        vTaskDelay(1);
+    }
+    // nothing is queued anymore, the handling task drains the ring and ends
+    xSemaphoreGive(_ready);
+    while (_handlerTask != NULL)
+    {
+        vTaskDelay(1);
+    }
+}
+
+bool NfcPipeline::isRunning()
+{
+    return _rfTask != NULL || _handlerTask != NULL;
+}
+
+NfcPipeline::Stats NfcPipeline::getStats()
+{
+    return _stats;
+}
+
+void NfcPipeline::resetStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+void NfcPipeline::rfTask(void *arg)
+{
+    NfcPipeline *pipeline = (NfcPipeline*)arg;
+    while (pipeline->_running)
+    {
+        pipeline->poll();
+        vTaskDelay(pipeline->_pollDelay > 0 ? pipeline->_pollDelay : 1);
+    }
+    pipeline->_rfTask = NULL;
+    vTaskDelete(NULL);
+}
+
+void NfcPipeline::handlerTask(void *arg)
+{
+    NfcPipeline *pipeline = (NfcPipeline*)arg;
+    while (pipeline->_running || pipeline->_rfTask != NULL)
+    {
+        xSemaphoreTake(pipeline->_ready, portMAX_DELAY);
+        pipeline->dispatch();
+    }
+    pipeline->dispatch();
+    pipeline->_handlerTask = NULL;
+    vTaskDelete(NULL);
+}
@@ -0,0 +1,153 @@
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "NfcProvisioner.h"
+
+static const char* LOG_TAG = "NFC Provisioner";
+
+NfcProvisioner::NfcProvisioner(NfcAdapter *adapter, NdefTemplate *message)
+{
+    _adapter = adapter;
+    _template = message;
+    _workspace = NULL;
+    _workspaceSize = 0;
+    begin();
+}
+
+void NfcProvisioner::begin(uint32_t serial)
+{
+    _serial = serial;
+    _startTime = esp_timer_get_time();
+    memset(&_stats, 0, sizeof(_stats));
+    TagInfoCache::reset(&_profile);
+    _hasProfile = false;
+    _lastUidLength = 0;
+}
+
+bool NfcProvisioner::provision(Report *report)
+{
+    if (!_adapter->tagPresent())
+    {
+        return false;
+    }
+    int64_t start = esp_timer_get_time();
+
+    TagSession *session = _adapter->open();
+    uint8_t uidLength = session->getUidLength();
+    if (uidLength == _lastUidLength && memcmp(session->getUid(), _lastUid, uidLength) == 0)
+    {
+        ESP_LOGD(LOG_TAG, "Tag already provisioned");
+        _adapter->haltTag();
+        return false;
+    }
+
+    memset(report, 0, sizeof(Report));
+    report->uidLength = uidLength;
+    memcpy(report->uid, session->getUid(), uidLength);
+    report->serial = _serial;
+
+    // A new UID gets the layout of the first tag once GET_VERSION and the CC show
+    // the same product formatted the same way, another one is mapped itself. Mifare
+    // Classic is always a 1K, its cached map is checked against the tag anyway.
+    TagInfo *info = session->getInfo();
+    if (_hasProfile && info != NULL && !info->identified && session->getTagType() == _profile.tagType)
+    {
+        bool classic = _profile.tagType == NfcTag::TYPE_MIFARE_CLASSIC;
+        if (!classic)
+        {
+            session->getCapacity();
+        }
+        if (classic || TagInfoCache::sameProduct(info, &_profile))
+        {
+            TagInfoCache::copyLayout(info, &_profile);
+        }
+        else
+        {
+            ESP_LOGD(LOG_TAG, "Tag differs from the first one, product %d", info->product);
+        }
+    }
+
+    int64_t writeStart = esp_timer_get_time();
+    report->result = _workspace != NULL ? write(session, report, _workspace, _workspaceSize) : write(session, report);
+    report->writeTime = esp_timer_get_time() - writeStart;
+    if (report->result != NdefTlv::WRITE_COMMITTED && report->error == NfcStatus::ERROR_NONE)
+    {
+        report->error = session->getStatus().getError();
+    }
+
+    if (report->result == NdefTlv::WRITE_COMMITTED)
+    {
+        info = session->getInfo();
+        if (!_hasProfile && info != NULL && info->identified && info->mapped)
+        {
+            TagInfoCache::copyLayout(&_profile, info);
+            _hasProfile = true;
+        }
+        memcpy(_lastUid, report->uid, uidLength);
+        _lastUidLength = uidLength;
+        _serial++;
+        _stats.committed++;
+    }
+    else
+    {
+        ESP_LOGW(LOG_TAG, "Tag not provisioned, result %d, %s", report->result, NfcStatus::getErrorName(report->error));
+        _stats.failed++;
+    }
+    _adapter->haltTag();
+
+    report->tagTime = esp_timer_get_time() - start;
+    _stats.tags++;
+    _stats.busyTime += report->tagTime;
+    if (report->tagTime > _stats.maxTagTime)
+    {
+        _stats.maxTagTime = report->tagTime;
+    }
+    return true;
+}
+
+void NfcProvisioner::setWorkspace(byte *workspace, uint16_t workspaceSize)
+{
+    _workspace = workspace;
+    _workspaceSize = workspaceSize;
+}
+
+NdefTlv::WriteResult NfcProvisioner::write(TagSession *session, Report *report)
+{
+    byte workspace[NDEF_WORKSPACE_SIZE];
+    return write(session, report, workspace, sizeof(workspace));
+}
+
+// the message is patched behind room for the TLV header and framed in place
+NdefTlv::WriteResult NfcProvisioner::write(TagSession *session, Report *report, byte *workspace, uint16_t workspaceSize)
+{
+    uint16_t length = _template->getEncodedSize();
+    if (NdefTlv::getWorkspaceSize(length) > workspaceSize)
+    {
+        ESP_LOGE(LOG_TAG, "Workspace of %d bytes can't hold a message of %d", workspaceSize, length);
+        report->error = NfcStatus::ERROR_WORKSPACE;
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+    if (!_template->patch(report->uid, report->uidLength, _serial, &workspace[LONG_TLV_SIZE]))
+    {
+        // a UID or serial longer than its slot
+        report->error = NfcStatus::ERROR_TOO_LARGE;
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+    return session->writeEncoded(&workspace[LONG_TLV_SIZE], length, true, workspace, workspaceSize);
+}
+
+uint32_t NfcProvisioner::getSerial()
+{
+    return _serial;
+}
+
+NfcProvisioner::Stats NfcProvisioner::getStats()
+{
+    _stats.elapsed = esp_timer_get_time() - _startTime;
+    return _stats;
+}
+
+float NfcProvisioner::getTagsPerMinute()
+{
+    int64_t elapsed = esp_timer_get_time() - _startTime;
+    return elapsed > 0 ? _stats.committed * 60000000.0f / elapsed : 0;
+}
@@ -0,0 +1,230 @@
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "NfcReaderPool.h"
+
+static const char* LOG_TAG = "NFC Reader Pool";
+
+NfcReaderPool::NfcReaderPool(Schedule schedule, uint8_t queueLength)
+    : _task(NULL), _running(false)
+{
+    memset(_readers, 0, sizeof(_readers));
+    _readerCount = 0;
+    _next = 0;
+    _schedule = schedule;
+    _events = xQueueCreate(queueLength, sizeof(Event));
+    _bus = xSemaphoreCreateMutex();
+    _pollDelay = 0;
+}
+
+NfcReaderPool::~NfcReaderPool()
+{
+    stop();
+    vQueueDelete(_events);
+    vSemaphoreDelete(_bus);
+}
+
+int NfcReaderPool::addReader(NfcAdapter *adapter, uint8_t priority)
+{
+    if (_readerCount >= NFC_READER_POOL_MAX_READERS)
+    {
+        ESP_LOGE(LOG_TAG, "Pool is full, %d readers", _readerCount);
+        return -1;
+    }
+
+    xSemaphoreTake(_bus, portMAX_DELAY);
+    Reader *reader = &_readers[_readerCount];
+    memset(reader, 0, sizeof(Reader));
+    reader->adapter = adapter;
+    // a reader with priority 0 would never be polled
+    reader->priority = priority > 0 ? priority : 1;
+    int index = _readerCount++;
+    xSemaphoreGive(_bus);
+    return index;
+}
+
+uint8_t NfcReaderPool::getReaderCount()
+{
+    return _readerCount;
+}
+
+NfcAdapter* NfcReaderPool::getReader(uint8_t reader)
+{
+    return reader < _readerCount ? _readers[reader].adapter : NULL;
+}
+
+bool NfcReaderPool::poll()
+{
+    if (_readerCount == 0 || xSemaphoreTake(_bus, portMAX_DELAY) != pdTRUE)
+    {
+        return false;
+    }
+
+    uint8_t index = nextReader();
+    Reader *reader = &_readers[index];
+    int64_t start = esp_timer_get_time();
+    if (reader->stats.polls > 0 && start - reader->stats.lastPoll > reader->stats.maxInterval)
+    {
+        reader->stats.maxInterval = start - reader->stats.lastPoll;
+    }
+    reader->stats.lastPoll = start;
+    reader->stats.polls++;
+
+    // a tag resting on the antenna answers every REQA, it was reported when it came
+    bool present = false;
+    if (!reader->reported || !reader->adapter->tagStillPresent())
+    {
+        reader->reported = false;
+        present = reader->adapter->tagPresent();
+    }
+    if (present)
+    {
+        reader->reported = true;
+        TagSession *session = reader->adapter->open();
+        Event event;
+        memset(&event, 0, sizeof(event));
+        event.reader = index;
+        event.uidLength = session->getUidLength();
+        memcpy(event.uid, session->getUid(), event.uidLength);
+        event.tagType = session->getTagType();
+        event.time = esp_timer_get_time();
+
+        reader->stats.tags++;
+        if (xQueueSend(_events, &event, 0) != pdTRUE)
+        {
+            ESP_LOGW(LOG_TAG, "Event queue full, dropped tag on reader %d", index);
+            reader->stats.dropped++;
+        }
+    }
+
+    int64_t elapsed = esp_timer_get_time() - start;
+    reader->stats.totalPollTime += elapsed;
+    if (elapsed > reader->stats.maxPollTime)
+    {
+        reader->stats.maxPollTime = elapsed;
+    }
+    xSemaphoreGive(_bus);
+    return present;
+}
+
+// Round robin takes the readers in turn. Priority uses smooth weighted round
+// robin: every reader earns its priority in credit each poll, the richest is
+// polled and pays the total, so polls of a busy reader are spread out evenly.
+uint8_t NfcReaderPool::nextReader()
+{
+    if (_schedule == SCHEDULE_ROUND_ROBIN)
+    {
+        uint8_t index = _next % _readerCount;
+        _next = (index + 1) % _readerCount;
+        return index;
+    }
+
+    int32_t total = 0;
+    uint8_t best = 0;
+    for (uint8_t i = 0; i < _readerCount; i++)
+    {
+        _readers[i].credit += _readers[i].priority;
+        total += _readers[i].priority;
+        if (_readers[i].credit > _readers[best].credit)
+        {
+            best = i;
+        }
+    }
+    _readers[best].credit -= total;
+    return best;
+}
+
+bool NfcReaderPool::start(uint32_t stackSize, UBaseType_t priority, TickType_t pollDelay)
+{
+    if (_task != NULL)
+    {
+        return false;
+    }
+
+    // the task clears its handle as it ends, so the handle is stored before the
+    // task is created and replaced by the real one only if it is still set
+    TaskHandle_t task = NULL;
+    TaskHandle_t pending = (TaskHandle_t)this;
+    _pollDelay = pollDelay;
+    _running = true;
+    _task = pending;
+    if (xTaskCreate(pollTask, "nfc_pool", stackSize, this, priority, &task) != pdPASS)
+    {
+        ESP_LOGE(LOG_TAG, "Could not create polling task");
+        _running = false;
+        _task = NULL;
+        return false;
+    }
+    _task.compare_exchange_strong(pending, task);
+    return true;
+}
+
+void NfcReaderPool::stop()
+{
+    _running = false;
+    while (_task != NULL)
+    {
+        vTaskDelay(1);
+    }
+}
+
+bool NfcReaderPool::isRunning()
+{
+    return _task != NULL;
+}
+
+void NfcReaderPool::pollTask(void *arg)
+{
+    NfcReaderPool *pool = (NfcReaderPool*)arg;
+    while (pool->_running)
+    {
+        pool->poll();
+        // yield once per round, so consumers of the queue and acquire() get a turn
+        if (pool->_readerCount == 0 || pool->_next == 0 || pool->_schedule == SCHEDULE_PRIORITY)
+        {
+            vTaskDelay(pool->_pollDelay > 0 ? pool->_pollDelay : 1);
+        }
+    }
+    pool->_task = NULL;
+    vTaskDelete(NULL);
+}
+
+bool NfcReaderPool::receive(Event *event, TickType_t wait)
+{
+    return xQueueReceive(_events, event, wait) == pdTRUE;
+}
+
+NfcAdapter* NfcReaderPool::acquire(uint8_t reader, TickType_t wait)
+{
+    if (reader >= _readerCount || xSemaphoreTake(_bus, wait) != pdTRUE)
+    {
+        return NULL;
+    }
+    return _readers[reader].adapter;
+}
+
+void NfcReaderPool::release()
+{
+    xSemaphoreGive(_bus);
+}
+
+NfcReaderPool::ReaderStats NfcReaderPool::getStats(uint8_t reader)
+{
+    ReaderStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (reader < _readerCount && xSemaphoreTake(_bus, portMAX_DELAY) == pdTRUE)
+    {
+        stats = _readers[reader].stats;
+        xSemaphoreGive(_bus);
+    }
+    return stats;
+}
+
+void NfcReaderPool::resetStats()
+{
+    xSemaphoreTake(_bus, portMAX_DELAY);
+    for (uint8_t i = 0; i < _readerCount; i++)
+    {
+        memset(&_readers[i].stats, 0, sizeof(ReaderStats));
+    }
+    xSemaphoreGive(_bus);
+}
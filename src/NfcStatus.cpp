@@ -0,0 +1,180 @@
+#include <esp_log.h>
+#include "NfcStatus.h"
+
+static const char* LOG_TAG = "NFC Status";
+
+NfcStatus::NfcStatus()
+{
+    _error = ERROR_NONE;
+    _operation = OPERATION_NONE;
+    _address = -1;
+    _transportStatus = NfcTransport::STATUS_OK;
+    _retries = 0;
+}
+
+NfcStatus::NfcStatus(Error error, Operation operation, int16_t address, NfcTransport::Status transportStatus)
+{
+    _retries = 0;
+    set(error, operation, address, transportStatus);
+}
+
+void NfcStatus::set(Error error, Operation operation, int16_t address, NfcTransport::Status transportStatus)
+{
+    _error = error;
+    _operation = operation;
+    _address = address;
+    _transportStatus = transportStatus;
+}
+
+void NfcStatus::setTransport(NfcTransport::Status transportStatus, Operation operation, int16_t address)
+{
+    set(fromTransport(transportStatus), operation, address, transportStatus);
+}
+
+void NfcStatus::clearError()
+{
+    set(ERROR_NONE);
+}
+
+void NfcStatus::retried()
+{
+    if (_retries < UINT8_MAX)
+    {
+        _retries++;
+    }
+}
+
+bool NfcStatus::ok()
+{
+    return _error == ERROR_NONE;
+}
+
+NfcStatus::Error NfcStatus::getError()
+{
+    return _error;
+}
+
+NfcStatus::Operation NfcStatus::getOperation()
+{
+    return _operation;
+}
+
+int16_t NfcStatus::getAddress()
+{
+    return _address;
+}
+
+NfcTransport::Status NfcStatus::getTransportStatus()
+{
+    return _transportStatus;
+}
+
+uint8_t NfcStatus::getRetries()
+{
+    return _retries;
+}
+
+NfcStatus::Recovery NfcStatus::getRecovery()
+{
+    switch (_error)
+    {
+        case ERROR_TIMEOUT:
+        case ERROR_FRAME:
+            return RECOVERY_RETRY;
+        case ERROR_NAK:
+            return RECOVERY_RESELECT;
+        case ERROR_AUTHENTICATION:
+            // Mifare Classic doesn't answer a wrong key, the same silence as a lost frame
+            return _transportStatus == NfcTransport::STATUS_TIMEOUT ? RECOVERY_RESELECT : RECOVERY_NONE;
+        default:
+            return RECOVERY_NONE;
+    }
+}
+
+NfcStatus::Error NfcStatus::fromTransport(NfcTransport::Status status)
+{
+    switch (status)
+    {
+        case NfcTransport::STATUS_OK: return ERROR_NONE;
+        case NfcTransport::STATUS_TIMEOUT: return ERROR_TIMEOUT;
+        case NfcTransport::STATUS_ERROR:
+        case NfcTransport::STATUS_COLLISION:
+        case NfcTransport::STATUS_CRC_WRONG: return ERROR_FRAME;
+        case NfcTransport::STATUS_MIFARE_NACK: return ERROR_NAK;
+        default: return ERROR_READER;
+    }
+}
+
+const char* NfcStatus::getErrorName(Error error)
+{
+    switch (error)
+    {
+        case ERROR_NONE: return "Success";
+        case ERROR_TIMEOUT: return "Timeout";
+        case ERROR_FRAME: return "Bad frame";
+        case ERROR_NAK: return "NAK";
+        case ERROR_READER: return "Reader error";
+        case ERROR_AUTHENTICATION: return "Authentication failed";
+        case ERROR_TAG_LOST: return "Tag lost";
+        case ERROR_NOT_FORMATTED: return "Not NDEF formatted";
+        case ERROR_BAD_TLV: return "Bad TLV";
+        case ERROR_TOO_LARGE: return "Message too large";
+        case ERROR_VERIFY: return "Verify failed";
+        case ERROR_UNSUPPORTED: return "Unsupported tag";
+        case ERROR_APDU: return "APDU refused";
+        case ERROR_IMAGE: return "Bad image";
+        case ERROR_WORKSPACE: return "Workspace too small";
+        case ERROR_STALE_INDEX: return "Record index out of date";
+        default: return "Unknown error";
+    }
+}
+
+NfcRetryPolicy::NfcRetryPolicy(uint8_t attempts, uint32_t backoff, uint32_t maxBackoff, uint8_t reselects)
+{
+    this->attempts = attempts;
+    this->backoff = backoff;
+    this->maxBackoff = maxBackoff;
+    this->reselects = reselects;
+}
+
+NfcRetry::NfcRetry(const NfcRetryPolicy& policy, NfcTransport *transport, bool sessionLost) : _policy(policy)
+{
+    _transport = transport;
+    _sessionLost = sessionLost;
+    _attempts = 1;
+    _reselects = 0;
+    _backoff = policy.backoff;
+    _last = ACTION_GIVE_UP;
+}
+
+NfcRetry::Action NfcRetry::next(NfcStatus& status)
+{
+    NfcStatus::Recovery recovery = status.getRecovery();
+    if (recovery == NfcStatus::RECOVERY_NONE || _attempts >= _policy.attempts)
+    {
+        return ACTION_GIVE_UP;
+    }
+
+    // the tag may have dropped to IDLE on a frame it didn't understand, only retry as is once
+    Action action = recovery == NfcStatus::RECOVERY_RETRY && _last != ACTION_RETRY && !_sessionLost ? ACTION_RETRY : ACTION_RESELECT;
+    if (action == ACTION_RESELECT)
+    {
+        if (_reselects >= _policy.reselects)
+        {
+            return ACTION_GIVE_UP;
+        }
+        _reselects++;
+    }
+
+    ESP_LOGD(LOG_TAG, "%s at %d, retry %d after %lu us%s", NfcStatus::getErrorName(status.getError()), status.getAddress(),
+        _attempts, (unsigned long)_backoff, action == ACTION_RESELECT ? ", reselecting" : "");
+    if (_backoff > 0)
+    {
+        _transport->delay(_backoff);
+    }
+    _backoff = _backoff * 2 < _policy.maxBackoff ? _backoff * 2 : _policy.maxBackoff;
+    _attempts++;
+    _last = action;
+    status.retried();
+    return action;
+}
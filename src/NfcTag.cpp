@@ -4,58 +4,115 @@
 
 static const char* LOG_TAG = "NFC Tag";
 
-NfcTag::NfcTag(byte *uid, uint8_t  uidLength, TagType tagType)
+NfcTag::NfcTag()
 {
-    _uid = uid;
-    _uidLength = uidLength;
+    setUid(NULL, 0);
+    _tagType = TYPE_UNKNOWN;
+    _ndefBuffer = NULL;
+    _ndefLength = 0;
+    _hasNdefMessage = false;
+    _ndefDropped = false;
+    _isFormatted = false;
+}
+
+NfcTag::NfcTag(const byte *uid, uint8_t  uidLength, TagType tagType)
+{
+    setUid(uid, uidLength);
     _tagType = tagType;
-    _ndefMessage = (NdefMessage*)NULL;
+    _ndefBuffer = NULL;
+    _ndefLength = 0;
+    _hasNdefMessage = false;
+    _ndefDropped = false;
     _isFormatted = false;
 }
 
-NfcTag::NfcTag(byte *uid, uint8_t  uidLength, TagType tagType, bool isFormatted)
+NfcTag::NfcTag(const byte *uid, uint8_t  uidLength, TagType tagType, bool isFormatted)
 {
-    _uid = uid;
-    _uidLength = uidLength;
+    setUid(uid, uidLength);
     _tagType = tagType;
-    _ndefMessage = (NdefMessage*)NULL;
+    _ndefBuffer = NULL;
+    _ndefLength = 0;
+    _hasNdefMessage = false;
+    _ndefDropped = false;
     _isFormatted = isFormatted;
 }
 
-NfcTag::NfcTag(byte *uid, uint8_t  uidLength, TagType tagType, NdefMessage& ndefMessage)
+NfcTag::NfcTag(const byte *uid, uint8_t  uidLength, TagType tagType, NdefMessage& ndefMessage,
+    byte *buffer, uint16_t bufferSize)
 {
-    _uid = uid;
-    _uidLength = uidLength;
+    setUid(uid, uidLength);
     _tagType = tagType;
-    _ndefMessage = new NdefMessage(ndefMessage);
+    _ndefBuffer = NULL;
+    _ndefLength = 0;
+    _hasNdefMessage = false;
+    _ndefDropped = false;
     _isFormatted = true; // If it has a message it's formatted
+    unsigned int length = ndefMessage.getEncodedSize();
+    byte *data = length <= UINT16_MAX ? allocateNdef(length, buffer, bufferSize) : NULL;
+    if (data == NULL)
+    {
+        ESP_LOGW(LOG_TAG, "Message of %d bytes left out, %d fit", length, NFC_TAG_INLINE_NDEF_SIZE);
+        _ndefLength = length <= UINT16_MAX ? length : UINT16_MAX;
+        _ndefDropped = true;
+        return;
+    }
+    ndefMessage.encode(data);
 }
 
-NfcTag::NfcTag(byte *uid, uint8_t uidLength, TagType tagType, const byte *ndefData, const uint16_t ndefDataLength)
+NfcTag::NfcTag(const byte *uid, uint8_t uidLength, TagType tagType, const byte *ndefData, const uint16_t ndefDataLength,
+    byte *buffer, uint16_t bufferSize)
 {
-    _uid = uid;
-    _uidLength = uidLength;
+    setUid(uid, uidLength);
     _tagType = tagType;
-    _ndefMessage = new NdefMessage(ndefData, ndefDataLength);
+    _ndefBuffer = NULL;
+    _ndefLength = 0;
+    _hasNdefMessage = false;
+    _ndefDropped = false;
     _isFormatted = true; // If it has a message it's formatted
+    byte *data = allocateNdef(ndefDataLength, buffer, bufferSize);
+    if (data == NULL)
+    {
+        ESP_LOGW(LOG_TAG, "Message of %d bytes left out, %d fit", ndefDataLength, NFC_TAG_INLINE_NDEF_SIZE);
+        return;
+    }
+    memcpy(data, ndefData, ndefDataLength);
 }
 
-NfcTag::~NfcTag()
+byte* NfcTag::allocateNdef(uint16_t length, byte *buffer, uint16_t bufferSize)
 {
-    delete _ndefMessage;
+    if (length <= NFC_TAG_INLINE_NDEF_SIZE)
+    {
+        _ndefBuffer = NULL;
+    }
+    else if (buffer != NULL && length <= bufferSize)
+    {
+        _ndefBuffer = buffer;
+    }
+    else
+    {
+        // the size stays known, so the caller can bring a buffer
+        _ndefBuffer = NULL;
+        _ndefLength = length;
+        _hasNdefMessage = false;
+        _ndefDropped = true;
+        return NULL;
+    }
+    _ndefLength = length;
+    _hasNdefMessage = true;
+    _ndefDropped = false;
+    _isFormatted = true;
+    return _ndefBuffer != NULL ? _ndefBuffer : _ndefInline;
 }
 
-NfcTag& NfcTag::operator=(const NfcTag& rhs)
+// the UID is copied, the reader overwrites its buffer on the next selection
+void NfcTag::setUid(const byte *uid, uint8_t uidLength)
 {
-    if (this != &rhs)
+    _uidLength = uidLength < TAG_MAX_UID_SIZE ? uidLength : TAG_MAX_UID_SIZE;
+    memset(_uid, 0, sizeof(_uid));
+    if (uid != NULL)
     {
-        delete _ndefMessage;
-        _uid = rhs._uid;
-        _uidLength = rhs._uidLength;
-        _tagType = rhs._tagType;
-        _ndefMessage = new NdefMessage(*rhs._ndefMessage);
+        memcpy(_uid, uid, _uidLength);
     }
-    return *this;
 }
 
 uint8_t NfcTag::getUidLength()
@@ -76,12 +133,44 @@ NfcTag::TagType NfcTag::getTagType()
 
 bool NfcTag::hasNdefMessage()
 {
-    return (_ndefMessage != NULL);
+    return _hasNdefMessage;
 }
 
 NdefMessage NfcTag::getNdefMessage()
 {
-    return *_ndefMessage;
+    if (!_hasNdefMessage)
+    {
+        return NdefMessage();
+    }
+    return NdefMessage(getNdefData(), _ndefLength);
+}
+
+NdefMessage NfcTag::getNdefMessage(byte *buffer, uint16_t bufferSize)
+{
+    if (!_hasNdefMessage)
+    {
+        return NdefMessage();
+    }
+    return NdefMessage(getNdefData(), _ndefLength, buffer, bufferSize);
+}
+
+const byte* NfcTag::getNdefData()
+{
+    if (!_hasNdefMessage)
+    {
+        return NULL;
+    }
+    return _ndefBuffer != NULL ? _ndefBuffer : _ndefInline;
+}
+
+bool NfcTag::isNdefDropped()
+{
+    return _ndefDropped;
+}
+
+uint16_t NfcTag::getNdefLength()
+{
+    return _ndefLength;
 }
 
 bool NfcTag::isFormatted()
@@ -93,12 +182,12 @@ void NfcTag::print()
 {
     ESP_LOGI(LOG_TAG, "NFC Tag - %d", _tagType);
 
-    if (_ndefMessage == NULL)
+    if (!_hasNdefMessage)
     {
         ESP_LOGI(LOG_TAG, "No NDEF Message");
     }
     else
     {
-        _ndefMessage->print();
+        getNdefMessage().print();
     }
 }
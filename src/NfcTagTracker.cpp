@@ -0,0 +1,192 @@
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "NfcTagTracker.h"
+
+static const char* LOG_TAG = "NFC Tag Tracker";
+
+NfcTagTracker::NfcTagTracker(NfcAdapter *adapter, int64_t exitTime, bool readMessages)
+{
+    _adapter = adapter;
+    _exitTime = exitTime;
+    _readMessages = readMessages;
+    _cacheMessages = false;
+    _entryCount = 0;
+    _current = -1;
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+// Tags unseen for the exit time are reported gone first, one event per poll, so
+// a tag resting on the antenna or one just entering doesn't hold them back. Then
+// the selected tag is checked, it costs one exchange and no anticollision.
+// Without one the field is polled for a tag.
+bool NfcTagTracker::poll(Event *event)
+{
+    int64_t now = esp_timer_get_time();
+    if (expire(event, now))
+    {
+        return true;
+    }
+
+    if (_current >= 0)
+    {
+        if (_adapter->tagStillPresent())
+        {
+            _entries[_current].lastSeen = now;
+            return false;
+        }
+        _current = -1;
+    }
+
+    if (_adapter->tagPresent())
+    {
+        TagSession *session = _adapter->open();
+        int index = find(session->getUid(), session->getUidLength());
+        if (index >= 0 && _entries[index].present)
+        {
+            // back before it was found gone, the same visit
+            ESP_LOGD(LOG_TAG, "Tag still present");
+            _entries[index].lastSeen = now;
+            _current = index;
+            _stats.suppressed++;
+        }
+        else
+        {
+            enter(session, index, event, now);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool NfcTagTracker::expire(Event *event, int64_t now)
+{
+    for (uint8_t i = 0; i < _entryCount; i++)
+    {
+        Entry *entry = &_entries[i];
+        if (entry->present && (int)i != _current && now - entry->lastSeen > _exitTime)
+        {
+            entry->present = false;
+            *event = Event();
+            event->type = EVENT_EXIT;
+            event->uidLength = entry->uidLength;
+            memcpy(event->uid, entry->uid, entry->uidLength);
+            event->time = now;
+            event->tag = entry->tag;
+            _stats.exits++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void NfcTagTracker::enter(TagSession *session, int index, Event *event, int64_t now)
+{
+    if (index < 0)
+    {
+        index = allocate();
+        Entry *entry = &_entries[index];
+        entry->uidLength = session->getUidLength();
+        memcpy(entry->uid, session->getUid(), entry->uidLength);
+        entry->hasMessage = false;
+    }
+    Entry *entry = &_entries[index];
+
+    *event = Event();
+    event->type = EVENT_ENTER;
+    event->uidLength = entry->uidLength;
+    memcpy(event->uid, entry->uid, entry->uidLength);
+    event->time = now;
+    if (_cacheMessages && entry->hasMessage)
+    {
+        event->cached = true;
+        _stats.cacheHits++;
+    }
+    else if (_readMessages)
+    {
+        entry->tag = session->read();
+        // a message that didn't fit inline, or a failed read, is read again next time
+        entry->hasMessage = entry->tag.hasNdefMessage() && session->getStatus().ok();
+    }
+    else
+    {
+        entry->tag = NfcTag(entry->uid, entry->uidLength, session->getTagType());
+    }
+    event->tag = entry->tag;
+
+    entry->present = true;
+    entry->lastSeen = now;
+    _current = index;
+    _stats.enters++;
+}
+
+void NfcTagTracker::setCacheMessages(bool cacheMessages)
+{
+    _cacheMessages = cacheMessages;
+}
+
+void NfcTagTracker::forget(const byte *uid, uint8_t uidLength)
+{
+    int index = find(uid, uidLength);
+    if (index >= 0)
+    {
+        _entries[index].hasMessage = false;
+    }
+}
+
+void NfcTagTracker::clear()
+{
+    _entryCount = 0;
+    _current = -1;
+}
+
+bool NfcTagTracker::isPresent(const byte *uid, uint8_t uidLength)
+{
+    int index = find(uid, uidLength);
+    return index >= 0 && _entries[index].present;
+}
+
+NfcTagTracker::Stats NfcTagTracker::getStats()
+{
+    return _stats;
+}
+
+void NfcTagTracker::resetStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+int NfcTagTracker::find(const byte *uid, uint8_t uidLength)
+{
+    for (uint8_t i = 0; i < _entryCount; i++)
+    {
+        if (_entries[i].uidLength == uidLength && memcmp(_entries[i].uid, uid, uidLength) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// a free entry, else the one of the tag gone longest, present tags last
+int NfcTagTracker::allocate()
+{
+    if (_entryCount < NFC_TRACKER_MAX_TAGS)
+    {
+        return _entryCount++;
+    }
+
+    int oldest = -1;
+    for (uint8_t i = 0; i < _entryCount; i++)
+    {
+        if ((int)i == _current)
+        {
+            continue;
+        }
+        if (oldest < 0 || (_entries[oldest].present && !_entries[i].present) ||
+            (_entries[oldest].present == _entries[i].present && _entries[i].lastSeen < _entries[oldest].lastSeen))
+        {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
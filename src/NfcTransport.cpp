@@ -0,0 +1,54 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_rom_sys.h>
+#include "NfcTransport.h"
+
+// SAK values from NXP AN10833, bit 2 set means the UID is not complete
+NfcTransport::PiccType NfcTransport::getType(byte sak)
+{
+    sak &= 0x7F;
+    switch (sak)
+    {
+        case 0x04: return PICC_TYPE_NOT_COMPLETE;
+        case 0x09: return PICC_TYPE_MIFARE_MINI;
+        case 0x08: return PICC_TYPE_MIFARE_1K;
+        case 0x18: return PICC_TYPE_MIFARE_4K;
+        case 0x00: return PICC_TYPE_MIFARE_UL;
+        case 0x10:
+        case 0x11: return PICC_TYPE_MIFARE_PLUS;
+        case 0x01: return PICC_TYPE_TNP3XXX;
+        case 0x20: return PICC_TYPE_ISO_14443_4;
+        case 0x40: return PICC_TYPE_ISO_18092;
+        default: return PICC_TYPE_UNKNOWN;
+    }
+}
+
+const char* NfcTransport::getStatusName(Status status)
+{
+    switch (status)
+    {
+        case STATUS_OK: return "Success";
+        case STATUS_ERROR: return "Error in communication";
+        case STATUS_COLLISION: return "Collision detected";
+        case STATUS_TIMEOUT: return "Timeout in communication";
+        case STATUS_NO_ROOM: return "A buffer is not big enough";
+        case STATUS_INTERNAL_ERROR: return "Internal error in the code";
+        case STATUS_INVALID: return "Invalid argument";
+        case STATUS_CRC_WRONG: return "The CRC_A does not match";
+        case STATUS_MIFARE_NACK: return "A MIFARE PICC responded with NAK";
+        default: return "Unknown error";
+    }
+}
+
+void NfcTransport::delay(uint32_t micros)
+{
+    // whole ticks let other tasks run, shorter waits spin
+    if (micros >= portTICK_PERIOD_MS * 1000)
+    {
+        vTaskDelay(pdMS_TO_TICKS(micros / 1000));
+    }
+    else
+    {
+        esp_rom_delay_us(micros);
+    }
+}
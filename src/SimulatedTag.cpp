@@ -0,0 +1,1015 @@
+#include <cstdlib>
+#include <esp_log.h>
+#include <mbedtls/des.h>
+#include "SimulatedTag.h"
+
+static const char* LOG_TAG = "Simulated Tag";
+
+// MF0ICU2 datasheet default key, "BREAKMEIFYOUCAN!"
+static const byte ULTRALIGHT_C_DEFAULT_KEY[16] = {
+    0x49, 0x45, 0x4D, 0x4B, 0x41, 0x45, 0x52, 0x42, 0x21, 0x4E, 0x41, 0x43, 0x55, 0x4F, 0x59, 0x46
+};
+
+// transport configuration, key A and B all FF, key A for everything
+static const byte CLASSIC_TRANSPORT_TRAILER[16] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x07, 0x80, 0x69, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+// ISO/IEC 14443-3 CRC_A
+static void appendCrc(byte *data, byte length)
+{
+    uint16_t crc = 0x6363;
+    for (byte i = 0; i < length; i++)
+    {
+        byte b = data[i] ^ (crc & 0xFF);
+        b ^= b << 4;
+        crc = (crc >> 8) ^ ((uint16_t)b << 8) ^ ((uint16_t)b << 3) ^ (b >> 4);
+    }
+    data[length] = crc & 0xFF;
+    data[length + 1] = crc >> 8;
+}
+
+SimulatedTag::SimulatedTag(Model model, const byte *uid, uint8_t uidLength)
+{
+    static uint32_t serial = 0;
+    serial++;
+
+    _model = model;
+    _uidLength = isClassic() ? 4 : 7;
+    if (uid != NULL && uidLength == _uidLength)
+    {
+        memcpy(_uid, uid, _uidLength);
+    }
+    else if (isClassic())
+    {
+        byte generated[4] = { 0x5A, (byte)(serial >> 16), (byte)(serial >> 8), (byte)serial };
+        memcpy(_uid, generated, sizeof(generated));
+    }
+    else
+    {
+        // NXP manufacturer code first
+        byte generated[7] = { 0x04, 0x5A, 0x00, (byte)(serial >> 24), (byte)(serial >> 16), (byte)(serial >> 8), (byte)serial };
+        memcpy(_uid, generated, sizeof(generated));
+    }
+
+    if (isType4())
+    {
+        // the CC file padded to 16 bytes, then the NDEF file
+        _memorySize = 16 + (model == MODEL_NTAG424_DNA ? 256 : 4096);
+    }
+    else
+    {
+        _memorySize = model == MODEL_MIFARE_CLASSIC_1K ? 1024 : model == MODEL_MIFARE_CLASSIC_4K ? 4096 : getPages() * 4;
+    }
+    _memory = (byte*)calloc(_memorySize, 1);
+    if (_memory == NULL)
+    {
+        ESP_LOGE(LOG_TAG, "Could not allocate %d bytes", _memorySize);
+        _memorySize = 0;
+    }
+    _state = STATE_IDLE;
+    _authSector = -1;
+    _authKeyB = false;
+    _authenticated = false;
+    _authStarted = false;
+    _random = serial * 2654435761u + 1;
+    memcpy(_key, ULTRALIGHT_C_DEFAULT_KEY, sizeof(_key));
+    _ndefApplication = false;
+    _protocol = false;
+    _fsd = IsoDep::getFrameSize(0);
+    _blockNumber = 1;
+    _lastBlockSize = 0;
+    _apduLength = 0;
+    _answerLength = 0;
+    _answerSent = 0;
+    _applicationSelected = false;
+    _file = 0;
+    _writeCycles = 0;
+    if (_memory == NULL)
+    {
+        return;
+    }
+
+    if (isType4())
+    {
+        // NTAG 424 DNA is shipped with the NDEF application, DESFire blank
+        if (model == MODEL_NTAG424_DNA)
+        {
+            formatNdef();
+        }
+        return;
+    }
+
+    if (isClassic())
+    {
+        // block 0 is the UID, BCC, SAK, ATQA and manufacturer data
+        memcpy(_memory, _uid, 4);
+        _memory[4] = _uid[0] ^ _uid[1] ^ _uid[2] ^ _uid[3];
+        _memory[5] = getSak();
+        _memory[6] = model == MODEL_MIFARE_CLASSIC_1K ? 0x04 : 0x02;
+        _memory[7] = 0x00;
+        for (int sector = 0; sector < (model == MODEL_MIFARE_CLASSIC_1K ? 16 : 40); sector++)
+        {
+            memcpy(&_memory[getTrailer(sector) * 16], CLASSIC_TRANSPORT_TRAILER, 16);
+        }
+        return;
+    }
+
+    // pages 0-2 hold the UID and its check bytes, then the lock bytes
+    memcpy(_memory, _uid, 3);
+    _memory[3] = 0x88 ^ _uid[0] ^ _uid[1] ^ _uid[2];
+    memcpy(&_memory[4], &_uid[3], 4);
+    _memory[8] = _uid[3] ^ _uid[4] ^ _uid[5] ^ _uid[6];
+    _memory[9] = 0x48;
+    if (model == MODEL_ULTRALIGHT_C)
+    {
+        // authentication disabled, AUTH0 past the last page
+        _memory[42 * 4] = 0x30;
+    }
+    else if (model != MODEL_ULTRALIGHT)
+    {
+        uint16_t config = getConfigPage();
+        _memory[config * 4 + 3] = 0xFF;
+        memset(&_memory[(config + 2) * 4], 0xFF, 4);
+    }
+    if (model >= MODEL_NTAG213)
+    {
+        // NTAG is shipped NDEF formatted
+        formatNdef();
+    }
+}
+
+SimulatedTag::~SimulatedTag()
+{
+    free(_memory);
+}
+
+SimulatedTag::Model SimulatedTag::getModel()
+{
+    return _model;
+}
+
+bool SimulatedTag::isClassic()
+{
+    return _model == MODEL_MIFARE_CLASSIC_1K || _model == MODEL_MIFARE_CLASSIC_4K;
+}
+
+bool SimulatedTag::isType4()
+{
+    return _model == MODEL_NTAG424_DNA || _model == MODEL_DESFIRE_EV2;
+}
+
+const byte* SimulatedTag::getUid()
+{
+    return _uid;
+}
+
+uint8_t SimulatedTag::getUidLength()
+{
+    return _uidLength;
+}
+
+byte SimulatedTag::getSak()
+{
+    if (isType4())
+    {
+        return 0x20;
+    }
+    return _model == MODEL_MIFARE_CLASSIC_1K ? 0x08 : _model == MODEL_MIFARE_CLASSIC_4K ? 0x18 : 0x00;
+}
+
+byte* SimulatedTag::getMemory()
+{
+    return _memory;
+}
+
+uint16_t SimulatedTag::getMemorySize()
+{
+    return _memorySize;
+}
+
+void SimulatedTag::formatNdef()
+{
+    if (_memory == NULL)
+    {
+        return;
+    }
+
+    if (isType4())
+    {
+        // CC: mapping version 2.0, MLe, MLc, then NDEF file E104 with free read and
+        // write access. NLEN 0 is an empty NDEF file.
+        uint16_t fileSize = _memorySize - 16;
+        bool ntag = _model == MODEL_NTAG424_DNA;
+        byte cc[15] = {0x00, 0x0F, 0x20, (byte)(ntag ? 0x01 : 0x00), (byte)(ntag ? 0x00 : 0x3B), 0x00, (byte)(ntag ? 0xFF : 0x34),
+            0x04, 0x06, 0xE1, 0x04, (byte)(fileSize >> 8), (byte)fileSize, 0x00, 0x00};
+        memset(_memory, 0, _memorySize);
+        memcpy(_memory, cc, sizeof(cc));
+        _ndefApplication = true;
+        return;
+    }
+
+    if (isClassic())
+    {
+        // MAD in sector 0, sectors 1-15 with the NFC Forum key and the NDEF AID
+        byte mad1[16] = {0x14, 0x01, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
+        byte mad2[16] = {0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
+        byte madTrailer[16] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0x78, 0x77, 0x88, 0xC1, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+        byte ndefTrailer[16] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7, 0x7F, 0x07, 0x88, 0x40, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+        memcpy(&_memory[16], mad1, 16);
+        memcpy(&_memory[32], mad2, 16);
+        memcpy(&_memory[48], madTrailer, 16);
+        for (int sector = 1; sector < 16; sector++)
+        {
+            memset(&_memory[sector * 64], 0, 48);
+            memcpy(&_memory[sector * 64 + 48], ndefTrailer, 16);
+        }
+        byte empty[3] = {0x03, 0x00, 0xFE};
+        memcpy(&_memory[64], empty, sizeof(empty));
+        return;
+    }
+
+    // CC: NDEF 1.0, data area size / 8, read and write access
+    uint16_t dataPages = _model == MODEL_ULTRALIGHT ? 12 : _model == MODEL_ULTRALIGHT_C ? 36 :
+        _model == MODEL_ULTRALIGHT_EV1 ? 12 : getConfigPage() - 5;
+    byte cc[4] = {0xE1, 0x10, (byte)(dataPages * 4 / 8), 0x00};
+    memcpy(&_memory[12], cc, sizeof(cc));
+    memset(&_memory[16], 0, dataPages * 4);
+    byte empty[3] = {0x03, 0x00, 0xFE};
+    memcpy(&_memory[16], empty, sizeof(empty));
+}
+
+void SimulatedTag::setPassword(const byte *password, const byte *pack, byte auth0, bool protectReads)
+{
+    if (isClassic() || _model == MODEL_ULTRALIGHT || _model == MODEL_ULTRALIGHT_C || _memory == NULL)
+    {
+        return;
+    }
+    uint16_t config = getConfigPage();
+    _memory[config * 4 + 3] = auth0;
+    _memory[(config + 1) * 4] = protectReads ? 0x80 : 0x00;
+    memcpy(&_memory[(config + 2) * 4], password, 4);
+    memcpy(&_memory[(config + 3) * 4], pack, 2);
+}
+
+void SimulatedTag::setUltralightCKey(const byte *key, byte auth0, bool protectReads)
+{
+    if (_model != MODEL_ULTRALIGHT_C || _memory == NULL)
+    {
+        return;
+    }
+    memcpy(_key, key, sizeof(_key));
+    _memory[42 * 4] = auth0;
+    _memory[43 * 4] = protectReads ? 0x00 : 0x01;
+}
+
+SimulatedTag::State SimulatedTag::getState()
+{
+    return _state;
+}
+
+void SimulatedTag::setState(State state)
+{
+    if (state != STATE_ACTIVE)
+    {
+        // leaving the selected state ends any authentication and the ISO-DEP protocol
+        _authSector = -1;
+        _authenticated = false;
+        _authStarted = false;
+        _protocol = false;
+        _applicationSelected = false;
+        _file = 0;
+    }
+    _state = state;
+}
+
+NfcTransport::Status SimulatedTag::nak()
+{
+    setState(STATE_IDLE);
+    return NfcTransport::STATUS_MIFARE_NACK;
+}
+
+uint16_t SimulatedTag::getPages()
+{
+    switch (_model)
+    {
+        case MODEL_ULTRALIGHT: return 16;
+        case MODEL_ULTRALIGHT_C: return 48;
+        case MODEL_ULTRALIGHT_EV1: return 20;
+        case MODEL_NTAG213: return 45;
+        case MODEL_NTAG215: return 135;
+        case MODEL_NTAG216: return 231;
+        default: return 0;
+    }
+}
+
+// CFG0 of NTAG and Ultralight EV1, followed by CFG1, PWD and PACK
+uint16_t SimulatedTag::getConfigPage()
+{
+    return getPages() - 4;
+}
+
+byte SimulatedTag::getAuth0()
+{
+    if (_model == MODEL_ULTRALIGHT)
+    {
+        return 0xFF;
+    }
+    if (_model == MODEL_ULTRALIGHT_C)
+    {
+        return _memory[42 * 4];
+    }
+    return _memory[getConfigPage() * 4 + 3];
+}
+
+bool SimulatedTag::readProtected()
+{
+    if (_model == MODEL_ULTRALIGHT)
+    {
+        return false;
+    }
+    if (_model == MODEL_ULTRALIGHT_C)
+    {
+        return (_memory[43 * 4] & 0x01) == 0;
+    }
+    return (_memory[(getConfigPage() + 1) * 4] & 0x80) != 0;
+}
+
+// static lock bits, byte 2 of page 2 locks pages 3-7 and byte 3 pages 8-15
+bool SimulatedTag::pageLocked(uint16_t page)
+{
+    if (page < 3 || page > 15)
+    {
+        return false;
+    }
+    return page < 8 ? (_memory[10] >> page) & 0x01 : (_memory[11] >> (page - 8)) & 0x01;
+}
+
+// PWD, PACK and the Ultralight C key always read as 0
+bool SimulatedTag::pageHidden(uint16_t page)
+{
+    if (_model == MODEL_ULTRALIGHT_C)
+    {
+        return page >= 44;
+    }
+    return _model != MODEL_ULTRALIGHT && page >= getConfigPage() + 2;
+}
+
+NfcTransport::Status SimulatedTag::read(byte block, byte *data)
+{
+    if (_state != STATE_ACTIVE || _protocol)
+    {
+        return NfcTransport::STATUS_TIMEOUT;
+    }
+    if (isType4())
+    {
+        return nak();
+    }
+
+    if (isClassic())
+    {
+        if (block * 16 >= _memorySize || getSector(block) != _authSector || !canRead(block))
+        {
+            return nak();
+        }
+        memcpy(data, &_memory[block * 16], 16);
+        if (block == getTrailer(_authSector))
+        {
+            // key A never reads back, key B only when the access bits allow it
+            byte access = getAccess(block);
+            memset(data, 0, 6);
+            if (!(access == 0 || access == 2 || access == 1))
+            {
+                memset(&data[10], 0, 6);
+            }
+        }
+        return NfcTransport::STATUS_OK;
+    }
+
+    uint16_t pages = getPages();
+    if (block >= pages || (readProtected() && !_authenticated && block >= getAuth0()))
+    {
+        return nak();
+    }
+    // READ returns 4 pages, rolling over to page 0 past the last page
+    for (byte i = 0; i < 4; i++)
+    {
+        uint16_t page = (block + i) % pages;
+        bool hidden = pageHidden(page) || (readProtected() && !_authenticated && page >= getAuth0());
+        if (hidden)
+        {
+            memset(&data[i * 4], 0, 4);
+        }
+        else
+        {
+            memcpy(&data[i * 4], &_memory[page * 4], 4);
+        }
+    }
+    return NfcTransport::STATUS_OK;
+}
+
+NfcTransport::Status SimulatedTag::write(byte block, const byte *data, byte length)
+{
+    if (_state != STATE_ACTIVE || _protocol)
+    {
+        return NfcTransport::STATUS_TIMEOUT;
+    }
+    if (isType4())
+    {
+        return nak();
+    }
+
+    if (isClassic())
+    {
+        if (length != 16 || block == 0 || block * 16 >= _memorySize || getSector(block) != _authSector)
+        {
+            return nak();
+        }
+        if (block != getTrailer(_authSector))
+        {
+            if (!canWrite(block))
+            {
+                return nak();
+            }
+            memcpy(&_memory[block * 16], data, 16);
+            return NfcTransport::STATUS_OK;
+        }
+
+        // each part of the trailer is written only if the access bits allow it
+        byte access = getAccess(block);
+        bool keyA = access == 0 || access == 1;
+        bool keyB = access == 4 || access == 3;
+        bool accessBits = (access == 1 && !_authKeyB) || ((access == 3 || access == 5) && _authKeyB);
+        bool keyAWritable = (keyA && !_authKeyB) || (keyB && _authKeyB);
+        if (!keyAWritable && !accessBits)
+        {
+            return nak();
+        }
+        if (accessBits && !accessBitsValid(data))
+        {
+            // a real tag would accept these and lock the sector for good
+            ESP_LOGE(LOG_TAG, "Error. Invalid access bits for block %d", block);
+            return nak();
+        }
+        byte *trailer = &_memory[block * 16];
+        if (keyAWritable)
+        {
+            memcpy(trailer, data, 6);
+            memcpy(&trailer[10], &data[10], 6);
+        }
+        if (accessBits)
+        {
+            memcpy(&trailer[6], &data[6], 4);
+        }
+        return NfcTransport::STATUS_OK;
+    }
+
+    if (block < 2 || block >= getPages() || pageLocked(block) || (block >= getAuth0() && !_authenticated))
+    {
+        return nak();
+    }
+    byte *page = &_memory[block * 4];
+    if (block == 2)
+    {
+        // only the lock bytes can be written, and their bits only set
+        page[2] |= data[2];
+        page[3] |= data[3];
+    }
+    else if (block == 3)
+    {
+        // the CC is one time programmable
+        for (byte i = 0; i < 4; i++)
+        {
+            page[i] |= data[i];
+        }
+    }
+    else
+    {
+        // COMPATIBILITY_WRITE sends 16 bytes, only the first 4 are written
+        memcpy(page, data, 4);
+    }
+    return NfcTransport::STATUS_OK;
+}
+
+NfcTransport::Status SimulatedTag::authenticate(bool keyB, byte block, const byte *key)
+{
+    if (_state != STATE_ACTIVE || _protocol)
+    {
+        return NfcTransport::STATUS_TIMEOUT;
+    }
+    if (!isClassic() || block * 16 >= _memorySize)
+    {
+        return nak();
+    }
+
+    int sector = getSector(block);
+    const byte *trailer = &_memory[getTrailer(sector) * 16];
+    if (memcmp(key, keyB ? &trailer[10] : trailer, 6) != 0)
+    {
+        // the tag doesn't answer a wrong key and needs to be selected again
+        setState(STATE_IDLE);
+        return NfcTransport::STATUS_TIMEOUT;
+    }
+    _authSector = sector;
+    _authKeyB = keyB;
+    return NfcTransport::STATUS_OK;
+}
+
+NfcTransport::Status SimulatedTag::command(const byte *command, byte commandSize, byte *response, byte *responseSize)
+{
+    if (_state != STATE_ACTIVE)
+    {
+        return NfcTransport::STATUS_TIMEOUT;
+    }
+    if (isClassic() || commandSize == 0)
+    {
+        return nak();
+    }
+    if (_protocol)
+    {
+        return isoDepBlock(command, commandSize, response, responseSize);
+    }
+
+    bool ntag = _model != MODEL_ULTRALIGHT && _model != MODEL_ULTRALIGHT_C;
+    NfcTransport::Status status = NfcTransport::STATUS_OK;
+    byte length = 0;
+    byte data[64];
+
+    if (isType4())
+    {
+        if (command[0] != ISO_DEP_CMD_RATS || commandSize < 2)
+        {
+            return nak();
+        }
+        // ATS: TL, T0 with FSCI and TA, TB, TC present, TA, TB with FWI and SFGI, TC and one historical byte
+        byte fsci = _model == MODEL_NTAG424_DNA ? 0x07 : 0x05;
+        byte ats[6] = {0x06, (byte)(0x70 | fsci), 0x77, (byte)(_model == MODEL_NTAG424_DNA ? 0x71 : 0x81), 0x02, 0x80};
+        memcpy(data, ats, sizeof(ats));
+        length = sizeof(ats);
+        _fsd = IsoDep::getFrameSize(command[1] >> 4);
+        _protocol = true;
+        _blockNumber = 1;
+        _lastBlockSize = 0;
+        _apduLength = 0;
+        _answerLength = 0;
+        _answerSent = 0;
+    }
+    else if (command[0] == 0x60 && ntag)
+    {
+        // GET_VERSION: NXP, product type, subtype, version, storage size, ISO 14443-3
+        byte version[8] = {0x00, 0x04, 0x04, 0x02, 0x01, 0x00, 0x00, 0x03};
+        version[6] = _model == MODEL_NTAG213 ? 0x0F : _model == MODEL_NTAG215 ? 0x11 : 0x13;
+        if (_model == MODEL_ULTRALIGHT_EV1)
+        {
+            version[2] = 0x03;
+            version[3] = 0x01;
+            version[6] = 0x0B;
+        }
+        memcpy(data, version, sizeof(version));
+        length = sizeof(version);
+    }
+    else if (command[0] == 0x3A && ntag && commandSize >= 3)
+    {
+        // FAST_READ
+        byte start = command[1];
+        byte end = command[2];
+        if (start > end || end >= getPages() || (readProtected() && !_authenticated && end >= getAuth0()))
+        {
+            return nak();
+        }
+        if ((end - start + 1) * 4 + 2 > (int)sizeof(data))
+        {
+            return NfcTransport::STATUS_NO_ROOM;
+        }
+        for (uint16_t page = start; page <= end; page++)
+        {
+            if (pageHidden(page))
+            {
+                memset(&data[length], 0, 4);
+            }
+            else
+            {
+                memcpy(&data[length], &_memory[page * 4], 4);
+            }
+            length += 4;
+        }
+    }
+    else if (command[0] == 0x1B && ntag && commandSize >= 5)
+    {
+        // PWD_AUTH
+        uint16_t config = getConfigPage();
+        if (memcmp(&command[1], &_memory[(config + 2) * 4], 4) != 0)
+        {
+            return nak();
+        }
+        _authenticated = true;
+        memcpy(data, &_memory[(config + 3) * 4], 2);
+        length = 2;
+    }
+    else if ((command[0] == 0x1A || command[0] == 0xAF) && _model == MODEL_ULTRALIGHT_C)
+    {
+        ultralightCAuth(command, commandSize, data, &length, &status);
+        if (status != NfcTransport::STATUS_OK)
+        {
+            return status;
+        }
+    }
+    else
+    {
+        return nak();
+    }
+
+    if (*responseSize < length + 2)
+    {
+        return NfcTransport::STATUS_NO_ROOM;
+    }
+    memcpy(response, data, length);
+    appendCrc(response, length);
+    *responseSize = length + 2;
+    return NfcTransport::STATUS_OK;
+}
+
+uint16_t SimulatedTag::takeWriteCycles()
+{
+    uint16_t cycles = _writeCycles;
+    _writeCycles = 0;
+    return cycles;
+}
+
+// A block answered as ISO/IEC 14443-4 asks of the PICC. Our last block is sent
+// again for R(NAK) or R(ACK) with our block number, the next chained one for
+// R(ACK) with the other. A block that isn't understood is not answered.
+NfcTransport::Status SimulatedTag::isoDepBlock(const byte *block, byte blockSize, byte *response, byte *responseSize)
+{
+    byte out[ISO_DEP_MAX_FRAME];
+    uint16_t outSize;
+    bool remember = true;
+    byte pcb = block[0];
+
+    if ((pcb & ISO_DEP_PCB_I_MASK) == ISO_DEP_PCB_I_BLOCK)
+    {
+        if (_apduLength + blockSize - 1 > (int)sizeof(_apdu))
+        {
+            _apduLength = 0;
+            return NfcTransport::STATUS_TIMEOUT;
+        }
+        _blockNumber = pcb & 0x01;
+        memcpy(&_apdu[_apduLength], &block[1], blockSize - 1);
+        _apduLength += blockSize - 1;
+        if (pcb & ISO_DEP_PCB_CHAINING)
+        {
+            out[0] = ISO_DEP_PCB_R_ACK | _blockNumber;
+            outSize = 1;
+        }
+        else
+        {
+            processApdu();
+            _apduLength = 0;
+            _answerSent = 0;
+            outSize = nextAnswerBlock(out);
+        }
+    }
+    else if ((pcb & ISO_DEP_PCB_R_MASK) == ISO_DEP_PCB_R_ACK || (pcb & ISO_DEP_PCB_R_MASK) == ISO_DEP_PCB_R_NAK)
+    {
+        bool ack = (pcb & ISO_DEP_PCB_R_MASK) == ISO_DEP_PCB_R_ACK;
+        if ((pcb & 0x01) == _blockNumber && _lastBlockSize > 0)
+        {
+            memcpy(out, _lastBlock, _lastBlockSize);
+            outSize = _lastBlockSize;
+            remember = false;
+        }
+        else if (ack && _answerSent < _answerLength)
+        {
+            _blockNumber = pcb & 0x01;
+            outSize = nextAnswerBlock(out);
+        }
+        else
+        {
+            out[0] = ISO_DEP_PCB_R_ACK | _blockNumber;
+            outSize = 1;
+            remember = false;
+        }
+    }
+    else if (pcb == ISO_DEP_PCB_S_DESELECT)
+    {
+        out[0] = ISO_DEP_PCB_S_DESELECT;
+        outSize = 1;
+        setState(STATE_HALT);
+    }
+    else
+    {
+        return NfcTransport::STATUS_TIMEOUT;
+    }
+
+    if (remember)
+    {
+        memcpy(_lastBlock, out, outSize);
+        _lastBlockSize = outSize;
+    }
+    if (*responseSize < outSize + 2)
+    {
+        return NfcTransport::STATUS_NO_ROOM;
+    }
+    memcpy(response, out, outSize);
+    appendCrc(response, outSize);
+    *responseSize = outSize + 2;
+    return NfcTransport::STATUS_OK;
+}
+
+// the next part of the answer, chained if it doesn't fit FSD
+uint16_t SimulatedTag::nextAnswerBlock(byte *block)
+{
+    uint16_t chunk = _answerLength - _answerSent;
+    bool chaining = chunk > _fsd - ISO_DEP_FRAME_OVERHEAD;
+    if (chaining)
+    {
+        chunk = _fsd - ISO_DEP_FRAME_OVERHEAD;
+    }
+    block[0] = ISO_DEP_PCB_I_BLOCK | _blockNumber | (chaining ? ISO_DEP_PCB_CHAINING : 0);
+    memcpy(&block[1], &_answer[_answerSent], chunk);
+    _answerSent += chunk;
+    return chunk + 1;
+}
+
+// SELECT, READ BINARY and UPDATE BINARY of the NFC Forum NDEF application.
+// MLe and MLc from the CC are enforced, so a driver ignoring them sees 6700.
+void SimulatedTag::processApdu()
+{
+    static const byte NDEF_AID[7] = {0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01};
+    uint16_t sw = 0x9000;
+    _answerLength = 0;
+    byte ins = _apduLength >= 4 ? _apdu[1] : 0x00;
+    uint16_t p = _apduLength >= 4 ? (_apdu[2] << 8) | _apdu[3] : 0;
+    byte lc = _apduLength >= 5 ? _apdu[4] : 0;
+    uint16_t maxRead = (_memory[3] << 8) | _memory[4];
+    uint16_t maxWrite = (_memory[5] << 8) | _memory[6];
+
+    if (_apduLength < 4)
+    {
+        sw = 0x6700;
+    }
+    else if (_apdu[0] != 0x00)
+    {
+        // class not supported
+        sw = 0x6E00;
+    }
+    else if (ins == 0xA4)
+    {
+        if (_apduLength < 5 + lc)
+        {
+            sw = 0x6700;
+        }
+        else if (_apdu[2] == 0x04)
+        {
+            _applicationSelected = _ndefApplication && lc == sizeof(NDEF_AID) && memcmp(&_apdu[5], NDEF_AID, lc) == 0;
+            _file = 0;
+            sw = _applicationSelected ? 0x9000 : 0x6A82;
+        }
+        else if (_apdu[2] == 0x00 && lc == 2 && _applicationSelected)
+        {
+            uint16_t file = (_apdu[5] << 8) | _apdu[6];
+            _file = getFile(file) != NULL ? file : 0;
+            sw = _file != 0 ? 0x9000 : 0x6A82;
+        }
+        else
+        {
+            sw = 0x6A82;
+        }
+    }
+    else if (ins == 0xB0)
+    {
+        uint16_t le = lc == 0 ? 256 : lc;
+        if (_file == 0)
+        {
+            // no file selected
+            sw = 0x6986;
+        }
+        else if (le > maxRead || (_file != 0xE103 && _memory[13] != 0x00))
+        {
+            sw = le > maxRead ? 0x6700 : 0x6982;
+        }
+        else if (p >= getFileSize(_file))
+        {
+            sw = 0x6B00;
+        }
+        else
+        {
+            // an answer past the end of the file is cut short
+            _answerLength = p + le > getFileSize(_file) ? getFileSize(_file) - p : le;
+            memcpy(_answer, getFile(_file) + p, _answerLength);
+        }
+    }
+    else if (ins == 0xD6)
+    {
+        if (_file == 0)
+        {
+            sw = 0x6986;
+        }
+        else if (_file == 0xE103 || _memory[14] != 0x00)
+        {
+            // the CC can't be written, the NDEF file only with free write access
+            sw = 0x6982;
+        }
+        else if (_apduLength < 5 + lc || lc > maxWrite)
+        {
+            sw = 0x6700;
+        }
+        else if (p + lc > getFileSize(_file))
+        {
+            sw = 0x6B00;
+        }
+        else
+        {
+            memcpy(getFile(_file) + p, &_apdu[5], lc);
+            _writeCycles += (lc + SIMULATED_TYPE_4_WRITE_SIZE - 1) / SIMULATED_TYPE_4_WRITE_SIZE;
+        }
+    }
+    else
+    {
+        // instruction not supported
+        sw = 0x6D00;
+    }
+
+    if (sw != 0x9000)
+    {
+        _answerLength = 0;
+    }
+    _answer[_answerLength++] = sw >> 8;
+    _answer[_answerLength++] = sw & 0xFF;
+}
+
+// the CC file, and the NDEF file it names, NULL for any other file
+byte* SimulatedTag::getFile(uint16_t file)
+{
+    if (file == 0xE103)
+    {
+        return _memory;
+    }
+    if (file == ((_memory[9] << 8) | _memory[10]))
+    {
+        return &_memory[16];
+    }
+    return NULL;
+}
+
+uint16_t SimulatedTag::getFileSize(uint16_t file)
+{
+    if (file == 0xE103)
+    {
+        return 15;
+    }
+    uint16_t size = (_memory[11] << 8) | _memory[12];
+    return size < _memorySize - 16 ? size : _memorySize - 16;
+}
+
+#if defined(MBEDTLS_DES_C)
+// 2 key 3DES in CBC mode, iv is updated to the last ciphertext block
+static void simulatedCrypt(const byte *key, int mode, byte *iv, const byte *input, byte *output, size_t length)
+{
+    mbedtls_des3_context context;
+    mbedtls_des3_init(&context);
+    if (mode == MBEDTLS_DES_ENCRYPT)
+    {
+        mbedtls_des3_set2key_enc(&context, key);
+    }
+    else
+    {
+        mbedtls_des3_set2key_dec(&context, key);
+    }
+    mbedtls_des3_crypt_cbc(&context, mode, length, iv, input, output);
+    mbedtls_des3_free(&context);
+}
+#endif
+
+// MF0ICU2 7.5.5: the tag sends ek(RndB), checks RndB' in ek(RndA || RndB')
+// and proves the key with ek(RndA')
+void SimulatedTag::ultralightCAuth(const byte *command, byte commandSize, byte *response, byte *responseSize, NfcTransport::Status *status)
+{
+#if defined(MBEDTLS_DES_C)
+    if (command[0] == 0x1A)
+    {
+        for (byte i = 0; i < sizeof(_rndB); i++)
+        {
+            _random = _random * 1103515245u + 12345;
+            _rndB[i] = _random >> 16;
+        }
+        byte iv[8] = { 0 };
+        response[0] = 0xAF;
+        simulatedCrypt(_key, MBEDTLS_DES_ENCRYPT, iv, _rndB, &response[1], sizeof(_rndB));
+        *responseSize = 1 + sizeof(_rndB);
+        _authStarted = true;
+        return;
+    }
+
+    if (!_authStarted || commandSize < 17)
+    {
+        *status = nak();
+        return;
+    }
+    _authStarted = false;
+
+    // CBC continues from ek(RndB), the last block the tag sent
+    byte iv[8];
+    byte encryptedRndB[8];
+    byte ivStart[8] = { 0 };
+    simulatedCrypt(_key, MBEDTLS_DES_ENCRYPT, ivStart, _rndB, encryptedRndB, sizeof(encryptedRndB));
+    memcpy(iv, encryptedRndB, sizeof(iv));
+    byte plain[16];
+    simulatedCrypt(_key, MBEDTLS_DES_DECRYPT, iv, &command[1], plain, sizeof(plain));
+    if (memcmp(&plain[8], &_rndB[1], 7) != 0 || plain[15] != _rndB[0])
+    {
+        *status = nak();
+        return;
+    }
+
+    byte rndA[8];
+    memcpy(rndA, &plain[1], 7);
+    rndA[7] = plain[0];
+    response[0] = 0x00;
+    simulatedCrypt(_key, MBEDTLS_DES_ENCRYPT, iv, rndA, &response[1], sizeof(rndA));
+    *responseSize = 1 + sizeof(rndA);
+    _authenticated = true;
+#else
+    *status = nak();
+#endif
+}
+
+// 32 sectors of 4 blocks, then 4K tags have 8 sectors of 16 blocks
+int SimulatedTag::getSector(byte block)
+{
+    return block < 128 ? block / 4 : 32 + (block - 128) / 16;
+}
+
+int SimulatedTag::getTrailer(int sector)
+{
+    return sector < 32 ? sector * 4 + 3 : 128 + (sector - 32) * 16 + 15;
+}
+
+// C1 C2 C3 of a block, as a 3 bit number. Blocks of the 16 block sectors share
+// access bits in groups of 5.
+byte SimulatedTag::getAccess(byte block)
+{
+    int sector = getSector(block);
+    const byte *trailer = &_memory[getTrailer(sector) * 16];
+    int group;
+    if (sector < 32)
+    {
+        group = block % 4;
+    }
+    else
+    {
+        int offset = (block - 128) % 16;
+        group = offset == 15 ? 3 : offset / 5;
+    }
+    byte c1 = (trailer[7] >> (4 + group)) & 0x01;
+    byte c2 = (trailer[8] >> group) & 0x01;
+    byte c3 = (trailer[8] >> (4 + group)) & 0x01;
+    return (c1 << 2) | (c2 << 1) | c3;
+}
+
+// byte 6 and the low nibble of byte 7 hold the inverted access bits
+bool SimulatedTag::accessBitsValid(const byte *trailer)
+{
+    return (trailer[6] & 0x0F) == (~(trailer[7] >> 4) & 0x0F) &&
+        (trailer[6] >> 4) == (~trailer[8] & 0x0F) &&
+        (trailer[7] & 0x0F) == (~(trailer[8] >> 4) & 0x0F);
+}
+
+bool SimulatedTag::canRead(byte block)
+{
+    byte trailerAccess = getAccess(getTrailer(_authSector));
+    if (block == getTrailer(_authSector))
+    {
+        return true;
+    }
+    // a readable key B can't be used for access
+    bool keyBReadable = trailerAccess == 0 || trailerAccess == 2 || trailerAccess == 1;
+    if (_authKeyB && keyBReadable)
+    {
+        return false;
+    }
+    byte access = getAccess(block);
+    if (access == 7)
+    {
+        return false;
+    }
+    return !(access == 3 || access == 5) || _authKeyB;
+}
+
+bool SimulatedTag::canWrite(byte block)
+{
+    byte trailerAccess = getAccess(getTrailer(_authSector));
+    bool keyBReadable = trailerAccess == 0 || trailerAccess == 2 || trailerAccess == 1;
+    if (_authKeyB && keyBReadable)
+    {
+        return false;
+    }
+    switch (getAccess(block))
+    {
+        case 0: return true;
+        case 4:
+        case 6:
+        case 3: return _authKeyB;
+        default: return false;
+    }
+}
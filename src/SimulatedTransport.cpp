@@ -0,0 +1,468 @@
+#include <esp_log.h>
+#include "SimulatedTransport.h"
+#include "WritePlan.h"
+
+static const char* LOG_TAG = "Simulated Transport";
+
+SimulatedTransport::SimulatedTransport()
+{
+    memset(_tags, 0, sizeof(_tags));
+    memset(&uid, 0, sizeof(uid));
+    _tagCount = 0;
+    _selected = NULL;
+    _crypto = false;
+    _latency.command = NFC_TIME_COMMAND_US;
+    _latency.byte = NFC_TIME_BYTE_US;
+    _latency.write = NFC_TIME_WRITE_US;
+    _latency.authenticate = NFC_TIME_AUTHENTICATE_US;
+    _errorThreshold = 0;
+    _random = 1;
+    _removeAfter = 0;
+    _irq = NULL;
+    _maxFrameSize = NFC_TRANSPORT_MAX_FRAME;
+    resetStats();
+}
+
+bool SimulatedTransport::addTag(SimulatedTag *tag)
+{
+    if (_tagCount >= SIMULATED_FIELD_MAX_TAGS)
+    {
+        ESP_LOGE(LOG_TAG, "Field is full, %d tags", _tagCount);
+        return false;
+    }
+    // a tag entering the field powers up IDLE
+    tag->setState(SimulatedTag::STATE_IDLE);
+    _tags[_tagCount++] = tag;
+    return true;
+}
+
+void SimulatedTransport::removeTag(SimulatedTag *tag)
+{
+    for (uint8_t i = 0; i < _tagCount; i++)
+    {
+        if (_tags[i] == tag)
+        {
+            memmove(&_tags[i], &_tags[i + 1], (_tagCount - i - 1) * sizeof(SimulatedTag*));
+            _tagCount--;
+            break;
+        }
+    }
+    if (_selected == tag)
+    {
+        _selected = NULL;
+    }
+}
+
+void SimulatedTransport::clearField()
+{
+    _tagCount = 0;
+    _selected = NULL;
+}
+
+uint8_t SimulatedTransport::getTagCount()
+{
+    return _tagCount;
+}
+
+SimulatedTag* SimulatedTransport::getSelectedTag()
+{
+    return _selected;
+}
+
+void SimulatedTransport::setLatency(const Latency& latency)
+{
+    _latency = latency;
+}
+
+SimulatedTransport::Latency SimulatedTransport::getLatency()
+{
+    return _latency;
+}
+
+void SimulatedTransport::setErrorRate(float rate, uint32_t seed)
+{
+    _errorThreshold = rate <= 0 ? 0 : rate >= 1 ? UINT32_MAX : (uint32_t)(rate * UINT32_MAX);
+    _random = seed != 0 ? seed : 1;
+}
+
+void SimulatedTransport::removeTagAfter(uint32_t exchanges)
+{
+    _removeAfter = exchanges;
+}
+
+void SimulatedTransport::setIrqSource(SimulatedIrqSource *irq)
+{
+    _irq = irq;
+}
+
+void SimulatedTransport::setMaxFrameSize(uint16_t size)
+{
+    _maxFrameSize = size;
+}
+
+uint16_t SimulatedTransport::getMaxFrameSize()
+{
+    return _maxFrameSize;
+}
+
+SimulatedTransport::Stats SimulatedTransport::getStats()
+{
+    return _stats;
+}
+
+void SimulatedTransport::resetStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+// A frame sent, moving the tag out of the field if it is due. Lost frames
+// never reach the tag, garbled ones are executed but their answer is corrupt.
+SimulatedTransport::Frame SimulatedTransport::send()
+{
+    if (_removeAfter > 0 && --_removeAfter == 0 && _selected != NULL)
+    {
+        ESP_LOGD(LOG_TAG, "Tag pulled out of the field");
+        removeTag(_selected);
+    }
+    _stats.exchanges++;
+    if (_errorThreshold == 0)
+    {
+        return FRAME_OK;
+    }
+    // xorshift32, so a seed replays the same errors
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    if (_random >= _errorThreshold)
+    {
+        return FRAME_OK;
+    }
+    return (_random & 0x01) ? FRAME_LOST : FRAME_GARBLED;
+}
+
+// time on the air of a frame and its answer
+void SimulatedTransport::charge(uint16_t sent, uint16_t received, uint32_t extra)
+{
+    _stats.busyTime += _latency.command + (sent + received) * _latency.byte + extra;
+}
+
+SimulatedTransport::Frame SimulatedTransport::exchange(uint16_t sent, uint16_t received, uint32_t extra)
+{
+    Frame frame = send();
+    charge(sent, received, extra);
+    return frame;
+}
+
+NfcTransport::Status SimulatedTransport::fail(Status status)
+{
+    _stats.errors++;
+    return status;
+}
+
+SimulatedTag* SimulatedTransport::getActiveTag()
+{
+    return _selected != NULL && _selected->getState() == SimulatedTag::STATE_ACTIVE ? _selected : NULL;
+}
+
+bool SimulatedTransport::isNewCardPresent()
+{
+    // with Crypto1 on the REQA is encrypted and no tag answers
+    if (exchange(1, 2, 0) != FRAME_OK || _crypto)
+    {
+        return false;
+    }
+    bool answered = false;
+    for (uint8_t i = 0; i < _tagCount; i++)
+    {
+        if (_tags[i]->getState() == SimulatedTag::STATE_IDLE)
+        {
+            _tags[i]->setState(SimulatedTag::STATE_READY);
+            answered = true;
+        }
+    }
+    return answered;
+}
+
+NfcTransport::Status SimulatedTransport::wakeupA()
+{
+    if (exchange(1, 2, 0) != FRAME_OK || _crypto)
+    {
+        return STATUS_TIMEOUT;
+    }
+    bool answered = false;
+    for (uint8_t i = 0; i < _tagCount; i++)
+    {
+        SimulatedTag::State state = _tags[i]->getState();
+        if (state == SimulatedTag::STATE_IDLE || state == SimulatedTag::STATE_HALT)
+        {
+            _tags[i]->setState(SimulatedTag::STATE_READY);
+            answered = true;
+        }
+    }
+    return answered ? STATUS_OK : STATUS_TIMEOUT;
+}
+
+// anticollision resolves the lowest UID, the others drop back to IDLE
+bool SimulatedTransport::readCardSerial()
+{
+    SimulatedTag *found = NULL;
+    for (uint8_t i = 0; i < _tagCount; i++)
+    {
+        SimulatedTag *tag = _tags[i];
+        if (tag->getState() != SimulatedTag::STATE_READY)
+        {
+            continue;
+        }
+        if (found == NULL || tag->getUidLength() < found->getUidLength() ||
+            (tag->getUidLength() == found->getUidLength() && memcmp(tag->getUid(), found->getUid(), tag->getUidLength()) < 0))
+        {
+            found = tag;
+        }
+    }
+    if (found == NULL)
+    {
+        exchange(2, 0, 0);
+        return false;
+    }
+
+    // ANTICOLLISION and SELECT for each cascade level
+    bool received = true;
+    for (uint8_t level = 0; level < (found->getUidLength() > 4 ? 2 : 1); level++)
+    {
+        received = exchange(2, 5, 0) == FRAME_OK && exchange(9, 3, 0) == FRAME_OK && received;
+    }
+    if (!received)
+    {
+        fail(STATUS_TIMEOUT);
+        return false;
+    }
+
+    if (_selected != NULL && _selected != found && _selected->getState() == SimulatedTag::STATE_ACTIVE)
+    {
+        _selected->setState(SimulatedTag::STATE_IDLE);
+    }
+    for (uint8_t i = 0; i < _tagCount; i++)
+    {
+        if (_tags[i] != found && _tags[i]->getState() == SimulatedTag::STATE_READY)
+        {
+            _tags[i]->setState(SimulatedTag::STATE_IDLE);
+        }
+    }
+    found->setState(SimulatedTag::STATE_ACTIVE);
+    _selected = found;
+    _stats.selections++;
+    uid.size = found->getUidLength();
+    memcpy(uid.uidByte, found->getUid(), uid.size);
+    uid.sak = found->getSak();
+    return true;
+}
+
+NfcTransport::Status SimulatedTransport::select(Uid *tagUid)
+{
+    bool received = true;
+    for (uint8_t level = 0; level < (tagUid->size > 4 ? 2 : 1); level++)
+    {
+        received = exchange(9, 3, 0) == FRAME_OK && received;
+    }
+    SimulatedTag *found = NULL;
+    for (uint8_t i = 0; i < _tagCount; i++)
+    {
+        if (_tags[i]->getState() == SimulatedTag::STATE_READY && _tags[i]->getUidLength() == tagUid->size &&
+            memcmp(_tags[i]->getUid(), tagUid->uidByte, tagUid->size) == 0)
+        {
+            found = _tags[i];
+        }
+    }
+    if (found == NULL || !received)
+    {
+        return fail(STATUS_TIMEOUT);
+    }
+
+    if (_selected != NULL && _selected != found && _selected->getState() == SimulatedTag::STATE_ACTIVE)
+    {
+        _selected->setState(SimulatedTag::STATE_IDLE);
+    }
+    found->setState(SimulatedTag::STATE_ACTIVE);
+    _selected = found;
+    _stats.selections++;
+    tagUid->sak = found->getSak();
+    uid.size = tagUid->size;
+    memcpy(uid.uidByte, tagUid->uidByte, uid.size);
+    uid.sak = tagUid->sak;
+    return STATUS_OK;
+}
+
+NfcTransport::Status SimulatedTransport::haltA()
+{
+    // HLTA is not answered, a timeout is success
+    Frame frame = exchange(4, 0, 0);
+    SimulatedTag *tag = getActiveTag();
+    if (tag != NULL && frame != FRAME_LOST)
+    {
+        tag->setState(SimulatedTag::STATE_HALT);
+    }
+    return STATUS_OK;
+}
+
+NfcTransport::Status SimulatedTransport::authenticate(bool keyB, byte block, const byte *key)
+{
+    _stats.authentications++;
+    Frame frame = exchange(12, 5, _latency.authenticate);
+    SimulatedTag *tag = getActiveTag();
+    if (tag == NULL || frame == FRAME_LOST)
+    {
+        return fail(STATUS_TIMEOUT);
+    }
+    if (frame == FRAME_GARBLED)
+    {
+        // the three pass authentication is broken off, the tag drops to IDLE
+        tag->setState(SimulatedTag::STATE_IDLE);
+        return fail(STATUS_TIMEOUT);
+    }
+    Status status = tag->authenticate(keyB, block, key);
+    if (status != STATUS_OK)
+    {
+        return fail(status);
+    }
+    _crypto = true;
+    return STATUS_OK;
+}
+
+void SimulatedTransport::stopCrypto1()
+{
+    _crypto = false;
+}
+
+NfcTransport::Status SimulatedTransport::mifareRead(byte block, byte *buffer, byte *bufferSize)
+{
+    if (buffer == NULL || *bufferSize < 18)
+    {
+        return STATUS_NO_ROOM;
+    }
+    _stats.reads++;
+    Frame frame = exchange(4, 18, 0);
+    SimulatedTag *tag = getActiveTag();
+    if (tag == NULL || frame == FRAME_LOST)
+    {
+        return fail(STATUS_TIMEOUT);
+    }
+    byte data[18];
+    Status status = tag->read(block, data);
+    if (status != STATUS_OK)
+    {
+        return fail(status);
+    }
+    if (frame == FRAME_GARBLED)
+    {
+        return fail(STATUS_CRC_WRONG);
+    }
+    // the MFRC522 library leaves the CRC in the buffer unchecked
+    memcpy(buffer, data, 16);
+    buffer[16] = 0;
+    buffer[17] = 0;
+    *bufferSize = 18;
+    return STATUS_OK;
+}
+
+NfcTransport::Status SimulatedTransport::mifareWrite(byte block, const byte *data)
+{
+    _stats.writes++;
+    // the command and the data are two frames, each ACKed with 4 bits
+    Frame frame = exchange(4, 1, 0);
+    SimulatedTag *tag = getActiveTag();
+    if (tag == NULL || frame == FRAME_LOST)
+    {
+        return fail(STATUS_TIMEOUT);
+    }
+    if (frame == FRAME_GARBLED)
+    {
+        tag->setState(SimulatedTag::STATE_IDLE);
+        return fail(STATUS_ERROR);
+    }
+    frame = exchange(18, 1, _latency.write);
+    if (getActiveTag() == NULL || frame == FRAME_LOST)
+    {
+        // the tag waiting for the data times out
+        tag->setState(SimulatedTag::STATE_IDLE);
+        return fail(STATUS_TIMEOUT);
+    }
+    Status status = tag->write(block, data, 16);
+    if (status != STATUS_OK)
+    {
+        return fail(status);
+    }
+    return frame == FRAME_GARBLED ? fail(STATUS_ERROR) : STATUS_OK;
+}
+
+NfcTransport::Status SimulatedTransport::ultralightWrite(byte page, const byte *data)
+{
+    _stats.writes++;
+    Frame frame = exchange(8, 1, _latency.write);
+    SimulatedTag *tag = getActiveTag();
+    if (tag == NULL || frame == FRAME_LOST)
+    {
+        return fail(STATUS_TIMEOUT);
+    }
+    Status status = tag->write(page, data, 4);
+    if (status != STATUS_OK)
+    {
+        return fail(status);
+    }
+    // the page was written, only the ACK was lost
+    return frame == FRAME_GARBLED ? fail(STATUS_ERROR) : STATUS_OK;
+}
+
+NfcTransport::Status SimulatedTransport::transceive(const byte *command, byte commandSize, byte *response, byte *responseSize)
+{
+    if (commandSize + 2 > _maxFrameSize)
+    {
+        return STATUS_NO_ROOM;
+    }
+    if (*responseSize > _maxFrameSize)
+    {
+        *responseSize = _maxFrameSize;
+    }
+    Frame frame = send();
+    SimulatedTag *tag = getActiveTag();
+    if (tag == NULL || frame == FRAME_LOST)
+    {
+        charge(commandSize + 2, 0, 0);
+        return fail(STATUS_TIMEOUT);
+    }
+    Status status = tag->command(command, commandSize, response, responseSize);
+    // Type 4 files are programmed while the tag holds back its answer
+    uint16_t cycles = tag->takeWriteCycles();
+    _stats.writes += cycles;
+    charge(commandSize + 2, status == STATUS_OK ? *responseSize : 1, cycles * _latency.write);
+    if (status != STATUS_OK)
+    {
+        return fail(status);
+    }
+    return frame == FRAME_GARBLED ? fail(STATUS_CRC_WRONG) : STATUS_OK;
+}
+
+void SimulatedTransport::delay(uint32_t micros)
+{
+    _stats.waitTime += micros;
+}
+
+void SimulatedTransport::armCardDetect()
+{
+    if (_irq == NULL || _crypto)
+    {
+        return;
+    }
+    for (uint8_t i = 0; i < _tagCount; i++)
+    {
+        if (_tags[i]->getState() == SimulatedTag::STATE_IDLE)
+        {
+            // the REQA left pending is answered
+            _irq->trigger();
+            return;
+        }
+    }
+}
+
+void SimulatedTransport::enableCardDetectIrq(bool enable)
+{
+}
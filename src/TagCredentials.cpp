@@ -0,0 +1,176 @@
+#include <esp_log.h>
+#include "TagCredentials.h"
+
+static const char* LOG_TAG = "Tag Credentials";
+
+TagCredentials::TagCredentials()
+{
+    memset(_entries, 0, sizeof(_entries));
+    memset(_defaultEntries, 0, sizeof(_defaultEntries));
+    memset(&_default, 0, sizeof(_default));
+    _selection = 1;
+    _clock = 0;
+}
+
+bool TagCredentials::setPassword(const byte *uid, uint8_t uidLength, const byte *password, const byte *pack)
+{
+    Entry *entry = uid == NULL ? &_default : allocate(_entries, TAG_CREDENTIALS_MAX_ENTRIES, uid, uidLength);
+    if (entry == NULL)
+    {
+        return false;
+    }
+    if (uid == NULL)
+    {
+        // copies of the old default are of no use any more
+        memset(_defaultEntries, 0, sizeof(_defaultEntries));
+    }
+
+    entry->kind = KIND_NTAG_PASSWORD;
+    memset(entry->key, 0, sizeof(entry->key));
+    memcpy(entry->key, password, NTAG_PASSWORD_SIZE);
+    entry->checkPack = (pack != NULL);
+    if (pack != NULL)
+    {
+        memcpy(entry->pack, pack, NTAG_PACK_SIZE);
+    }
+    entry->failed = false;
+    entry->authenticatedSelection = 0;
+    return true;
+}
+
+bool TagCredentials::setUltralightCKey(const byte *uid, uint8_t uidLength, const byte *key)
+{
+    Entry *entry = uid == NULL ? &_default : allocate(_entries, TAG_CREDENTIALS_MAX_ENTRIES, uid, uidLength);
+    if (entry == NULL)
+    {
+        return false;
+    }
+    if (uid == NULL)
+    {
+        // copies of the old default are of no use any more
+        memset(_defaultEntries, 0, sizeof(_defaultEntries));
+    }
+
+    entry->kind = KIND_ULTRALIGHT_C_KEY;
+    memcpy(entry->key, key, ULTRALIGHT_C_KEY_SIZE);
+    entry->checkPack = false;
+    entry->failed = false;
+    entry->authenticatedSelection = 0;
+    return true;
+}
+
+void TagCredentials::remove(const byte *uid, uint8_t uidLength)
+{
+    Entry *entry = lookup(_entries, TAG_CREDENTIALS_MAX_ENTRIES, uid, uidLength);
+    if (entry != NULL)
+    {
+        memset(entry, 0, sizeof(Entry));
+    }
+    entry = lookup(_defaultEntries, TAG_CREDENTIALS_MAX_DEFAULT_ENTRIES, uid, uidLength);
+    if (entry != NULL)
+    {
+        memset(entry, 0, sizeof(Entry));
+    }
+}
+
+TagCredentials::Entry* TagCredentials::find(const byte *uid, uint8_t uidLength)
+{
+    Entry *entry = lookup(_entries, TAG_CREDENTIALS_MAX_ENTRIES, uid, uidLength);
+    if (entry == NULL && _default.kind != KIND_NONE)
+    {
+        // the default gets its own entry so a rejection is remembered per tag
+        entry = lookup(_defaultEntries, TAG_CREDENTIALS_MAX_DEFAULT_ENTRIES, uid, uidLength);
+        if (entry == NULL)
+        {
+            entry = allocate(_defaultEntries, TAG_CREDENTIALS_MAX_DEFAULT_ENTRIES, uid, uidLength);
+        }
+        if (entry != NULL && entry->kind == KIND_NONE)
+        {
+            memcpy(entry->key, _default.key, sizeof(entry->key));
+            memcpy(entry->pack, _default.pack, sizeof(entry->pack));
+            entry->kind = _default.kind;
+            entry->checkPack = _default.checkPack;
+        }
+    }
+
+    if (entry != NULL)
+    {
+        entry->lastUsed = ++_clock;
+    }
+    return entry;
+}
+
+void TagCredentials::beginSelection()
+{
+    _selection++;
+}
+
+bool TagCredentials::isAuthenticated(Entry *entry)
+{
+    return entry->authenticatedSelection == _selection;
+}
+
+void TagCredentials::setAuthenticated(Entry *entry)
+{
+    entry->authenticatedSelection = _selection;
+}
+
+void TagCredentials::setFailed(Entry *entry)
+{
+    ESP_LOGW(LOG_TAG, "Credential rejected, it won't be tried on this tag again");
+    entry->failed = true;
+    entry->authenticatedSelection = 0;
+}
+
+TagCredentials::Entry* TagCredentials::lookup(Entry *entries, uint8_t count, const byte *uid, uint8_t uidLength)
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (entries[i].kind != KIND_NONE && entries[i].uidLength == uidLength && memcmp(entries[i].uid, uid, uidLength) == 0)
+        {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Existing entry for uid, a free one or the least recently used. Entries that
+// were rejected go last, forgetting one costs the tag another failed attempt.
+TagCredentials::Entry* TagCredentials::allocate(Entry *entries, uint8_t count, const byte *uid, uint8_t uidLength)
+{
+    if (uidLength == 0 || uidLength > TAG_MAX_UID_SIZE)
+    {
+        ESP_LOGE(LOG_TAG, "Invalid UID length %d", uidLength);
+        return NULL;
+    }
+
+    Entry *entry = lookup(entries, count, uid, uidLength);
+    for (uint8_t i = 0; entry == NULL && i < count; i++)
+    {
+        if (entries[i].kind == KIND_NONE)
+        {
+            entry = &entries[i];
+        }
+    }
+
+    if (entry == NULL)
+    {
+        entry = &entries[0];
+        for (uint8_t i = 1; i < count; i++)
+        {
+            bool kept = entries[i].failed && !entry->failed;
+            bool evicted = !entries[i].failed && entry->failed;
+            if (evicted || (!kept && entries[i].lastUsed < entry->lastUsed))
+            {
+                entry = &entries[i];
+            }
+        }
+        ESP_LOGD(LOG_TAG, "Evicting least recently used credential");
+    }
+
+    memset(entry, 0, sizeof(Entry));
+    memcpy(entry->uid, uid, uidLength);
+    entry->uidLength = uidLength;
+    entry->lastUsed = ++_clock;
+    return entry;
+}
@@ -0,0 +1,41 @@
+#include <cstring>
+#include "TagImage.h"
+
+TagImageBuffer::TagImageBuffer(byte *buffer, uint16_t size, uint8_t unitSize)
+{
+    _buffer = buffer;
+    _size = size;
+    _unitSize = unitSize;
+    _length = 0;
+}
+
+bool TagImageBuffer::write(uint16_t unit, const byte *data, uint8_t length)
+{
+    uint32_t offset = (uint32_t)unit * _unitSize;
+    if (offset + length > _size)
+    {
+        return false;
+    }
+    memcpy(&_buffer[offset], data, length);
+    if (offset + length > _length)
+    {
+        _length = offset + length;
+    }
+    return true;
+}
+
+bool TagImageBuffer::read(uint16_t unit, byte *data, uint8_t length)
+{
+    uint32_t offset = (uint32_t)unit * _unitSize;
+    if (offset + length > _size)
+    {
+        return false;
+    }
+    memcpy(data, &_buffer[offset], length);
+    return true;
+}
+
+uint16_t TagImageBuffer::getLength()
+{
+    return _length;
+}
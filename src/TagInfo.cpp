@@ -0,0 +1,115 @@
+#include <esp_log.h>
+#include "TagInfo.h"
+
+static const char* LOG_TAG = "Tag Info";
+
+TagInfoCache::TagInfoCache()
+{
+    clear();
+}
+
+TagInfo* TagInfoCache::find(const byte *uid, uint8_t uidLength)
+{
+    for (uint8_t i = 0; i < TAG_INFO_CACHE_SIZE; i++)
+    {
+        if (_entries[i].uidLength == uidLength && uidLength > 0 && memcmp(_entries[i].uid, uid, uidLength) == 0)
+        {
+            _entries[i].lastUsed = ++_clock;
+            return &_entries[i];
+        }
+    }
+    return NULL;
+}
+
+TagInfo* TagInfoCache::get(const byte *uid, uint8_t uidLength)
+{
+    TagInfo *info = find(uid, uidLength);
+    if (info != NULL)
+    {
+        ESP_LOGD(LOG_TAG, "Cache hit");
+        return info;
+    }
+
+    if (uidLength == 0 || uidLength > TAG_MAX_UID_SIZE)
+    {
+        return NULL;
+    }
+
+    // a free entry has no UID, and is always the least recently used
+    info = &_entries[0];
+    for (uint8_t i = 1; i < TAG_INFO_CACHE_SIZE; i++)
+    {
+        if (_entries[i].lastUsed < info->lastUsed)
+        {
+            info = &_entries[i];
+        }
+    }
+
+    reset(info);
+    memcpy(info->uid, uid, uidLength);
+    info->uidLength = uidLength;
+    info->lastUsed = ++_clock;
+    return info;
+}
+
+void TagInfoCache::invalidate(const byte *uid, uint8_t uidLength)
+{
+    TagInfo *info = find(uid, uidLength);
+    if (info != NULL)
+    {
+        ESP_LOGD(LOG_TAG, "Invalidating cached tag info");
+        reset(info);
+    }
+}
+
+void TagInfoCache::clear()
+{
+    for (uint8_t i = 0; i < TAG_INFO_CACHE_SIZE; i++)
+    {
+        reset(&_entries[i]);
+    }
+    _clock = 0;
+}
+
+void TagInfoCache::reset(TagInfo *info)
+{
+    memset(info->uid, 0, sizeof(info->uid));
+    info->uidLength = 0;
+    info->tagType = NfcTag::TYPE_UNKNOWN;
+    info->identified = false;
+    info->product = 0;
+    info->dataAreaSize = 0;
+    info->fastRead = false;
+    info->ccKnown = false;
+    memset(info->cc, 0, sizeof(info->cc));
+    info->formatted = false;
+    info->mapped = false;
+    info->map.reset(0, 0);
+    info->keyKind = TagCredentials::KIND_NONE;
+    memset(info->key, 0, sizeof(info->key));
+    info->lastUsed = 0;
+}
+
+void TagInfoCache::copyLayout(TagInfo *info, const TagInfo *from)
+{
+    info->tagType = from->tagType;
+    info->identified = from->identified;
+    info->product = from->product;
+    info->dataAreaSize = from->dataAreaSize;
+    info->fastRead = from->fastRead;
+    info->ccKnown = from->ccKnown;
+    memcpy(info->cc, from->cc, sizeof(info->cc));
+    info->formatted = from->formatted;
+    info->mapped = from->mapped;
+    info->map = from->map;
+}
+
+bool TagInfoCache::sameProduct(const TagInfo *info, const TagInfo *from)
+{
+    return info->identified && from->identified &&
+        info->tagType == from->tagType &&
+        info->product == from->product &&
+        info->dataAreaSize == from->dataAreaSize &&
+        info->ccKnown == from->ccKnown &&
+        memcmp(info->cc, from->cc, sizeof(info->cc)) == 0;
+}
@@ -0,0 +1,673 @@
+#include <esp_log.h>
+#include "TagSession.h"
+
+static const char* LOG_TAG = "Tag Session";
+
+TagSession::TagSession(NfcTransport *shield, TagCredentials *credentials, TagInfoCache *cache) :
+    _shield(shield)
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    , _classic(shield)
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    , _ultralight(shield, credentials)
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    , _type4(shield)
+#endif
+{
+    _credentials = credentials;
+    _cache = cache;
+    _info = NULL;
+    _uidLength = 0;
+    _type = NfcTag::TYPE_UNKNOWN;
+    _open = false;
+}
+
+void TagSession::begin()
+{
+    _uidLength = _shield->uid.size;
+    memcpy(_uid, _shield->uid.uidByte, _uidLength);
+    _info = _cache == NULL ? NULL : _cache->get(_uid, _uidLength);
+    _type = guessTagType();
+    _open = true;
+    _status = NfcStatus();
+
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    _classic.reset(_info);
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    _ultralight.reset(_info);
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    _type4.reset(_info);
+#endif
+    ESP_LOGD(LOG_TAG, "Session opened, tag type %d", _type);
+}
+
+void TagSession::end()
+{
+    _open = false;
+    _info = NULL;
+}
+
+void TagSession::close()
+{
+    if (_open)
+    {
+#ifdef NDEF_SUPPORT_TYPE_4
+        // a tag in the ISO-DEP protocol ignores HLTA
+        if (_type == NfcTag::TYPE_4)
+        {
+            _type4.deselect();
+        }
+#endif
+        _shield->haltA();
+        _shield->stopCrypto1();
+        if (_credentials != NULL)
+        {
+            _credentials->beginSelection();
+        }
+    }
+    end();
+}
+
+bool TagSession::isOpen()
+{
+    return _open && _shield->uid.size == _uidLength && memcmp(_shield->uid.uidByte, _uid, _uidLength) == 0;
+}
+
+bool TagSession::isPresent()
+{
+    if (!isOpen())
+    {
+        return false;
+    }
+
+    bool present;
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        present = _classic.isPresent();
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        present = _ultralight.isPresent();
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    if (_type == NfcTag::TYPE_4)
+    {
+        present = _type4.isPresent();
+    }
+    else
+#endif
+    {
+        _shield->haltA();
+        present = _shield->wakeupA() == NfcTransport::STATUS_OK &&
+            _shield->select(&(_shield->uid)) == NfcTransport::STATUS_OK;
+    }
+
+    if (!present)
+    {
+        ESP_LOGD(LOG_TAG, "Tag left the field");
+        end();
+    }
+    return present;
+}
+
+NfcTag TagSession::read(byte *buffer, uint16_t bufferSize)
+{
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        ESP_LOGD(LOG_TAG, "Reading Mifare Classic");
+        return _classic.read(buffer, bufferSize);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        ESP_LOGD(LOG_TAG, "Reading Mifare Ultralight");
+        return _ultralight.read(buffer, bufferSize);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    if (_type == NfcTag::TYPE_4)
+    {
+        ESP_LOGD(LOG_TAG, "Reading Type 4");
+        return _type4.read(buffer, bufferSize);
+    }
+    else
+#endif
+    if (_type == NfcTag::TYPE_UNKNOWN)
+    {
+        ESP_LOGI(LOG_TAG, "Can not determine tag type");
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        return NfcTag(_uid, _uidLength, NfcTag::TYPE_UNKNOWN);
+    }
+    else
+    {
+        ESP_LOGI(LOG_TAG, "No driver for card type %d", _type);
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        // TODO should set type here
+        return NfcTag(_uid, _uidLength, NfcTag::TYPE_UNKNOWN);
+    }
+}
+
+bool TagSession::indexRecords(NdefRecordIndex& index)
+{
+    index.reset();
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        return _classic.indexRecords(index);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        return _ultralight.indexRecords(index);
+    }
+    else
+#endif
+    {
+        // a Type 4 message is one file, read in a few large ReadBinary commands
+        ESP_LOGI(LOG_TAG, "No record index for card type %d", _type);
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        return false;
+    }
+}
+
+bool TagSession::readPayload(const NdefRecordIndex& index, uint8_t entry, byte *data, uint16_t dataSize)
+{
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        return _classic.readPayload(index, entry, data, dataSize);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        return _ultralight.readPayload(index, entry, data, dataSize);
+    }
+    else
+#endif
+    {
+        // a Type 4 message is one file, read in a few large ReadBinary commands
+        ESP_LOGI(LOG_TAG, "No record index for card type %d", _type);
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        return false;
+    }
+}
+
+bool TagSession::write(NdefMessage& ndefMessage)
+{
+    byte workspace[NDEF_WORKSPACE_SIZE];
+    return write(ndefMessage, workspace, sizeof(workspace));
+}
+
+bool TagSession::write(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize)
+{
+    bool success;
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        ESP_LOGD(LOG_TAG, "Writing Mifare Classic");
+        success = _classic.write(ndefMessage, workspace, workspaceSize);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        ESP_LOGD(LOG_TAG, "Writing Mifare Ultralight");
+        success = _ultralight.write(ndefMessage, workspace, workspaceSize);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    if (_type == NfcTag::TYPE_4)
+    {
+        ESP_LOGD(LOG_TAG, "Writing Type 4");
+        success = _type4.write(ndefMessage, workspace, workspaceSize);
+    }
+    else
+#endif
+    if (_type == NfcTag::TYPE_UNKNOWN)
+    {
+        ESP_LOGI(LOG_TAG, "Can not determine tag type");
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        return false;
+    }
+    else
+    {
+        ESP_LOGD(LOG_TAG, "No driver for card type %d", _type);
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        return false;
+    }
+
+    // a message too large for the tag or the workspace says nothing about its layout
+    NfcStatus::Error error = getStatus().getError();
+    if (!success && error != NfcStatus::ERROR_TOO_LARGE && error != NfcStatus::ERROR_WORKSPACE)
+    {
+        // the tag may have been swapped or reformatted, probe it again next time
+        invalidate();
+    }
+    return success;
+}
+
+NdefTlv::WriteResult TagSession::writeTransaction(NdefMessage& ndefMessage)
+{
+    byte workspace[NDEF_WORKSPACE_SIZE];
+    return writeTransaction(ndefMessage, workspace, sizeof(workspace));
+}
+
+NdefTlv::WriteResult TagSession::writeTransaction(NdefMessage& ndefMessage, byte *workspace, uint16_t workspaceSize)
+{
+    NdefTlv::WriteResult result;
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        ESP_LOGD(LOG_TAG, "Writing Mifare Classic");
+        result = _classic.writeTransaction(ndefMessage, workspace, workspaceSize);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        ESP_LOGD(LOG_TAG, "Writing Mifare Ultralight");
+        result = _ultralight.writeTransaction(ndefMessage, workspace, workspaceSize);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    if (_type == NfcTag::TYPE_4)
+    {
+        ESP_LOGD(LOG_TAG, "Writing Type 4");
+        result = _type4.writeTransaction(ndefMessage, workspace, workspaceSize);
+    }
+    else
+#endif
+    {
+        ESP_LOGI(LOG_TAG, "No driver for card type %d", _type);
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+
+    if (result == NdefTlv::WRITE_TORN)
+    {
+        invalidate();
+    }
+    return result;
+}
+
+NdefTlv::WriteResult TagSession::writeEncoded(const byte *message, uint16_t length, bool transactional)
+{
+    byte workspace[NDEF_WORKSPACE_SIZE];
+    return writeEncoded(message, length, transactional, workspace, sizeof(workspace));
+}
+
+NdefTlv::WriteResult TagSession::writeEncoded(const byte *message, uint16_t length, bool transactional,
+    byte *workspace, uint16_t workspaceSize)
+{
+    NdefTlv::WriteResult result;
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        ESP_LOGD(LOG_TAG, "Writing Mifare Classic");
+        result = _classic.writeEncoded(message, length, transactional, workspace, workspaceSize);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        ESP_LOGD(LOG_TAG, "Writing Mifare Ultralight");
+        result = _ultralight.writeEncoded(message, length, transactional, workspace, workspaceSize);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    if (_type == NfcTag::TYPE_4)
+    {
+        ESP_LOGD(LOG_TAG, "Writing Type 4");
+        // a Type 4 tag takes the message as it is, the workspace isn't needed
+        result = _type4.writeEncoded(message, length, transactional);
+    }
+    else
+#endif
+    {
+        ESP_LOGI(LOG_TAG, "No driver for card type %d", _type);
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+
+    if (result == NdefTlv::WRITE_TORN)
+    {
+        invalidate();
+    }
+    return result;
+}
+
+uint16_t TagSession::requiredWorkspace(NdefMessage& message)
+{
+    return NdefTlv::getWorkspaceSize(message.getEncodedSize());
+}
+
+uint16_t TagSession::requiredWorkspace(const TagInfo& info)
+{
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (info.tagType == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        return MifareClassic::requiredWorkspace(info);
+    }
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (info.tagType == NfcTag::TYPE_2)
+    {
+        return MifareUltralight::requiredWorkspace(info);
+    }
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    if (info.tagType == NfcTag::TYPE_4)
+    {
+        return Type4Tag::requiredWorkspace(info);
+    }
+#endif
+    return 0;
+}
+
+bool TagSession::planWrite(NdefMessage& message, const TagInfo& info, WritePlan& plan, bool transactional)
+{
+    uint16_t length = message.getEncodedSize();
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (info.tagType == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        MifareClassic::planWrite(info, length, transactional, plan);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (info.tagType == NfcTag::TYPE_2)
+    {
+        MifareUltralight::planWrite(info, length, transactional, plan);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    if (info.tagType == NfcTag::TYPE_4)
+    {
+        Type4Tag::planWrite(info, length, transactional, plan);
+    }
+    else
+#endif
+    {
+        plan.reset();
+        plan.messageLength = length;
+    }
+    return plan.fits;
+}
+
+bool TagSession::erase()
+{
+    NdefMessage message = NdefMessage();
+    message.addEmptyRecord();
+    // three bytes of message with a TLV header and terminator
+    byte workspace[8];
+    return write(message, workspace, sizeof(workspace));
+}
+
+bool TagSession::format()
+{
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        return _classic.formatNDEF();
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        ESP_LOGD(LOG_TAG, "No need for formating a UL");
+        return true;
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    if (_type == NfcTag::TYPE_4)
+    {
+        // creating the NDEF application takes the tag's own commands and keys
+        ESP_LOGI(LOG_TAG, "Type 4 tags can't be formatted, they need an NDEF application");
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        return false;
+    }
+    else
+#endif
+    {
+        ESP_LOGD(LOG_TAG, "Unsupported Tag.");
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        return false;
+    }
+}
+
+bool TagSession::clean()
+{
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        ESP_LOGD(LOG_TAG, "Cleaning Mifare Classic");
+        return _classic.formatMifare();
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        ESP_LOGD(LOG_TAG, "Cleaning Mifare Ultralight");
+        return _ultralight.clean();
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    if (_type == NfcTag::TYPE_4)
+    {
+        ESP_LOGD(LOG_TAG, "Cleaning Type 4");
+        return _type4.clean();
+    }
+    else
+#endif
+    {
+        ESP_LOGI(LOG_TAG, "No driver for card type %d", _type);
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        return false;
+    }
+}
+
+bool TagSession::dumpImage(TagImageSink& sink, uint16_t *next)
+{
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        return _classic.dumpImage(sink, next);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        return _ultralight.dumpImage(sink, next);
+    }
+    else
+#endif
+    {
+        // a Type 4 tag has files behind an application, not a memory image
+        ESP_LOGI(LOG_TAG, "No image of card type %d", _type);
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        return false;
+    }
+}
+
+bool TagSession::restoreImage(TagImageSource& source, uint16_t *next, const byte *keyB)
+{
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        return _classic.restoreImage(source, next, keyB);
+    }
+    else
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        return _ultralight.restoreImage(source, next);
+    }
+    else
+#endif
+    {
+        (void)keyB;
+        ESP_LOGI(LOG_TAG, "No image of card type %d", _type);
+        _status.set(NfcStatus::ERROR_UNSUPPORTED);
+        return false;
+    }
+}
+
+const byte* TagSession::getUid()
+{
+    return _uid;
+}
+
+uint8_t TagSession::getUidLength()
+{
+    return _uidLength;
+}
+
+NfcTag::TagType TagSession::getTagType()
+{
+    return _type;
+}
+
+TagInfo* TagSession::getInfo()
+{
+    return _info;
+}
+
+uint16_t TagSession::getCapacity()
+{
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        return CLASSIC_1K_DATA_BLOCKS * BLOCK_SIZE;
+    }
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        return _ultralight.getCapacity();
+    }
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    if (_type == NfcTag::TYPE_4)
+    {
+        return _type4.getCapacity();
+    }
+#endif
+    return 0;
+}
+
+NfcStatus TagSession::getStatus()
+{
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    if (_type == NfcTag::TYPE_MIFARE_CLASSIC)
+    {
+        return _classic.getStatus();
+    }
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    if (_type == NfcTag::TYPE_2)
+    {
+        return _ultralight.getStatus();
+    }
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    if (_type == NfcTag::TYPE_4)
+    {
+        return _type4.getStatus();
+    }
+#endif
+    return _status;
+}
+
+void TagSession::setRetryPolicy(const NfcRetryPolicy& policy)
+{
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    _classic.setRetryPolicy(policy);
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    _ultralight.setRetryPolicy(policy);
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    _type4.setRetryPolicy(policy);
+#endif
+}
+
+NfcTag::TagType TagSession::guessTagType()
+{
+    if (_info != NULL && _info->tagType != NfcTag::TYPE_UNKNOWN)
+    {
+        return _info->tagType;
+    }
+
+    NfcTransport::PiccType piccType = NfcTransport::getType(_shield->uid.sak);
+
+    if (piccType == NfcTransport::PICC_TYPE_MIFARE_1K)
+    {
+        return NfcTag::TYPE_MIFARE_CLASSIC;
+    }
+    else if (piccType == NfcTransport::PICC_TYPE_MIFARE_UL)
+    {
+        return NfcTag::TYPE_2;
+    }
+#ifdef NDEF_SUPPORT_TYPE_4
+    else if (piccType == NfcTransport::PICC_TYPE_ISO_14443_4)
+    {
+        // DESFire and NTAG 424 DNA, whether the NDEF application is there shows when it is selected
+        return NfcTag::TYPE_4;
+    }
+#endif
+    else
+    {
+        return NfcTag::TYPE_UNKNOWN;
+    }
+}
+
+// drop what is known about the tag, in the cache and in the drivers. The status
+// of the operation that failed stays for getStatus().
+void TagSession::invalidate()
+{
+    if (_cache != NULL)
+    {
+        _cache->invalidate(_uid, _uidLength);
+        _info = _cache->get(_uid, _uidLength);
+    }
+#ifdef NDEF_SUPPORT_MIFARE_CLASSIC
+    _classic.invalidate(_info);
+#endif
+#ifdef NDEF_SUPPORT_ULTRALIGHT
+    _ultralight.invalidate(_info);
+#endif
+#ifdef NDEF_SUPPORT_TYPE_4
+    // the tag stays activated, only the CC and NDEF file are read again
+    _type4.invalidate(_info);
+#endif
+}
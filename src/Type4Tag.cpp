@@ -0,0 +1,600 @@
+#include <esp_log.h>
+#include "Type4Tag.h"
+
+#ifdef NDEF_SUPPORT_TYPE_4
+
+static const char* LOG_TAG = "Type 4 Tag";
+
+// NDEF Tag Application, mapping version 2.0
+static const byte NDEF_AID[TYPE_4_NDEF_AID_SIZE] = { 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01 };
+
+Type4Tag::Type4Tag(NfcTransport *transport, TagInfo *info) : _isoDep(transport)
+{
+    _transport = transport;
+    reset(info);
+}
+
+void Type4Tag::reset(TagInfo *info)
+{
+    _isoDep.reset();
+    invalidate(info);
+}
+
+void Type4Tag::invalidate(TagInfo *info)
+{
+    _info = info;
+    _selected = false;
+    _maxRead = 0;
+    _maxWrite = 0;
+    _fileId = 0;
+    _fileSize = 0;
+    _writable = false;
+}
+
+NfcTag Type4Tag::read(byte *buffer, uint16_t bufferSize)
+{
+    _status = NfcStatus();
+    if (!open())
+    {
+        return NfcTag(_transport->uid.uidByte, _transport->uid.size, NfcTag::TYPE_4);
+    }
+
+    // NLEN and as much of the message as the first frame of the answer holds
+    uint16_t firstLength = _isoDep.getReceiveFrameSize() - ISO_DEP_FRAME_OVERHEAD - TYPE_4_SW_SIZE;
+    if (firstLength > _maxRead)
+    {
+        firstLength = _maxRead;
+    }
+    if (firstLength > _fileSize)
+    {
+        firstLength = _fileSize;
+    }
+    byte first[TYPE_4_MAX_LE];
+    if (!readBinary(0, first, firstLength))
+    {
+        return NfcTag(_transport->uid.uidByte, _transport->uid.size, NfcTag::TYPE_4);
+    }
+
+    uint16_t messageLength = (first[0] << 8) | first[1];
+    if (messageLength == 0)
+    {
+        NdefMessage message = NdefMessage();
+        message.addEmptyRecord();
+        return NfcTag(_transport->uid.uidByte, _transport->uid.size, NfcTag::TYPE_4, message);
+    }
+    if (messageLength > getCapacity())
+    {
+        ESP_LOGE(LOG_TAG, "Error. NLEN %d exceeds the NDEF file", messageLength);
+        _status.set(NfcStatus::ERROR_BAD_TLV, NfcStatus::OPERATION_READ, 0);
+        return NfcTag(_transport->uid.uidByte, _transport->uid.size, NfcTag::TYPE_4);
+    }
+
+    // the rest is read straight into the tag, or the caller's buffer when it's larger
+    NfcTag tag(_transport->uid.uidByte, _transport->uid.size, NfcTag::TYPE_4);
+    byte *data = tag.allocateNdef(messageLength, buffer, bufferSize);
+    if (data == NULL)
+    {
+        ESP_LOGE(LOG_TAG, "Error. Message of %d bytes needs a buffer", messageLength);
+        _status.set(NfcStatus::ERROR_TOO_LARGE, NfcStatus::OPERATION_READ, 0);
+        return tag;
+    }
+    uint16_t known = firstLength - TYPE_4_NLEN_SIZE < messageLength ? firstLength - TYPE_4_NLEN_SIZE : messageLength;
+    memcpy(data, &first[TYPE_4_NLEN_SIZE], known);
+    if (known < messageLength && !readBinary(TYPE_4_NLEN_SIZE + known, &data[known], messageLength - known))
+    {
+        return NfcTag(_transport->uid.uidByte, _transport->uid.size, NfcTag::TYPE_4);
+    }
+    return tag;
+}
+
+bool Type4Tag::write(NdefMessage& m)
+{
+    byte workspace[NDEF_WORKSPACE_SIZE];
+    return writeMessage(m, false, workspace, sizeof(workspace)) == NdefTlv::WRITE_COMMITTED;
+}
+
+bool Type4Tag::write(NdefMessage& m, byte *workspace, uint16_t workspaceSize)
+{
+    return writeMessage(m, false, workspace, workspaceSize) == NdefTlv::WRITE_COMMITTED;
+}
+
+NdefTlv::WriteResult Type4Tag::writeTransaction(NdefMessage& m)
+{
+    byte workspace[NDEF_WORKSPACE_SIZE];
+    return writeMessage(m, true, workspace, sizeof(workspace));
+}
+
+NdefTlv::WriteResult Type4Tag::writeTransaction(NdefMessage& m, byte *workspace, uint16_t workspaceSize)
+{
+    return writeMessage(m, true, workspace, workspaceSize);
+}
+
+NdefTlv::WriteResult Type4Tag::writeMessage(NdefMessage& m, bool transactional, byte *workspace, uint16_t workspaceSize)
+{
+    uint16_t length = m.getEncodedSize();
+    if (length > workspaceSize)
+    {
+        ESP_LOGE(LOG_TAG, "Workspace of %d bytes can't hold a message of %d", workspaceSize, length);
+        _status = NfcStatus();
+        _status.set(NfcStatus::ERROR_WORKSPACE, NfcStatus::OPERATION_WRITE);
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+    m.encode(workspace);
+    return writeEncoded(workspace, length, transactional);
+}
+
+// NFC Forum Type 4 Tag 5.4.5: NLEN is cleared, the message written and NLEN set,
+// so a tag pulled away keeps its old message or an empty one. A plain write of
+// a message fitting one UpdateBinary sends NLEN and the message together.
+NdefTlv::WriteResult Type4Tag::writeEncoded(const byte *message, uint16_t messageLength, bool transactional)
+{
+    _status = NfcStatus();
+    if (!open())
+    {
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+    if (!_writable)
+    {
+        ESP_LOGE(LOG_TAG, "Error. NDEF file is read only");
+        _status.set(NfcStatus::ERROR_APDU, NfcStatus::OPERATION_WRITE, 0);
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+    if (messageLength > getCapacity())
+    {
+        ESP_LOGD(LOG_TAG, "Encoded Message length exceeded tag Capacity %d", getCapacity());
+        _status.set(NfcStatus::ERROR_TOO_LARGE, NfcStatus::OPERATION_WRITE);
+        return NdefTlv::WRITE_ROLLED_BACK;
+    }
+
+    byte nlen[TYPE_4_NLEN_SIZE] = { (byte)(messageLength >> 8), (byte)messageLength };
+    if (!transactional && TYPE_4_NLEN_SIZE + messageLength <= _maxWrite)
+    {
+        byte data[TYPE_4_MAX_LC];
+        memcpy(data, nlen, TYPE_4_NLEN_SIZE);
+        memcpy(&data[TYPE_4_NLEN_SIZE], message, messageLength);
+        return updateBinary(0, data, TYPE_4_NLEN_SIZE + messageLength) ? NdefTlv::WRITE_COMMITTED : NdefTlv::WRITE_TORN;
+    }
+
+    byte empty[TYPE_4_NLEN_SIZE] = { 0x00, 0x00 };
+    if (!updateBinary(0, empty, TYPE_4_NLEN_SIZE))
+    {
+        // read NLEN back to see if it was cleared
+        NfcStatus failed = _status;
+        byte current[TYPE_4_NLEN_SIZE];
+        bool intact = readBinary(0, current, TYPE_4_NLEN_SIZE) && (current[0] != 0 || current[1] != 0);
+        _status = failed;
+        if (intact)
+        {
+            ESP_LOGE(LOG_TAG, "Error. Write failed, the old message is intact");
+            return NdefTlv::WRITE_ROLLED_BACK;
+        }
+        ESP_LOGE(LOG_TAG, "Error. Write failed, the tag state is unknown");
+        return NdefTlv::WRITE_TORN;
+    }
+    if (!updateBinary(TYPE_4_NLEN_SIZE, message, messageLength) || !updateBinary(0, nlen, TYPE_4_NLEN_SIZE))
+    {
+        ESP_LOGE(LOG_TAG, "Error. Write torn, the NDEF file is empty");
+        return NdefTlv::WRITE_TORN;
+    }
+    if (!transactional)
+    {
+        return NdefTlv::WRITE_COMMITTED;
+    }
+
+    // read back a response of MLe at a time, as readBinary() would anyway
+    bool verified = true;
+    uint16_t length = TYPE_4_NLEN_SIZE + messageLength;
+    for (uint16_t offset = 0; verified && offset < length; offset += _maxRead)
+    {
+        byte written[TYPE_4_MAX_LE];
+        uint16_t chunk = length - offset < _maxRead ? length - offset : _maxRead;
+        verified = readBinary(offset, written, chunk);
+        for (uint16_t i = 0; verified && i < chunk; i++)
+        {
+            uint16_t at = offset + i;
+            verified = written[i] == (at < TYPE_4_NLEN_SIZE ? nlen[at] : message[at - TYPE_4_NLEN_SIZE]);
+        }
+    }
+    if (!verified)
+    {
+        ESP_LOGE(LOG_TAG, "Error. Verify failed");
+        if (_status.ok())
+        {
+            _status.set(NfcStatus::ERROR_VERIFY, NfcStatus::OPERATION_WRITE);
+        }
+        return NdefTlv::WRITE_TORN;
+    }
+    return NdefTlv::WRITE_COMMITTED;
+}
+
+// An APDU of sent bytes answered with received bytes, each chained in frames of
+// the MFRC522 FIFO, the tag acknowledging every frame but the last with R(ACK)
+static uint32_t apduTime(uint16_t sent, uint16_t received, uint32_t extra)
+{
+    uint16_t payload = NFC_TRANSPORT_MAX_FRAME - ISO_DEP_FRAME_OVERHEAD;
+    uint16_t sentFrames = (sent + payload - 1) / payload;
+    uint16_t receivedFrames = (received + payload - 1) / payload;
+    uint16_t frames = sentFrames + receivedFrames - 1;
+    return frames * NFC_TIME_COMMAND_US + extra +
+        (sent + received + 2 * frames * ISO_DEP_FRAME_OVERHEAD) * NFC_TIME_BYTE_US;
+}
+
+// The UpdateBinary commands writeEncoded() sends, by the CC info holds. The
+// tag is activated and the NDEF application and file selected first.
+void Type4Tag::planWrite(const TagInfo& info, uint16_t messageLength, bool transactional, WritePlan& plan)
+{
+    plan.reset();
+    plan.messageLength = messageLength;
+    uint16_t maxRead, maxWrite, fileId, fileSize;
+    bool writable;
+    if (info.tagType != NfcTag::TYPE_4 || !info.ccKnown ||
+        !parseCapabilities(info.cc, &maxRead, &maxWrite, &fileId, &fileSize, &writable))
+    {
+        return;
+    }
+    plan.known = true;
+    plan.capacity = fileSize - TYPE_4_NLEN_SIZE;
+    plan.fits = writable && messageLength <= plan.capacity;
+    if (!plan.fits)
+    {
+        return;
+    }
+
+    plan.writeLength = TYPE_4_NLEN_SIZE + messageLength;
+    // RATS, SELECT of the application and of the NDEF file
+    plan.estimatedTime = apduTime(2, 6, 0) + apduTime(6 + TYPE_4_NDEF_AID_SIZE, TYPE_4_SW_SIZE, 0) +
+        apduTime(7, TYPE_4_SW_SIZE, 0);
+    if (!transactional && plan.writeLength <= maxWrite)
+    {
+        plan.addUnit(0);
+        plan.estimatedTime += apduTime(5 + plan.writeLength, TYPE_4_SW_SIZE,
+            (plan.writeLength + NFC_TYPE_4_WRITE_SIZE - 1) / NFC_TYPE_4_WRITE_SIZE * NFC_TIME_WRITE_US);
+        return;
+    }
+
+    // NLEN cleared, the message in chunks of MLc, NLEN set
+    uint32_t nlenTime = apduTime(5 + TYPE_4_NLEN_SIZE, TYPE_4_SW_SIZE, NFC_TIME_WRITE_US);
+    plan.addUnit(0);
+    plan.estimatedTime += 2 * nlenTime;
+    for (uint16_t offset = 0; offset < messageLength; offset += maxWrite)
+    {
+        uint16_t chunk = messageLength - offset < maxWrite ? messageLength - offset : maxWrite;
+        plan.addUnit(TYPE_4_NLEN_SIZE + offset);
+        plan.estimatedTime += apduTime(5 + chunk, TYPE_4_SW_SIZE,
+            (chunk + NFC_TYPE_4_WRITE_SIZE - 1) / NFC_TYPE_4_WRITE_SIZE * NFC_TIME_WRITE_US);
+    }
+    plan.addUnit(0);
+    if (transactional)
+    {
+        // NLEN and the message read back
+        for (uint16_t offset = 0; offset < plan.writeLength; offset += maxRead)
+        {
+            uint16_t chunk = plan.writeLength - offset < maxRead ? plan.writeLength - offset : maxRead;
+            plan.reads++;
+            plan.estimatedTime += apduTime(5, chunk + TYPE_4_SW_SIZE, 0);
+        }
+    }
+}
+
+uint16_t Type4Tag::requiredWorkspace(const TagInfo& info)
+{
+    uint16_t maxRead, maxWrite, fileId, fileSize;
+    bool writable;
+    if (info.tagType != NfcTag::TYPE_4 || !info.ccKnown ||
+        !parseCapabilities(info.cc, &maxRead, &maxWrite, &fileId, &fileSize, &writable))
+    {
+        return 0;
+    }
+    // the message alone would do, the size is the same as for the other tag types
+    return NdefTlv::getWorkspaceSize(fileSize - TYPE_4_NLEN_SIZE);
+}
+
+bool Type4Tag::clean()
+{
+    _status = NfcStatus();
+    byte empty[TYPE_4_NLEN_SIZE] = { 0x00, 0x00 };
+    return open() && updateBinary(0, empty, TYPE_4_NLEN_SIZE);
+}
+
+uint16_t Type4Tag::getCapacity()
+{
+    if (!_selected && !open())
+    {
+        return 0;
+    }
+    return _fileSize > TYPE_4_NLEN_SIZE ? _fileSize - TYPE_4_NLEN_SIZE : 0;
+}
+
+// R(NAK) once the tag is activated, RATS before
+bool Type4Tag::isPresent()
+{
+    if (_isoDep.isActive())
+    {
+        return _isoDep.isPresent();
+    }
+    return _isoDep.activate() == NfcTransport::STATUS_OK;
+}
+
+void Type4Tag::deselect()
+{
+    _isoDep.deselect();
+    _selected = false;
+}
+
+NfcStatus Type4Tag::getStatus()
+{
+    return _status;
+}
+
+void Type4Tag::setRetryPolicy(const NfcRetryPolicy& policy)
+{
+    _retryPolicy = policy;
+    _isoDep.setRetryPolicy(policy);
+}
+
+// the NDEF file selected, retried like a command
+bool Type4Tag::open()
+{
+    NfcRetry retry(_retryPolicy, _transport, true);
+    while (!_selected && !selectNdefFile())
+    {
+        if (!recover(retry))
+        {
+            return false;
+        }
+    }
+    if (!_status.ok())
+    {
+        _status.clearError();
+    }
+    return true;
+}
+
+// RATS, the NDEF application, the CC file and the NDEF file it names
+bool Type4Tag::selectNdefFile()
+{
+    if (!_isoDep.isActive())
+    {
+        NfcTransport::Status status = _isoDep.activate();
+        if (status != NfcTransport::STATUS_OK)
+        {
+            _status.setTransport(status, NfcStatus::OPERATION_SELECT, -1);
+            return false;
+        }
+    }
+
+    if (!select(0x04, 0x00, NDEF_AID, sizeof(NDEF_AID)))
+    {
+        if (_status.getError() == NfcStatus::ERROR_APDU)
+        {
+            ESP_LOGI(LOG_TAG, "WARNING: Tag has no NDEF application.");
+            _status.set(NfcStatus::ERROR_NOT_FORMATTED, NfcStatus::OPERATION_SELECT);
+        }
+        return false;
+    }
+    if (!readCapabilities())
+    {
+        return false;
+    }
+
+    byte fileId[2] = { (byte)(_fileId >> 8), (byte)_fileId };
+    if (!select(0x00, 0x0C, fileId, sizeof(fileId)))
+    {
+        return false;
+    }
+    _selected = true;
+    ESP_LOGD(LOG_TAG, "NDEF file %04X, %d bytes, MLe %d, MLc %d, frames %d/%d", _fileId, _fileSize,
+        _maxRead, _maxWrite, _isoDep.getSendFrameSize(), _isoDep.getReceiveFrameSize());
+    return true;
+}
+
+// The CC file doesn't change for a UID, a cached copy saves its SELECT and READ BINARY
+bool Type4Tag::readCapabilities()
+{
+    byte cc[TYPE_4_CC_SIZE];
+    if (_info != NULL && _info->ccKnown && _info->tagType == NfcTag::TYPE_4)
+    {
+        memcpy(cc, _info->cc, TYPE_4_CC_SIZE);
+    }
+    else
+    {
+        byte ccFile[2] = { (byte)(TYPE_4_CC_FILE >> 8), (byte)TYPE_4_CC_FILE };
+        byte apdu[5] = { TYPE_4_CLA, TYPE_4_INS_READ_BINARY, 0x00, 0x00, TYPE_4_CC_SIZE };
+        byte response[TYPE_4_CC_SIZE + TYPE_4_SW_SIZE];
+        uint16_t responseLength = sizeof(response);
+        if (!select(0x00, 0x0C, ccFile, sizeof(ccFile)) ||
+            !sendApdu(apdu, sizeof(apdu), response, &responseLength, NfcStatus::OPERATION_READ, 0))
+        {
+            return false;
+        }
+        if (responseLength < TYPE_4_CC_SIZE)
+        {
+            _status.set(NfcStatus::ERROR_NOT_FORMATTED, NfcStatus::OPERATION_READ, 0);
+            return false;
+        }
+        memcpy(cc, response, TYPE_4_CC_SIZE);
+    }
+
+    if (!parseCapabilities(cc, &_maxRead, &_maxWrite, &_fileId, &_fileSize, &_writable))
+    {
+        ESP_LOGE(LOG_TAG, "Error. No readable NDEF file in the CC");
+        _status.set(NfcStatus::ERROR_NOT_FORMATTED, NfcStatus::OPERATION_READ, 0);
+        return false;
+    }
+
+    if (_info != NULL)
+    {
+        _info->tagType = NfcTag::TYPE_4;
+        _info->identified = true;
+        _info->dataAreaSize = _fileSize;
+        _info->ccKnown = true;
+        memcpy(_info->cc, cc, TYPE_4_CC_SIZE);
+        _info->formatted = true;
+    }
+    return true;
+}
+
+bool Type4Tag::parseCapabilities(const byte *cc, uint16_t *maxRead, uint16_t *maxWrite,
+    uint16_t *fileId, uint16_t *fileSize, bool *writable)
+{
+    // MLe and MLc, then the NDEF File Control TLV: file ID, size, read and write access
+    *maxRead = (cc[3] << 8) | cc[4];
+    *maxWrite = (cc[5] << 8) | cc[6];
+    *fileSize = (cc[11] << 8) | cc[12];
+    if (cc[7] != 0x04 || cc[8] < 6 || *maxRead == 0 || *maxWrite == 0 || cc[13] != 0x00 || *fileSize < TYPE_4_NLEN_SIZE)
+    {
+        return false;
+    }
+    *maxRead = *maxRead < TYPE_4_MAX_LE ? *maxRead : TYPE_4_MAX_LE;
+    *maxWrite = *maxWrite < TYPE_4_MAX_LC ? *maxWrite : TYPE_4_MAX_LC;
+    *fileId = (cc[9] << 8) | cc[10];
+    *writable = cc[14] == 0x00;
+    return true;
+}
+
+bool Type4Tag::select(byte p1, byte p2, const byte *data, byte length)
+{
+    // by name the FCI may be returned, Le 0 asks for it
+    byte apdu[5 + TYPE_4_NDEF_AID_SIZE + 1] = { TYPE_4_CLA, TYPE_4_INS_SELECT, p1, p2, length };
+    memcpy(&apdu[5], data, length);
+    uint16_t apduLength = 5 + length;
+    if (p2 == 0x00)
+    {
+        apdu[apduLength++] = 0x00;
+    }
+    byte response[TYPE_4_MAX_LE + TYPE_4_SW_SIZE];
+    uint16_t responseLength = sizeof(response);
+    return sendApdu(apdu, apduLength, response, &responseLength, NfcStatus::OPERATION_SELECT, -1);
+}
+
+// READ BINARY in chunks of MLe, each chained by ISO-DEP in frames as large as FSD
+bool Type4Tag::readBinary(uint16_t offset, byte *data, uint16_t length)
+{
+    while (length > 0)
+    {
+        uint16_t chunk = length < _maxRead ? length : _maxRead;
+        byte apdu[5] = { TYPE_4_CLA, TYPE_4_INS_READ_BINARY, (byte)(offset >> 8), (byte)offset, (byte)chunk };
+        byte response[TYPE_4_MAX_LE + TYPE_4_SW_SIZE];
+        uint16_t responseLength = sizeof(response);
+        if (!command(apdu, sizeof(apdu), response, &responseLength, NfcStatus::OPERATION_READ, offset))
+        {
+            return false;
+        }
+        if (responseLength != chunk)
+        {
+            ESP_LOGE(LOG_TAG, "Error. Offset %d: %d bytes read of %d", offset, responseLength, chunk);
+            _status.set(NfcStatus::ERROR_FRAME, NfcStatus::OPERATION_READ, offset);
+            return false;
+        }
+
+        ESP_LOGD(LOG_TAG, "Offset %d-%d:", offset, offset + chunk - 1);
+        ESP_LOG_BUFFER_HEX_LEVEL(LOG_TAG, response, chunk, ESP_LOG_DEBUG);
+        memcpy(data, response, chunk);
+        offset += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+// UPDATE BINARY in chunks of MLc, each chained by ISO-DEP in frames as large as FSC
+bool Type4Tag::updateBinary(uint16_t offset, const byte *data, uint16_t length)
+{
+    while (length > 0)
+    {
+        uint16_t chunk = length < _maxWrite ? length : _maxWrite;
+        byte apdu[5 + TYPE_4_MAX_LC] = { TYPE_4_CLA, TYPE_4_INS_UPDATE_BINARY, (byte)(offset >> 8), (byte)offset, (byte)chunk };
+        memcpy(&apdu[5], data, chunk);
+        byte response[TYPE_4_SW_SIZE];
+        uint16_t responseLength = sizeof(response);
+        if (!command(apdu, 5 + chunk, response, &responseLength, NfcStatus::OPERATION_WRITE, offset))
+        {
+            return false;
+        }
+
+        ESP_LOGD(LOG_TAG, "Wrote offset %d-%d", offset, offset + chunk - 1);
+        offset += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return true;
+}
+
+// Reading and writing the same offset again is harmless, a failed APDU is sent
+// again after the tag was selected and the NDEF file opened again
+bool Type4Tag::command(const byte *apdu, uint16_t length, byte *response, uint16_t *responseLength,
+    NfcStatus::Operation operation, int16_t offset)
+{
+    NfcRetry retry(_retryPolicy, _transport, true);
+    uint16_t capacity = *responseLength;
+    while (!(_selected || selectNdefFile()) || !sendApdu(apdu, length, response, responseLength, operation, offset))
+    {
+        *responseLength = capacity;
+        if (!recover(retry))
+        {
+            return false;
+        }
+    }
+    if (!_status.ok())
+    {
+        _status.clearError();
+    }
+    return true;
+}
+
+// one APDU, the status word is checked and dropped from the response
+bool Type4Tag::sendApdu(const byte *apdu, uint16_t length, byte *response, uint16_t *responseLength,
+    NfcStatus::Operation operation, int16_t offset)
+{
+    NfcTransport::Status status = _isoDep.transceive(apdu, length, response, responseLength);
+    if (status != NfcTransport::STATUS_OK)
+    {
+        ESP_LOGD(LOG_TAG, "APDU %02X at %d failed - Status: %d", apdu[1], offset, status);
+        _status.setTransport(status, operation, offset);
+        return false;
+    }
+    if (*responseLength < TYPE_4_SW_SIZE)
+    {
+        _status.set(NfcStatus::ERROR_FRAME, operation, offset, status);
+        return false;
+    }
+
+    *responseLength -= TYPE_4_SW_SIZE;
+    uint16_t sw = (response[*responseLength] << 8) | response[*responseLength + 1];
+    if (sw != TYPE_4_SW_OK)
+    {
+        ESP_LOGD(LOG_TAG, "APDU %02X at %d refused - SW: %04X", apdu[1], offset, sw);
+        _status.set(NfcStatus::ERROR_APDU, operation, offset, status);
+        return false;
+    }
+    return true;
+}
+
+// ISO-DEP already asked for lost blocks again, what is left needs the tag
+// deselected, selected and activated again
+bool Type4Tag::recover(NfcRetry& retry)
+{
+    NfcRetry::Action action = retry.next(_status);
+    if (action == NfcRetry::ACTION_GIVE_UP)
+    {
+        ESP_LOGE(LOG_TAG, "Error. Offset %d: %s after %d retries", _status.getAddress(),
+            NfcStatus::getErrorName(_status.getError()), _status.getRetries());
+        return false;
+    }
+
+    _isoDep.deselect();
+    _isoDep.reset();
+    _selected = false;
+    _transport->haltA();
+    _transport->wakeupA();
+    NfcTransport::Status status = _transport->select(&(_transport->uid));
+    if (status != NfcTransport::STATUS_OK)
+    {
+        ESP_LOGE(LOG_TAG, "Error. Could not reselect tag - Status: %d", status);
+        _status.set(NfcStatus::ERROR_TAG_LOST, NfcStatus::OPERATION_SELECT, _status.getAddress());
+        return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#include <sdkconfig.h>
+#include <MFRC522.h>
+#include <NfcAdapter.h>
+
+// Every public entry point the report covers is called here, so none is
+// dropped by the linker. Nothing needs to run, the firmware is never flashed.
+
+static MFRC522 mfrc522(5, UINT8_MAX);
+static NfcAdapter nfc(&mfrc522);
+static byte buffer[1024];
+static byte imageBuffer[1024];
+static byte workspace[1024];
+
+extern "C" void app_main(void)
+{
+    nfc.begin();
+    if (!nfc.tagPresent())
+    {
+        return;
+    }
+
+    NfcTag tag = nfc.read(buffer, sizeof(buffer));
+    NdefRecordIndex index;
+    if (nfc.indexRecords(index))
+    {
+        nfc.readPayload(index, index.last(), buffer, sizeof(buffer));
+    }
+    NdefMessage message = tag.hasNdefMessage() ? tag.getNdefMessage() : NdefMessage();
+    message.addTextRecord("size report");
+    message.addUriRecord("https://example.com");
+#ifdef CONFIG_NDEF_SUPPORT_COMPRESSION
+    message.compress();
+    message.decompress(buffer, sizeof(buffer));
+#endif
+    nfc.write(message);
+    nfc.writeTransaction(message);
+    nfc.write(message, workspace, sizeof(workspace));
+    nfc.writeTransaction(message, workspace, sizeof(workspace));
+    nfc.erase();
+    nfc.format();
+    nfc.clean();
+
+    TagImageBuffer image(imageBuffer, sizeof(imageBuffer), 16);
+    uint16_t next = 0;
+    nfc.dumpImage(image, &next);
+    next = 0;
+    nfc.restoreImage(image, &next);
+    nfc.haltTag();
+}
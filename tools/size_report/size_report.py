@@ -0,0 +1,199 @@
+#!/usr/bin/env python3
+"""Flash, static RAM and worst-case stack of the component, for each profile.
+
+Builds tools/size_report once per file in profiles/ with idf.py, then reads the
+linker map for what the component takes and the -fcallgraph-info files of every
+object for the deepest stack below each public entry point.
+
+    . $IDF_PATH/export.sh
+    NDEF_EXTRA_COMPONENT_DIRS=/path/to/esp-idf-mfrc522 ./size_report.py --target esp32
+
+A stack marked + calls through a function pointer or a virtual method, or
+recurses, the real depth can be larger. Calls into prebuilt libraries, e.g.
+the ROM, count as taking no stack.
+
+Experimental: the parsers were tried on host builds only, compare the flash
+and RAM figures with idf.py size-components until an IDF run has checked them.
+"""
+
+import argparse
+import glob
+import os
+import re
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(os.path.dirname(HERE))
+PROFILES = os.path.join(HERE, 'profiles')
+
+# names in the call graph come with their return type
+DEFAULT_API = r'\b(NfcAdapter|TagSession|NdefMessage|NfcProvisioner|NfcTagTracker|NfcPipeline|NfcReaderPool)::~?\w+\('
+
+# output sections of the ESP32 family linker scripts
+FLASH = ('.flash.text', '.flash.rodata', '.flash.appdesc')
+IRAM = ('.iram0.text', '.iram0.vectors')
+DATA = ('.dram0.data',)
+BSS = ('.dram0.bss', '.noinit', '.dram0.noinit')
+
+
+def build(profile, target, idf_py):
+    build_dir = os.path.join(HERE, 'build', profile)
+    defaults = ';'.join([os.path.join(HERE, 'sdkconfig.defaults'), os.path.join(PROFILES, profile)])
+    cmd = [idf_py, '-C', HERE, '-B', build_dir,
+           '-D', 'IDF_TARGET=' + target,
+           '-D', 'SDKCONFIG=' + os.path.join(build_dir, 'sdkconfig'),
+           '-D', 'SDKCONFIG_DEFAULTS=' + defaults,
+           'build']
+    print('Building', profile, file=sys.stderr)
+    subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL)
+    return build_dir
+
+
+def section_sizes(map_file, archive):
+    """Bytes of the archive's objects in each kind of memory, from a GNU ld map."""
+    sizes = {'flash': 0, 'iram': 0, 'data': 0, 'bss': 0}
+    kinds = [(FLASH, 'flash'), (IRAM, 'iram'), (DATA, 'data'), (BSS, 'bss')]
+    # an input section with its address, size and object, on one line or, when
+    # the section name is long, with the numbers on the next
+    whole = re.compile(r'^ \S+\s+0x[0-9a-fA-F]+\s+(0x[0-9a-fA-F]+)\s+(\S.*)$')
+    name_only = re.compile(r'^ \S+$')
+    numbers = re.compile(r'^\s+0x[0-9a-fA-F]+\s+(0x[0-9a-fA-F]+)\s+(\S.*)$')
+    kind = None
+    started = False
+    pending = False
+    with open(map_file) as f:
+        for line in f:
+            line = line.rstrip('\n')
+            if not started:
+                started = line.startswith('Linker script and memory map')
+                continue
+            if line.startswith('.'):
+                name = line.split()[0]
+                kind = next((k for names, k in kinds if name in names), None)
+                pending = False
+                continue
+            if kind is None:
+                continue
+            match = whole.match(line) or (numbers.match(line) if pending else None)
+            pending = name_only.match(line) is not None
+            if match and os.path.basename(match.group(2).split('(')[0]) == archive:
+                sizes[kind] += int(match.group(1), 16)
+    return sizes
+
+
+class CallGraph:
+    """Functions of every object built with -fcallgraph-info=su."""
+
+    def __init__(self):
+        self.functions = {}  # (ci file, title): (name, stack bytes, location)
+        self.calls = {}      # (ci file, title): [callee titles]
+        self.defined = {}    # title: (ci file, title), for calls from other objects
+
+    def load(self, ci_file):
+        node = re.compile(r'node: \{ title: "([^"]+)" label: "([^"]*)"')
+        edge = re.compile(r'edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"')
+        with open(ci_file) as f:
+            for line in f:
+                m = node.match(line)
+                if m:
+                    # functions only called from here have a name and no stack usage
+                    label = m.group(2).split('\\n')
+                    usage = re.match(r'(\d+) bytes', label[2]) if len(label) > 2 else None
+                    if usage:
+                        key = (ci_file, m.group(1))
+                        self.functions[key] = (label[0], int(usage.group(1)), label[1])
+                        self.defined.setdefault(m.group(1), key)
+                    continue
+                m = edge.match(line)
+                if m:
+                    self.calls.setdefault((ci_file, m.group(1)), []).append(m.group(2))
+
+    def resolve(self, ci_file, title):
+        if (ci_file, title) in self.functions:
+            return (ci_file, title)
+        return self.defined.get(title)
+
+    def worst(self, key, memo, active):
+        """Deepest stack below key, and whether part of it is unknown."""
+        if key in memo:
+            return memo[key]
+        if key in active:
+            return (0, True)  # recursion
+        active.add(key)
+        deepest, unknown = 0, False
+        for title in self.calls.get(key, []):
+            if title == '__indirect_call':
+                unknown = True
+                continue
+            callee = self.resolve(key[0], title)
+            if callee is None:
+                continue
+            depth, partial = self.worst(callee, memo, active)
+            deepest = max(deepest, depth)
+            unknown = unknown or partial
+        active.discard(key)
+        memo[key] = (self.functions[key][1] + deepest, unknown)
+        return memo[key]
+
+    def entry_points(self, api, sources):
+        pattern = re.compile(api)
+        for key, (name, _, location) in self.functions.items():
+            if pattern.search(name) and location.startswith(sources):
+                yield key
+
+
+def report(profiles, results, stacks):
+    print('| Profile | Flash | IRAM | DRAM data | DRAM bss | Static RAM |')
+    print('|---|---:|---:|---:|---:|---:|')
+    for profile in profiles:
+        s = results[profile]
+        print('| %s | %d | %d | %d | %d | %d |' % (profile, s['flash'] + s['iram'] + s['data'],
+                                                 s['iram'], s['data'], s['bss'], s['iram'] + s['data'] + s['bss']))
+    print()
+    print('Worst-case stack in bytes')
+    print()
+    print('| Entry point | ' + ' | '.join(profiles) + ' |')
+    print('|---|' + '---:|' * len(profiles))
+    names = sorted({name for p in profiles for name in stacks[p]},
+                   key=lambda n: -max(stacks[p].get(n, (0, False))[0] for p in profiles))
+    for name in names:
+        cells = []
+        for p in profiles:
+            depth = stacks[p].get(name)
+            cells.append('-' if depth is None else '%d%s' % (depth[0], '+' if depth[1] else ''))
+        print('| `%s` | %s |' % (name, ' | '.join(cells)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('profiles', nargs='*', help='files in profiles/, all by default')
+    parser.add_argument('--target', default='esp32')
+    parser.add_argument('--idf-py', default='idf.py')
+    parser.add_argument('--api', default=DEFAULT_API, help='regular expression of the entry points reported')
+    args = parser.parse_args()
+    sys.setrecursionlimit(10000)
+
+    profiles = args.profiles or sorted(os.listdir(PROFILES))
+    component = os.path.basename(ROOT)
+    sources = os.path.join(ROOT, 'src') + os.sep
+    results, stacks = {}, {}
+    for profile in profiles:
+        build_dir = build(profile, args.target, args.idf_py)
+        results[profile] = section_sizes(os.path.join(build_dir, 'size_report.map'), 'lib%s.a' % component)
+
+        graph = CallGraph()
+        for ci_file in glob.glob(os.path.join(build_dir, 'esp-idf', '**', '*.ci'), recursive=True):
+            graph.load(ci_file)
+        memo = {}
+        stacks[profile] = {}
+        for key in graph.entry_points(args.api, sources):
+            depth = graph.worst(key, memo, set())
+            name = graph.functions[key][0]
+            if depth[0] > stacks[profile].get(name, (0, False))[0]:
+                stacks[profile][name] = depth
+    report(profiles, results, stacks)
+
+
+if __name__ == '__main__':
+    main()